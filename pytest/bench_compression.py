@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""
+measure how the throughput of large compressed reads and writes scales
+with the number of codec threads of client and server
+
+    cd pytest && python3 bench_compression.py [--compression CODEC] [--files N] [--size BYTES]
+
+each configuration serves a fresh directory. the files hold compressible
+text and are written and read through a mount with 1 MB requests by a
+single thread, so any gain comes from compressing the chunks of each
+request in parallel.
+"""
+import argparse
+import os
+import shutil
+import time
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-bench")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-bench")
+
+BLOCK_SIZE = 1024 * 1024
+
+
+def compressible_data(size):
+    line = b"%08d the quick brown fox jumps over the lazy dog %s\n"
+    data = bytearray()
+    i = 0
+    while len(data) < size:
+        data += line % (i, os.urandom(4).hex().encode())
+        i += 1
+    return bytes(data[:size])
+
+
+def run_configuration(codec_threads, compression, n_files, size):
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-bench.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, args=["--codecthreads", str(codec_threads)])
+    start_client(endpoint, CLIENT_DIR, args=[f"--compression={compression}",
+            f"--codecthreads={codec_threads}", "--readahead=0", "--writeback=0"])
+    time.sleep(1)
+
+    paths = [os.path.join(CLIENT_DIR, f"file{i:05d}") for i in range(n_files)]
+    data = compressible_data(size)
+
+    try:
+        start = time.monotonic()
+        for path in paths:
+            with open(path, "wb") as f:
+                for offset in range(0, size, BLOCK_SIZE):
+                    f.write(data[offset:offset + BLOCK_SIZE])
+        t_write = time.monotonic() - start
+
+        start = time.monotonic()
+        for path in paths:
+            with open(path, "rb") as f:
+                while f.read(BLOCK_SIZE):
+                    pass
+        t_read = time.monotonic() - start
+    finally:
+        stop_client(CLIENT_DIR)
+        stop_server()
+        time.sleep(1)
+        shutil.rmtree(CLIENT_DIR)
+        shutil.rmtree(SRV_DIR)
+
+    mbytes = n_files * size / (1024 * 1024)
+    return (mbytes / t_write, mbytes / t_read)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+            formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--compression", default="zstd:3")
+    parser.add_argument("--files", type=int, default=8)
+    parser.add_argument("--size", type=int, default=64 * 1024 * 1024)
+    args = parser.parse_args()
+
+    n_cpus = os.cpu_count() or 1
+    thread_counts = sorted({0, 1, 3, 7, n_cpus - 1} & set(range(n_cpus)))
+
+    print(f"{args.files} files of {args.size} bytes, {args.compression}, {n_cpus} CPUs\n")
+    print(f"{'codec threads':<24}{'write MB/s':>12}{'read MB/s':>12}")
+    for codec_threads in thread_counts:
+        write_rate, read_rate = run_configuration(codec_threads, args.compression,
+                args.files, args.size)
+        print(f"{codec_threads:<24}{write_rate:>12.1f}{read_rate:>12.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""
+compare the io_uring backend of rhizosrv to the blocking workers
+
+    cd pytest && python3 bench_uring.py [--files N] [--size BYTES] [--threads N]
+
+each configuration serves a fresh directory. the files are written and
+read through a mount by a pool of threads, so many requests are in
+flight at once.
+"""
+import argparse
+import os
+import shutil
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-bench")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-bench")
+
+CONFIGURATIONS = [
+    ("blocking, 5 workers", ["-n", "5"]),
+    ("blocking, 2 workers", ["-n", "2"]),
+    ("io_uring, 2 workers", ["-n", "2", "--uring"]),
+]
+
+
+def timed(pool, func, items):
+    start = time.monotonic()
+    list(pool.map(func, items))
+    return time.monotonic() - start
+
+
+def run_configuration(server_args, n_files, size, n_threads):
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-bench.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, args=server_args)
+    start_client(endpoint, CLIENT_DIR)
+    time.sleep(1)
+
+    paths = [os.path.join(CLIENT_DIR, f"file{i:05d}") for i in range(n_files)]
+    data = os.urandom(size)
+
+    def write(path):
+        with open(path, "wb") as f:
+            f.write(data)
+
+    def read(path):
+        with open(path, "rb") as f:
+            while f.read(1024 * 1024):
+                pass
+
+    try:
+        with ThreadPoolExecutor(max_workers=n_threads) as pool:
+            t_write = timed(pool, write, paths)
+            t_read = timed(pool, read, paths)
+            t_stat = timed(pool, os.lstat, paths)
+    finally:
+        stop_client(CLIENT_DIR)
+        stop_server()
+        time.sleep(1)
+        shutil.rmtree(CLIENT_DIR)
+        shutil.rmtree(SRV_DIR)
+
+    mbytes = n_files * size / (1024 * 1024)
+    return (mbytes / t_write, mbytes / t_read, n_files / t_stat)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+            formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--files", type=int, default=500)
+    parser.add_argument("--size", type=int, default=256 * 1024)
+    parser.add_argument("--threads", type=int, default=32)
+    args = parser.parse_args()
+
+    print(f"{args.files} files of {args.size} bytes, {args.threads} client threads\n")
+    print(f"{'server':<24}{'write MB/s':>12}{'read MB/s':>12}{'stat/s':>12}")
+    for name, server_args in CONFIGURATIONS:
+        write_rate, read_rate, stat_rate = run_configuration(server_args,
+                args.files, args.size, args.threads)
+        print(f"{name:<24}{write_rate:>12.1f}{read_rate:>12.1f}{stat_rate:>12.0f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,6 +1,7 @@
 import os
 import signal
 import shutil
+import socket
 import stat
 import subprocess
 import time
@@ -20,11 +21,12 @@ class CmdReturn:
         self.stderr = stderr
 
 
-def run(cmd):
+def run(cmd, preexec_fn=None):
     print(f"starting process: {cmd}")
     process = subprocess.Popen(cmd, shell=False,  # nosec
                                stdout=subprocess.PIPE,
-                               stderr=subprocess.PIPE)
+                               stderr=subprocess.PIPE,
+                               preexec_fn=preexec_fn)
     out, err = process.communicate()
 
     stdout = out.decode().strip()
@@ -42,10 +44,11 @@ def stop_server():
     os.kill(pid, signal.SIGTERM)
 
 
-def start_server(endpoint, directory, args=[]):
+def start_server(endpoint, directory, args=[], preexec_fn=None):
     pwd = os.getcwd()
     pidfile_path = os.path.join(pwd, "rhizosrv.pid")
-    ret = run([RHIZOSRV, endpoint, directory] + args + ["-p", pidfile_path])
+    ret = run([RHIZOSRV, endpoint, directory] + args + ["-p", pidfile_path],
+              preexec_fn=preexec_fn)
     print(ret.stderr)
     print(ret.stdout)
     print(ret.retval)
@@ -67,7 +70,9 @@ def start_client(endpoint, directory, args=[], ignore_fail=False):
 
 
 def stop_client(directory):
-    if shutil.which("fusermount"):
+    if shutil.which("fusermount3"):
+        ret = run(["fusermount3", "-u", directory])
+    elif shutil.which("fusermount"):
         ret = run(["fusermount", "-u", directory])
     else:
         # no fusermount on MacOS
@@ -81,6 +86,29 @@ def stop_client(directory):
     assert ret.retval == 0
 
 
+# get the response of the metrics endpoint listening on the unix socket "path"
+def scrape_metrics(path, request=b"GET /metrics HTTP/1.0\r\n\r\n"):
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+        s.settimeout(5)
+        s.connect(path)
+        s.sendall(request)
+        chunks = []
+        while True:
+            chunk = s.recv(65536)
+            if not chunk:
+                break
+            chunks.append(chunk)
+    return b"".join(chunks).decode()
+
+
+# get the value of the series "name" from a metrics response
+def metric_value(response, name):
+    for line in response.split("\n"):
+        if line.startswith(name + " "):
+            return float(line.split()[1])
+    return None
+
+
 def vmci_supported():
     try:
         return stat.S_ISCHR(os.stat("/dev/vmci").st_mode)
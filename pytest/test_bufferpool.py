@@ -0,0 +1,117 @@
+import os
+import pytest
+import random
+import shutil
+import threading
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-bufferpool")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-bufferpool")
+
+# the server sends small blocks uncompressed
+CODEC_MIN_SIZE=100
+
+# the pool keeps buffers from 64 KB up to 4 MB
+SIZES=[1, CODEC_MIN_SIZE - 1, CODEC_MIN_SIZE, CODEC_MIN_SIZE + 1,
+       64 * 1024 - 1, 64 * 1024, 64 * 1024 + 1, 1024 * 1024,
+       4 * 1024 * 1024 + 1, 5 * 1024 * 1024]
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-bufferpool.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, ["--hugepages"])
+
+    # uncompressed data is sent straight from the buffers of the pool
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR, ["--compression=none", "--dataframes=1",
+            "--attrcache=0", "--readahead=0"])
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def write_srv(name, data):
+    with open(os.path.join(SRV_DIR, name), "wb") as f:
+        f.write(data)
+
+
+@pytest.mark.parametrize("size", SIZES)
+def test_read(size):
+    name = f"read-{size}"
+    data = random.randbytes(size)
+    write_srv(name, data)
+
+    with open(os.path.join(CLIENT_DIR, name), "rb") as f:
+        assert f.read() == data
+
+    # reads ending after the end of the file
+    with open(os.path.join(CLIENT_DIR, name), "rb", buffering=0) as f:
+        for offset in [0, size // 2, size - 1, size, size + 4096]:
+            f.seek(offset)
+            assert f.read(size + CODEC_MIN_SIZE) == data[offset:]
+
+
+def test_short_read_after_reuse():
+    # buffers are not cleared when they are reused. a short read must
+    # only send the bytes read
+    name = "short-read"
+    big = random.randbytes(1024 * 1024)
+    write_srv(name, big)
+    with open(os.path.join(CLIENT_DIR, name), "rb") as f:
+        assert f.read() == big
+
+    small = random.randbytes(CODEC_MIN_SIZE + 1)
+    write_srv(name, small)
+    with open(os.path.join(CLIENT_DIR, name), "rb", buffering=0) as f:
+        assert f.read(len(big)) == small
+        f.seek(CODEC_MIN_SIZE)
+        assert f.read(len(big)) == small[CODEC_MIN_SIZE:]
+        assert f.read(len(big)) == b""
+
+
+def test_parallel_reads():
+    # replies of several workers are in flight while buffers return
+    # to the pools
+    files = {}
+    for i, size in enumerate(SIZES):
+        name = f"parallel-{i}"
+        files[name] = random.randbytes(size)
+        write_srv(name, files[name])
+
+    errors = []
+
+    def reader(names):
+        try:
+            for _ in range(5):
+                for name in names:
+                    with open(os.path.join(CLIENT_DIR, name), "rb") as f:
+                        if f.read() != files[name]:
+                            errors.append(name)
+        except Exception as e:
+            errors.append(str(e))
+
+    names = list(files.keys())
+    threads = [threading.Thread(target=reader, args=(names[i:] + names[:i],))
+               for i in range(8)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    assert errors == []
@@ -0,0 +1,77 @@
+import os
+import pytest
+import shutil
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-bytelimit")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-bytelimit")
+
+BYTE_LIMIT = 1024 * 1024
+FILE_SIZE = 8 * BYTE_LIMIT
+
+# the write-back buffers of the client are sent in extents of this size
+WRITEBACK_BLOCK_SIZE = 4 * 1024 * 1024
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-bytelimit.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, [f"--bytelimit={BYTE_LIMIT}"])
+
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR, ["--compression=none"])
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def test_reads_stay_under_byte_limit():
+    data = os.urandom(FILE_SIZE)
+    with open(os.path.join(SRV_DIR, "read.bin"), "wb") as f:
+        f.write(data)
+
+    start = time.monotonic()
+    with open(os.path.join(CLIENT_DIR, "read.bin"), "rb") as f:
+        assert f.read() == data
+    elapsed = time.monotonic() - start
+
+    # a second worth of bytes may be sent in a burst. the replies of
+    # the reads started before the limit was reached are sent as well
+    burst = 3 * BYTE_LIMIT
+    assert (FILE_SIZE - burst) / elapsed <= BYTE_LIMIT * 1.1
+    assert elapsed < 20
+
+
+def test_writes_stay_under_byte_limit():
+    data = os.urandom(FILE_SIZE)
+
+    # the tokens used by the reads are refilled
+    time.sleep(1)
+
+    start = time.monotonic()
+    with open(os.path.join(CLIENT_DIR, "write.bin"), "wb") as f:
+        f.write(data)
+    elapsed = time.monotonic() - start
+
+    # a whole extent is sent once the client has tokens left
+    burst = BYTE_LIMIT + WRITEBACK_BLOCK_SIZE
+    assert (FILE_SIZE - burst) / elapsed <= BYTE_LIMIT * 1.1
+    assert elapsed < 20
+
+    with open(os.path.join(SRV_DIR, "write.bin"), "rb") as f:
+        assert f.read() == data
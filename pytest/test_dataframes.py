@@ -0,0 +1,103 @@
+import os
+import pytest
+import random
+import shutil
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-dataframes")
+
+# the server sends small blocks uncompressed
+CODEC_MIN_SIZE=100
+
+SIZES=[0, 1, CODEC_MIN_SIZE - 1, CODEC_MIN_SIZE, CODEC_MIN_SIZE + 1,
+       4096, 128 * 1024 + 7, 1024 * 1024 + 3]
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-dataframes.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR)
+
+    yield endpoint
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+# clients with --dataframes=0 ask for the data inside the protobuf
+# messages, like clients built before data frames were added
+@pytest.fixture(scope='module', params=[
+        ("none", 1), ("lz4", 1), ("none", 0), ("lz4", 0)],
+        ids=["none-frames", "lz4-frames", "none-inline", "lz4-inline"])
+def client_dir(request, setup_test):
+    compression, data_frames = request.param
+    client_dir = os.path.join(os.getcwd(), f"clientdir-dataframes-{request.param_index}")
+
+    os.makedirs(client_dir, exist_ok=True)
+    start_client(setup_test, client_dir, [f"--compression={compression}",
+            f"--dataframes={data_frames}", "--attrcache=0", "--writeback=0"])
+
+    time.sleep(1)
+
+    yield client_dir
+
+    stop_client(client_dir)
+    shutil.rmtree(client_dir)
+
+
+def make_data(size, compressible):
+    if compressible:
+        line = b"rhizofs sends the data of reads and writes as a separate frame\n"
+        return (line * (size // len(line) + 1))[:size]
+    return random.randbytes(size)
+
+
+@pytest.mark.parametrize("compressible", [True, False], ids=["text", "random"])
+@pytest.mark.parametrize("size", SIZES)
+def test_read(client_dir, size, compressible):
+    name = f"read-{size}-{compressible}-{os.path.basename(client_dir)}"
+    data = make_data(size, compressible)
+    with open(os.path.join(SRV_DIR, name), "wb") as f:
+        f.write(data)
+
+    with open(os.path.join(client_dir, name), "rb") as f:
+        assert f.read() == data
+
+    # reads ending after the end of the file
+    with open(os.path.join(client_dir, name), "rb") as f:
+        for offset in [0, size // 2, max(size - 1, 0), size, size + 10]:
+            f.seek(offset)
+            assert f.read(CODEC_MIN_SIZE * 3) == data[offset:offset + CODEC_MIN_SIZE * 3]
+            f.seek(offset)
+            assert f.read(size + 4096) == data[offset:]
+
+
+@pytest.mark.parametrize("compressible", [True, False], ids=["text", "random"])
+@pytest.mark.parametrize("size", SIZES)
+def test_write(client_dir, size, compressible):
+    name = f"write-{size}-{compressible}-{os.path.basename(client_dir)}"
+    data = make_data(size, compressible)
+
+    with open(os.path.join(client_dir, name), "wb") as f:
+        f.write(data)
+    with open(os.path.join(SRV_DIR, name), "rb") as f:
+        assert f.read() == data
+
+    # overwrite the middle and append to the file
+    patch = make_data(CODEC_MIN_SIZE + 1, compressible)
+    with open(os.path.join(client_dir, name), "r+b") as f:
+        f.seek(size // 2)
+        f.write(patch)
+    expected = data[:size // 2] + patch + data[size // 2 + len(patch):]
+    with open(os.path.join(SRV_DIR, name), "rb") as f:
+        assert f.read() == expected
+    with open(os.path.join(client_dir, name), "rb") as f:
+        assert f.read() == expected
@@ -0,0 +1,148 @@
+import os
+import pytest
+import shutil
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-fdcache")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-fdcache")
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-fdcache.sock"
+
+    # without handles every read and write goes by path and uses the
+    # files kept open by the fdcache
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, ["--openfiles=0"])
+
+    # the attributes are fetched again for every access, so changes of
+    # the size made on the server are seen right away
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR, ["--attrttl=0", "--negttl=0", "--attrcache=0"])
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def write_srv(name, data):
+    with open(os.path.join(SRV_DIR, name), "wb") as f:
+        f.write(data)
+
+
+def read_srv(name):
+    with open(os.path.join(SRV_DIR, name), "rb") as f:
+        return f.read()
+
+
+def read_client(name):
+    with open(os.path.join(CLIENT_DIR, name), "rb") as f:
+        return f.read()
+
+
+def write_client(name, data, mode="wb"):
+    with open(os.path.join(CLIENT_DIR, name), mode) as f:
+        f.write(data)
+
+
+def make_hot(name, data):
+    write_srv(name, data)
+    for _ in range(3):
+        assert read_client(name) == data
+    write_client(name, data, "r+b")
+
+
+def test_modify_hot_file_on_srvdir():
+    name = "hot-modified.txt"
+    make_hot(name, b"first version\n")
+
+    with open(os.path.join(SRV_DIR, name), "r+b") as f:
+        f.write(b"FIRST")
+    assert read_client(name) == b"FIRST version\n"
+
+    with open(os.path.join(SRV_DIR, name), "ab") as f:
+        f.write(b"appended on the server\n")
+    assert read_client(name) == b"FIRST version\nappended on the server\n"
+
+    os.truncate(os.path.join(SRV_DIR, name), 5)
+    assert read_client(name) == b"FIRST"
+
+
+def test_replace_hot_file_on_srvdir():
+    name = "hot-replaced.txt"
+    make_hot(name, b"old file\n")
+
+    # the old file stays readable through this fd
+    old = open(os.path.join(SRV_DIR, name), "rb")
+    try:
+        write_srv(name + ".tmp", b"new file\n")
+        os.rename(os.path.join(SRV_DIR, name + ".tmp"), os.path.join(SRV_DIR, name))
+
+        assert read_client(name) == b"new file\n"
+
+        write_client(name, b"NEW", "r+b")
+        assert read_srv(name) == b"NEW file\n"
+        assert old.read() == b"old file\n"
+    finally:
+        old.close()
+
+
+def test_unlink_hot_file_on_srvdir():
+    name = "hot-unlinked.txt"
+    make_hot(name, b"unlinked file\n")
+
+    os.unlink(os.path.join(SRV_DIR, name))
+    with pytest.raises(FileNotFoundError):
+        read_client(name)
+
+    # writing must create a new file instead of writing to the
+    # unlinked one
+    write_client(name, b"created again\n")
+    assert read_srv(name) == b"created again\n"
+    assert read_client(name) == b"created again\n"
+
+    os.unlink(os.path.join(SRV_DIR, name))
+    write_srv(name, b"created on the server\n")
+    assert read_client(name) == b"created on the server\n"
+
+
+def test_rename_hot_files_through_mount():
+    make_hot("hot-a.txt", b"file a\n")
+    make_hot("hot-b.txt", b"file b\n")
+
+    os.rename(os.path.join(CLIENT_DIR, "hot-a.txt"), os.path.join(CLIENT_DIR, "hot-b.txt"))
+
+    assert read_client("hot-b.txt") == b"file a\n"
+    with pytest.raises(FileNotFoundError):
+        read_client("hot-a.txt")
+
+    write_client("hot-b.txt", b"FILE", "r+b")
+    assert read_srv("hot-b.txt") == b"FILE a\n"
+
+
+def test_unlink_and_truncate_hot_file_through_mount():
+    name = "hot-mount.txt"
+    make_hot(name, b"some content\n")
+
+    os.truncate(os.path.join(CLIENT_DIR, name), 4)
+    assert read_client(name) == b"some"
+    assert read_srv(name) == b"some"
+
+    os.unlink(os.path.join(CLIENT_DIR, name))
+    assert not os.path.exists(os.path.join(SRV_DIR, name))
+
+    write_client(name, b"again\n")
+    assert read_srv(name) == b"again\n"
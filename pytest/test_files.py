@@ -91,6 +91,24 @@ def test_readdir():
     assert basename in entries
 
 
+def test_readdir_paged():
+    dirname = "readdir-paged"
+    os.makedirs(os.path.join(SRV_DIR, dirname))
+
+    # several pages, and more names than get cached
+    names = set(f"entry-{i:05}" for i in range(5000))
+    for name in names:
+        open(os.path.join(SRV_DIR, dirname, name), "w").close()
+
+    for _ in range(2):
+        entries = os.listdir(os.path.join(CLIENT_DIR, dirname))
+        assert len(entries) == len(names)
+        assert set(entries) == names
+
+        with os.scandir(os.path.join(CLIENT_DIR, dirname)) as it:
+            assert sum(1 for entry in it if entry.is_file()) == len(names)
+
+
 def test_attributes():
     basename = "attributes.txt"
     text = "something from client"
@@ -192,6 +210,23 @@ def test_utimens_ns():
     assert s.st_mtime_ns == mtime_ns
 
 
+def test_copy_preserving_attributes():
+    src = os.path.join(CLIENT_DIR, "copy-src.txt")
+    dst = os.path.join(CLIENT_DIR, "copy-dst.txt")
+    write_file(src, "something from client")
+    os.chmod(src, 0o640)
+    os.utime(src, times=(1000000, 2000000))
+
+    # create, write, chmod and utimens like cp -p
+    shutil.copy2(src, dst)
+
+    s = os.stat(os.path.join(SRV_DIR, "copy-dst.txt"))
+    assert stat.S_IMODE(s.st_mode) == 0o640
+    assert s.st_mtime == 2000000
+    with open(os.path.join(SRV_DIR, "copy-dst.txt"), "rt") as f:
+        assert f.read() == "something from client"
+
+
 def test_link():
     filename = os.path.join(CLIENT_DIR, "linked.txt")
     linkname = os.path.join(CLIENT_DIR, "link.txt")
@@ -201,12 +236,15 @@ def test_link():
     assert os.path.exists(filename)
     assert os.path.exists(linkname)
 
+    # the kernel keeps the inode of the link until its entry expires
     s_file = os.stat(filename)
     s_link = os.stat(linkname)
+    assert s_file.st_ino == s_link.st_ino
+    assert s_link.st_nlink == 2
 
-    # TODO: inodes are different on client,
-    # but we can check on the server
-#    assert s_file.st_ino == s_link.st_ino
+    s_srv_file = os.stat(os.path.join(SRV_DIR, "linked.txt"))
+    s_srv_link = os.stat(os.path.join(SRV_DIR, "link.txt"))
+    assert s_srv_file.st_ino == s_srv_link.st_ino
 
 
 def test_rename():
@@ -238,3 +276,91 @@ def test_statfs():
     write_file(filename, "something from client")
     os.statvfs(filename)
 
+
+
+def test_read_open_file_renamed_on_srvdir():
+    text = "something from server\n"
+    filename_srv = os.path.join(SRV_DIR, "open-handle.txt")
+    write_file(filename_srv, text)
+
+    filename = os.path.join(CLIENT_DIR, "open-handle.txt")
+    with open(filename, "rt") as f:
+        # the server keeps the file open, so renaming it
+        # must not affect the open file on the client
+        os.rename(filename_srv, os.path.join(SRV_DIR, "open-handle-renamed.txt"))
+        content = f.read()
+
+    assert content == text
+
+
+def test_write_open_file_unlinked_on_srvdir():
+    filename_srv = os.path.join(SRV_DIR, "open-unlinked.txt")
+    filename = os.path.join(CLIENT_DIR, "open-unlinked.txt")
+
+    with open(filename, "wt") as f:
+        f.write("first line\n")
+        f.flush()
+        os.fsync(f.fileno())
+
+        # writes go to the file kept open by the server, they must
+        # not create a new file at the old path
+        os.unlink(filename_srv)
+        f.write("second line\n")
+        f.flush()
+        os.fsync(f.fileno())
+
+    assert not os.path.exists(filename_srv)
+
+
+def test_open_file_unlinked_through_mount():
+    filename = os.path.join(CLIENT_DIR, "unlinked-open.txt")
+
+    with open(filename, "w+b", buffering=0) as f:
+        f.write(b"first line\n")
+        os.unlink(filename)
+        assert not os.path.exists(filename)
+
+        # the open file is still reached by its handle
+        assert os.fstat(f.fileno()).st_size == len(b"first line\n")
+        f.write(b"second line\n")
+        os.ftruncate(f.fileno(), len(b"first line\nsecond"))
+        assert os.fstat(f.fileno()).st_size == len(b"first line\nsecond")
+
+        f.seek(0)
+        assert f.read() == b"first line\nsecond"
+
+    assert not os.path.exists(os.path.join(SRV_DIR, "unlinked-open.txt"))
+
+
+def test_write_read_same_file():
+    filename = os.path.join(CLIENT_DIR, "write-read.txt")
+    with open(filename, "w+") as f:
+        f.write("first line\n")
+        f.flush()
+        f.write("second line\n")
+        f.flush()
+        f.seek(0)
+        content = f.read()
+
+    assert content == "first line\nsecond line\n"
+
+
+def test_client_stats():
+    filename = os.path.join(CLIENT_DIR, "stats.txt")
+    write_file(filename, "some data\n")
+    os.stat(filename)
+
+    stats_file = os.path.join(CLIENT_DIR, ".rhizofs", "stats")
+    assert os.listdir(os.path.join(CLIENT_DIR, ".rhizofs")) == ["stats"]
+    assert ".rhizofs" not in os.listdir(CLIENT_DIR)
+
+    with open(stats_file, "rt") as f:
+        stats = dict(line.split(" ", 1) for line in f.read().splitlines())
+
+    assert int(stats["op.write.requests"]) > 0
+    assert int(stats["op.write.sent_bytes"]) > 0
+    assert float(stats["op.write.latency_avg_ms"]) > 0
+    assert int(stats["attrcache.hits"]) + int(stats["attrcache.misses"]) > 0
+
+    with pytest.raises(PermissionError):
+        open(stats_file, "w")
@@ -0,0 +1,78 @@
+import errno
+import os
+import pytest
+import shutil
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client, run
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-lease")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-lease")
+CRASHING_CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-lease-crashing")
+
+OPEN_FILES=4
+LEASE_SEC=2
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-lease.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    for i in range(OPEN_FILES + 1):
+        with open(os.path.join(SRV_DIR, f"file-{i}.txt"), "wb") as f:
+            f.write(f"file {i}\n".encode())
+    start_server(endpoint, SRV_DIR, [f"--openfiles={OPEN_FILES}",
+                                     f"--lease={LEASE_SEC}"])
+
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR)
+    os.makedirs(CRASHING_CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CRASHING_CLIENT_DIR)
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+    shutil.rmtree(CRASHING_CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def test_handles_of_crashed_client_get_closed():
+    files = [open(os.path.join(CRASHING_CLIENT_DIR, f"file-{i}.txt"), "rb")
+             for i in range(OPEN_FILES)]
+
+    # all handles of the server are taken
+    with pytest.raises(OSError) as e:
+        open(os.path.join(CLIENT_DIR, f"file-{OPEN_FILES}.txt"), "rb")
+    assert e.value.errno == errno.ENFILE
+
+    # the client goes away without releasing its handles
+    assert run(["pkill", "-9", "-f", CRASHING_CLIENT_DIR]).retval == 0
+    for f in files:
+        try:
+            f.close()
+        except OSError:
+            pass
+    run(["fusermount3", "-uz", CRASHING_CLIENT_DIR])
+
+    time.sleep(LEASE_SEC + 2)
+
+    for i in range(OPEN_FILES):
+        with open(os.path.join(CLIENT_DIR, f"file-{i}.txt"), "rb") as f:
+            assert f.read() == f"file {i}\n".encode()
+
+
+def test_handles_of_idle_client_are_kept():
+    with open(os.path.join(CLIENT_DIR, "file-0.txt"), "rb") as f:
+        # the keepalives of the client renew the lease
+        time.sleep(LEASE_SEC * 3)
+        assert f.read() == b"file 0\n"
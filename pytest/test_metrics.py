@@ -0,0 +1,81 @@
+import os
+import pytest
+import shutil
+import socket
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client, \
+                   scrape_metrics, metric_value
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-metrics")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-metrics")
+METRICS_SOCKET=os.path.join(os.getcwd(), ".rhizo-metrics-metrics.sock")
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-metrics.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, [f"--metrics=unix:{METRICS_SOCKET}"])
+
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR, ["--attrttl=0", "--negttl=0", "--attrcache=0"])
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def test_scrape():
+    with open(os.path.join(CLIENT_DIR, "metrics.txt"), "wt") as f:
+        f.write("counted\n")
+    os.stat(os.path.join(CLIENT_DIR, "metrics.txt"))
+
+    response = scrape_metrics(METRICS_SOCKET)
+    header, body = response.split("\r\n\r\n", 1)
+    header_lines = header.split("\r\n")
+
+    assert header_lines[0] == "HTTP/1.0 200 OK"
+    assert "Content-Type: text/plain; version=0.0.4" in header_lines
+    assert f"Content-Length: {len(body.encode())}" in header_lines
+
+    assert "# TYPE rhizosrv_requests_total counter" in body
+    assert metric_value(body, 'rhizosrv_requests_total{type="getattr"}') > 0
+    assert metric_value(body, "rhizosrv_received_bytes_total") > 0
+    assert metric_value(body, "rhizosrv_sent_bytes_total") > 0
+    assert metric_value(body, "rhizosrv_workers") >= 1
+    assert metric_value(body, "rhizosrv_clients") >= 1
+
+
+def test_scrapers_going_away_early():
+    for _ in range(20):
+        # gone before the response is sent
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+            s.connect(METRICS_SOCKET)
+            s.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+
+        # gone without sending a request
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+            s.connect(METRICS_SOCKET)
+
+        # gone after reading a part of the response
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+            s.connect(METRICS_SOCKET)
+            s.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+            s.recv(16)
+
+    # the server is still up and serving both
+    assert scrape_metrics(METRICS_SOCKET).startswith("HTTP/1.0 200 OK")
+    with open(os.path.join(CLIENT_DIR, "metrics.txt"), "rt") as f:
+        assert f.read() == "counted\n"
@@ -237,3 +237,81 @@ def test_mount_zap_invalid():
 
     stop_server()
     shutil.rmtree(srv_dir)
+
+
+@pytest.mark.parametrize("compression", ["none", "lz4", "lz4:8", "lz4hc:9", "zstd", "zstd:-5"])
+def test_mount_compression(compression):
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo.sock"
+
+    srv_dir = tempfile.mkdtemp(prefix="servedir-", dir=pwd)
+    ret = start_server(endpoint, srv_dir)
+
+    client_dir = tempfile.mkdtemp(prefix="clientdir-", dir=pwd)
+    start_client(endpoint, client_dir, args=[f"--compression={compression}"])
+
+    time.sleep(1)
+
+    # compressible data, large enough to be compressed in every block
+    data = b"".join(b"line %d of the compressed file\n" % i for i in range(100000))
+    filename = os.path.join(client_dir, "compressed.txt")
+    with open(filename, "wb") as f:
+        f.write(data)
+
+    with open(os.path.join(srv_dir, "compressed.txt"), "rb") as f:
+        assert f.read() == data
+    with open(filename, "rb") as f:
+        assert f.read() == data
+
+    stop_client(client_dir)
+    shutil.rmtree(client_dir)
+
+    stop_server()
+    shutil.rmtree(srv_dir)
+
+
+def test_mount_compression_skips_random_data():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo.sock"
+
+    srv_dir = tempfile.mkdtemp(prefix="servedir-", dir=pwd)
+    ret = start_server(endpoint, srv_dir)
+
+    client_dir = tempfile.mkdtemp(prefix="clientdir-", dir=pwd)
+    start_client(endpoint, client_dir, args=["--compression=lz4"])
+
+    time.sleep(1)
+
+    data = os.urandom(4 * 1024 * 1024)
+    filename = os.path.join(client_dir, "random.bin")
+    with open(filename, "wb") as f:
+        f.write(data)
+    with open(filename, "rb") as f:
+        assert f.read() == data
+
+    with open(os.path.join(client_dir, ".rhizofs", "stats"), "rt") as f:
+        stats = dict(line.split(" ", 1) for line in f.read().splitlines())
+    assert int(stats["compression.skipped_entropy"]) > 0
+
+    stop_client(client_dir)
+    shutil.rmtree(client_dir)
+
+    stop_server()
+    shutil.rmtree(srv_dir)
+
+
+def test_mount_compression_invalid():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo.sock"
+
+    srv_dir = tempfile.mkdtemp(prefix="servedir-", dir=pwd)
+    ret = start_server(endpoint, srv_dir)
+
+    client_dir = tempfile.mkdtemp(prefix="clientdir-", dir=pwd)
+    ret = start_client(endpoint, client_dir, args=["--compression=lz4hc:99"], ignore_fail=True)
+    assert ret.retval != 0
+
+    shutil.rmtree(client_dir)
+
+    stop_server()
+    shutil.rmtree(srv_dir)
@@ -0,0 +1,98 @@
+import os
+import pytest
+import shutil
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-notify")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-notify")
+
+# long enough for stale entries to fail the tests
+TTL=300
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-notify.sock"
+    notify_endpoint = f"ipc://{pwd}/.rhizo-notify-pub.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, ["--notify", notify_endpoint])
+
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR,
+                 [f"--attrttl={TTL}", f"--negttl={TTL}", f"--notify={notify_endpoint}"])
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def wait_for(condition, timeout=5):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if condition():
+            return True
+        time.sleep(0.1)
+    return condition()
+
+
+def test_created_on_srvdir():
+    basename = "notify-created.txt"
+    client_path = os.path.join(CLIENT_DIR, basename)
+
+    # cache the negative lookup
+    assert not os.path.exists(client_path)
+
+    with open(os.path.join(SRV_DIR, basename), "wt") as f:
+        f.write("created\n")
+
+    assert wait_for(lambda: os.path.exists(client_path))
+    assert basename in os.listdir(CLIENT_DIR)
+
+
+def test_modified_on_srvdir():
+    basename = "notify-modified.txt"
+    srv_path = os.path.join(SRV_DIR, basename)
+    client_path = os.path.join(CLIENT_DIR, basename)
+
+    with open(srv_path, "wt") as f:
+        f.write("before\n")
+    assert wait_for(lambda: os.path.exists(client_path))
+
+    with open(client_path, "rt") as f:
+        assert f.read() == "before\n"
+
+    with open(srv_path, "wt") as f:
+        f.write("after the change\n")
+
+    def changed():
+        with open(client_path, "rt") as f:
+            return f.read() == "after the change\n"
+    assert wait_for(changed)
+
+
+def test_removed_on_srvdir():
+    basename = "notify-removed.txt"
+    srv_path = os.path.join(SRV_DIR, basename)
+    client_path = os.path.join(CLIENT_DIR, basename)
+
+    with open(srv_path, "wt") as f:
+        f.write("removed\n")
+    assert wait_for(lambda: os.path.exists(client_path))
+
+    os.unlink(srv_path)
+
+    assert wait_for(lambda: not os.path.exists(client_path))
+    assert basename not in os.listdir(CLIENT_DIR)
@@ -0,0 +1,89 @@
+import errno
+import os
+import pytest
+import shutil
+import threading
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client, \
+                   scrape_metrics, metric_value
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-ratelimit")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-ratelimit")
+METRICS_SOCKET=os.path.join(os.getcwd(), ".rhizo-ratelimit-metrics.sock")
+
+RATE_LIMIT = 20
+CLIENT_QUEUE = 4
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-ratelimit.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    with open(os.path.join(SRV_DIR, "stat.txt"), "wt") as f:
+        f.write("stat me\n")
+    start_server(endpoint, SRV_DIR, [f"--ratelimit={RATE_LIMIT}",
+                                     f"--clientqueue={CLIENT_QUEUE}",
+                                     f"--metrics=unix:{METRICS_SOCKET}"])
+
+    # every stat is sent to the server
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR, ["--attrttl=0", "--negttl=0", "--attrcache=0"])
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def test_requests_stay_under_rate_limit():
+    filename = os.path.join(CLIENT_DIR, "stat.txt")
+    n_stats = 3 * RATE_LIMIT
+
+    start = time.monotonic()
+    for _ in range(n_stats):
+        os.stat(filename)
+    elapsed = time.monotonic() - start
+
+    # a second worth of requests may be sent in a burst
+    assert (n_stats - RATE_LIMIT) / elapsed <= RATE_LIMIT * 1.1
+    assert elapsed < 10
+
+    assert metric_value(scrape_metrics(METRICS_SOCKET), "rhizosrv_client_throttled_total") > 0
+
+
+def test_requests_beyond_client_queue_fail_with_eagain():
+    filename = os.path.join(CLIENT_DIR, "stat.txt")
+    errors = []
+
+    def stat_loop():
+        for _ in range(10):
+            try:
+                os.stat(filename)
+            except OSError as e:
+                errors.append(e.errno)
+
+    # more requests than may be queued wait for the throttled client
+    threads = [threading.Thread(target=stat_loop) for _ in range(4 * CLIENT_QUEUE)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    assert errno.EAGAIN in errors
+    assert set(errors) == {errno.EAGAIN}
+    assert metric_value(scrape_metrics(METRICS_SOCKET), "rhizosrv_client_rejected_total") > 0
+
+    # the client is served again once its queue drained
+    time.sleep(1)
+    assert os.stat(filename).st_size == len("stat me\n")
@@ -0,0 +1,61 @@
+import os
+import pytest
+import shutil
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client, run
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-readdir")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-readdir")
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-readdir.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR)
+
+    # without the attrcache no entry of a listing has attributes
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR, ["--attrcache=0"])
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def test_list_without_attrcache():
+    dirname = "listing"
+    os.makedirs(os.path.join(SRV_DIR, dirname, "subdir"))
+    names = {f"file{i:03d}" for i in range(100)} | {"subdir"}
+    for name in names - {"subdir"}:
+        with open(os.path.join(SRV_DIR, dirname, name), "wt") as f:
+            f.write(name)
+
+    client_dir = os.path.join(CLIENT_DIR, dirname)
+    assert set(os.listdir(client_dir)) == names
+
+    with os.scandir(client_dir) as it:
+        entries = list(it)
+    assert {entry.name for entry in entries} == names
+    for entry in entries:
+        assert entry.inode() != 0
+        assert entry.is_dir() == (entry.name == "subdir")
+
+    ret = run(["ls", "-a", client_dir])
+    assert ret.retval == 0
+    assert set(ret.stdout) == names | {".", ".."}
+
+    # the second listing is served after the entries have been looked up
+    assert set(os.listdir(client_dir)) == names
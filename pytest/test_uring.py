@@ -0,0 +1,64 @@
+import os
+import pytest
+import shutil
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-uring")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-uring")
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-uring.sock"
+
+    # falls back to blocking I/O where io_uring is not available
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, ["--uring", "-n", "2"])
+
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR)
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def test_concurrent_read_write():
+    contents = {f"uring{i:03d}.bin": os.urandom(200 * 1024 + i) for i in range(64)}
+
+    def write(name):
+        with open(os.path.join(CLIENT_DIR, name), "wb") as f:
+            f.write(contents[name])
+
+    def read(name):
+        with open(os.path.join(CLIENT_DIR, name), "rb") as f:
+            return f.read()
+
+    with ThreadPoolExecutor(max_workers=16) as pool:
+        list(pool.map(write, contents))
+        for name, data in zip(contents, pool.map(read, contents)):
+            assert data == contents[name]
+
+    for name, data in contents.items():
+        st = os.lstat(os.path.join(CLIENT_DIR, name))
+        assert st.st_size == len(data)
+        with open(os.path.join(SRV_DIR, name), "rb") as f:
+            assert f.read() == data
+
+
+def test_missing_file():
+    with pytest.raises(FileNotFoundError):
+        os.lstat(os.path.join(CLIENT_DIR, "uring-missing"))
@@ -0,0 +1,126 @@
+import os
+import pytest
+import shutil
+import statistics
+import threading
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client, \
+                   scrape_metrics, metric_value
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-workers")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-workers")
+METRICS_SOCKET=os.path.join(os.getcwd(), ".rhizo-workers-metrics.sock")
+
+NUM_WORKERS = 2
+MIN_WORKERS = 1
+MAX_WORKERS = 8
+
+N_READERS = 6
+FILE_SIZE = 32 * 1024 * 1024
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-workers.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    for i in range(N_READERS):
+        with open(os.path.join(SRV_DIR, f"bulk-{i}.bin"), "wb") as f:
+            f.write(os.urandom(FILE_SIZE))
+    with open(os.path.join(SRV_DIR, "stat.txt"), "wt") as f:
+        f.write("stat me\n")
+    start_server(endpoint, SRV_DIR, [f"--numworkers={NUM_WORKERS}",
+                                     f"--minworkers={MIN_WORKERS}",
+                                     f"--maxworkers={MAX_WORKERS}",
+                                     "--metaworkers=1",
+                                     f"--metrics=unix:{METRICS_SOCKET}"])
+
+    # every stat is sent to the server
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR, ["--attrttl=0", "--negttl=0", "--attrcache=0"])
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+# reads large files through the mount in threads until stopped
+class BulkReaders:
+
+    def __init__(self):
+        self.stopped = threading.Event()
+        self.threads = [threading.Thread(target=self.read, args=(i,))
+                        for i in range(N_READERS)]
+
+    def read(self, i):
+        while not self.stopped.is_set():
+            with open(os.path.join(CLIENT_DIR, f"bulk-{i}.bin"), "rb") as f:
+                while not self.stopped.is_set() and f.read(1024 * 1024):
+                    pass
+
+    def __enter__(self):
+        for t in self.threads:
+            t.start()
+        # let the reads fill the queues
+        time.sleep(1)
+        return self
+
+    def __exit__(self, *args):
+        self.stopped.set()
+        for t in self.threads:
+            t.join()
+
+
+def test_pool_grows_and_shrinks():
+    response = scrape_metrics(METRICS_SOCKET)
+    assert metric_value(response, "rhizosrv_workers") <= NUM_WORKERS
+
+    most_workers = 0
+    with BulkReaders():
+        deadline = time.monotonic() + 10
+        while time.monotonic() < deadline and most_workers <= NUM_WORKERS:
+            response = scrape_metrics(METRICS_SOCKET)
+            most_workers = max(most_workers, metric_value(response, "rhizosrv_workers"))
+            time.sleep(0.2)
+
+    assert most_workers > NUM_WORKERS
+    assert most_workers <= MAX_WORKERS
+
+    # workers are removed one at a time after a while of low load
+    deadline = time.monotonic() + 30
+    workers = most_workers
+    while time.monotonic() < deadline and workers >= most_workers:
+        workers = metric_value(scrape_metrics(METRICS_SOCKET), "rhizosrv_workers")
+        time.sleep(1)
+
+    assert workers < most_workers
+    assert workers >= MIN_WORKERS
+
+
+def test_stat_latency_during_bulk_reads():
+    filename = os.path.join(CLIENT_DIR, "stat.txt")
+    latencies = []
+
+    with BulkReaders():
+        for _ in range(50):
+            start = time.monotonic()
+            os.stat(filename)
+            latencies.append(time.monotonic() - start)
+            time.sleep(0.02)
+
+    # stats are served by the reserved worker instead of waiting
+    # behind the reads
+    print(f"stat latencies: median={statistics.median(latencies):.4f}s max={max(latencies):.4f}s")
+    assert statistics.median(latencies) < 0.1
+    assert max(latencies) < 1
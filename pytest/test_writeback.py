@@ -0,0 +1,216 @@
+import os
+import pytest
+import resource
+import shutil
+import signal
+import time
+
+
+from common import start_server, stop_server, \
+                   start_client, stop_client
+
+
+SRV_DIR=os.path.join(os.getcwd(), "srvdir-writeback")
+CLIENT_DIR=os.path.join(os.getcwd(), "clientdir-writeback")
+
+# files on the server may not grow beyond this size, so writes
+# can be made to fail
+MAX_FILE_SIZE = 8 * 1024 * 1024
+
+# the client writes dirty data older than a second
+FLUSH_INTERVAL = 1
+
+
+def limit_file_size():
+    # writes beyond the limit fail with EFBIG instead of
+    # killing the server
+    signal.signal(signal.SIGXFSZ, signal.SIG_IGN)
+    resource.setrlimit(resource.RLIMIT_FSIZE, (MAX_FILE_SIZE, MAX_FILE_SIZE))
+
+
+@pytest.fixture(scope='module', autouse=True)
+def setup_test():
+    pwd = os.getcwd()
+    endpoint = f"ipc://{pwd}/.rhizo-writeback.sock"
+
+    os.makedirs(SRV_DIR, exist_ok=True)
+    start_server(endpoint, SRV_DIR, preexec_fn=limit_file_size)
+
+    os.makedirs(CLIENT_DIR, exist_ok=True)
+    start_client(endpoint, CLIENT_DIR)
+
+    time.sleep(1)
+
+    yield
+
+    stop_client(CLIENT_DIR)
+    shutil.rmtree(CLIENT_DIR)
+
+    stop_server()
+    shutil.rmtree(SRV_DIR)
+
+
+def read_srv(name):
+    with open(os.path.join(SRV_DIR, name), "rb") as f:
+        return f.read()
+
+
+def test_small_adjacent_and_overlapping_writes():
+    filename = os.path.join(CLIENT_DIR, "small-writes.bin")
+    expected = bytearray()
+
+    with open(filename, "wb", buffering=0) as f:
+        for i in range(2000):
+            chunk = os.urandom(1 + (i % 37))
+            f.write(chunk)
+            expected += chunk
+
+        # overwrite ranges inside and across the data written so far,
+        # and append behind it after a gap
+        for offset in (0, 100, 5000, len(expected) - 10):
+            chunk = os.urandom(64)
+            f.seek(offset)
+            f.write(chunk)
+            end = offset + len(chunk)
+            if end > len(expected):
+                expected += bytes(end - len(expected))
+            expected[offset:end] = chunk
+
+        f.seek(len(expected) + 1000)
+        f.write(b"tail")
+        expected += bytes(1000) + b"tail"
+
+    with open(filename, "rb") as f:
+        assert f.read() == expected
+    assert read_srv("small-writes.bin") == expected
+
+
+def test_read_back_before_flush():
+    filename = os.path.join(CLIENT_DIR, "read-back.bin")
+    data = os.urandom(300 * 1024)
+
+    with open(filename, "w+b", buffering=0) as f:
+        for offset in range(0, len(data), 1000):
+            f.write(data[offset:offset + 1000])
+        f.seek(0)
+        assert f.read() == data
+
+
+def test_size_and_mtime_before_and_after_flush():
+    name = "attrs.bin"
+    filename = os.path.join(CLIENT_DIR, name)
+    data = os.urandom(100 * 1024)
+
+    with open(filename, "wb", buffering=0) as f:
+        f.write(b"x")
+        os.fsync(f.fileno())
+        mtime_before = os.stat(filename).st_mtime
+
+        time.sleep(1.1)
+        for offset in range(0, len(data), 512):
+            f.write(data[offset:offset + 512])
+
+        # getattr sends the buffered writes before asking the server
+        st = os.stat(filename)
+        assert st.st_size == 1 + len(data)
+        assert st.st_mtime > mtime_before
+
+        os.fsync(f.fileno())
+        st_flushed = os.stat(filename)
+        assert st_flushed.st_size == 1 + len(data)
+        assert os.stat(os.path.join(SRV_DIR, name)).st_size == 1 + len(data)
+
+    st_srv = os.stat(os.path.join(SRV_DIR, name))
+    assert os.stat(filename).st_mtime == st_srv.st_mtime
+    assert read_srv(name) == b"x" + data
+
+
+def test_size_after_rename():
+    filename = os.path.join(CLIENT_DIR, "before-rename.bin")
+    renamed = os.path.join(CLIENT_DIR, "after-rename.bin")
+    data = os.urandom(64 * 1024)
+
+    with open(filename, "wb", buffering=0) as f:
+        f.write(data)
+        os.rename(filename, renamed)
+
+        # buffered under the new path, so getattr sends them
+        f.write(data)
+        assert os.stat(renamed).st_size == 2 * len(data)
+
+    assert read_srv("after-rename.bin") == data + data
+
+
+def test_size_after_renaming_directory():
+    os.mkdir(os.path.join(CLIENT_DIR, "dir-before-rename"))
+    filename = os.path.join(CLIENT_DIR, "dir-before-rename", "file.bin")
+    renamed = os.path.join(CLIENT_DIR, "dir-after-rename", "file.bin")
+    data = os.urandom(64 * 1024)
+
+    with open(filename, "wb", buffering=0) as f:
+        f.write(data)
+        os.rename(os.path.join(CLIENT_DIR, "dir-before-rename"),
+                  os.path.join(CLIENT_DIR, "dir-after-rename"))
+
+        f.write(data)
+        assert os.stat(renamed).st_size == 2 * len(data)
+
+    assert read_srv(os.path.join("dir-after-rename", "file.bin")) == data + data
+
+
+def test_timer_flush():
+    name = "timer.bin"
+    filename = os.path.join(CLIENT_DIR, name)
+
+    with open(filename, "wb", buffering=0) as f:
+        f.write(b"dirty data")
+        time.sleep(FLUSH_INTERVAL * 3)
+
+        # written without fsync or close
+        assert read_srv(name) == b"dirty data"
+
+
+def test_timer_flush_while_other_files_are_written():
+    name = "timer-busy.bin"
+    filename = os.path.join(CLIENT_DIR, name)
+    other = os.path.join(CLIENT_DIR, "timer-other.bin")
+
+    with open(filename, "wb", buffering=0) as f, \
+            open(other, "wb", buffering=0) as g:
+        f.write(b"dirty data")
+
+        # steady writes keep the writeback threads busy
+        deadline = time.monotonic() + FLUSH_INTERVAL * 4
+        while time.monotonic() < deadline:
+            g.write(os.urandom(4096))
+            time.sleep(0.01)
+
+        assert read_srv(name) == b"dirty data"
+
+
+def test_fsync_error():
+    filename = os.path.join(CLIENT_DIR, "fsync-error.bin")
+
+    with open(filename, "wb", buffering=0) as f:
+        # buffered by the client, the server fails to write it
+        f.seek(MAX_FILE_SIZE)
+        f.write(b"beyond the limit")
+        with pytest.raises(OSError):
+            os.fsync(f.fileno())
+
+        # the error is reported once
+        f.seek(0)
+        f.write(b"within the limit")
+        os.fsync(f.fileno())
+
+    assert read_srv("fsync-error.bin") == b"within the limit"
+
+
+def test_close_error():
+    filename = os.path.join(CLIENT_DIR, "close-error.bin")
+
+    f = open(filename, "wb", buffering=0)
+    f.seek(MAX_FILE_SIZE)
+    f.write(b"beyond the limit")
+    with pytest.raises(OSError):
+        f.close()
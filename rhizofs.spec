@@ -8,8 +8,10 @@ Summary:    A simple remote filesystem based on FUSE, ZeroMQ and protobuf-c
 License:    BSD
 
 BuildRequires: protobuf-c-devel
-BuildRequires: fuse-devel
+BuildRequires: fuse3-devel
 BuildRequires: zeromq-devel
+BuildRequires: lz4-devel
+BuildRequires: libzstd-devel
 
 %description
 This package contains the client.
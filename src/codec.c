@@ -0,0 +1,355 @@
+#include "codec.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zstd.h>
+
+#include "dbg.h"
+
+
+/**
+ * the functions of a compression type
+ */
+typedef struct CodecOps {
+    Rhizofs__CompressionType type;
+    size_t (*bound)(size_t len);
+    size_t (*compress)(int level, const uint8_t * src, size_t len, uint8_t * dst,
+            size_t dst_size);
+    bool (*decompress)(const uint8_t * src, size_t len, uint8_t * dst, size_t size);
+} CodecOps;
+
+
+// prototypes
+static size_t Codec_lz4_bound(size_t len);
+static size_t Codec_lz4_compress(int level, const uint8_t * src, size_t len,
+        uint8_t * dst, size_t dst_size);
+static bool Codec_lz4_decompress(const uint8_t * src, size_t len, uint8_t * dst, size_t size);
+static size_t Codec_zstd_bound(size_t len);
+static size_t Codec_zstd_compress(int level, const uint8_t * src, size_t len,
+        uint8_t * dst, size_t dst_size);
+static bool Codec_zstd_decompress(const uint8_t * src, size_t len, uint8_t * dst, size_t size);
+
+
+static const CodecOps codec_ops[] = {
+    { RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4,
+        Codec_lz4_bound, Codec_lz4_compress, Codec_lz4_decompress },
+    { RHIZOFS__COMPRESSION_TYPE__COMPR_ZSTD,
+        Codec_zstd_bound, Codec_zstd_compress, Codec_zstd_decompress },
+};
+
+#define CODEC_N_OPS (sizeof(codec_ops) / sizeof(codec_ops[0]))
+
+/* the zstd contexts of every thread, created on first use */
+static pthread_once_t codec_keys_once = PTHREAD_ONCE_INIT;
+static pthread_key_t codec_zstd_cctx_key;
+static pthread_key_t codec_zstd_dctx_key;
+static bool codec_keys_created = false;
+
+
+static const CodecOps *
+Codec_ops(Rhizofs__CompressionType type)
+{
+    for (size_t i=0; i<CODEC_N_OPS; i++) {
+        if (codec_ops[i].type == type) {
+            return &(codec_ops[i]);
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * parse the level following the name of a codec
+ *
+ * returns false if there is none or it is not a number within the range
+ */
+static bool
+Codec_parse_level(const char * spec, int min, int max, int * level)
+{
+    char * end = NULL;
+
+    if (spec[0] != ':') {
+        return false;
+    }
+    errno = 0;
+    long value = strtol(spec + 1, &end, 10);
+    if ((errno != 0) || (end == spec + 1) || (*end != '\0') || (value < min) || (value > max)) {
+        return false;
+    }
+    *level = (int)value;
+    return true;
+}
+
+
+bool
+Codec_parse(const char * spec, Codec * codec)
+{
+    int level = 0;
+
+    check((spec != NULL), "passed codec is null");
+
+    if (strcmp(spec, "none") == 0) {
+        codec->type = RHIZOFS__COMPRESSION_TYPE__COMPR_NONE;
+        codec->level = 0;
+    }
+    else if (strncmp(spec, "lz4hc", 5) == 0) {
+        level = LZ4HC_CLEVEL_DEFAULT;
+        check_debug((spec[5] == '\0') || Codec_parse_level(spec + 5, 1, LZ4HC_CLEVEL_MAX, &level),
+                "invalid lz4hc level in %s", spec);
+        codec->type = RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4;
+        codec->level = level;
+    }
+    else if (strncmp(spec, "lz4", 3) == 0) {
+        check_debug((spec[3] == '\0') || Codec_parse_level(spec + 3, 1, 65537, &level),
+                "invalid lz4 acceleration in %s", spec);
+        codec->type = RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4;
+        codec->level = (level > 1) ? -level : 0;
+    }
+    else if (strncmp(spec, "zstd", 4) == 0) {
+        level = ZSTD_CLEVEL_DEFAULT;
+        check_debug((spec[4] == '\0') ||
+                Codec_parse_level(spec + 4, ZSTD_minCLevel(), ZSTD_maxCLevel(), &level),
+                "invalid zstd level in %s", spec);
+        codec->type = RHIZOFS__COMPRESSION_TYPE__COMPR_ZSTD;
+        codec->level = level;
+    }
+    else {
+        return false;
+    }
+    codec->chunk_size = 0;
+    return true;
+
+error:
+    return false;
+}
+
+
+void
+Codec_format(const Codec * codec, char * buf, size_t size)
+{
+    switch (codec->type) {
+        case RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4:
+            if (codec->level > 0) {
+                snprintf(buf, size, "lz4hc:%d", codec->level);
+            }
+            else if (codec->level < 0) {
+                snprintf(buf, size, "lz4:%d", -codec->level);
+            }
+            else {
+                snprintf(buf, size, "lz4");
+            }
+            break;
+
+        case RHIZOFS__COMPRESSION_TYPE__COMPR_ZSTD:
+            snprintf(buf, size, "zstd:%d", codec->level);
+            break;
+
+        case RHIZOFS__COMPRESSION_TYPE__COMPR_NONE:
+            snprintf(buf, size, "none");
+            break;
+
+        default:
+            snprintf(buf, size, "unknown(%d)", (int)codec->type);
+            break;
+    }
+}
+
+
+bool
+Codec_is_supported(Rhizofs__CompressionType type)
+{
+    return (type == RHIZOFS__COMPRESSION_TYPE__COMPR_NONE) || (Codec_ops(type) != NULL);
+}
+
+
+size_t
+Codec_list(Rhizofs__CompressionType * types, size_t max)
+{
+    size_t n = 0;
+
+    if (n < max) {
+        types[n++] = RHIZOFS__COMPRESSION_TYPE__COMPR_NONE;
+    }
+    for (size_t i=0; (i<CODEC_N_OPS) && (n<max); i++) {
+        types[n++] = codec_ops[i].type;
+    }
+    return n;
+}
+
+
+size_t
+Codec_bound(const Codec * codec, size_t len)
+{
+    const CodecOps * ops = Codec_ops(codec->type);
+    return (ops != NULL) ? ops->bound(len) : len;
+}
+
+
+size_t
+Codec_compress(const Codec * codec, const uint8_t * src, size_t len,
+        uint8_t * dst, size_t dst_size)
+{
+    const CodecOps * ops = Codec_ops(codec->type);
+    if ((ops == NULL) || (len == 0)) {
+        return 0;
+    }
+
+    size_t compressed = ops->compress(codec->level, src, len, dst, dst_size);
+    return (compressed < len) ? compressed : 0;
+}
+
+
+bool
+Codec_decompress(Rhizofs__CompressionType type, const uint8_t * src, size_t len,
+        uint8_t * dst, size_t size)
+{
+    const CodecOps * ops = Codec_ops(type);
+    check((ops != NULL), "Unsupported compression type %d", (int)type);
+
+    return ops->decompress(src, len, dst, size);
+
+error:
+    return false;
+}
+
+
+/*** LZ4 *************************************************/
+
+static size_t
+Codec_lz4_bound(size_t len)
+{
+    if (len > LZ4_MAX_INPUT_SIZE) {
+        return 0;
+    }
+    return (size_t)LZ4_compressBound((int)len);
+}
+
+
+static size_t
+Codec_lz4_compress(int level, const uint8_t * src, size_t len, uint8_t * dst, size_t dst_size)
+{
+    int n = 0;
+
+    if (len > LZ4_MAX_INPUT_SIZE) {
+        return 0;
+    }
+    if (dst_size > INT_MAX) {
+        dst_size = INT_MAX;
+    }
+
+    if (level > 0) {
+        n = LZ4_compress_HC((const char *)src, (char *)dst, (int)len, (int)dst_size, level);
+    }
+    else {
+        n = LZ4_compress_fast((const char *)src, (char *)dst, (int)len, (int)dst_size,
+                (level < 0) ? -level : 1);
+    }
+    return (n > 0) ? (size_t)n : 0;
+}
+
+
+static bool
+Codec_lz4_decompress(const uint8_t * src, size_t len, uint8_t * dst, size_t size)
+{
+    check((len <= INT_MAX) && (size <= INT_MAX), "lz4 block too large");
+
+    int n = LZ4_decompress_safe((const char *)src, (char *)dst, (int)len, (int)size);
+    check((n >= 0), "LZ4_decompress_safe failed");
+    check(((size_t)n == size), "could not decompress the whole block "
+            "(only %d bytes of %d bytes)", n, (int)size);
+    return true;
+
+error:
+    return false;
+}
+
+
+/*** zstd ************************************************/
+
+static void
+Codec_free_cctx(void * cctx)
+{
+    ZSTD_freeCCtx((ZSTD_CCtx *)cctx);
+}
+
+
+static void
+Codec_free_dctx(void * dctx)
+{
+    ZSTD_freeDCtx((ZSTD_DCtx *)dctx);
+}
+
+
+static void
+Codec_create_keys()
+{
+    codec_keys_created = (pthread_key_create(&codec_zstd_cctx_key, Codec_free_cctx) == 0) &&
+            (pthread_key_create(&codec_zstd_dctx_key, Codec_free_dctx) == 0);
+}
+
+
+static size_t
+Codec_zstd_bound(size_t len)
+{
+    return ZSTD_compressBound(len);
+}
+
+
+static size_t
+Codec_zstd_compress(int level, const uint8_t * src, size_t len, uint8_t * dst, size_t dst_size)
+{
+    pthread_once(&codec_keys_once, Codec_create_keys);
+    check(codec_keys_created, "Could not create the keys of the zstd contexts");
+
+    // a context keeps its tables between calls, which saves their
+    // setup for every block
+    ZSTD_CCtx * cctx = pthread_getspecific(codec_zstd_cctx_key);
+    if (cctx == NULL) {
+        cctx = ZSTD_createCCtx();
+        check_mem(cctx);
+        if (pthread_setspecific(codec_zstd_cctx_key, cctx) != 0) {
+            ZSTD_freeCCtx(cctx);
+            log_and_error("Could not keep the zstd context");
+        }
+    }
+
+    size_t n = ZSTD_compressCCtx(cctx, dst, dst_size, src, len, level);
+    check_debug(!ZSTD_isError(n), "ZSTD_compressCCtx failed: %s", ZSTD_getErrorName(n));
+    return n;
+
+error:
+    return 0;
+}
+
+
+static bool
+Codec_zstd_decompress(const uint8_t * src, size_t len, uint8_t * dst, size_t size)
+{
+    pthread_once(&codec_keys_once, Codec_create_keys);
+    check(codec_keys_created, "Could not create the keys of the zstd contexts");
+
+    ZSTD_DCtx * dctx = pthread_getspecific(codec_zstd_dctx_key);
+    if (dctx == NULL) {
+        dctx = ZSTD_createDCtx();
+        check_mem(dctx);
+        if (pthread_setspecific(codec_zstd_dctx_key, dctx) != 0) {
+            ZSTD_freeDCtx(dctx);
+            log_and_error("Could not keep the zstd context");
+        }
+    }
+
+    size_t n = ZSTD_decompressDCtx(dctx, dst, size, src, len);
+    check(!ZSTD_isError(n), "ZSTD_decompressDCtx failed: %s", ZSTD_getErrorName(n));
+    check((n == size), "could not decompress the whole block "
+            "(only %d bytes of %d bytes)", (int)n, (int)size);
+    return true;
+
+error:
+    return false;
+}
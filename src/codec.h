@@ -0,0 +1,93 @@
+#ifndef __codec_h__
+#define __codec_h__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "proto/rhizofs.pb-c.h"
+
+/* data smaller than this (in bytes) is not worth compressing */
+#define CODEC_MIN_SIZE 100
+
+/* maximum number of compression types a build supports */
+#define CODEC_MAX_TYPES 8
+
+/* size of the chunks large data is split into, so they can be
+ * compressed in parallel, and the smallest size accepted from a peer */
+#define CODEC_CHUNK_SIZE (128 * 1024)
+#define CODEC_MIN_CHUNK_SIZE (16 * 1024)
+
+
+/**
+ * a compressor, its level and the size of the chunks data is split into
+ *
+ * the level depends on the type:
+ *  - COMPR_LZ4: 0 is the fast compressor, a negative level its
+ *    acceleration (-4 = acceleration 4, faster and weaker), a positive
+ *    level the level of the HC compressor (1-12). all of them produce
+ *    the same block format
+ *  - COMPR_ZSTD: the level of zstd. 0 is its default
+ */
+typedef struct Codec {
+    Rhizofs__CompressionType type;
+    int level;
+
+    // data larger than this is split into chunks of this size, which
+    // are compressed independently and in parallel. 0 if the peer does
+    // not accept chunks
+    uint32_t chunk_size;
+} Codec;
+
+
+/**
+ * parse a codec given as "none", "lz4[:ACCELERATION]", "lz4hc[:LEVEL]"
+ * or "zstd[:LEVEL]"
+ *
+ * returns false if "spec" is invalid
+ */
+bool Codec_parse(const char * spec, Codec * codec);
+
+/**
+ * write the name of a codec in the format read by Codec_parse
+ */
+void Codec_format(const Codec * codec, char * buf, size_t size);
+
+/**
+ * check if the data of a compression type can be compressed and
+ * decompressed by this build
+ */
+bool Codec_is_supported(Rhizofs__CompressionType type);
+
+/**
+ * get the compression types supported by this build
+ *
+ * returns the number of types written to "types", at most "max"
+ */
+size_t Codec_list(Rhizofs__CompressionType * types, size_t max);
+
+/**
+ * maximum size of the compressed data of "len" bytes
+ */
+size_t Codec_bound(const Codec * codec, size_t len);
+
+/**
+ * compress "len" bytes of "src" to "dst", which has room for
+ * "dst_size" bytes
+ *
+ * returns the size of the compressed data or 0 on error or if
+ * the data did not get smaller
+ */
+size_t Codec_compress(const Codec * codec, const uint8_t * src, size_t len,
+        uint8_t * dst, size_t dst_size);
+
+/**
+ * decompress "len" bytes of "src" to exactly "size" bytes in "dst"
+ *
+ * returns false on error, including corrupt data and data which does
+ * not decompress to "size" bytes
+ */
+bool Codec_decompress(Rhizofs__CompressionType type, const uint8_t * src, size_t len,
+        uint8_t * dst, size_t size);
+
+#endif /* __codec_h__ */
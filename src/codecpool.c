@@ -0,0 +1,204 @@
+#include "codecpool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "dbg.h"
+
+
+/**
+ * the calls of one CodecPool_run. lives on the stack of the caller
+ */
+typedef struct CodecPoolBatch {
+    void (*func)(void * ctx, size_t i);
+    void * ctx;
+    size_t n;
+
+    // the next index to call "func" for and the number of calls
+    // which have returned
+    size_t next;
+    size_t n_done;
+    pthread_cond_t done;
+
+    struct CodecPoolBatch * next_batch;
+} CodecPoolBatch;
+
+
+typedef struct CodecPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+
+    // batches with indices left to call "func" for
+    CodecPoolBatch * head;
+    CodecPoolBatch * tail;
+
+    pthread_t threads[CODECPOOL_MAX_THREADS];
+    size_t n_threads;
+    bool stop;
+} CodecPool;
+
+
+static CodecPool pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, { 0 }, 0, false
+};
+
+
+/**
+ * take the next index of "batch" and remove the batch from the queue
+ * once its last index has been taken
+ *
+ * the mutex has to be held
+ */
+static size_t
+CodecPool_take(CodecPoolBatch * batch)
+{
+    size_t i = batch->next++;
+
+    if (batch->next == batch->n) {
+        CodecPoolBatch ** prev = &(pool.head);
+        while (*prev != batch) {
+            prev = &((*prev)->next_batch);
+        }
+        *prev = batch->next_batch;
+        if (pool.tail == batch) {
+            pool.tail = NULL;
+            for (CodecPoolBatch * b = pool.head; b != NULL; b = b->next_batch) {
+                pool.tail = b;
+            }
+        }
+    }
+    return i;
+}
+
+
+/**
+ * call "func" for an index taken from "batch"
+ *
+ * the mutex has to be held and is held again on return
+ */
+static void
+CodecPool_call(CodecPoolBatch * batch)
+{
+    size_t i = CodecPool_take(batch);
+
+    pthread_mutex_unlock(&(pool.mutex));
+    batch->func(batch->ctx, i);
+    pthread_mutex_lock(&(pool.mutex));
+
+    batch->n_done++;
+    if (batch->n_done == batch->n) {
+        pthread_cond_signal(&(batch->done));
+    }
+}
+
+
+static void *
+CodecPool_thread(void * UNUSED_PARAMETER(arg))
+{
+    pthread_mutex_lock(&(pool.mutex));
+    while (!pool.stop) {
+        if (pool.head == NULL) {
+            pthread_cond_wait(&(pool.work), &(pool.mutex));
+            continue;
+        }
+        CodecPool_call(pool.head);
+    }
+    pthread_mutex_unlock(&(pool.mutex));
+    return NULL;
+}
+
+
+size_t
+CodecPool_default_threads()
+{
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n_cpus <= 1) {
+        return 0;
+    }
+    if (n_cpus > CODECPOOL_MAX_THREADS) {
+        return CODECPOOL_MAX_THREADS;
+    }
+    return (size_t)n_cpus - 1;
+}
+
+
+bool
+CodecPool_start(size_t n_threads)
+{
+    check((pool.n_threads == 0), "The codec pool has already been started");
+    check((n_threads <= CODECPOOL_MAX_THREADS), "The codec pool may not have more than %d threads",
+            CODECPOOL_MAX_THREADS);
+
+    pool.stop = false;
+    while (pool.n_threads < n_threads) {
+        check((pthread_create(&(pool.threads[pool.n_threads]), NULL,
+                CodecPool_thread, NULL) == 0), "Could not start a thread of the codec pool");
+        pool.n_threads++;
+    }
+    return true;
+
+error:
+    CodecPool_stop();
+    return false;
+}
+
+
+void
+CodecPool_stop()
+{
+    pthread_mutex_lock(&(pool.mutex));
+    pool.stop = true;
+    pthread_cond_broadcast(&(pool.work));
+    pthread_mutex_unlock(&(pool.mutex));
+
+    for (size_t i=0; i<pool.n_threads; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    pool.n_threads = 0;
+}
+
+
+void
+CodecPool_run(size_t n, void (*func)(void * ctx, size_t i), void * ctx)
+{
+    CodecPoolBatch batch;
+
+    if ((n < 2) || (pool.n_threads == 0)) {
+        for (size_t i=0; i<n; i++) {
+            func(ctx, i);
+        }
+        return;
+    }
+
+    batch.func = func;
+    batch.ctx = ctx;
+    batch.n = n;
+    batch.next = 0;
+    batch.n_done = 0;
+    batch.next_batch = NULL;
+    pthread_cond_init(&(batch.done), NULL);
+
+    pthread_mutex_lock(&(pool.mutex));
+    if (pool.tail != NULL) {
+        pool.tail->next_batch = &batch;
+    }
+    else {
+        pool.head = &batch;
+    }
+    pool.tail = &batch;
+    pthread_cond_broadcast(&(pool.work));
+
+    // the caller works on its own batch, so it progresses even
+    // while the threads are busy with the batches of others
+    while (batch.next < batch.n) {
+        CodecPool_call(&batch);
+    }
+    while (batch.n_done < batch.n) {
+        pthread_cond_wait(&(batch.done), &(pool.mutex));
+    }
+    pthread_mutex_unlock(&(pool.mutex));
+
+    pthread_cond_destroy(&(batch.done));
+}
@@ -0,0 +1,43 @@
+#ifndef __codecpool_h__
+#define __codecpool_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* maximum number of threads of the pool */
+#define CODECPOOL_MAX_THREADS 64
+
+
+/**
+ * the threads compressing and decompressing the chunks of large data
+ * blocks, shared by all threads of the process
+ *
+ * the pool is started once. until then and with 0 threads the chunks
+ * are processed by the calling thread alone
+ */
+
+/**
+ * the number of threads used if none is configured. one less than
+ * the number of processors, as the calling thread works as well
+ */
+size_t CodecPool_default_threads();
+
+/**
+ * start "n_threads" threads
+ *
+ * returns false on error
+ */
+bool CodecPool_start(size_t n_threads);
+
+/**
+ * stop the threads. no more work may be submitted
+ */
+void CodecPool_stop();
+
+/**
+ * call "func" for every index from 0 to "n" - 1, on the threads of the
+ * pool and the calling thread, and return once all calls are done
+ */
+void CodecPool_run(size_t n, void (*func)(void * ctx, size_t i), void * ctx);
+
+#endif /* __codecpool_h__ */
@@ -0,0 +1,343 @@
+#include "compresspolicy.h"
+
+#include <string.h>
+
+#include "dbg.h"
+#include "hashfunc.h"
+
+/* number of windows the sample of a block is taken from */
+#define COMPRESSPOLICY_SAMPLE_WINDOWS 4
+
+/* data compressed to more than this share (in 1/1024) did not get
+ * smaller enough to be worth the cost */
+#define COMPRESSPOLICY_MAX_RATIO 960
+
+/* the codec LZ4 without acceleration. cheap enough to be worth trying
+ * on any link which is not local */
+static const Codec compresspolicy_fast = { RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4, 0, 0 };
+
+
+bool
+CompressPolicy_init(CompressPolicy * policy, bool weigh_costs)
+{
+    memset(policy, 0, sizeof(CompressPolicy));
+    policy->weigh_costs = weigh_costs;
+    policy->codecs[0] = compresspolicy_fast;
+    policy->codecs[1] = compresspolicy_fast;
+
+    check((pthread_mutex_init(&(policy->mutex), NULL) == 0),
+            "Could not initialize the mutex of the compression policy");
+    policy->initialized = true;
+    return true;
+
+error:
+    return false;
+}
+
+
+void
+CompressPolicy_deinit(CompressPolicy * policy)
+{
+    if (policy->initialized) {
+        pthread_mutex_destroy(&(policy->mutex));
+        policy->initialized = false;
+    }
+}
+
+
+uint64_t
+CompressPolicy_file(const char * path, uint64_t handle)
+{
+    if (handle != 0) {
+        return handle;
+    }
+    return (path != NULL) ? Hashfunc_sdbm((const unsigned char *)path) : 0;
+}
+
+
+/**
+ * log2 of "x" in 1/65536. "x" has to be larger than 0
+ */
+static uint32_t
+CompressPolicy_log2(uint32_t x)
+{
+    uint32_t msb = 0;
+    while ((x >> (msb + 1)) != 0) {
+        msb++;
+    }
+
+    // the fraction is found bit by bit by squaring x normalized to [1, 2)
+    uint32_t result = msb << 16;
+    uint64_t y = ((uint64_t)x << 30) >> msb;
+    for (uint32_t bit = 1U << 15; bit != 0; bit >>= 1) {
+        y = (y * y) >> 30;
+        if (y >= (2ULL << 30)) {
+            y >>= 1;
+            result |= bit;
+        }
+    }
+    return result;
+}
+
+
+uint32_t
+CompressPolicy_entropy(const uint8_t * data, size_t len)
+{
+    uint32_t counts[256];
+    uint64_t sum = 0;
+    const size_t window = COMPRESSPOLICY_SAMPLE_SIZE / COMPRESSPOLICY_SAMPLE_WINDOWS;
+
+    if ((data == NULL) || (len < COMPRESSPOLICY_SAMPLE_SIZE)) {
+        return 0;
+    }
+
+    // the windows are spread over the block, so a header at its
+    // start does not decide for all of it
+    memset(counts, 0, sizeof(counts));
+    for (size_t w=0; w<COMPRESSPOLICY_SAMPLE_WINDOWS; w++) {
+        const uint8_t * p = data + (w * (len - window)) / (COMPRESSPOLICY_SAMPLE_WINDOWS - 1);
+        for (size_t i=0; i<window; i++) {
+            counts[p[i]]++;
+        }
+    }
+
+    // H = log2(n) - sum(c * log2(c)) / n
+    for (int i=0; i<256; i++) {
+        if (counts[i] > 1) {
+            sum += (uint64_t)counts[i] * CompressPolicy_log2(counts[i]);
+        }
+    }
+    return CompressPolicy_log2(COMPRESSPOLICY_SAMPLE_SIZE) -
+            (uint32_t)(sum / COMPRESSPOLICY_SAMPLE_SIZE);
+}
+
+
+static inline bool
+CompressPolicy_codec_equal(const Codec * a, const Codec * b)
+{
+    return (a->type == b->type) && (a->level == b->level);
+}
+
+
+static inline void
+CompressPolicy_average(uint64_t * average, uint64_t value, uint64_t n_samples)
+{
+    *average = (n_samples == 0) ? value : ((*average * 7) + value) / 8;
+}
+
+
+/**
+ * remember that a block of "file" did not get smaller. the following
+ * blocks are skipped, twice as many after every failure
+ *
+ * the mutex has to be held
+ */
+static void
+CompressPolicy_failed(CompressPolicy * policy, uint64_t file)
+{
+    CompressPolicyFile * slot = &(policy->files[file & (COMPRESSPOLICY_N_FILES - 1)]);
+
+    if (slot->file != file) {
+        slot->file = file;
+        slot->n_failed = 0;
+    }
+    if ((1U << slot->n_failed) < COMPRESSPOLICY_MAX_SKIP) {
+        slot->n_failed++;
+    }
+    slot->n_skip = (uint16_t)(1U << slot->n_failed);
+}
+
+
+/**
+ * choose between no compression and the codecs weighed by the time
+ * they take to transfer "len" bytes
+ *
+ * the mutex has to be held. returns the index of the codec or -1
+ */
+static int
+CompressPolicy_weigh(CompressPolicy * policy, size_t len)
+{
+    int n_codecs = CompressPolicy_codec_equal(&(policy->codecs[0]), &(policy->codecs[1])) ? 1 : 2;
+    int best = n_codecs - 1;
+
+    if (policy->throughput == 0) {
+        // nothing known about the link yet
+        return best;
+    }
+
+    uint64_t transfer_ns = ((uint64_t)len * 1000000000ULL) / policy->throughput;
+    uint64_t best_ns = transfer_ns;
+    best = -1;
+
+    for (int i=n_codecs-1; i>=0; i--) {
+        const CompressPolicyCost * cost = &(policy->costs[i]);
+        if (cost->n_samples == 0) {
+            // try it to learn its costs
+            return i;
+        }
+        uint64_t ns = (((uint64_t)len * cost->ns_per_kb) / 1024) +
+                ((transfer_ns * cost->ratio) / 1024);
+        if (ns < best_ns) {
+            best_ns = ns;
+            best = i;
+        }
+    }
+
+    // try the codecs not chosen now and then, as their costs change
+    // with the data
+    if ((policy->n_blocks % COMPRESSPOLICY_PROBE_INTERVAL) == 0) {
+        if (best == -1) {
+            best = (int)((policy->n_blocks / COMPRESSPOLICY_PROBE_INTERVAL) % (uint64_t)n_codecs);
+        }
+        else if (n_codecs == 2) {
+            best = 1 - best;
+        }
+    }
+    return best;
+}
+
+
+void
+CompressPolicy_choose(CompressPolicy * policy, uint64_t file, const uint8_t * data,
+        size_t len, Codec * codec)
+{
+    CompressPolicyFile * slot = &(policy->files[file & (COMPRESSPOLICY_N_FILES - 1)]);
+    bool skip = false;
+
+    if ((codec->type == RHIZOFS__COMPRESSION_TYPE__COMPR_NONE) || (len <= CODEC_MIN_SIZE)) {
+        return;
+    }
+
+    pthread_mutex_lock(&(policy->mutex));
+    policy->n_blocks++;
+    if ((slot->file == file) && (slot->n_skip > 0)) {
+        slot->n_skip--;
+        skip = true;
+    }
+    pthread_mutex_unlock(&(policy->mutex));
+
+    if (skip) {
+        __atomic_add_fetch(&(policy->n_skipped_file), 1, __ATOMIC_RELAXED);
+        codec->type = RHIZOFS__COMPRESSION_TYPE__COMPR_NONE;
+        codec->level = 0;
+        return;
+    }
+
+    if (CompressPolicy_entropy(data, len) > COMPRESSPOLICY_MAX_ENTROPY) {
+        pthread_mutex_lock(&(policy->mutex));
+        CompressPolicy_failed(policy, file);
+        pthread_mutex_unlock(&(policy->mutex));
+
+        __atomic_add_fetch(&(policy->n_skipped_entropy), 1, __ATOMIC_RELAXED);
+        codec->type = RHIZOFS__COMPRESSION_TYPE__COMPR_NONE;
+        codec->level = 0;
+        return;
+    }
+
+    if (!policy->weigh_costs) {
+        return;
+    }
+
+    pthread_mutex_lock(&(policy->mutex));
+    if (!CompressPolicy_codec_equal(&(policy->codecs[1]), codec)) {
+        policy->codecs[1] = *codec;
+        memset(&(policy->costs[1]), 0, sizeof(CompressPolicyCost));
+    }
+    int chosen = CompressPolicy_weigh(policy, len);
+    if (chosen >= 0) {
+        codec->type = policy->codecs[chosen].type;
+        codec->level = policy->codecs[chosen].level;
+    }
+    bool fast = CompressPolicy_codec_equal(codec, &compresspolicy_fast);
+    pthread_mutex_unlock(&(policy->mutex));
+
+    if (chosen == -1) {
+        __atomic_add_fetch(&(policy->n_skipped_cost), 1, __ATOMIC_RELAXED);
+        codec->type = RHIZOFS__COMPRESSION_TYPE__COMPR_NONE;
+        codec->level = 0;
+    }
+    else if (fast) {
+        __atomic_add_fetch(&(policy->n_fast), 1, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_add_fetch(&(policy->n_strong), 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+void
+CompressPolicy_record(CompressPolicy * policy, uint64_t file, const Codec * codec,
+        const Rhizofs__DataBlock * dblk, uint64_t cpu_ns)
+{
+    if ((codec->type == RHIZOFS__COMPRESSION_TYPE__COMPR_NONE) || (dblk == NULL) ||
+            (dblk->size <= CODEC_MIN_SIZE)) {
+        return;
+    }
+
+    bool compressed = (dblk->compression != RHIZOFS__COMPRESSION_TYPE__COMPR_NONE);
+    uint64_t size = (uint64_t)dblk->size;
+    uint64_t ratio = compressed ? (((uint64_t)dblk->data.len * 1024) / size) : 1024;
+
+    pthread_mutex_lock(&(policy->mutex));
+    CompressPolicyFile * slot = &(policy->files[file & (COMPRESSPOLICY_N_FILES - 1)]);
+    if (ratio > COMPRESSPOLICY_MAX_RATIO) {
+        CompressPolicy_failed(policy, file);
+    }
+    else if (slot->file == file) {
+        slot->n_failed = 0;
+        slot->n_skip = 0;
+    }
+
+    // only compressed blocks tell about the codec, the others about
+    // the data
+    if (policy->weigh_costs && compressed) {
+        for (int i=0; i<2; i++) {
+            if (CompressPolicy_codec_equal(&(policy->codecs[i]), codec)) {
+                CompressPolicyCost * cost = &(policy->costs[i]);
+                CompressPolicy_average(&(cost->ratio), ratio, cost->n_samples);
+                if (cpu_ns > 0) {
+                    CompressPolicy_average(&(cost->ns_per_kb), (cpu_ns * 1024) / size,
+                            (cost->ns_per_kb == 0) ? 0 : cost->n_samples);
+                }
+                cost->n_samples++;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&(policy->mutex));
+
+    if (ratio > COMPRESSPOLICY_MAX_RATIO) {
+        __atomic_add_fetch(&(policy->n_incompressible), 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+void
+CompressPolicy_record_transfer(CompressPolicy * policy, size_t bytes, uint64_t ns)
+{
+    if ((bytes < COMPRESSPOLICY_MIN_TRANSFER) || (ns == 0)) {
+        return;
+    }
+    uint64_t throughput = ((uint64_t)bytes * 1000000000ULL) / ns;
+
+    pthread_mutex_lock(&(policy->mutex));
+    CompressPolicy_average(&(policy->throughput), throughput, (policy->throughput == 0) ? 0 : 1);
+    pthread_mutex_unlock(&(policy->mutex));
+}
+
+
+void
+CompressPolicy_get_stats(CompressPolicy * policy, CompressPolicyStats * stats)
+{
+    stats->n_skipped_entropy = __atomic_load_n(&(policy->n_skipped_entropy), __ATOMIC_RELAXED);
+    stats->n_skipped_file = __atomic_load_n(&(policy->n_skipped_file), __ATOMIC_RELAXED);
+    stats->n_skipped_cost = __atomic_load_n(&(policy->n_skipped_cost), __ATOMIC_RELAXED);
+    stats->n_fast = __atomic_load_n(&(policy->n_fast), __ATOMIC_RELAXED);
+    stats->n_strong = __atomic_load_n(&(policy->n_strong), __ATOMIC_RELAXED);
+    stats->n_incompressible = __atomic_load_n(&(policy->n_incompressible), __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&(policy->mutex));
+    stats->n_blocks = policy->n_blocks;
+    stats->throughput = policy->throughput;
+    pthread_mutex_unlock(&(policy->mutex));
+}
@@ -0,0 +1,159 @@
+#ifndef __compresspolicy_h__
+#define __compresspolicy_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "codec.h"
+#include "proto/rhizofs.pb-c.h"
+
+/* number of files whose compressibility is remembered. a power of 2 */
+#define COMPRESSPOLICY_N_FILES 1024
+
+/* bytes sampled to estimate the entropy of a block. smaller blocks are
+ * not sampled as the estimate of a few bytes is too low */
+#define COMPRESSPOLICY_SAMPLE_SIZE 4096
+
+/* blocks whose bytes have a higher entropy (in 1/65536 bits per byte)
+ * are not compressed. 7.6 bits */
+#define COMPRESSPOLICY_MAX_ENTROPY 498074
+
+/* blocks of a file skipped at most after its blocks did not compress.
+ * the next block is compressed to check if this is still the case */
+#define COMPRESSPOLICY_MAX_SKIP 64
+
+/* a codec not chosen is tried on every n-th block to keep the
+ * measurements of its costs current */
+#define COMPRESSPOLICY_PROBE_INTERVAL 32
+
+/* transfers smaller than this are dominated by the latency and do not
+ * tell about the throughput of the link */
+#define COMPRESSPOLICY_MIN_TRANSFER (64 * 1024)
+
+
+/**
+ * what is known about a file. "file" is the key of the file, "n_skip"
+ * the number of its blocks which will not be compressed
+ */
+typedef struct CompressPolicyFile {
+    uint64_t file;
+    uint16_t n_failed;
+    uint16_t n_skip;
+} CompressPolicyFile;
+
+
+/**
+ * averages of the cost and the gain of a codec
+ */
+typedef struct CompressPolicyCost {
+    // cpu time per 1024 bytes of input. 0 if not measured yet
+    uint64_t ns_per_kb;
+
+    // size of the compressed data per 1024 bytes of input
+    uint64_t ratio;
+    uint64_t n_samples;
+} CompressPolicyCost;
+
+
+typedef struct CompressPolicyStats {
+    uint64_t n_blocks;
+    uint64_t n_skipped_entropy;
+    uint64_t n_skipped_file;
+    uint64_t n_skipped_cost;
+    uint64_t n_fast;
+    uint64_t n_strong;
+    uint64_t n_incompressible;
+
+    // bytes per second. 0 if not measured yet
+    uint64_t throughput;
+} CompressPolicyStats;
+
+
+/**
+ * decides how each block of data is compressed
+ *
+ * blocks which look random are not compressed, nor are the following
+ * blocks of a file whose blocks did not get smaller. if the policy
+ * weighs costs it measures the time compressing takes and the
+ * throughput of the link and chooses between no compression, the fast
+ * codec and the one asked for, whatever transfers a block soonest.
+ * used by all threads
+ */
+typedef struct CompressPolicy {
+    bool weigh_costs;
+
+    // the first of the codecs being weighed is the fast one
+    Codec codecs[2];
+    CompressPolicyCost costs[2];
+    uint64_t throughput;
+
+    CompressPolicyFile files[COMPRESSPOLICY_N_FILES];
+    pthread_mutex_t mutex;
+    bool initialized;
+
+    uint64_t n_blocks;
+    uint64_t n_skipped_entropy;
+    uint64_t n_skipped_file;
+    uint64_t n_skipped_cost;
+    uint64_t n_fast;
+    uint64_t n_strong;
+    uint64_t n_incompressible;
+} CompressPolicy;
+
+
+/**
+ * set up a policy
+ *
+ * "weigh_costs" lets the policy replace the codec asked for by the fast
+ * one or none. otherwise it only skips data which will not compress
+ *
+ * returns false on error
+ */
+bool CompressPolicy_init(CompressPolicy * policy, bool weigh_costs);
+
+/**
+ * free the resources of a policy. may be called for a policy which
+ * has not been set up
+ */
+void CompressPolicy_deinit(CompressPolicy * policy);
+
+/**
+ * the key a file is remembered by. "handle" is used if it is not 0
+ */
+uint64_t CompressPolicy_file(const char * path, uint64_t handle);
+
+/**
+ * choose the codec of a block of "len" bytes of "file"
+ *
+ * "codec" holds the codec asked for and is set to the one to use.
+ * "data" is sampled if given. it is NULL if the data is compressed by
+ * the other side, as for the replies to reads
+ */
+void CompressPolicy_choose(CompressPolicy * policy, uint64_t file, const uint8_t * data,
+        size_t len, Codec * codec);
+
+/**
+ * learn from a block of "file" compressed with "codec" into "dblk"
+ *
+ * "cpu_ns" is the time compressing took or 0 if it is unknown
+ */
+void CompressPolicy_record(CompressPolicy * policy, uint64_t file, const Codec * codec,
+        const Rhizofs__DataBlock * dblk, uint64_t cpu_ns);
+
+/**
+ * learn the throughput of the link from "bytes" transferred in "ns"
+ */
+void CompressPolicy_record_transfer(CompressPolicy * policy, size_t bytes, uint64_t ns);
+
+/**
+ * estimate the entropy of the bytes of a block from a sample
+ *
+ * returns bits per byte in 1/65536
+ */
+uint32_t CompressPolicy_entropy(const uint8_t * data, size_t len);
+
+void CompressPolicy_get_stats(CompressPolicy * policy, CompressPolicyStats * stats);
+
+#endif /* __compresspolicy_h__ */
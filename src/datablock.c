@@ -1,12 +1,45 @@
 #include "datablock.h"
 
+#include <limits.h>
+#include <string.h>
+
+#include "codecpool.h"
 #include "dbg.h"
-#include "lz4.h"
+
+
+/**
+ * the chunks of a datablock being compressed or decompressed in
+ * parallel
+ */
+typedef struct DataBlockChunks {
+    const Codec * codec;
+    Rhizofs__CompressionType compression;
+    size_t chunk_size;
+
+    // the data read and the data written, and the size of the
+    // uncompressed data
+    const uint8_t * src;
+    uint8_t * dst;
+    size_t len;
+
+    // the size of every chunk as stored and, when decompressing,
+    // its offset in the stored data
+    uint32_t * lengths;
+    size_t * offsets;
+
+    // set by any chunk failing to decompress
+    bool failed;
+} DataBlockChunks;
+
 
 // prototypes
 static int get_uncompressed_data(Rhizofs__DataBlock * dblk, uint8_t ** data, int do_alloc);
-static int get_lz4_compressed_data(Rhizofs__DataBlock * dblk, uint8_t ** data, int do_alloc);
-static int set_lz4_compressed_data(Rhizofs__DataBlock * dblk, const uint8_t * data, const size_t len);
+static int get_compressed_data(Rhizofs__DataBlock * dblk, uint8_t ** data, int do_alloc);
+static int set_compressed_data(Rhizofs__DataBlock * dblk, const uint8_t * data, const size_t len,
+        const Codec * codec);
+static int set_chunked_data(Rhizofs__DataBlock * dblk, const uint8_t * data, const size_t len,
+        const Codec * codec);
+static bool get_chunked_data(Rhizofs__DataBlock * dblk, uint8_t * data, size_t len);
 
 
 
@@ -37,6 +70,7 @@ DataBlock_destroy(Rhizofs__DataBlock * dblk)
             free(dblk->data.data);
             dblk->data.data = NULL;
         }
+        free(dblk->chunk_lengths);
         free(dblk);
     }
     dblk = NULL;
@@ -45,7 +79,7 @@ DataBlock_destroy(Rhizofs__DataBlock * dblk)
 
 bool
 DataBlock_set_data(Rhizofs__DataBlock * dblk, const uint8_t * data,
-        size_t len, Rhizofs__CompressionType compression)
+        size_t len, const Codec * codec)
 {
     check((dblk != NULL), "passed datablock is null");
 
@@ -60,35 +94,19 @@ DataBlock_set_data(Rhizofs__DataBlock * dblk, const uint8_t * data,
     // only use compression if the length of the data exceeds
     // a threshold as tiny chunks of data are not very compression-worth
     // anyways
-    Rhizofs__CompressionType compression_method = 
-            len > 100 ? compression : RHIZOFS__COMPRESSION_TYPE__COMPR_NONE;
-
-    bool compression_failed = false;
-    switch (compression_method) {
-        case RHIZOFS__COMPRESSION_TYPE__COMPR_NONE:
-            // skip. data will be added in fallback
-            break;
-
-        case RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4:
-            {
-                if (set_lz4_compressed_data(dblk, data, len) != -1) {
-                    dblk->compression = compression_method;
-                }
-                else {
-                    compression_failed = true;
-                    debug("could not lz4 compress");
-                }
-            }
-            break;
-
-        default:
-            log_and_error("Unsupported compression type %d", compression_method);
+    if ((codec != NULL) && (codec->type != RHIZOFS__COMPRESSION_TYPE__COMPR_NONE) &&
+            (len > CODEC_MIN_SIZE)) {
+        // large data is split into chunks compressed in parallel
+        int rc = ((codec->chunk_size > 0) && (len > codec->chunk_size)) ?
+                set_chunked_data(dblk, data, len, codec) :
+                set_compressed_data(dblk, data, len, codec);
+        if (rc == -1) {
+            debug("could not compress, sending the data uncompressed");
+        }
     }
 
     // fallback to no compression
-    if ((compression_method == RHIZOFS__COMPRESSION_TYPE__COMPR_NONE) || 
-                (compression_failed == true )) {
-        dblk->data.data = NULL;
+    if (dblk->data.data == NULL) {
         dblk->data.data = malloc((size_t)(len * sizeof(uint8_t)));
         check_mem(dblk->data.data);
         memcpy(dblk->data.data, data, (size_t)(len * sizeof(uint8_t)));
@@ -134,14 +152,11 @@ DataBlock_get_data(Rhizofs__DataBlock * dblk, uint8_t ** data)
             }
             break;
 
-        case RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4:
+        default:
             {
-                len = get_lz4_compressed_data(dblk, data, 1);
+                len = get_compressed_data(dblk, data, 1);
             }
             break;
-
-        default:
-            log_and_error("Unsupported compression type %d", dblk->compression);
     }
 
     debug("Getting data from datablock containing %d bytes "
@@ -178,14 +193,11 @@ DataBlock_get_data_noalloc(Rhizofs__DataBlock * dblk, uint8_t * data, size_t dat
             }
             break;
 
-        case RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4:
+        default:
             {
-                len = get_lz4_compressed_data(dblk, &data, 0);
+                len = get_compressed_data(dblk, &data, 0);
             }
             break;
-
-        default:
-            log_and_error("Unsupported compression type %d", dblk->compression);
     }
 
     debug("Getting data from datablock containing %d bytes of UNcompressed data", (int)len);
@@ -198,6 +210,92 @@ error:
 }
 
 
+int
+DataBlock_peek_data(Rhizofs__DataBlock * dblk, const uint8_t ** data)
+{
+    check((dblk != NULL), "passed datablock is null");
+    check_debug((dblk->compression == RHIZOFS__COMPRESSION_TYPE__COMPR_NONE),
+            "the data of the datablock is compressed");
+    check((dblk->data.len <= INT_MAX), "invalid size of datablock");
+
+    (*data) = dblk->data.data;
+    return (int)dblk->data.len;
+
+error:
+    return -1;
+}
+
+
+/*** frames  *************************************/
+
+/**
+ * free callback of the frames built from the data of datablocks
+ */
+static void
+free_frame_data(void * data, void * UNUSED_PARAMETER(hint))
+{
+    free(data);
+}
+
+
+bool
+DataBlock_move_to_frame(Rhizofs__DataBlock * dblk, zmq_msg_t * frame)
+{
+    if ((dblk == NULL) || (dblk->data.len == 0)) {
+        return (zmq_msg_init(frame) == 0);
+    }
+
+    // the frame frees the data once it has been sent
+    if (zmq_msg_init_data(frame, dblk->data.data, dblk->data.len, free_frame_data, NULL) != 0) {
+        log_err("Could not initialize the data frame");
+        zmq_msg_init(frame);
+        return false;
+    }
+    dblk->data.data = NULL;
+    dblk->data.len = 0;
+    dblk->has_data_frame = 1;
+    dblk->data_frame = true;
+    return true;
+}
+
+
+bool
+DataBlock_attach_frame(Rhizofs__DataBlock * dblk, zmq_msg_t * frame)
+{
+    size_t frame_len = (frame != NULL) ? zmq_msg_size(frame) : 0;
+
+    if (!dblk->data_frame) {
+        check((frame_len == 0), "received a data frame the datablock does not refer to");
+        return true;
+    }
+
+    check((dblk->data.len == 0), "datablock has data in its message and a data frame");
+    check((frame_len > 0), "the data frame of the datablock is missing");
+    check((dblk->compression != RHIZOFS__COMPRESSION_TYPE__COMPR_NONE) ||
+            (frame_len == (size_t)dblk->size),
+            "the data frame does not match the size of the datablock");
+
+    dblk->data.data = zmq_msg_data(frame);
+    dblk->data.len = frame_len;
+    return true;
+
+error:
+    // the data of the message is freed with it
+    dblk->data_frame = false;
+    return false;
+}
+
+
+void
+DataBlock_release_frame(Rhizofs__DataBlock * dblk)
+{
+    if ((dblk != NULL) && dblk->data_frame) {
+        dblk->data.data = NULL;
+        dblk->data.len = 0;
+    }
+}
+
+
 /*** uncompressed  *************************************/
 
 /**
@@ -238,42 +336,33 @@ error:
 
 
 
-/*** LZ4 Compression *************************************/
+/*** Compression *************************************/
 
 /**
  * compress the given data into the datablock
  *
- * returns the number of compressed bytes on success
- * and -1 on failure
+ * returns the number of compressed bytes on success and -1 on
+ * failure or if the data did not get smaller
  **/
 static int
-set_lz4_compressed_data(Rhizofs__DataBlock * dblk, const uint8_t * data, const size_t len)
+set_compressed_data(Rhizofs__DataBlock * dblk, const uint8_t * data, const size_t len,
+        const Codec * codec)
 {
     size_t bytes_compressed = 0;
 
     check((dblk != NULL), "passed datablock is null");
     check((data != NULL), "passed data is null");
 
-    /*
-     * from http://fastcompression.blogspot.de/2011/05/lz4-explained.html :
-     *      There can be any number of bytes following the token.
-     *      There is no "size limit". As a sidenote, here is the reason why a
-     *      not-compressible input stream can be expanded by up to 0.4%.
-     *
-     *  so we will size the outputbuffer accordingly to prevent writes
-     *  outside the allocated memory area
-     **/
-    int extra_mem_size = 0;
-    if (len > 0) {
-        extra_mem_size = len / 250;
-    }
-    dblk->data.data = malloc(sizeof(uint8_t) * (len + extra_mem_size));
+    // the compressors stop when the output would not fit, so data which
+    // does not get smaller needs no room beyond its own size
+    dblk->data.data = malloc(sizeof(uint8_t) * len);
     check_mem(dblk->data.data);
 
-    bytes_compressed = LZ4_compress((const char*)data, (char*)dblk->data.data, len);
-    check_debug((bytes_compressed != 0), "LZ4_compress failed");
+    bytes_compressed = Codec_compress(codec, data, len, dblk->data.data, len);
+    check_debug((bytes_compressed != 0), "compression did not reduce the size");
 
     dblk->data.len = bytes_compressed;
+    dblk->compression = codec->type;
 
     return bytes_compressed;
 
@@ -289,19 +378,19 @@ error:
 }
 
 /**
- * get the uncompressed data from a lz4 compressed datablock
+ * get the uncompressed data from a compressed datablock
  *
  * see  get_uncompressed_data(Rhizofs__DataBlock * dblk, uint8_t * data, int do_alloc)
  */
 static int
-get_lz4_compressed_data(Rhizofs__DataBlock * dblk, uint8_t ** data, int do_alloc)
+get_compressed_data(Rhizofs__DataBlock * dblk, uint8_t ** data, int do_alloc)
 {
     size_t len = dblk->size;
-    int bytes_uncompressed = 0;
     bool free_data = false;
 
     check((dblk != NULL), "passed datablock is null");
     check((data != NULL), "passed data pointer is null");
+    check((dblk->size >= 0) && (dblk->size <= INT_MAX), "invalid size of datablock");
 
     if (do_alloc) {
         (*data) = calloc(sizeof(uint8_t), len);
@@ -309,12 +398,13 @@ get_lz4_compressed_data(Rhizofs__DataBlock * dblk, uint8_t ** data, int do_alloc
     }
     check(((*data) != NULL), "data buffer is null");
 
-    bytes_uncompressed = LZ4_uncompress((const char*)dblk->data.data,
-                (char*)(*data), len);
-    check((bytes_uncompressed >= 0), "LZ4_uncompress failed");
-    check((dblk->data.len == (size_t)bytes_uncompressed), "could not decompress "
-                "the whole block (only %d bytes of %d bytes)", 
-                bytes_uncompressed, (int)dblk->data.len);
+    if (dblk->n_chunk_lengths > 0) {
+        check(get_chunked_data(dblk, *data, len), "could not decompress the chunks of datablock");
+    }
+    else {
+        check(Codec_decompress(dblk->compression, dblk->data.data, dblk->data.len, *data, len),
+                "could not decompress datablock");
+    }
 
     return len;
 
@@ -325,3 +415,181 @@ error:
     }
     return -1;
 }
+
+
+/*** Chunks ******************************************/
+
+static inline size_t
+chunk_len(const DataBlockChunks * chunks, size_t i)
+{
+    size_t offset = i * chunks->chunk_size;
+    return ((chunks->len - offset) < chunks->chunk_size) ?
+            (chunks->len - offset) : chunks->chunk_size;
+}
+
+
+/**
+ * compress a chunk. called by the threads of the codec pool
+ */
+static void
+compress_chunk(void * ctx, size_t i)
+{
+    DataBlockChunks * chunks = (DataBlockChunks *)ctx;
+    size_t offset = i * chunks->chunk_size;
+    size_t len = chunk_len(chunks, i);
+
+    // every chunk is compressed to the place of its uncompressed data,
+    // as it is stored uncompressed if it does not get smaller
+    size_t compressed = Codec_compress(chunks->codec, chunks->src + offset, len,
+            chunks->dst + offset, len);
+    if (compressed == 0) {
+        memcpy(chunks->dst + offset, chunks->src + offset, len);
+        compressed = len;
+    }
+    chunks->lengths[i] = (uint32_t)compressed;
+}
+
+
+/**
+ * decompress a chunk. called by the threads of the codec pool
+ */
+static void
+decompress_chunk(void * ctx, size_t i)
+{
+    DataBlockChunks * chunks = (DataBlockChunks *)ctx;
+    size_t len = chunk_len(chunks, i);
+    uint8_t * dst = chunks->dst + (i * chunks->chunk_size);
+
+    if (chunks->lengths[i] == len) {
+        memcpy(dst, chunks->src + chunks->offsets[i], len);
+    }
+    else if (!Codec_decompress(chunks->compression, chunks->src + chunks->offsets[i],
+                chunks->lengths[i], dst, len)) {
+        __atomic_store_n(&(chunks->failed), true, __ATOMIC_RELAXED);
+    }
+}
+
+
+/**
+ * split the data into chunks of codec->chunk_size and compress them
+ * in parallel into the datablock
+ *
+ * returns the number of bytes stored on success and -1 on failure. if
+ * no chunk got smaller the data is stored uncompressed
+ */
+static int
+set_chunked_data(Rhizofs__DataBlock * dblk, const uint8_t * data, const size_t len,
+        const Codec * codec)
+{
+    DataBlockChunks chunks;
+    size_t n_chunks = (len + codec->chunk_size - 1) / codec->chunk_size;
+    size_t stored = 0;
+    bool compressed = false;
+
+    check((len <= INT_MAX), "data too large for a datablock");
+
+    memset(&chunks, 0, sizeof(chunks));
+    chunks.codec = codec;
+    chunks.chunk_size = codec->chunk_size;
+    chunks.src = data;
+    chunks.len = len;
+
+    dblk->data.data = malloc(sizeof(uint8_t) * len);
+    check_mem(dblk->data.data);
+    dblk->chunk_lengths = calloc(n_chunks, sizeof(uint32_t));
+    check_mem(dblk->chunk_lengths);
+    dblk->n_chunk_lengths = n_chunks;
+
+    chunks.dst = dblk->data.data;
+    chunks.lengths = dblk->chunk_lengths;
+    CodecPool_run(n_chunks, compress_chunk, &chunks);
+
+    // move the chunks together
+    for (size_t i=0; i<n_chunks; i++) {
+        size_t offset = i * chunks.chunk_size;
+        if (chunks.lengths[i] < chunk_len(&chunks, i)) {
+            compressed = true;
+        }
+        if (stored != offset) {
+            memmove(dblk->data.data + stored, dblk->data.data + offset, chunks.lengths[i]);
+        }
+        stored += chunks.lengths[i];
+    }
+
+    if (compressed) {
+        dblk->data.len = stored;
+        dblk->compression = codec->type;
+        dblk->has_chunk_size = 1;
+        dblk->chunk_size = (uint32_t)chunks.chunk_size;
+    }
+    else {
+        // all chunks have been copied as they are
+        free(dblk->chunk_lengths);
+        dblk->chunk_lengths = NULL;
+        dblk->n_chunk_lengths = 0;
+        dblk->data.len = len;
+        dblk->compression = RHIZOFS__COMPRESSION_TYPE__COMPR_NONE;
+    }
+    return (int)stored;
+
+error:
+    if (dblk != NULL) {
+        free(dblk->data.data);
+        dblk->data.data = NULL;
+        dblk->data.len = 0;
+        free(dblk->chunk_lengths);
+        dblk->chunk_lengths = NULL;
+        dblk->n_chunk_lengths = 0;
+    }
+    return -1;
+}
+
+
+/**
+ * decompress the chunks of a datablock in parallel to "data", which
+ * has room for "len" bytes, the uncompressed size of the datablock
+ *
+ * returns false on failure, including chunks which do not match the
+ * size of the datablock
+ */
+static bool
+get_chunked_data(Rhizofs__DataBlock * dblk, uint8_t * data, size_t len)
+{
+    DataBlockChunks chunks;
+    size_t n_chunks = 0;
+    size_t stored = 0;
+
+    memset(&chunks, 0, sizeof(chunks));
+
+    check((dblk->has_chunk_size && (dblk->chunk_size > 0)), "chunks without a chunk size");
+    chunks.compression = dblk->compression;
+    chunks.chunk_size = dblk->chunk_size;
+    chunks.src = dblk->data.data;
+    chunks.dst = data;
+    chunks.len = len;
+    chunks.lengths = dblk->chunk_lengths;
+
+    n_chunks = (len + chunks.chunk_size - 1) / chunks.chunk_size;
+    check((n_chunks == dblk->n_chunk_lengths), "expected %d chunks, got %d",
+            (int)n_chunks, (int)dblk->n_chunk_lengths);
+
+    chunks.offsets = malloc(sizeof(size_t) * n_chunks);
+    check_mem(chunks.offsets);
+    for (size_t i=0; i<n_chunks; i++) {
+        check((chunks.lengths[i] <= chunk_len(&chunks, i)), "chunk %d is too large", (int)i);
+        chunks.offsets[i] = stored;
+        stored += chunks.lengths[i];
+    }
+    check((stored == dblk->data.len), "the chunks do not match the size of the data "
+            "(%d bytes of %d bytes)", (int)stored, (int)dblk->data.len);
+
+    CodecPool_run(n_chunks, decompress_chunk, &chunks);
+    check(!chunks.failed, "could not decompress the chunks");
+
+    free(chunks.offsets);
+    return true;
+
+error:
+    free(chunks.offsets);
+    return false;
+}
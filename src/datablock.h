@@ -4,7 +4,11 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+
+#include <zmq.h>
+
 #include "proto/rhizofs.pb-c.h"
+#include "codec.h"
 
 
 /**
@@ -24,12 +28,14 @@ void DataBlock_destroy(Rhizofs__DataBlock * dblk);
 /**
  * set the data of the datablock
  *
- * the data will not be modified or freed
+ * the data will not be modified or freed. it is compressed with "codec"
+ * unless it is small or does not get smaller. "codec" may be NULL to
+ * store the data uncompressed
  *
  * returns true on success and false on failure
  */
-bool DataBlock_set_data(Rhizofs__DataBlock * dblk, const uint8_t * data, 
-        size_t len, Rhizofs__CompressionType compression);
+bool DataBlock_set_data(Rhizofs__DataBlock * dblk, const uint8_t * data,
+        size_t len, const Codec * codec);
 
 
 /**
@@ -54,5 +60,42 @@ int DataBlock_get_data(Rhizofs__DataBlock * dblk, uint8_t ** data);
 int DataBlock_get_data_noalloc(Rhizofs__DataBlock * dblk, uint8_t * data, size_t len_data);
 
 
+/**
+ * get the data of an uncompressed datablock without copying it. the
+ * data belongs to the datablock
+ *
+ * returns the number of bytes of "data" or -1 if the data is compressed
+ */
+int DataBlock_peek_data(Rhizofs__DataBlock * dblk, const uint8_t ** data);
+
+
+/**
+ * move the bytes of the datablock into "frame" without copying them,
+ * to be sent as the frame following the message of the datablock.
+ * "frame" is initialized empty if the datablock has no data and has
+ * to be closed in any case
+ *
+ * returns true on success and false on failure
+ */
+bool DataBlock_move_to_frame(Rhizofs__DataBlock * dblk, zmq_msg_t * frame);
+
+
+/**
+ * let an unpacked datablock refer to the bytes of the frame received
+ * after its message. "frame" may be NULL if there was none and has to
+ * stay open until DataBlock_release_frame has been called
+ *
+ * returns false if the frame does not match the datablock
+ */
+bool DataBlock_attach_frame(Rhizofs__DataBlock * dblk, zmq_msg_t * frame);
+
+
+/**
+ * drop the reference of an unpacked datablock to its frame. has to be
+ * called before the datablock is freed
+ */
+void DataBlock_release_frame(Rhizofs__DataBlock * dblk);
+
+
 
 #endif
@@ -7,11 +7,23 @@
 #include "../dbg.h"
 
 // prototypes
-static hnode_t * CacheEntry_hash_create(void * context);
-static void CacheEntry_hash_destroy(hnode_t * node, void * context);
-bool AttrCache_entry_is_deprecated(const AttrCache * attrcache, const CacheEntry * cache_entry);
-void Attrcache_lock_modify_mutex(AttrCache * attrcache);
-void Attrcache_unlock_modify_mutex(AttrCache * attrcache);
+static AttrCacheShard * AttrCache_shard(AttrCache * attrcache, const char * path);
+static bool AttrCache_entry_is_deprecated(const AttrCache * attrcache,
+        const CacheEntry * cache_entry, time_t current_time);
+static bool AttrCache_listing_is_deprecated(const AttrCache * attrcache,
+        const DirListing * listing, time_t current_time);
+static AttrCacheResult AttrCache_lookup_listing(AttrCache * attrcache, const char * path,
+        time_t current_time);
+static char * AttrCache_split_path(const char * path, const char ** name);
+static void AttrCache_count(uint64_t * counter);
+static CacheEntry * AttrCacheShard_get(AttrCacheShard * shard, const char * path);
+static void AttrCacheShard_delete(AttrCacheShard * shard, CacheEntry * cache_entry);
+static void AttrCacheShard_lru_unlink(AttrCacheShard * shard, CacheEntry * cache_entry);
+static void AttrCacheShard_lru_push(AttrCacheShard * shard, CacheEntry * cache_entry);
+static CachedListing * AttrCacheShard_get_listing(AttrCacheShard * shard, const char * path);
+static void AttrCacheShard_delete_listing(AttrCacheShard * shard, CachedListing * cached);
+static void AttrCacheShard_listing_lru_unlink(AttrCacheShard * shard, CachedListing * cached);
+static void AttrCacheShard_listing_lru_push(AttrCacheShard * shard, CachedListing * cached);
 
 // #### CacheEntry ############################################
 
@@ -33,50 +45,57 @@ error:
 inline void
 CacheEntry_destroy(CacheEntry * cache_entry)
 {
-    free(cache_entry);
+    if (cache_entry) {
+        free(cache_entry->path);
+        free(cache_entry);
+    }
 }
 
-static hnode_t *
-CacheEntry_hash_create(void * context)
-{
-    (void) context;
-    return (hnode_t *)calloc(sizeof(hnode_t), 1);
-}
 
+// #### AttrCache ###########################################
 
-static void
-CacheEntry_hash_destroy(hnode_t * node, void * context)
+bool
+AttrCache_init(AttrCache * attrcache, size_t max_size, unsigned int max_age_sec,
+        unsigned int negative_max_age_sec)
 {
-    (void) context;
+    check((attrcache != NULL), "the attrcache parameter is NULL");
 
-    CacheEntry_destroy(hnode_get(node));
-    free((char *)hnode_getkey(node));
-    free(node);
-}
+    memset(attrcache, 0, sizeof(AttrCache));
+    attrcache->max_age_sec = max_age_sec;
+    attrcache->negative_max_age_sec = negative_max_age_sec;
 
+    if (max_size == 0) {
+        debug("Attrcache allows 0 entries - nothing will be added");
+        return true;
+    }
 
-// #### AttrCache ###########################################
+    // small caches would hardly use most of the shards
+    attrcache->n_shards = (max_size < ATTRCACHE_SHARDS) ? 1 : ATTRCACHE_SHARDS;
+    attrcache->max_entries_per_shard = (max_size + attrcache->n_shards - 1) / attrcache->n_shards;
+    attrcache->max_listing_names_per_shard = attrcache->max_entries_per_shard;
 
-bool
-AttrCache_init(AttrCache * attrcache, size_t max_size, unsigned int max_age_sec)
-{
-    check((attrcache != NULL), "the attrcache parameter is NULL");
+    attrcache->shards = calloc(sizeof(AttrCacheShard), attrcache->n_shards);
+    check_mem(attrcache->shards);
 
-    attrcache->hashtable = hash_create(max_size,
-            (hash_comp_t)strcmp,
-            (hash_fun_t)Hashfunc_djb2);
-    check_mem(attrcache->hashtable);
+    for (size_t i=0; i<attrcache->n_shards; i++) {
+        AttrCacheShard * shard = &(attrcache->shards[i]);
 
-    hash_set_allocator(attrcache->hashtable,
-            CacheEntry_hash_create,
-            CacheEntry_hash_destroy,
-            NULL);
+        // the entries know their paths and get freed by the cache itself,
+        // so the default allocator of the hash is used
+        shard->entries = hash_create(HASHCOUNT_T_MAX,
+                (hash_comp_t)strcmp,
+                (hash_fun_t)Hashfunc_djb2);
+        check_mem(shard->entries);
 
-    attrcache->max_age_sec = max_age_sec;
-    attrcache->batch_size = ATTRCACHE_DEFAULT_BATCH_SIZE;
+        shard->listings = hash_create(HASHCOUNT_T_MAX,
+                (hash_comp_t)strcmp,
+                (hash_fun_t)Hashfunc_djb2);
+        check_mem(shard->listings);
 
-    check(pthread_mutex_init(&(attrcache->mutex_modify), NULL) == 0,
-            "Could not initialize modify mutex")
+        check(pthread_mutex_init(&(shard->mutex), NULL) == 0,
+                "Could not initialize shard mutex");
+        shard->initialized = true;
+    }
 
     return true;
 
@@ -89,186 +108,524 @@ error:
 void
 AttrCache_deinit(AttrCache * attrcache)
 {
-    if (attrcache) {
-        if (attrcache->hashtable) {
-            hash_free_nodes(attrcache->hashtable);
-            hash_destroy(attrcache->hashtable);
+    if (attrcache == NULL || attrcache->shards == NULL) {
+        return;
+    }
+
+    for (size_t i=0; i<attrcache->n_shards; i++) {
+        AttrCacheShard * shard = &(attrcache->shards[i]);
+
+        if (shard->entries) {
+            while (shard->lru_head) {
+                AttrCacheShard_delete(shard, shard->lru_head);
+            }
+            hash_destroy(shard->entries);
         }
-        if (pthread_mutex_destroy(&(attrcache->mutex_modify)) != 0) {
-            log_err("Could not destroy modify mutex");
+        if (shard->listings) {
+            while (shard->listings_lru_head) {
+                AttrCacheShard_delete_listing(shard, shard->listings_lru_head);
+            }
+            hash_destroy(shard->listings);
+        }
+        if (shard->initialized && (pthread_mutex_destroy(&(shard->mutex)) != 0)) {
+            log_err("Could not destroy shard mutex");
         }
     }
-    attrcache = NULL;
+    free(attrcache->shards);
+    attrcache->shards = NULL;
+    attrcache->n_shards = 0;
 }
 
 
-CacheEntry *
-AttrCache_get(AttrCache * attrcache, const char * path)
+inline bool
+AttrCache_copy_stat(AttrCache * attrcache, const char * path, struct stat * stat_result)
 {
-    check(attrcache != NULL, "passed attrcache is null");
+    return (AttrCache_lookup(attrcache, path, stat_result) == ATTRCACHE_HIT);
+}
+
+
+AttrCacheResult
+AttrCache_lookup(AttrCache * attrcache, const char * path, struct stat * stat_result)
+{
+    AttrCacheResult result = ATTRCACHE_MISS;
+    check(stat_result != NULL, "passed stat_result is null");
     check(path != NULL, "given path is null");
 
-    debug("attrcache_get %s", path);
+    if (attrcache->shards == NULL) {
+        AttrCache_count(&(attrcache->n_misses));
+        return ATTRCACHE_MISS;
+    }
 
-	CacheEntry * cache_entry = NULL;
-    hnode_t * hash_node = hash_lookup(attrcache->hashtable, path);
-    if (hash_node) {
+    time_t current_time = time(NULL);
+    check((current_time != -1), "could not fetch current time");
 
-        cache_entry = hnode_get(hash_node);
+    AttrCacheShard * shard = AttrCache_shard(attrcache, path);
+    pthread_mutex_lock(&(shard->mutex));
 
-        // check timestamp
-        if (AttrCache_entry_is_deprecated(attrcache, cache_entry)) {
-            hash_delete_free(attrcache->hashtable, hash_node);
-            cache_entry = NULL;
+    CacheEntry * cache_entry = AttrCacheShard_get(shard, path);
+    if (cache_entry) {
+        if (AttrCache_entry_is_deprecated(attrcache, cache_entry, current_time)) {
+            debug("CacheEntry for %s is deprecated", path);
+            AttrCacheShard_delete(shard, cache_entry);
+            AttrCache_count(&(attrcache->n_expired));
+        }
+        else {
+            if (cache_entry->negative) {
+                result = ATTRCACHE_NEGATIVE;
+            }
+            else {
+                memcpy(stat_result, &(cache_entry->stat_result), sizeof(struct stat));
+                result = ATTRCACHE_HIT;
+            }
+            AttrCacheShard_lru_unlink(shard, cache_entry);
+            AttrCacheShard_lru_push(shard, cache_entry);
         }
     }
+    pthread_mutex_unlock(&(shard->mutex));
 
-    if (cache_entry) {
+    if (result == ATTRCACHE_MISS) {
+        // the listing may be in another shard. never hold two shard
+        // locks at once
+        result = AttrCache_lookup_listing(attrcache, path, current_time);
+    }
+
+    if (result == ATTRCACHE_HIT) {
         debug("HIT: Found CacheEntry for %s in cache", path);
+        AttrCache_count(&(attrcache->n_hits));
+    }
+    else if (result == ATTRCACHE_NEGATIVE) {
+        debug("NEGATIVE: %s is known to not exist", path);
+        AttrCache_count(&(attrcache->n_negative_hits));
     }
     else {
         debug("MISS: No CacheEntry for %s in cache", path);
+        AttrCache_count(&(attrcache->n_misses));
     }
-
-    return cache_entry;
+    return result;
 error:
-    return NULL;
+    return ATTRCACHE_MISS;
 }
 
 
-inline bool
-AttrCache_copy_stat(AttrCache * attrcache, const char * path, struct stat * stat_result)
+bool
+AttrCache_set(AttrCache * attrcache, char * path, CacheEntry * cache_entry)
 {
-    bool found = false;
-    check(stat_result != NULL, "passed stat_result is null");
+    check(attrcache != NULL, "passed attrcache is null");
+    check(cache_entry != NULL, "passed cache_entry is null");
 
-    Attrcache_lock_modify_mutex(attrcache);
+    debug("attrcache_set %s", path);
 
-    CacheEntry * cache_entry = AttrCache_get(attrcache, path);
-    if (cache_entry) {
-        memcpy(stat_result, &(cache_entry->stat_result), sizeof(struct stat));
-        found = true;
+    free(cache_entry->path);
+    cache_entry->path = path;
+
+    if (attrcache->shards == NULL) {
+        CacheEntry_destroy(cache_entry);
+        return true;
     }
-    Attrcache_unlock_modify_mutex(attrcache);
 
-    return found;
+    AttrCacheShard * shard = AttrCache_shard(attrcache, path);
+    pthread_mutex_lock(&(shard->mutex));
+
+    // remove the old entry if there is one
+    CacheEntry * old_entry = AttrCacheShard_get(shard, path);
+    if (old_entry) {
+        debug("Replacing %s in cache", path);
+        AttrCacheShard_delete(shard, old_entry);
+    }
+
+    if (hash_alloc_insert(shard->entries, cache_entry->path, cache_entry) != 1) {
+        pthread_mutex_unlock(&(shard->mutex));
+        CacheEntry_destroy(cache_entry);
+        log_and_error("could not add cacheEntry to hash");
+    }
+    AttrCacheShard_lru_push(shard, cache_entry);
+
+    // make room by dropping the least recently used entries
+    while (hash_count(shard->entries) > attrcache->max_entries_per_shard) {
+        AttrCacheShard_delete(shard, shard->lru_tail);
+        AttrCache_count(&(attrcache->n_evicted));
+    }
+
+    pthread_mutex_unlock(&(shard->mutex));
+    return true;
 error:
-    Attrcache_unlock_modify_mutex(attrcache);
     return false;
 }
 
 
 bool
-AttrCache_set(AttrCache * attrcache, char * path, CacheEntry * cache_entry)
+AttrCache_set_negative(AttrCache * attrcache, const char * path)
 {
-    check(attrcache != NULL, "passed attrcache is null");
-    check(cache_entry != NULL, "passed cache_entry is null");
+    char * path_copy = NULL;
+    CacheEntry * cache_entry = NULL;
 
-    debug("attrcache_set %s", path);
+    check(attrcache != NULL, "passed attrcache is null");
 
-    if (attrcache->hashtable->hash_maxcount == 0) {
-        debug("Attrcache hastable allows 0 entries - nothing will be added");
+    if ((attrcache->negative_max_age_sec == 0) || (attrcache->shards == NULL)) {
         return true;
     }
 
-    // make room for new keys if the cache is full
-    if (hash_isfull(attrcache->hashtable)) {
-        AttrCache_shrink(attrcache);
+    path_copy = strdup(path);
+    check_mem(path_copy);
+    cache_entry = CacheEntry_create();
+    check_mem(cache_entry);
+
+    cache_entry->cache_creation_ts = time(NULL);
+    check((cache_entry->cache_creation_ts != -1), "could not fetch current time");
+    cache_entry->negative = true;
+
+    // takes care of the memory even on failure
+    return AttrCache_set(attrcache, path_copy, cache_entry);
+
+error:
+    free(path_copy);
+    CacheEntry_destroy(cache_entry);
+    return false;
+}
+
+
+bool
+AttrCache_set_listing(AttrCache * attrcache, const char * path, DirListing * listing)
+{
+    CachedListing * cached = NULL;
+
+    check(attrcache != NULL, "passed attrcache is null");
+    check(listing != NULL, "passed listing is null");
+
+    if ((attrcache->shards == NULL) ||
+            (listing->n_entries > attrcache->max_listing_names_per_shard)) {
+        debug("Not caching the listing of %s", path);
+        DirListing_destroy(listing);
+        return true;
     }
 
+    listing->cache_creation_ts = time(NULL);
+    check((listing->cache_creation_ts != -1), "could not fetch current time");
 
-    Attrcache_lock_modify_mutex(attrcache);
+    check(DirListing_index(listing), "Could not index listing");
 
-    // remove the old entry if there is one
-    hnode_t * hash_node = hash_lookup(attrcache->hashtable, path);
-    if (hash_node) {
-        debug("Replacing %s in cache", path);
-        hash_delete_free(attrcache->hashtable, hash_node);
+    cached = calloc(sizeof(CachedListing), 1);
+    check_mem(cached);
+    cached->path = strdup(path);
+    check_mem(cached->path);
+    cached->listing = listing;
+
+    AttrCacheShard * shard = AttrCache_shard(attrcache, path);
+    pthread_mutex_lock(&(shard->mutex));
+
+    CachedListing * old_cached = AttrCacheShard_get_listing(shard, path);
+    if (old_cached) {
+        AttrCacheShard_delete_listing(shard, old_cached);
     }
 
-    check(hash_alloc_insert(attrcache->hashtable, path, cache_entry) == 1,
-            "could not add cacheEntry to hash");
-    Attrcache_unlock_modify_mutex(attrcache);
+    if (hash_alloc_insert(shard->listings, cached->path, cached) != 1) {
+        pthread_mutex_unlock(&(shard->mutex));
+        log_and_error("could not add listing to hash");
+    }
+    AttrCacheShard_listing_lru_push(shard, cached);
+    shard->n_listing_names += listing->n_entries;
 
+    while (shard->n_listing_names > attrcache->max_listing_names_per_shard) {
+        AttrCacheShard_delete_listing(shard, shard->listings_lru_tail);
+        AttrCache_count(&(attrcache->n_listings_evicted));
+    }
+
+    pthread_mutex_unlock(&(shard->mutex));
+
+    debug("cached listing of %s with %d entries", path, (int)listing->n_entries);
     return true;
+
 error:
-    Attrcache_unlock_modify_mutex(attrcache);
+    if (cached) {
+        free(cached->path);
+        free(cached);
+    }
+    DirListing_destroy(listing);
     return false;
 }
 
 
+DirListing *
+AttrCache_get_listing(AttrCache * attrcache, const char * path, bool * is_fresh)
+{
+    DirListing * copy = NULL;
+
+    check(attrcache != NULL, "passed attrcache is null");
+
+    if (attrcache->shards == NULL) {
+        AttrCache_count(&(attrcache->n_listing_misses));
+        return NULL;
+    }
+
+    time_t current_time = time(NULL);
+    check((current_time != -1), "could not fetch current time");
+
+    AttrCacheShard * shard = AttrCache_shard(attrcache, path);
+    pthread_mutex_lock(&(shard->mutex));
+    CachedListing * cached = AttrCacheShard_get_listing(shard, path);
+    if (cached) {
+        copy = DirListing_copy(cached->listing);
+        *is_fresh = (cached->listing->cache_creation_ts + attrcache->max_age_sec) >= current_time;
+
+        AttrCacheShard_listing_lru_unlink(shard, cached);
+        AttrCacheShard_listing_lru_push(shard, cached);
+    }
+    pthread_mutex_unlock(&(shard->mutex));
+
+    if (cached == NULL) {
+        AttrCache_count(&(attrcache->n_listing_misses));
+    }
+    else if (*is_fresh) {
+        AttrCache_count(&(attrcache->n_listing_hits));
+    }
+    else {
+        AttrCache_count(&(attrcache->n_listing_stale));
+    }
+
+    return copy;
+error:
+    return NULL;
+}
+
+
+void
+AttrCache_revalidate_listing(AttrCache * attrcache, const char * path, uint64_t validator)
+{
+    time_t current_time = time(NULL);
+    if ((current_time == -1) || (attrcache->shards == NULL)) {
+        return;
+    }
+
+    AttrCacheShard * shard = AttrCache_shard(attrcache, path);
+    pthread_mutex_lock(&(shard->mutex));
+    CachedListing * cached = AttrCacheShard_get_listing(shard, path);
+    if (cached && (cached->listing->validator == validator)) {
+        debug("revalidated listing of %s", path);
+        cached->listing->cache_creation_ts = current_time;
+    }
+    pthread_mutex_unlock(&(shard->mutex));
+}
+
+
 void
 AttrCache_remove(AttrCache * attrcache, const char * path)
 {
-    if (!attrcache || !path) {
+    if (!attrcache || !path || !attrcache->shards) {
         return;
     }
 
-    hnode_t * hash_node = hash_lookup(attrcache->hashtable, path);
-    if (hash_node) {
+    AttrCacheShard * shard = AttrCache_shard(attrcache, path);
+    pthread_mutex_lock(&(shard->mutex));
+
+    CacheEntry * cache_entry = AttrCacheShard_get(shard, path);
+    if (cache_entry) {
         debug("Removing %s from cache", path);
+        AttrCacheShard_delete(shard, cache_entry);
+    }
+
+    pthread_mutex_unlock(&(shard->mutex));
+}
+
+
+void
+AttrCache_clear(AttrCache * attrcache)
+{
+    if (!attrcache || !attrcache->shards) {
+        return;
+    }
+
+    for (size_t i=0; i<attrcache->n_shards; i++) {
+        AttrCacheShard * shard = &(attrcache->shards[i]);
 
-        Attrcache_lock_modify_mutex(attrcache);
-        hash_delete_free(attrcache->hashtable, hash_node);
-        Attrcache_unlock_modify_mutex(attrcache);
+        pthread_mutex_lock(&(shard->mutex));
+        while (shard->lru_head) {
+            AttrCacheShard_delete(shard, shard->lru_head);
+        }
+        while (shard->listings_lru_head) {
+            AttrCacheShard_delete_listing(shard, shard->listings_lru_head);
+        }
+        pthread_mutex_unlock(&(shard->mutex));
     }
+    debug("Cleared the attrcache");
 }
 
 
-bool
-AttrCache_shrink(AttrCache * attrcache)
+void
+AttrCache_add_name(AttrCache * attrcache, const char * path, mode_t type)
 {
-    check(attrcache != NULL, "passed attrcache is null");
+    const char * name = NULL;
+    char * parent = NULL;
+    AttrCacheShard * shard = NULL;
 
+    if (!attrcache || !path || !attrcache->shards) {
+        return;
+    }
 
-    // get real number of entries to remove
-    unsigned int shrink_num = attrcache->batch_size < hash_count(attrcache->hashtable) ?
-                attrcache->batch_size : hash_count(attrcache->hashtable);
+    shard = AttrCache_shard(attrcache, path);
+    pthread_mutex_lock(&(shard->mutex));
+    CacheEntry * cache_entry = AttrCacheShard_get(shard, path);
+    if (cache_entry && cache_entry->negative) {
+        AttrCacheShard_delete(shard, cache_entry);
+    }
+    pthread_mutex_unlock(&(shard->mutex));
+
+    parent = AttrCache_split_path(path, &name);
+    if (parent != NULL) {
+        shard = AttrCache_shard(attrcache, parent);
+        pthread_mutex_lock(&(shard->mutex));
+        CachedListing * cached = AttrCacheShard_get_listing(shard, parent);
+        if (cached) {
+            size_t n_entries = cached->listing->n_entries;
+            if (DirListing_insert(cached->listing, name, type)) {
+                shard->n_listing_names += cached->listing->n_entries - n_entries;
+            }
+            else {
+                // an incomplete listing must not be used
+                debug("Removing listing of %s from cache", parent);
+                AttrCacheShard_delete_listing(shard, cached);
+            }
+        }
+        pthread_mutex_unlock(&(shard->mutex));
+    }
+    else if (name == NULL) {
+        // without the parent the listing can not be found. drop them all
+        log_err("Could not allocate parent path of %s", path);
+        for (size_t i=0; i<attrcache->n_shards; i++) {
+            shard = &(attrcache->shards[i]);
+            pthread_mutex_lock(&(shard->mutex));
+            while (shard->listings_lru_head) {
+                AttrCacheShard_delete_listing(shard, shard->listings_lru_head);
+            }
+            pthread_mutex_unlock(&(shard->mutex));
+        }
+    }
 
-    debug("attrcache_shrink %d", shrink_num);
+    free(parent);
+}
 
-    if (shrink_num == 0) {
-        return true;
+
+void
+AttrCache_remove_name(AttrCache * attrcache, const char * path)
+{
+    const char * name = NULL;
+    char * parent = NULL;
+
+    if (!attrcache || !path || !attrcache->shards) {
+        return;
     }
 
-    time_t current_time = time(NULL);
-    check((current_time != -1), "could not fetch current time");
+    parent = AttrCache_split_path(path, &name);
+    if (parent == NULL) {
+        // stale names in a listing only cause additional lookups
+        return;
+    }
 
-    size_t nodes_removed_count = 0;
+    AttrCacheShard * shard = AttrCache_shard(attrcache, parent);
+    pthread_mutex_lock(&(shard->mutex));
+    CachedListing * cached = AttrCacheShard_get_listing(shard, parent);
+    if (cached) {
+        size_t n_entries = cached->listing->n_entries;
+        DirListing_remove(cached->listing, name);
+        shard->n_listing_names -= n_entries - cached->listing->n_entries;
+    }
+    pthread_mutex_unlock(&(shard->mutex));
 
-    Attrcache_lock_modify_mutex(attrcache);
+    free(parent);
+}
 
-    hscan_t hash_scan;
-    hnode_t * hash_node = NULL;
-	hash_scan_begin(&hash_scan, attrcache->hashtable);
-	while ((hash_node = hash_scan_next(&hash_scan))) {
-        CacheEntry * cache_entry = hnode_get(hash_node);
 
-        if ((cache_entry->cache_creation_ts + attrcache->max_age_sec) < current_time) {
-            // entry is already above max age - immdediately delete it
-            hash_scan_delete(attrcache->hashtable, hash_node);
-            nodes_removed_count++;
-        }
+void
+AttrCache_rename_name(AttrCache * attrcache, const char * path_from, const char * path_to)
+{
+    const char * name = NULL;
+    char * parent = NULL;
+    mode_t type = 0;
+    AttrCacheShard * shard = NULL;
+
+    if (!attrcache || !path_from || !path_to || !attrcache->shards) {
+        return;
     }
 
-    // check if deleting the depracated entries made enough space,
-    // otherwise simply delete the first entries until shrink_num is
-    // reached
-    if (nodes_removed_count < shrink_num) {
-        hash_scan_begin(&hash_scan, attrcache->hashtable);
-        while( (nodes_removed_count < shrink_num) && (hash_node = hash_scan_next(&hash_scan)) ) {
-            hash_scan_delete(attrcache->hashtable, hash_node);
-            nodes_removed_count++;
+    // find out the type of the renamed entry before it is gone
+    shard = AttrCache_shard(attrcache, path_from);
+    pthread_mutex_lock(&(shard->mutex));
+    CacheEntry * cache_entry = AttrCacheShard_get(shard, path_from);
+    if (cache_entry && !cache_entry->negative) {
+        type = cache_entry->stat_result.st_mode & S_IFMT;
+    }
+    pthread_mutex_unlock(&(shard->mutex));
+
+    parent = AttrCache_split_path(path_from, &name);
+    if ((type == 0) && (parent != NULL)) {
+        shard = AttrCache_shard(attrcache, parent);
+        pthread_mutex_lock(&(shard->mutex));
+        CachedListing * cached = AttrCacheShard_get_listing(shard, parent);
+        if (cached) {
+            DirListingEntry * entry = DirListing_find(cached->listing, name);
+            if (entry) {
+                type = entry->type;
+            }
         }
+        pthread_mutex_unlock(&(shard->mutex));
     }
-    debug("Removed %d nodes from attrcache", (int)nodes_removed_count);
+    free(parent);
 
-    Attrcache_unlock_modify_mutex(attrcache);
-    return true;
+    AttrCache_remove_name(attrcache, path_from);
+    AttrCache_add_name(attrcache, path_to, type);
+}
 
-error:
-    Attrcache_unlock_modify_mutex(attrcache);
-    return false;
+
+void
+AttrCache_get_stats(AttrCache * attrcache, AttrCacheStats * stats)
+{
+    memset(stats, 0, sizeof(AttrCacheStats));
+
+    stats->n_hits = __atomic_load_n(&(attrcache->n_hits), __ATOMIC_RELAXED);
+    stats->n_negative_hits = __atomic_load_n(&(attrcache->n_negative_hits), __ATOMIC_RELAXED);
+    stats->n_misses = __atomic_load_n(&(attrcache->n_misses), __ATOMIC_RELAXED);
+    stats->n_expired = __atomic_load_n(&(attrcache->n_expired), __ATOMIC_RELAXED);
+    stats->n_evicted = __atomic_load_n(&(attrcache->n_evicted), __ATOMIC_RELAXED);
+    stats->n_listing_hits = __atomic_load_n(&(attrcache->n_listing_hits), __ATOMIC_RELAXED);
+    stats->n_listing_stale = __atomic_load_n(&(attrcache->n_listing_stale), __ATOMIC_RELAXED);
+    stats->n_listing_misses = __atomic_load_n(&(attrcache->n_listing_misses), __ATOMIC_RELAXED);
+    stats->n_listings_evicted = __atomic_load_n(&(attrcache->n_listings_evicted),
+            __ATOMIC_RELAXED);
+    stats->max_entries = attrcache->max_entries_per_shard * attrcache->n_shards;
+
+    for (size_t i=0; i<attrcache->n_shards; i++) {
+        AttrCacheShard * shard = &(attrcache->shards[i]);
+
+        pthread_mutex_lock(&(shard->mutex));
+        stats->n_entries += hash_count(shard->entries);
+        stats->n_listings += hash_count(shard->listings);
+        pthread_mutex_unlock(&(shard->mutex));
+    }
+}
+
+
+static void
+AttrCache_count(uint64_t * counter)
+{
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * get the shard responsible for a path
+ */
+static AttrCacheShard *
+AttrCache_shard(AttrCache * attrcache, const char * path)
+{
+    uint64_t hash = (uint64_t)Hashfunc_djb2((const unsigned char *)path);
+
+    // the hash tables of the shards select their chains by the low
+    // bits of the same hash. mix it and use the high bits, so the
+    // entries of a shard still spread over its chains
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return &(attrcache->shards[(hash >> 32) % attrcache->n_shards]);
 }
 
 
@@ -277,52 +634,222 @@ error:
  *
  * returns true if the entry is to old
  */
-inline bool
-AttrCache_entry_is_deprecated(const AttrCache * attrcache, const CacheEntry * cache_entry)
+static bool
+AttrCache_entry_is_deprecated(const AttrCache * attrcache, const CacheEntry * cache_entry,
+        time_t current_time)
 {
-    time_t current_time = time(NULL);
-    check((current_time != -1), "could not fetch current time");
+    unsigned int max_age_sec = cache_entry->negative ?
+            attrcache->negative_max_age_sec : attrcache->max_age_sec;
 
-    bool is_deprecated = (bool)((cache_entry->cache_creation_ts + attrcache->max_age_sec) < current_time);
+    return (bool)((cache_entry->cache_creation_ts + max_age_sec) < current_time);
+}
 
-    if (is_deprecated) {
-        debug("CacheEntry is deprecated - older than %d seconds", (int)attrcache->max_age_sec);
-    }
 
-    return is_deprecated;
-error:
-    return true;
+/**
+ * check if a listing is beyond the max age of negative entries
+ *
+ * returns true if the listing is to old
+ */
+static bool
+AttrCache_listing_is_deprecated(const AttrCache * attrcache, const DirListing * listing,
+        time_t current_time)
+{
+    return (bool)((listing->cache_creation_ts + attrcache->negative_max_age_sec) < current_time);
 }
 
+
 /**
+ * check the listing of the directory of "path" for its name
  *
+ * locks the shard of the directory
  */
-inline void
-Attrcache_lock_modify_mutex(AttrCache * attrcache)
+static AttrCacheResult
+AttrCache_lookup_listing(AttrCache * attrcache, const char * path, time_t current_time)
 {
-    if (attrcache) {
-        debug("Locking attrcache modify mutex");
-        check(pthread_mutex_lock(&(attrcache->mutex_modify)) == 0,
-                "locking modify mutex failed");
+    AttrCacheResult result = ATTRCACHE_MISS;
+    const char * name = NULL;
+    char * parent = NULL;
+
+    if (attrcache->negative_max_age_sec == 0) {
+        return ATTRCACHE_MISS;
     }
-    return;
-error:
-    return;
+
+    parent = AttrCache_split_path(path, &name);
+    if ((parent == NULL) || (name[0] == '\0')) {
+        free(parent);
+        return ATTRCACHE_MISS;
+    }
+
+    AttrCacheShard * shard = AttrCache_shard(attrcache, parent);
+    pthread_mutex_lock(&(shard->mutex));
+    CachedListing * cached = AttrCacheShard_get_listing(shard, parent);
+    if (cached && !AttrCache_listing_is_deprecated(attrcache, cached->listing, current_time) &&
+            (DirListing_find(cached->listing, name) == NULL)) {
+        result = ATTRCACHE_NEGATIVE;
+    }
+    pthread_mutex_unlock(&(shard->mutex));
+
+    free(parent);
+    return result;
 }
 
 
 /**
+ * split a path into the path of its directory and its name
  *
+ * returns the newly allocated path of the directory or NULL if there is
+ * none or on error. "name" points into "path" and is set to NULL on
+ * error
  */
-inline void
-Attrcache_unlock_modify_mutex(AttrCache * attrcache)
+static char *
+AttrCache_split_path(const char * path, const char ** name)
 {
-    if (attrcache) {
-        debug("Unlocking attrcache modify mutex");
-        check(pthread_mutex_unlock(&(attrcache->mutex_modify)) == 0,
-                "unlocking modify mutex failed");
+    char * parent = NULL;
+
+    *name = NULL;
+    const char * sep = strrchr(path, '/');
+    if (sep == NULL) {
+        *name = path;
+        return NULL;
     }
-    return;
+
+    size_t parent_len = (sep == path) ? 1 : (size_t)(sep - path);
+    parent = strndup(path, parent_len);
+    check_mem(parent);
+
+    *name = sep + 1;
+    return parent;
+
 error:
-    return;
+    return NULL;
+}
+
+
+// #### AttrCacheShard ######################################
+//
+// has to be called with the mutex of the shard locked
+
+static CacheEntry *
+AttrCacheShard_get(AttrCacheShard * shard, const char * path)
+{
+    hnode_t * hash_node = hash_lookup(shard->entries, path);
+    if (hash_node) {
+        return hnode_get(hash_node);
+    }
+    return NULL;
+}
+
+
+/**
+ * remove an entry from the hash and the lru list and free it
+ */
+static void
+AttrCacheShard_delete(AttrCacheShard * shard, CacheEntry * cache_entry)
+{
+    hnode_t * hash_node = hash_lookup(shard->entries, cache_entry->path);
+    if (hash_node) {
+        hash_delete_free(shard->entries, hash_node);
+    }
+    AttrCacheShard_lru_unlink(shard, cache_entry);
+    CacheEntry_destroy(cache_entry);
+}
+
+
+static void
+AttrCacheShard_lru_unlink(AttrCacheShard * shard, CacheEntry * cache_entry)
+{
+    if (cache_entry->lru_prev) {
+        cache_entry->lru_prev->lru_next = cache_entry->lru_next;
+    }
+    else {
+        shard->lru_head = cache_entry->lru_next;
+    }
+    if (cache_entry->lru_next) {
+        cache_entry->lru_next->lru_prev = cache_entry->lru_prev;
+    }
+    else {
+        shard->lru_tail = cache_entry->lru_prev;
+    }
+    cache_entry->lru_prev = NULL;
+    cache_entry->lru_next = NULL;
+}
+
+
+static void
+AttrCacheShard_lru_push(AttrCacheShard * shard, CacheEntry * cache_entry)
+{
+    cache_entry->lru_prev = NULL;
+    cache_entry->lru_next = shard->lru_head;
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = cache_entry;
+    }
+    else {
+        shard->lru_tail = cache_entry;
+    }
+    shard->lru_head = cache_entry;
+}
+
+
+static CachedListing *
+AttrCacheShard_get_listing(AttrCacheShard * shard, const char * path)
+{
+    hnode_t * hash_node = hash_lookup(shard->listings, path);
+    if (hash_node) {
+        return hnode_get(hash_node);
+    }
+    return NULL;
+}
+
+
+/**
+ * remove a listing from the hash and the lru list and free it
+ */
+static void
+AttrCacheShard_delete_listing(AttrCacheShard * shard, CachedListing * cached)
+{
+    hnode_t * hash_node = hash_lookup(shard->listings, cached->path);
+    if (hash_node) {
+        hash_delete_free(shard->listings, hash_node);
+    }
+    AttrCacheShard_listing_lru_unlink(shard, cached);
+
+    shard->n_listing_names -= cached->listing->n_entries;
+    DirListing_destroy(cached->listing);
+    free(cached->path);
+    free(cached);
+}
+
+
+static void
+AttrCacheShard_listing_lru_unlink(AttrCacheShard * shard, CachedListing * cached)
+{
+    if (cached->lru_prev) {
+        cached->lru_prev->lru_next = cached->lru_next;
+    }
+    else {
+        shard->listings_lru_head = cached->lru_next;
+    }
+    if (cached->lru_next) {
+        cached->lru_next->lru_prev = cached->lru_prev;
+    }
+    else {
+        shard->listings_lru_tail = cached->lru_prev;
+    }
+    cached->lru_prev = NULL;
+    cached->lru_next = NULL;
+}
+
+
+static void
+AttrCacheShard_listing_lru_push(AttrCacheShard * shard, CachedListing * cached)
+{
+    cached->lru_prev = NULL;
+    cached->lru_next = shard->listings_lru_head;
+    if (shard->listings_lru_head) {
+        shard->listings_lru_head->lru_prev = cached;
+    }
+    else {
+        shard->listings_lru_tail = cached;
+    }
+    shard->listings_lru_head = cached;
 }
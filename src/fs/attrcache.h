@@ -7,9 +7,11 @@
 #include <pthread.h>
 
 #include "../kazlib/hash.h"
+#include "dirlisting.h"
 
 
-#define ATTRCACHE_DEFAULT_BATCH_SIZE 50
+/* number of independently locked parts of the cache */
+#define ATTRCACHE_SHARDS 64
 
 
 typedef struct CacheEntry {
@@ -17,62 +19,155 @@ typedef struct CacheEntry {
 
     // timestamp of the creation of this cache entry
     time_t cache_creation_ts;
+
+    // the path does not exist on the server. stat_result is unused
+    bool negative;
+
+    // set by the cache: the path the entry is stored for and
+    // the neighbours in the lru list of its shard
+    char * path;
+    struct CacheEntry * lru_prev;
+    struct CacheEntry * lru_next;
 } CacheEntry;
 
 
+/** a listing stored in the cache */
+typedef struct CachedListing {
+    DirListing * listing;
+
+    // the path of the directory and the neighbours in the lru
+    // list of its shard
+    char * path;
+    struct CachedListing * lru_prev;
+    struct CachedListing * lru_next;
+} CachedListing;
+
+
+/** result of a lookup in the attrcache */
+typedef enum {
+    ATTRCACHE_MISS = 0,
+    ATTRCACHE_HIT,
+    // the path is known to not exist
+    ATTRCACHE_NEGATIVE
+} AttrCacheResult;
+
+
+/**
+ * a part of the cache with a lock of its own. paths are assigned
+ * to shards by their hash
+ */
+typedef struct AttrCacheShard {
+    // path -> CacheEntry
+    hash_t * entries;
+
+    // most recently used entry first
+    CacheEntry * lru_head;
+    CacheEntry * lru_tail;
+
+    // directory path -> CachedListing
+    hash_t * listings;
+
+    CachedListing * listings_lru_head;
+    CachedListing * listings_lru_tail;
+
+    // number of names in all listings of the shard
+    size_t n_listing_names;
+
+    pthread_mutex_t mutex;
+    bool initialized;
+} AttrCacheShard;
+
+
 typedef struct AttrCache {
-    hash_t * hashtable;
+    AttrCacheShard * shards;
+    size_t n_shards;
+
+    // the least recently used entries get removed when a shard
+    // grows beyond this
+    size_t max_entries_per_shard;
+
+    // the same for the sum of the names of the listings in a shard
+    size_t max_listing_names_per_shard;
 
     // max age of a entry in the cache before it gets deleted
-    // in seconds
+    // in seconds. listings are used without asking the server
+    // for the same time and kept for revalidation after that
     unsigned int max_age_sec;
 
-    // number of entries getting modified on
-    // batch operations like shrink.
-    // default is ATTRCACHE_DEFAULT_BATCH_SIZE
-    unsigned int batch_size;
-
-    pthread_mutex_t mutex_modify;
+    // max age of negative entries and of listings used as proof
+    // of names not existing in seconds. 0 disables negative caching
+    unsigned int negative_max_age_sec;
+
+    // counters of the lookups and of the entries dropped to make
+    // room. updated atomically as they span all shards
+    uint64_t n_hits;
+    uint64_t n_negative_hits;
+    uint64_t n_misses;
+    uint64_t n_expired;
+    uint64_t n_evicted;
+    uint64_t n_listing_hits;
+    uint64_t n_listing_stale;
+    uint64_t n_listing_misses;
+    uint64_t n_listings_evicted;
 
 } AttrCache;
 
 
+/** the counters of the attrcache and its current size */
+typedef struct AttrCacheStats {
+    uint64_t n_hits;
+    uint64_t n_negative_hits;
+    uint64_t n_misses;
+    uint64_t n_expired;
+    uint64_t n_evicted;
+    uint64_t n_listing_hits;
+    uint64_t n_listing_stale;
+    uint64_t n_listing_misses;
+    uint64_t n_listings_evicted;
+
+    size_t n_entries;
+    size_t n_listings;
+    size_t max_entries;
+} AttrCacheStats;
+
+
 CacheEntry * CacheEntry_create();
 void CacheEntry_destroy(CacheEntry * cache_entry);
 
 /**
  * initialize the attrcache
  *
+ * "max_size" is the maximum number of entries and of names of listings
+ * to keep. 0 disables the cache
+ *
  * returns false on error
  */
-bool AttrCache_init(AttrCache * attrcache, size_t max_size, unsigned int max_age_sec);
+bool AttrCache_init(AttrCache * attrcache, size_t max_size, unsigned int max_age_sec,
+        unsigned int negative_max_age_sec);
 
 /**
  */
 void AttrCache_deinit(AttrCache * attrcache);
 
 
-/**
- * return a pointer to the CacheEntry structure of the entry.
- * the allocated memory of the pointer still belongs to the cache
- *
- * does not perform any locking
- *
- * returns NULL if the entry is not found.
- */
-CacheEntry * AttrCache_get(AttrCache * attrcache, const char * path);
-
 /**
  * get the stat_result from the cache and copy it to the
  * passed pointer
  *
- * will lock the cache for modifications during this operation
- *
  * returns false if the cacheEntry is not found, true if the copy
  * was successful
  */
 bool AttrCache_copy_stat(AttrCache * attrcache, const char * path, struct stat * stat_result);
 
+/**
+ * look up a path and copy its stat_result to the passed pointer
+ *
+ * paths without an entry of their own are reported as ATTRCACHE_NEGATIVE
+ * when the listing of their directory is cached and does not contain
+ * them
+ */
+AttrCacheResult AttrCache_lookup(AttrCache * attrcache, const char * path, struct stat * stat_result);
+
 /**
  * add a cache entry
  *
@@ -82,18 +177,65 @@ bool AttrCache_copy_stat(AttrCache * attrcache, const char * path, struct stat *
 bool AttrCache_set(AttrCache * attrcache, char * path, CacheEntry * cache_entry);
 
 
+/**
+ * remember that a path does not exist on the server
+ *
+ * returns true on success
+ */
+bool AttrCache_set_negative(AttrCache * attrcache, const char * path);
+
+/**
+ * add the listing of a directory
+ *
+ * will take ownership of the listing.
+ * returns true on success
+ */
+bool AttrCache_set_listing(AttrCache * attrcache, const char * path, DirListing * listing);
+
+/**
+ * get a copy of the cached listing of a directory. "is_fresh" is set
+ * to false if the listing has to be revalidated before being used
+ *
+ * returns NULL if there is no listing. the caller is responsible for
+ * destroying the returned listing
+ */
+DirListing * AttrCache_get_listing(AttrCache * attrcache, const char * path, bool * is_fresh);
+
+/**
+ * mark the listing of a directory as fresh again after the server
+ * confirmed "validator" to still be valid
+ */
+void AttrCache_revalidate_listing(AttrCache * attrcache, const char * path, uint64_t validator);
+
 /**
  * remove entry from the cache
  */
 void AttrCache_remove(AttrCache * attrcache, const char * path);
 
+/**
+ * remove all entries and listings from the cache
+ */
+void AttrCache_clear(AttrCache * attrcache);
 
 /**
- * shrink the number of entries by "batch_size" entries
- *
- * oldest entries get removed first
- * returns true on success
+ * update the cache after "path" has been created. "type" contains the
+ * file type bits of the mode or 0 if unknown
+ */
+void AttrCache_add_name(AttrCache * attrcache, const char * path, mode_t type);
+
+/**
+ * update the cache after "path" has been removed
+ */
+void AttrCache_remove_name(AttrCache * attrcache, const char * path);
+
+/**
+ * update the cache after "path_from" has been renamed to "path_to"
+ */
+void AttrCache_rename_name(AttrCache * attrcache, const char * path_from, const char * path_to);
+
+/**
+ * get the counters and the number of entries and listings cached
  */
-bool AttrCache_shrink(AttrCache * attrcache);
+void AttrCache_get_stats(AttrCache * attrcache, AttrCacheStats * stats);
 
 #endif // __fs_attrache_h__
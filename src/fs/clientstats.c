@@ -0,0 +1,344 @@
+#include "clientstats.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../dbg.h"
+
+/* upper bounds of the buckets in nanoseconds */
+static const uint64_t clientstats_bucket_ns[CLIENTSTATS_N_BUCKETS] = {
+    10000ULL, 25000ULL, 50000ULL, 100000ULL, 250000ULL, 500000ULL,
+    1000000ULL, 2500000ULL, 5000000ULL, 10000000ULL, 25000000ULL, 50000000ULL,
+    100000000ULL, 250000000ULL, 500000000ULL, 1000000000ULL, 2500000000ULL
+};
+
+/* percentiles of the latencies reported */
+static const unsigned int clientstats_percentiles[] = { 50, 90, 99 };
+
+
+/**
+ * the formatted statistics
+ */
+typedef struct ClientStatsBuffer {
+    char * data;
+    size_t len;
+    size_t size;
+    bool failed;
+} ClientStatsBuffer;
+
+
+void
+ClientStats_init(ClientStats * stats, Transport * transport, AttrCache * attrcache,
+        CompressPolicy * compresspolicy)
+{
+    memset(stats, 0, sizeof(ClientStats));
+    stats->started_ns = Transport_now_ns();
+    stats->transport = transport;
+    stats->attrcache = attrcache;
+    stats->compresspolicy = compresspolicy;
+}
+
+
+static void
+ClientStatsHistogram_add(ClientStatsHistogram * histogram, uint64_t ns)
+{
+    size_t bucket = 0;
+    while ((bucket < CLIENTSTATS_N_BUCKETS) && (ns > clientstats_bucket_ns[bucket])) {
+        bucket++;
+    }
+    __atomic_add_fetch(&(histogram->buckets[bucket]), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(histogram->sum_ns), ns, __ATOMIC_RELAXED);
+
+    uint64_t max_ns = __atomic_load_n(&(histogram->max_ns), __ATOMIC_RELAXED);
+    while ((ns > max_ns) && !__atomic_compare_exchange_n(&(histogram->max_ns), &max_ns, ns,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // max_ns has been reloaded
+    }
+}
+
+
+void
+ClientStats_record(ClientStats * stats, int request_type, int err, bool answered,
+        size_t request_size, size_t reply_size, uint64_t latency_ns, uint64_t queued_ns)
+{
+    if ((request_type < 0) || (request_type >= CLIENTSTATS_N_REQUEST_TYPES)) {
+        request_type = RHIZOFS__REQUEST_TYPE__INVALID;
+    }
+    ClientStatsOp * op = &(stats->ops[request_type]);
+
+    __atomic_add_fetch(&(op->n_requests), 1, __ATOMIC_RELAXED);
+
+    if (answered) {
+        if (err != 0) {
+            __atomic_add_fetch(&(op->n_errors), 1, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&(op->bytes_sent), request_size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(op->bytes_received), reply_size, __ATOMIC_RELAXED);
+        ClientStatsHistogram_add(&(op->latency), latency_ns);
+        ClientStatsHistogram_add(&(op->queued), queued_ns);
+    }
+    else if (err == EAGAIN) {
+        __atomic_add_fetch(&(op->n_timeouts), 1, __ATOMIC_RELAXED);
+    }
+    else if (err == EINTR) {
+        __atomic_add_fetch(&(op->n_interrupted), 1, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_add_fetch(&(op->n_failed), 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+static void
+ClientStatsBuffer_printf(ClientStatsBuffer * buf, const char * format, ...)
+{
+    va_list args;
+
+    if (buf->data == NULL) {
+        buf->size = 16384;
+        buf->data = malloc(buf->size);
+        buf->failed = (buf->data == NULL);
+    }
+
+    while (!buf->failed) {
+        va_start(args, format);
+        int n = vsnprintf(buf->data + buf->len, buf->size - buf->len, format, args);
+        va_end(args);
+
+        if ((n >= 0) && ((size_t)n < buf->size - buf->len)) {
+            buf->len += (size_t)n;
+            return;
+        }
+
+        size_t size = (buf->size * 2) + ((n > 0) ? (size_t)n : 0);
+        char * data = realloc(buf->data, size);
+        if (data == NULL) {
+            buf->failed = true;
+            return;
+        }
+        buf->data = data;
+        buf->size = size;
+    }
+}
+
+
+static uint64_t
+ClientStats_get(uint64_t * counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+static double
+ClientStats_ratio(uint64_t part, uint64_t total)
+{
+    return (total > 0) ? ((double)part / (double)total) : 0.0;
+}
+
+
+/**
+ * write the average, the percentiles and the buckets of a histogram in
+ * milliseconds. percentiles are reported as the upper bound of their
+ * bucket
+ */
+static void
+ClientStats_write_histogram(ClientStatsBuffer * buf, const char * prefix,
+        ClientStatsHistogram * histogram)
+{
+    uint64_t buckets[CLIENTSTATS_N_BUCKETS + 1];
+    uint64_t count = 0;
+
+    for (int b=0; b<=CLIENTSTATS_N_BUCKETS; b++) {
+        buckets[b] = ClientStats_get(&(histogram->buckets[b]));
+        count += buckets[b];
+    }
+    uint64_t max_ns = ClientStats_get(&(histogram->max_ns));
+
+    ClientStatsBuffer_printf(buf, "%s_avg_ms %.3f\n", prefix,
+            ClientStats_ratio(ClientStats_get(&(histogram->sum_ns)), count) / 1e6);
+
+    for (size_t i=0; i<sizeof(clientstats_percentiles) / sizeof(clientstats_percentiles[0]); i++) {
+        uint64_t rank = ((count * clientstats_percentiles[i]) + 99) / 100;
+        uint64_t seen = 0;
+        uint64_t bound_ns = 0;
+
+        for (int b=0; (b<=CLIENTSTATS_N_BUCKETS) && (rank > 0); b++) {
+            seen += buckets[b];
+            if (seen >= rank) {
+                bound_ns = (b < CLIENTSTATS_N_BUCKETS) ? clientstats_bucket_ns[b] : max_ns;
+                break;
+            }
+        }
+        if (bound_ns > max_ns) {
+            bound_ns = max_ns;
+        }
+        ClientStatsBuffer_printf(buf, "%s_p%u_ms %.3f\n", prefix,
+                clientstats_percentiles[i], (double)bound_ns / 1e6);
+    }
+    ClientStatsBuffer_printf(buf, "%s_max_ms %.3f\n", prefix, (double)max_ns / 1e6);
+
+    ClientStatsBuffer_printf(buf, "%s_hist_ms", prefix);
+    for (int b=0; b<=CLIENTSTATS_N_BUCKETS; b++) {
+        if (b < CLIENTSTATS_N_BUCKETS) {
+            ClientStatsBuffer_printf(buf, " %g:%llu", (double)clientstats_bucket_ns[b] / 1e6,
+                    (unsigned long long)buckets[b]);
+        }
+        else {
+            ClientStatsBuffer_printf(buf, " inf:%llu\n", (unsigned long long)buckets[b]);
+        }
+    }
+}
+
+
+static void
+ClientStats_write_ops(ClientStats * stats, ClientStatsBuffer * buf)
+{
+    char prefix[64];
+
+    for (int t=0; t<CLIENTSTATS_N_REQUEST_TYPES; t++) {
+        ClientStatsOp * op = &(stats->ops[t]);
+        const char * name = Request_type_name(t);
+
+        if (ClientStats_get(&(op->n_requests)) == 0) {
+            continue;
+        }
+
+        ClientStatsBuffer_printf(buf, "op.%s.requests %llu\n", name,
+                (unsigned long long)ClientStats_get(&(op->n_requests)));
+        ClientStatsBuffer_printf(buf, "op.%s.errors %llu\n", name,
+                (unsigned long long)ClientStats_get(&(op->n_errors)));
+        ClientStatsBuffer_printf(buf, "op.%s.timeouts %llu\n", name,
+                (unsigned long long)ClientStats_get(&(op->n_timeouts)));
+        ClientStatsBuffer_printf(buf, "op.%s.interrupted %llu\n", name,
+                (unsigned long long)ClientStats_get(&(op->n_interrupted)));
+        ClientStatsBuffer_printf(buf, "op.%s.failed %llu\n", name,
+                (unsigned long long)ClientStats_get(&(op->n_failed)));
+        ClientStatsBuffer_printf(buf, "op.%s.sent_bytes %llu\n", name,
+                (unsigned long long)ClientStats_get(&(op->bytes_sent)));
+        ClientStatsBuffer_printf(buf, "op.%s.received_bytes %llu\n", name,
+                (unsigned long long)ClientStats_get(&(op->bytes_received)));
+
+        snprintf(prefix, sizeof(prefix), "op.%s.latency", name);
+        ClientStats_write_histogram(buf, prefix, &(op->latency));
+        snprintf(prefix, sizeof(prefix), "op.%s.queued", name);
+        ClientStats_write_histogram(buf, prefix, &(op->queued));
+    }
+}
+
+
+static void
+ClientStats_write_transport(ClientStats * stats, ClientStatsBuffer * buf)
+{
+    TransportStats ts;
+
+    if (stats->transport == NULL) {
+        return;
+    }
+    Transport_get_stats(stats->transport, &ts);
+
+    ClientStatsBuffer_printf(buf, "transport.window %u\n", ts.window);
+    ClientStatsBuffer_printf(buf, "transport.in_flight %u\n", ts.in_flight);
+    ClientStatsBuffer_printf(buf, "transport.pending %llu\n", (unsigned long long)ts.n_pending);
+    ClientStatsBuffer_printf(buf, "transport.sent %llu\n", (unsigned long long)ts.n_sent);
+    ClientStatsBuffer_printf(buf, "transport.send_retries %llu\n",
+            (unsigned long long)ts.n_send_retries);
+    ClientStatsBuffer_printf(buf, "transport.send_failures %llu\n",
+            (unsigned long long)ts.n_send_failures);
+    ClientStatsBuffer_printf(buf, "transport.cancelled %llu\n",
+            (unsigned long long)ts.n_cancelled);
+    ClientStatsBuffer_printf(buf, "transport.stale_replies %llu\n",
+            (unsigned long long)ts.n_stale_replies);
+    ClientStatsBuffer_printf(buf, "transport.malformed_replies %llu\n",
+            (unsigned long long)ts.n_malformed_replies);
+}
+
+
+static void
+ClientStats_write_attrcache(ClientStats * stats, ClientStatsBuffer * buf)
+{
+    AttrCacheStats as;
+
+    if (stats->attrcache == NULL) {
+        return;
+    }
+    AttrCache_get_stats(stats->attrcache, &as);
+
+    uint64_t n_lookups = as.n_hits + as.n_negative_hits + as.n_misses;
+    uint64_t n_listing_lookups = as.n_listing_hits + as.n_listing_stale + as.n_listing_misses;
+
+    ClientStatsBuffer_printf(buf, "attrcache.entries %llu\n", (unsigned long long)as.n_entries);
+    ClientStatsBuffer_printf(buf, "attrcache.max_entries %llu\n",
+            (unsigned long long)as.max_entries);
+    ClientStatsBuffer_printf(buf, "attrcache.hits %llu\n", (unsigned long long)as.n_hits);
+    ClientStatsBuffer_printf(buf, "attrcache.negative_hits %llu\n",
+            (unsigned long long)as.n_negative_hits);
+    ClientStatsBuffer_printf(buf, "attrcache.misses %llu\n", (unsigned long long)as.n_misses);
+    ClientStatsBuffer_printf(buf, "attrcache.hit_ratio %.3f\n",
+            ClientStats_ratio(as.n_hits + as.n_negative_hits, n_lookups));
+    ClientStatsBuffer_printf(buf, "attrcache.expired %llu\n", (unsigned long long)as.n_expired);
+    ClientStatsBuffer_printf(buf, "attrcache.evicted %llu\n", (unsigned long long)as.n_evicted);
+    ClientStatsBuffer_printf(buf, "attrcache.listings %llu\n",
+            (unsigned long long)as.n_listings);
+    ClientStatsBuffer_printf(buf, "attrcache.listing_hits %llu\n",
+            (unsigned long long)as.n_listing_hits);
+    ClientStatsBuffer_printf(buf, "attrcache.listing_stale %llu\n",
+            (unsigned long long)as.n_listing_stale);
+    ClientStatsBuffer_printf(buf, "attrcache.listing_misses %llu\n",
+            (unsigned long long)as.n_listing_misses);
+    ClientStatsBuffer_printf(buf, "attrcache.listing_hit_ratio %.3f\n",
+            ClientStats_ratio(as.n_listing_hits, n_listing_lookups));
+    ClientStatsBuffer_printf(buf, "attrcache.listings_evicted %llu\n",
+            (unsigned long long)as.n_listings_evicted);
+}
+
+
+static void
+ClientStats_write_compression(ClientStats * stats, ClientStatsBuffer * buf)
+{
+    CompressPolicyStats cs;
+
+    if (stats->compresspolicy == NULL) {
+        return;
+    }
+    CompressPolicy_get_stats(stats->compresspolicy, &cs);
+
+    ClientStatsBuffer_printf(buf, "compression.blocks %llu\n", (unsigned long long)cs.n_blocks);
+    ClientStatsBuffer_printf(buf, "compression.fast %llu\n", (unsigned long long)cs.n_fast);
+    ClientStatsBuffer_printf(buf, "compression.strong %llu\n", (unsigned long long)cs.n_strong);
+    ClientStatsBuffer_printf(buf, "compression.skipped_entropy %llu\n",
+            (unsigned long long)cs.n_skipped_entropy);
+    ClientStatsBuffer_printf(buf, "compression.skipped_file %llu\n",
+            (unsigned long long)cs.n_skipped_file);
+    ClientStatsBuffer_printf(buf, "compression.skipped_cost %llu\n",
+            (unsigned long long)cs.n_skipped_cost);
+    ClientStatsBuffer_printf(buf, "compression.incompressible %llu\n",
+            (unsigned long long)cs.n_incompressible);
+    ClientStatsBuffer_printf(buf, "compression.link_bytes_per_second %llu\n",
+            (unsigned long long)cs.throughput);
+}
+
+
+char *
+ClientStats_format(ClientStats * stats, size_t * size)
+{
+    ClientStatsBuffer buf;
+    memset(&buf, 0, sizeof(buf));
+
+    ClientStatsBuffer_printf(&buf, "uptime_seconds %.3f\n",
+            (double)(Transport_now_ns() - stats->started_ns) / 1e9);
+    ClientStats_write_ops(stats, &buf);
+    ClientStats_write_transport(stats, &buf);
+    ClientStats_write_attrcache(stats, &buf);
+    ClientStats_write_compression(stats, &buf);
+
+    check_mem(!buf.failed);
+
+    *size = buf.len;
+    return buf.data;
+
+error:
+    free(buf.data);
+    return NULL;
+}
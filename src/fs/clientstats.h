@@ -0,0 +1,90 @@
+#ifndef __fs_clientstats_h__
+#define __fs_clientstats_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../request.h"
+#include "../compresspolicy.h"
+#include "attrcache.h"
+#include "transport.h"
+
+/* number of request types counted */
+#define CLIENTSTATS_N_REQUEST_TYPES (RHIZOFS__REQUEST_TYPE__COMPOUND + 1)
+
+/* number of buckets of the latency histograms, without the last
+ * one holding everything slower */
+#define CLIENTSTATS_N_BUCKETS 17
+
+
+typedef struct ClientStatsHistogram {
+    uint64_t buckets[CLIENTSTATS_N_BUCKETS + 1];
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} ClientStatsHistogram;
+
+
+/** the counters of one request type */
+typedef struct ClientStatsOp {
+    uint64_t n_requests;
+
+    // answered by the server with an error
+    uint64_t n_errors;
+
+    // no answer within the timeout, interrupted by the caller or
+    // not sent at all
+    uint64_t n_timeouts;
+    uint64_t n_interrupted;
+    uint64_t n_failed;
+
+    // size of the requests and replies as transferred
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+
+    // time from sending the request to receiving the reply, and
+    // the time waited for a free slot in the window before sending
+    ClientStatsHistogram latency;
+    ClientStatsHistogram queued;
+} ClientStatsOp;
+
+
+/**
+ * statistics of the requests sent to the server, updated by all
+ * threads without locking. the state of the transport and the attrcache
+ * is read from them when formatting
+ */
+typedef struct ClientStats {
+    ClientStatsOp ops[CLIENTSTATS_N_REQUEST_TYPES];
+
+    uint64_t started_ns;
+
+    // each may be NULL
+    Transport * transport;
+    AttrCache * attrcache;
+    CompressPolicy * compresspolicy;
+} ClientStats;
+
+
+void ClientStats_init(ClientStats * stats, Transport * transport, AttrCache * attrcache,
+        CompressPolicy * compresspolicy);
+
+/**
+ * count a request which has been answered or failed
+ *
+ * "err" is 0 or the errno reported by the server, or EAGAIN, EINTR
+ * or any other errno when the request got no answer. "latency_ns" and
+ * "queued_ns" are only used for answered requests
+ */
+void ClientStats_record(ClientStats * stats, int request_type, int err, bool answered,
+        size_t request_size, size_t reply_size, uint64_t latency_ns, uint64_t queued_ns);
+
+/**
+ * format the statistics as text, one value per line
+ *
+ * returns a newly allocated string the caller is responsible for
+ * freeing or NULL on error. "size" is set to its length
+ */
+char * ClientStats_format(ClientStats * stats, size_t * size);
+
+#endif /* __fs_clientstats_h__ */
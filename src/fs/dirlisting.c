@@ -0,0 +1,271 @@
+#include "dirlisting.h"
+
+#include <string.h>
+
+#include "../dbg.h"
+
+#define DIRLISTING_MIN_CAPACITY 16
+
+// prototypes
+static bool DirListing_reserve(DirListing * listing, size_t capacity);
+static bool DirListing_search(const DirListing * listing, const char * name, size_t * pos);
+
+
+DirListing *
+DirListing_create()
+{
+    DirListing * listing = NULL;
+    listing = calloc(sizeof(DirListing), 1);
+    check_mem(listing);
+
+    return listing;
+error:
+    return NULL;
+}
+
+
+void
+DirListing_destroy(DirListing * listing)
+{
+    if (listing) {
+        for (size_t i=0; i<listing->n_entries; i++) {
+            free(listing->entries[i].name);
+        }
+        free(listing->entries);
+        free(listing->sorted);
+        free(listing);
+    }
+}
+
+
+DirListing *
+DirListing_copy(const DirListing * listing)
+{
+    DirListing * copy = DirListing_create();
+    check_mem(copy);
+
+    check(DirListing_reserve(copy, listing->n_entries),
+            "Could not allocate entries of listing copy");
+    for (size_t i=0; i<listing->n_entries; i++) {
+        copy->entries[i].name = strdup(listing->entries[i].name);
+        check_mem(copy->entries[i].name);
+        copy->entries[i].type = listing->entries[i].type;
+        copy->n_entries++;
+    }
+    copy->validator = listing->validator;
+    copy->cache_creation_ts = listing->cache_creation_ts;
+
+    return copy;
+
+error:
+    DirListing_destroy(copy);
+    return NULL;
+}
+
+
+bool
+DirListing_append(DirListing * listing, const char * name, mode_t type)
+{
+    char * name_copy = NULL;
+
+    check((listing->sorted == NULL), "listing has already been indexed");
+
+    if (listing->n_entries == listing->capacity) {
+        check(DirListing_reserve(listing, listing->capacity * 2),
+                "Could not grow listing");
+    }
+
+    name_copy = strdup(name);
+    check_mem(name_copy);
+
+    listing->entries[listing->n_entries].name = name_copy;
+    listing->entries[listing->n_entries].type = type & S_IFMT;
+    listing->n_entries++;
+
+    return true;
+
+error:
+    return false;
+}
+
+
+static int
+DirListing_compare_entries(const void * entry1, const void * entry2)
+{
+    return strcmp((*(DirListingEntry * const *)entry1)->name,
+                  (*(DirListingEntry * const *)entry2)->name);
+}
+
+
+bool
+DirListing_index(DirListing * listing)
+{
+    DirListingEntry ** by_name = NULL;
+
+    free(listing->sorted);
+    listing->sorted = calloc(sizeof(size_t), listing->capacity ? listing->capacity : 1);
+    check_mem(listing->sorted);
+
+    // sort pointers to the entries, their offsets are the indices
+    by_name = calloc(sizeof(DirListingEntry *), listing->n_entries ? listing->n_entries : 1);
+    check_mem(by_name);
+    for (size_t i=0; i<listing->n_entries; i++) {
+        by_name[i] = &(listing->entries[i]);
+    }
+    qsort(by_name, listing->n_entries, sizeof(DirListingEntry *), DirListing_compare_entries);
+
+    for (size_t i=0; i<listing->n_entries; i++) {
+        listing->sorted[i] = (size_t)(by_name[i] - listing->entries);
+    }
+
+    free(by_name);
+    return true;
+
+error:
+    free(listing->sorted);
+    listing->sorted = NULL;
+    return false;
+}
+
+
+DirListingEntry *
+DirListing_find(const DirListing * listing, const char * name)
+{
+    size_t pos = 0;
+
+    if (DirListing_search(listing, name, &pos)) {
+        return &(listing->entries[listing->sorted[pos]]);
+    }
+    return NULL;
+}
+
+
+bool
+DirListing_insert(DirListing * listing, const char * name, mode_t type)
+{
+    size_t pos = 0;
+    char * name_copy = NULL;
+
+    check((listing->sorted != NULL), "listing has not been indexed");
+
+    if (DirListing_search(listing, name, &pos)) {
+        listing->entries[listing->sorted[pos]].type = type & S_IFMT;
+        return true;
+    }
+
+    if (listing->n_entries == listing->capacity) {
+        check(DirListing_reserve(listing, listing->capacity * 2),
+                "Could not grow listing");
+    }
+
+    name_copy = strdup(name);
+    check_mem(name_copy);
+
+    listing->entries[listing->n_entries].name = name_copy;
+    listing->entries[listing->n_entries].type = type & S_IFMT;
+
+    memmove(&(listing->sorted[pos+1]), &(listing->sorted[pos]),
+            (listing->n_entries - pos) * sizeof(size_t));
+    listing->sorted[pos] = listing->n_entries;
+    listing->n_entries++;
+
+    return true;
+
+error:
+    return false;
+}
+
+
+void
+DirListing_remove(DirListing * listing, const char * name)
+{
+    size_t pos = 0;
+
+    if ((listing->sorted == NULL) || !DirListing_search(listing, name, &pos)) {
+        return;
+    }
+
+    size_t removed = listing->sorted[pos];
+    free(listing->entries[removed].name);
+
+    // keep the order of the remaining entries
+    memmove(&(listing->entries[removed]), &(listing->entries[removed+1]),
+            (listing->n_entries - removed - 1) * sizeof(DirListingEntry));
+    memmove(&(listing->sorted[pos]), &(listing->sorted[pos+1]),
+            (listing->n_entries - pos - 1) * sizeof(size_t));
+    listing->n_entries--;
+
+    for (size_t i=0; i<listing->n_entries; i++) {
+        if (listing->sorted[i] > removed) {
+            listing->sorted[i]--;
+        }
+    }
+}
+
+
+/**
+ * grow the entries and the index to hold at least "capacity" entries
+ */
+static bool
+DirListing_reserve(DirListing * listing, size_t capacity)
+{
+    if (capacity < DIRLISTING_MIN_CAPACITY) {
+        capacity = DIRLISTING_MIN_CAPACITY;
+    }
+    if (capacity <= listing->capacity) {
+        return true;
+    }
+
+    DirListingEntry * entries = realloc(listing->entries, capacity * sizeof(DirListingEntry));
+    check_mem(entries);
+    listing->entries = entries;
+
+    if (listing->sorted != NULL) {
+        size_t * sorted = realloc(listing->sorted, capacity * sizeof(size_t));
+        check_mem(sorted);
+        listing->sorted = sorted;
+    }
+    listing->capacity = capacity;
+
+    return true;
+
+error:
+    return false;
+}
+
+
+/**
+ * binary search for a name in the index
+ *
+ * returns true if the name was found. "pos" is set to the position
+ * of the name in the index or to the position it would have to be
+ * inserted at
+ */
+static bool
+DirListing_search(const DirListing * listing, const char * name, size_t * pos)
+{
+    size_t low = 0;
+    size_t high = listing->n_entries;
+
+    if (listing->sorted == NULL) {
+        *pos = 0;
+        return false;
+    }
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = strcmp(listing->entries[listing->sorted[mid]].name, name);
+        if (cmp == 0) {
+            *pos = mid;
+            return true;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    *pos = low;
+    return false;
+}
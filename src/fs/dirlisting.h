@@ -0,0 +1,91 @@
+#ifndef __fs_dirlisting_h__
+#define __fs_dirlisting_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+
+typedef struct DirListingEntry {
+    char * name;
+
+    // the file type bits of st_mode. 0 if unknown
+    mode_t type;
+} DirListingEntry;
+
+
+/**
+ * the names of the entries of a directory as listed by the server.
+ *
+ * a complete listing proves which names do not exist in the directory
+ */
+typedef struct DirListing {
+    // the entries in the order of the listing
+    DirListingEntry * entries;
+    size_t n_entries;
+    size_t capacity;
+
+    // indices of the entries sorted by name. NULL until the
+    // listing has been indexed
+    size_t * sorted;
+
+    // validator of the listing sent by the server. 0 if the
+    // server did not send one
+    uint64_t validator;
+
+    // timestamp of the creation or the last revalidation of
+    // the listing
+    time_t cache_creation_ts;
+} DirListing;
+
+
+DirListing * DirListing_create();
+void DirListing_destroy(DirListing * listing);
+
+/**
+ * create a copy of the entries and the validator of a listing. the
+ * copy is not indexed
+ *
+ * returns NULL on error
+ */
+DirListing * DirListing_copy(const DirListing * listing);
+
+/**
+ * add an entry at the end of the listing. the index is not updated,
+ * so this may only be used before DirListing_index
+ *
+ * returns false on error
+ */
+bool DirListing_append(DirListing * listing, const char * name, mode_t type);
+
+/**
+ * build the index used for looking up names
+ *
+ * returns false on error
+ */
+bool DirListing_index(DirListing * listing);
+
+/**
+ * look up a name in an indexed listing
+ *
+ * returns the entry or NULL if the name is not part of the listing
+ */
+DirListingEntry * DirListing_find(const DirListing * listing, const char * name);
+
+/**
+ * add an entry to an indexed listing. the type of an existing
+ * entry with the same name will be replaced
+ *
+ * returns false on error
+ */
+bool DirListing_insert(DirListing * listing, const char * name, mode_t type);
+
+/**
+ * remove an entry from an indexed listing
+ */
+void DirListing_remove(DirListing * listing, const char * name);
+
+#endif /* __fs_dirlisting_h__ */
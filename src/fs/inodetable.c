@@ -0,0 +1,390 @@
+#include "inodetable.h"
+
+#include <string.h>
+
+#include "../hashfunc.h"
+#include "../dbg.h"
+
+// prototypes
+static hash_val_t InodeTable_hash_ino(const void * key);
+static int InodeTable_compare_ino(const void * key1, const void * key2);
+static InodeEntry * InodeTable_find_path(InodeTable * it, const char * path);
+static InodeEntry * InodeTable_add(InodeTable * it, uint64_t ino, const char * path);
+static void InodeTable_unlink(InodeTable * it, InodeEntry * entry);
+static void InodeTable_delete(InodeTable * it, InodeEntry * entry);
+
+
+bool
+InodeTable_init(InodeTable * it)
+{
+    check((it != NULL), "the inodetable parameter is NULL");
+
+    memset(it, 0, sizeof(InodeTable));
+
+    it->by_ino = hash_create(HASHCOUNT_T_MAX,
+            InodeTable_compare_ino,
+            InodeTable_hash_ino);
+    check_mem(it->by_ino);
+
+    it->by_path = hash_create(HASHCOUNT_T_MAX,
+            (hash_comp_t)strcmp,
+            (hash_fun_t)Hashfunc_djb2);
+    check_mem(it->by_path);
+
+    check(pthread_mutex_init(&(it->mutex), NULL) == 0,
+            "Could not initialize inodetable mutex");
+
+    // the kernel never forgets the root
+    InodeEntry * root = InodeTable_add(it, INODETABLE_ROOT_INO, "/");
+    check((root != NULL), "Could not add the root inode");
+    root->nlookup = 1;
+    it->next_ino = INODETABLE_ROOT_INO + 1;
+
+    return true;
+
+error:
+    InodeTable_deinit(it);
+    return false;
+}
+
+
+void
+InodeTable_deinit(InodeTable * it)
+{
+    if (it == NULL) {
+        return;
+    }
+
+    if (it->by_path) {
+        hash_free_nodes(it->by_path);
+        hash_destroy(it->by_path);
+        it->by_path = NULL;
+    }
+    if (it->by_ino) {
+        hscan_t hash_scan;
+        hnode_t * hash_node = NULL;
+
+        hash_scan_begin(&hash_scan, it->by_ino);
+        while ((hash_node = hash_scan_next(&hash_scan))) {
+            InodeEntry * entry = hnode_get(hash_node);
+            hash_scan_delfree(it->by_ino, hash_node);
+            free(entry->path);
+            free(entry);
+        }
+        hash_destroy(it->by_ino);
+        it->by_ino = NULL;
+
+        pthread_mutex_destroy(&(it->mutex));
+    }
+}
+
+
+uint64_t
+InodeTable_lookup(InodeTable * it, const char * path)
+{
+    uint64_t ino = 0;
+
+    check((path != NULL), "passed path is null");
+
+    pthread_mutex_lock(&(it->mutex));
+
+    InodeEntry * entry = InodeTable_find_path(it, path);
+    if (entry == NULL) {
+        entry = InodeTable_add(it, it->next_ino, path);
+        if (entry != NULL) {
+            it->next_ino++;
+        }
+    }
+    if (entry != NULL) {
+        entry->nlookup++;
+        ino = entry->ino;
+    }
+
+    pthread_mutex_unlock(&(it->mutex));
+    return ino;
+
+error:
+    return 0;
+}
+
+
+uint64_t
+InodeTable_peek(InodeTable * it, const char * path)
+{
+    uint64_t ino = 0;
+
+    pthread_mutex_lock(&(it->mutex));
+    InodeEntry * entry = InodeTable_find_path(it, path);
+    if (entry != NULL) {
+        ino = entry->ino;
+    }
+    pthread_mutex_unlock(&(it->mutex));
+
+    return ino;
+}
+
+
+bool
+InodeTable_hold(InodeTable * it, uint64_t ino)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&(it->mutex));
+    hnode_t * hash_node = hash_lookup(it->by_ino, &ino);
+    if (hash_node != NULL) {
+        InodeEntry * entry = hnode_get(hash_node);
+        entry->nlookup++;
+        found = true;
+    }
+    pthread_mutex_unlock(&(it->mutex));
+
+    return found;
+}
+
+
+uint64_t *
+InodeTable_list(InodeTable * it, size_t * n_inodes)
+{
+    uint64_t * inodes = NULL;
+    hscan_t hash_scan;
+    hnode_t * hash_node = NULL;
+
+    pthread_mutex_lock(&(it->mutex));
+
+    *n_inodes = 0;
+    inodes = calloc(sizeof(uint64_t), hash_count(it->by_ino) + 1);
+    if (inodes != NULL) {
+        hash_scan_begin(&hash_scan, it->by_ino);
+        while ((hash_node = hash_scan_next(&hash_scan))) {
+            InodeEntry * entry = hnode_get(hash_node);
+            inodes[(*n_inodes)++] = entry->ino;
+        }
+    }
+
+    pthread_mutex_unlock(&(it->mutex));
+
+    check_mem(inodes);
+    return inodes;
+
+error:
+    return NULL;
+}
+
+
+char *
+InodeTable_get_path(InodeTable * it, uint64_t ino)
+{
+    char * path = NULL;
+
+    pthread_mutex_lock(&(it->mutex));
+    hnode_t * hash_node = hash_lookup(it->by_ino, &ino);
+    if (hash_node != NULL) {
+        InodeEntry * entry = hnode_get(hash_node);
+        if (entry->path != NULL) {
+            path = strdup(entry->path);
+        }
+    }
+    pthread_mutex_unlock(&(it->mutex));
+
+    if (path == NULL) {
+        debug("no path for inode %llu", (unsigned long long)ino);
+    }
+    return path;
+}
+
+
+void
+InodeTable_forget(InodeTable * it, uint64_t ino, uint64_t nlookup)
+{
+    if (ino == INODETABLE_ROOT_INO) {
+        return;
+    }
+
+    pthread_mutex_lock(&(it->mutex));
+    hnode_t * hash_node = hash_lookup(it->by_ino, &ino);
+    if (hash_node != NULL) {
+        InodeEntry * entry = hnode_get(hash_node);
+        if (entry->nlookup > nlookup) {
+            entry->nlookup -= nlookup;
+        }
+        else {
+            InodeTable_delete(it, entry);
+        }
+    }
+    pthread_mutex_unlock(&(it->mutex));
+}
+
+
+void
+InodeTable_rename(InodeTable * it, const char * path_from, const char * path_to)
+{
+    size_t from_len = strlen(path_from);
+    InodeEntry ** moved = NULL;
+    size_t n_moved = 0;
+
+    if (strcmp(path_from, path_to) == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&(it->mutex));
+
+    InodeEntry * target = InodeTable_find_path(it, path_to);
+    if (target != NULL) {
+        InodeTable_unlink(it, target);
+    }
+
+    // collect the renamed inode and everything below it
+    moved = calloc(sizeof(InodeEntry *), hash_count(it->by_path));
+    check_mem(moved);
+
+    hscan_t hash_scan;
+    hnode_t * hash_node = NULL;
+    hash_scan_begin(&hash_scan, it->by_path);
+    while ((hash_node = hash_scan_next(&hash_scan))) {
+        InodeEntry * entry = hnode_get(hash_node);
+        if ((strncmp(entry->path, path_from, from_len) == 0) &&
+                ((entry->path[from_len] == '\0') || (entry->path[from_len] == '/'))) {
+            hash_scan_delfree(it->by_path, hash_node);
+            moved[n_moved++] = entry;
+        }
+    }
+
+    for (size_t i=0; i<n_moved; i++) {
+        InodeEntry * entry = moved[i];
+        char * new_path = malloc(strlen(path_to) + strlen(entry->path + from_len) + 1);
+        if (new_path == NULL) {
+            log_err("Could not allocate path for renamed inode");
+            free(entry->path);
+            entry->path = NULL;
+            continue;
+        }
+        strcpy(new_path, path_to);
+        strcat(new_path, entry->path + from_len);
+        free(entry->path);
+        entry->path = new_path;
+
+        if (hash_alloc_insert(it->by_path, entry->path, entry) != 1) {
+            log_err("Could not add renamed inode %s", entry->path);
+            free(entry->path);
+            entry->path = NULL;
+        }
+    }
+
+error:
+    free(moved);
+    pthread_mutex_unlock(&(it->mutex));
+}
+
+
+void
+InodeTable_remove(InodeTable * it, const char * path)
+{
+    pthread_mutex_lock(&(it->mutex));
+    InodeEntry * entry = InodeTable_find_path(it, path);
+    if ((entry != NULL) && (entry->ino != INODETABLE_ROOT_INO)) {
+        InodeTable_unlink(it, entry);
+    }
+    pthread_mutex_unlock(&(it->mutex));
+}
+
+
+static hash_val_t
+InodeTable_hash_ino(const void * key)
+{
+    // inode numbers are handed out sequentially, so they are
+    // spread evenly over the chains
+    return (hash_val_t)(*(const uint64_t *)key);
+}
+
+
+static int
+InodeTable_compare_ino(const void * key1, const void * key2)
+{
+    return (*(const uint64_t *)key1 == *(const uint64_t *)key2) ? 0 : 1;
+}
+
+
+/**
+ * has to be called with the mutex locked
+ */
+static InodeEntry *
+InodeTable_find_path(InodeTable * it, const char * path)
+{
+    hnode_t * hash_node = hash_lookup(it->by_path, path);
+    if (hash_node == NULL) {
+        return NULL;
+    }
+    return hnode_get(hash_node);
+}
+
+
+/**
+ * create a new entry with a lookup count of 0
+ *
+ * has to be called with the mutex locked
+ */
+static InodeEntry *
+InodeTable_add(InodeTable * it, uint64_t ino, const char * path)
+{
+    InodeEntry * entry = calloc(sizeof(InodeEntry), 1);
+    check_mem(entry);
+
+    entry->ino = ino;
+    entry->path = strdup(path);
+    check_mem(entry->path);
+
+    check((hash_alloc_insert(it->by_ino, &(entry->ino), entry) == 1),
+            "Could not add inode %llu", (unsigned long long)ino);
+    if (hash_alloc_insert(it->by_path, entry->path, entry) != 1) {
+        hash_delete_free(it->by_ino, hash_lookup(it->by_ino, &(entry->ino)));
+        log_and_error("Could not add path %s", path);
+    }
+
+    debug("added inode %llu for %s", (unsigned long long)ino, path);
+    return entry;
+
+error:
+    if (entry) {
+        free(entry->path);
+        free(entry);
+    }
+    return NULL;
+}
+
+
+/**
+ * remove the path of an entry. the inode stays valid until the
+ * kernel forgets it
+ *
+ * has to be called with the mutex locked
+ */
+static void
+InodeTable_unlink(InodeTable * it, InodeEntry * entry)
+{
+    if (entry->path != NULL) {
+        hnode_t * hash_node = hash_lookup(it->by_path, entry->path);
+        if (hash_node != NULL) {
+            hash_delete_free(it->by_path, hash_node);
+        }
+        free(entry->path);
+        entry->path = NULL;
+    }
+}
+
+
+/**
+ * has to be called with the mutex locked
+ */
+static void
+InodeTable_delete(InodeTable * it, InodeEntry * entry)
+{
+    debug("forgetting inode %llu", (unsigned long long)entry->ino);
+
+    InodeTable_unlink(it, entry);
+
+    hnode_t * hash_node = hash_lookup(it->by_ino, &(entry->ino));
+    if (hash_node != NULL) {
+        hash_delete_free(it->by_ino, hash_node);
+    }
+    free(entry);
+}
@@ -0,0 +1,110 @@
+#ifndef __fs_inodetable_h__
+#define __fs_inodetable_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "../kazlib/hash.h"
+
+/* inode number of the root directory. the same as FUSE_ROOT_ID */
+#define INODETABLE_ROOT_INO 1
+
+
+typedef struct InodeEntry {
+    uint64_t ino;
+
+    // the path of the inode on the server. NULL after the
+    // inode has been unlinked
+    char * path;
+
+    // number of lookups not yet forgotten by the kernel
+    uint64_t nlookup;
+} InodeEntry;
+
+
+/**
+ * maps the inode numbers handed out to the kernel to the paths
+ * on the server
+ *
+ * inode numbers are assigned by the client. an inode lives as long
+ * as the kernel holds a reference to it, which is counted by lookups
+ * and released by forgets.
+ */
+typedef struct InodeTable {
+    hash_t * by_ino;
+    hash_t * by_path;
+
+    uint64_t next_ino;
+
+    pthread_mutex_t mutex;
+} InodeTable;
+
+
+/**
+ * initialize the inodetable. the root directory is always present
+ *
+ * returns false on error
+ */
+bool InodeTable_init(InodeTable * it);
+
+void InodeTable_deinit(InodeTable * it);
+
+/**
+ * get the inode of a path and increase its lookup count. the inode
+ * will be created if the path is not known yet
+ *
+ * returns 0 on error
+ */
+uint64_t InodeTable_lookup(InodeTable * it, const char * path);
+
+/**
+ * get the inode of a path without increasing its lookup count
+ *
+ * returns 0 if the path is not known
+ */
+uint64_t InodeTable_peek(InodeTable * it, const char * path);
+
+/**
+ * increase the lookup count of a known inode
+ *
+ * returns false if the inode is unknown
+ */
+bool InodeTable_hold(InodeTable * it, uint64_t ino);
+
+/**
+ * get the numbers of all inodes known to the kernel
+ *
+ * returns a newly allocated array of "n_inodes" inode numbers the
+ * caller is responsible for freeing or NULL on error
+ */
+uint64_t * InodeTable_list(InodeTable * it, size_t * n_inodes);
+
+/**
+ * get the path of an inode
+ *
+ * returns a newly allocated string the caller is responsible
+ * for freeing or NULL if the inode is unknown or has been unlinked
+ */
+char * InodeTable_get_path(InodeTable * it, uint64_t ino);
+
+/**
+ * decrease the lookup count of an inode by "nlookup". the inode
+ * is removed when the count drops to 0
+ */
+void InodeTable_forget(InodeTable * it, uint64_t ino, uint64_t nlookup);
+
+/**
+ * update the paths after "path_from" has been renamed to "path_to".
+ * an inode at "path_to" gets unlinked, the inodes below a renamed
+ * directory are moved along with it
+ */
+void InodeTable_rename(InodeTable * it, const char * path_from, const char * path_to);
+
+/**
+ * unlink the inode of a path which has been removed on the server
+ */
+void InodeTable_remove(InodeTable * it, const char * path);
+
+#endif /* __fs_inodetable_h__ */
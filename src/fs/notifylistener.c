@@ -0,0 +1,176 @@
+#include "notifylistener.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zmq.h>
+
+#include "transport.h"
+#include "../notification.h"
+#include "../dbg.h"
+
+// prototypes
+static void * NotifyListener_thread(void * arg);
+static void NotifyListener_receive(NotifyListener * nl);
+static void NotifyListener_overflow(NotifyListener * nl);
+
+
+bool
+NotifyListener_init(NotifyListener * nl, void * context, const char * socket_name,
+        NotifyListener_callback_t callback, void * ctx, const char *server_public_key,
+        const char *client_public_key, const char *client_secret_key)
+{
+    check((nl != NULL), "passed listener is null");
+
+    memset(nl, 0, sizeof(NotifyListener));
+    nl->wakeup_fds[0] = -1;
+    nl->wakeup_fds[1] = -1;
+    nl->callback = callback;
+    nl->ctx = ctx;
+
+    check((pipe(nl->wakeup_fds) == 0), "Could not create listener wakeup pipe");
+
+    nl->socket = create_socket(context, ZMQ_SUB, server_public_key,
+            client_public_key, client_secret_key);
+    check((nl->socket != NULL), "Could not create notification socket");
+
+    // notifications are small. the sequence tells when some got lost
+    int hwm = NOTIFYLISTENER_DEFAULT_HWM;
+    zmq_setsockopt(nl->socket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    check((zmq_setsockopt(nl->socket, ZMQ_SUBSCRIBE, "", 0) == 0),
+            "Could not subscribe to notifications");
+
+    check((zmq_connect(nl->socket, socket_name) == 0), "could not connect to socket %s", socket_name);
+
+    check((pthread_create(&(nl->thread), NULL, NotifyListener_thread, nl) == 0),
+            "Could not start listener thread");
+    nl->thread_started = true;
+
+    return true;
+
+error:
+    NotifyListener_deinit(nl);
+    return false;
+}
+
+
+void
+NotifyListener_deinit(NotifyListener * nl)
+{
+    if (nl == NULL || nl->callback == NULL) {
+        return;
+    }
+
+    if (nl->thread_started) {
+        if (write(nl->wakeup_fds[1], "", 1) != 1) {
+            debug("could not wake up the listener thread");
+        }
+        pthread_join(nl->thread, NULL);
+        nl->thread_started = false;
+    }
+
+    if (nl->socket != NULL) {
+        zmq_close(nl->socket);
+        nl->socket = NULL;
+    }
+    for (int i=0; i<2; i++) {
+        if (nl->wakeup_fds[i] != -1) {
+            close(nl->wakeup_fds[i]);
+            nl->wakeup_fds[i] = -1;
+        }
+    }
+    nl->callback = NULL;
+}
+
+
+static void *
+NotifyListener_thread(void * arg)
+{
+    NotifyListener * nl = (NotifyListener *)arg;
+
+    while (true) {
+        zmq_pollitem_t pollset[] = {
+            { nl->socket, 0,                ZMQ_POLLIN, 0 },
+            { NULL,       nl->wakeup_fds[0], ZMQ_POLLIN, 0 }
+        };
+        if (zmq_poll(pollset, 2, -1) == -1) {
+            if (errno == ETERM) {
+                log_err("the 0mq context has been terminated");
+                break;
+            }
+            continue;
+        }
+
+        if (pollset[1].revents & ZMQ_POLLIN) {
+            break;
+        }
+        if (pollset[0].revents & ZMQ_POLLIN) {
+            NotifyListener_receive(nl);
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+NotifyListener_receive(NotifyListener * nl)
+{
+    zmq_msg_t msg;
+    Rhizofs__Notification * notification = NULL;
+
+    check((zmq_msg_init(&msg) == 0), "Could not initialize notification message");
+
+    while (zmq_msg_recv(&msg, nl->socket, ZMQ_DONTWAIT) != -1) {
+        notification = Notification_from_message(&msg);
+        if (notification == NULL) {
+            log_warn("Could not unpack notification");
+            NotifyListener_overflow(nl);
+            continue;
+        }
+
+        // the server restarted or notifications were dropped on the
+        // way. everything may have changed in between
+        uint64_t expected = nl->sequence;
+        if (notification->notificationtype != RHIZOFS__NOTIFICATION_TYPE__NT_HEARTBEAT) {
+            expected++;
+        }
+        if (notification->sequence != expected) {
+            log_warn("Lost notifications (expected %llu, got %llu)",
+                    (unsigned long long)expected,
+                    (unsigned long long)notification->sequence);
+            NotifyListener_overflow(nl);
+        }
+        nl->sequence = notification->sequence;
+
+        if (notification->notificationtype != RHIZOFS__NOTIFICATION_TYPE__NT_HEARTBEAT) {
+            nl->callback(notification, nl->ctx);
+        }
+
+        Notification_from_message_destroy(notification);
+        notification = NULL;
+    }
+
+    zmq_msg_close(&msg);
+
+error:
+    return;
+}
+
+
+/**
+ * tell the callback that notifications have been lost
+ */
+static void
+NotifyListener_overflow(NotifyListener * nl)
+{
+    Rhizofs__Notification notification;
+    Rhizofs__Version version;
+
+    Notification_init(&notification, &version);
+    notification.notificationtype = RHIZOFS__NOTIFICATION_TYPE__NT_OVERFLOW;
+    notification.sequence = nl->sequence;
+
+    nl->callback(&notification, nl->ctx);
+}
@@ -0,0 +1,63 @@
+#ifndef __fs_notifylistener_h__
+#define __fs_notifylistener_h__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../proto/rhizofs.pb-c.h"
+
+/* number of notifications queued in the socket before further
+ * ones get dropped */
+#define NOTIFYLISTENER_DEFAULT_HWM 100000
+
+
+/**
+ * called by the thread of the listener for every notification. lost
+ * notifications are reported as a notification of the type
+ * NT_OVERFLOW
+ */
+typedef void (*NotifyListener_callback_t)(const Rhizofs__Notification * notification, void * ctx);
+
+
+/**
+ * subscribes to the changes published by the server and passes
+ * them on to a callback
+ */
+typedef struct NotifyListener {
+    void * socket;
+
+    pthread_t thread;
+    bool thread_started;
+
+    // written to to stop the thread
+    int wakeup_fds[2];
+
+    // the sequence of the last notification received. the first
+    // notification reports a gap unless the server just started,
+    // which drops what has been cached before the connection was
+    // established
+    uint64_t sequence;
+
+    NotifyListener_callback_t callback;
+    void * ctx;
+} NotifyListener;
+
+
+/**
+ * subscribe to the notifications published on "socket_name" and start
+ * the thread. the keys may be NULL when encryption is not used
+ *
+ * returns false on error
+ */
+bool NotifyListener_init(NotifyListener * nl, void * context, const char * socket_name,
+        NotifyListener_callback_t callback, void * ctx, const char *server_public_key,
+        const char *client_public_key, const char *client_secret_key);
+
+/**
+ * stop the thread and close the socket
+ */
+void NotifyListener_deinit(NotifyListener * nl);
+
+#endif /* __fs_notifylistener_h__ */
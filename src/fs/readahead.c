@@ -0,0 +1,483 @@
+#include "readahead.h"
+
+#include <string.h>
+
+#include "../dbg.h"
+
+// prototypes
+static void * ReadAheadPool_worker(void * arg);
+static ReadAheadBlock * ReadAhead_find_block(ReadAhead * ra, off_t offset);
+static void ReadAhead_drop_blocks(ReadAhead * ra, off_t before);
+static void ReadAhead_cancel(ReadAhead * ra);
+static void ReadAhead_schedule(ReadAhead * ra);
+static void ReadAhead_update(ReadAhead * ra, size_t size, off_t offset, bool hit);
+
+
+// #### ReadAheadPool #########################################
+
+bool
+ReadAheadPool_init(ReadAheadPool * pool, unsigned int n_threads, ReadAhead_fetch_fn fetch)
+{
+    check((pool != NULL), "passed pool is null");
+    check((fetch != NULL), "passed fetch function is null");
+
+    memset(pool, 0, sizeof(ReadAheadPool));
+    pool->fetch = fetch;
+
+    check(pthread_mutex_init(&(pool->mutex), NULL) == 0,
+            "Could not initialize readahead pool mutex");
+    check(pthread_cond_init(&(pool->cond_job), NULL) == 0,
+            "Could not initialize readahead pool condition");
+
+    pool->threads = calloc(sizeof(pthread_t), n_threads);
+    check_mem(pool->threads);
+
+    while (pool->n_threads < n_threads) {
+        check((pthread_create(&(pool->threads[pool->n_threads]), NULL,
+                ReadAheadPool_worker, pool) == 0),
+                "Could not start readahead thread");
+        pool->n_threads++;
+    }
+
+    return true;
+
+error:
+    ReadAheadPool_deinit(pool);
+    return false;
+}
+
+
+void
+ReadAheadPool_deinit(ReadAheadPool * pool)
+{
+    if (pool && pool->threads) {
+        pthread_mutex_lock(&(pool->mutex));
+        pool->shutdown = true;
+        pthread_cond_broadcast(&(pool->cond_job));
+        pthread_mutex_unlock(&(pool->mutex));
+
+        for (unsigned int t=0; t<pool->n_threads; t++) {
+            pthread_join(pool->threads[t], NULL);
+        }
+        free(pool->threads);
+        pool->threads = NULL;
+        pool->n_threads = 0;
+
+        pthread_cond_destroy(&(pool->cond_job));
+        pthread_mutex_destroy(&(pool->mutex));
+    }
+}
+
+
+static void *
+ReadAheadPool_worker(void * arg)
+{
+    ReadAheadPool * pool = (ReadAheadPool *)arg;
+
+    pthread_mutex_lock(&(pool->mutex));
+    while (true) {
+        while (!pool->shutdown && (pool->queue_head == NULL)) {
+            pthread_cond_wait(&(pool->cond_job), &(pool->mutex));
+        }
+        if (pool->shutdown) {
+            break;
+        }
+
+        ReadAheadBlock * block = pool->queue_head;
+        pool->queue_head = block->next_job;
+        if (pool->queue_head == NULL) {
+            pool->queue_tail = NULL;
+        }
+        block->next_job = NULL;
+        pthread_mutex_unlock(&(pool->mutex));
+
+        // the block still counts as in flight, so the readahead
+        // struct will not be destroyed before it is done
+        ReadAhead * ra = block->readahead;
+
+        pthread_mutex_lock(&(ra->mutex));
+        block->state = RABLOCK_FETCHING;
+        pthread_mutex_unlock(&(ra->mutex));
+
+        debug("prefetching %d bytes at offset %lld", (int)block->size,
+                (long long)block->offset);
+        int rc = pool->fetch(ra->ctx, block->data, block->size, block->offset);
+
+        pthread_mutex_lock(&(ra->mutex));
+        if (block->discard) {
+            block->state = RABLOCK_EMPTY;
+        }
+        else if (rc < 0) {
+            debug("prefetching at offset %lld failed: %d", (long long)block->offset, rc);
+            block->state = RABLOCK_FAILED;
+        }
+        else {
+            block->len = (size_t)rc;
+            block->state = RABLOCK_READY;
+            if (block->len < block->size) {
+                ra->eof_offset = block->offset + (off_t)block->len;
+            }
+        }
+        block->discard = false;
+        ra->in_flight--;
+        pthread_cond_broadcast(&(ra->cond_done));
+        pthread_mutex_unlock(&(ra->mutex));
+
+        pthread_mutex_lock(&(pool->mutex));
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return NULL;
+}
+
+
+// #### ReadAhead #############################################
+
+ReadAhead *
+ReadAhead_create(ReadAheadPool * pool, void * ctx, unsigned int max_window)
+{
+    ReadAhead * ra = NULL;
+
+    check((pool != NULL), "passed pool is null");
+    check((max_window > 0), "the readahead window needs at least one block");
+
+    ra = calloc(sizeof(ReadAhead), 1);
+    check_mem(ra);
+
+    ra->blocks = calloc(sizeof(ReadAheadBlock), max_window);
+    check_mem(ra->blocks);
+
+    ra->pool = pool;
+    ra->ctx = ctx;
+    ra->max_window = max_window;
+    ra->window = READAHEAD_INITIAL_WINDOW < max_window ?
+            READAHEAD_INITIAL_WINDOW : max_window;
+    ra->block_size = READAHEAD_BLOCK_SIZE;
+    ra->next_offset = 0;
+    ra->eof_offset = -1;
+
+    check(pthread_mutex_init(&(ra->mutex), NULL) == 0,
+            "Could not initialize readahead mutex");
+    check(pthread_cond_init(&(ra->cond_done), NULL) == 0,
+            "Could not initialize readahead condition");
+
+    return ra;
+
+error:
+    if (ra) {
+        free(ra->blocks);
+        free(ra);
+    }
+    return NULL;
+}
+
+
+void
+ReadAhead_destroy(ReadAhead * ra)
+{
+    if (ra) {
+        pthread_mutex_lock(&(ra->mutex));
+        ReadAhead_cancel(ra);
+        while (ra->in_flight > 0) {
+            pthread_cond_wait(&(ra->cond_done), &(ra->mutex));
+        }
+        pthread_mutex_unlock(&(ra->mutex));
+
+        debug("readahead: %lu hits, %lu misses", ra->hits, ra->misses);
+
+        for (unsigned int i=0; i<ra->max_window; i++) {
+            free(ra->blocks[i].data);
+        }
+        free(ra->blocks);
+
+        pthread_cond_destroy(&(ra->cond_done));
+        pthread_mutex_destroy(&(ra->mutex));
+        free(ra);
+    }
+}
+
+
+int
+ReadAhead_read(ReadAhead * ra, uint8_t * buf, size_t size, off_t offset)
+{
+    size_t copied = 0;
+    bool eof = false;
+
+    pthread_mutex_lock(&(ra->mutex));
+
+    while (copied < size) {
+        off_t pos = offset + (off_t)copied;
+
+        if ((ra->eof_offset >= 0) && (pos >= ra->eof_offset)) {
+            eof = true;
+            break;
+        }
+
+        ReadAheadBlock * block = ReadAhead_find_block(ra, pos);
+        if (block == NULL) {
+            break;
+        }
+
+        if ((block->state == RABLOCK_QUEUED) || (block->state == RABLOCK_FETCHING)) {
+            // waiting is always cheaper than requesting the data again
+            pthread_cond_wait(&(ra->cond_done), &(ra->mutex));
+            continue;
+        }
+
+        if (block->state == RABLOCK_FAILED) {
+            block->state = RABLOCK_EMPTY;
+            break;
+        }
+
+        off_t available = (block->offset + (off_t)block->len) - pos;
+        if (available <= 0) {
+            break;
+        }
+        size_t n = (size_t)available < (size - copied) ? (size_t)available : (size - copied);
+        memcpy(buf + copied, block->data + (pos - block->offset), n);
+        copied += n;
+    }
+
+    // a short read is only trusted if there is data. otherwise
+    // the server has to confirm the end of the file
+    bool hit = (copied == size) || (eof && (copied > 0));
+
+    ReadAhead_update(ra, size, offset, hit);
+
+    pthread_mutex_unlock(&(ra->mutex));
+
+    return hit ? (int)copied : -1;
+}
+
+
+void
+ReadAhead_invalidate(ReadAhead * ra)
+{
+    if (ra) {
+        pthread_mutex_lock(&(ra->mutex));
+        ReadAhead_cancel(ra);
+        ra->eof_offset = -1;
+        pthread_mutex_unlock(&(ra->mutex));
+    }
+}
+
+
+/**
+ * find the block containing offset. discarded blocks are ignored
+ *
+ * has to be called with the mutex of the readahead locked
+ *
+ * returns NULL if there is no such block
+ */
+static ReadAheadBlock *
+ReadAhead_find_block(ReadAhead * ra, off_t offset)
+{
+    for (unsigned int i=0; i<ra->max_window; i++) {
+        ReadAheadBlock * block = &(ra->blocks[i]);
+        if ((block->state != RABLOCK_EMPTY) && !block->discard &&
+                (block->offset <= offset) &&
+                (offset < block->offset + (off_t)block->size)) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * drop the fetched blocks ending before "before"
+ *
+ * has to be called with the mutex of the readahead locked
+ */
+static void
+ReadAhead_drop_blocks(ReadAhead * ra, off_t before)
+{
+    for (unsigned int i=0; i<ra->max_window; i++) {
+        ReadAheadBlock * block = &(ra->blocks[i]);
+        if (((block->state == RABLOCK_READY) || (block->state == RABLOCK_FAILED)) &&
+                (block->offset + (off_t)block->size <= before)) {
+            block->state = RABLOCK_EMPTY;
+        }
+    }
+}
+
+
+/**
+ * drop all blocks. blocks still in the queue are removed from it,
+ * blocks being fetched get discarded as soon as they arrive
+ *
+ * has to be called with the mutex of the readahead locked
+ */
+static void
+ReadAhead_cancel(ReadAhead * ra)
+{
+    ReadAheadPool * pool = ra->pool;
+
+    pthread_mutex_lock(&(pool->mutex));
+    ReadAheadBlock * prev = NULL;
+    ReadAheadBlock * block = pool->queue_head;
+    while (block != NULL) {
+        ReadAheadBlock * next = block->next_job;
+        if (block->readahead == ra) {
+            if (prev == NULL) {
+                pool->queue_head = next;
+            }
+            else {
+                prev->next_job = next;
+            }
+            if (pool->queue_tail == block) {
+                pool->queue_tail = prev;
+            }
+            block->next_job = NULL;
+            block->state = RABLOCK_EMPTY;
+            ra->in_flight--;
+        }
+        else {
+            prev = block;
+        }
+        block = next;
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+
+    // blocks still queued here have already been taken
+    // from the queue by a worker
+    for (unsigned int i=0; i<ra->max_window; i++) {
+        block = &(ra->blocks[i]);
+        if ((block->state == RABLOCK_QUEUED) || (block->state == RABLOCK_FETCHING)) {
+            block->discard = true;
+        }
+        else {
+            block->state = RABLOCK_EMPTY;
+        }
+    }
+}
+
+
+/**
+ * queue requests for the blocks following next_offset until
+ * the window is filled
+ *
+ * has to be called with the mutex of the readahead locked
+ */
+static void
+ReadAhead_schedule(ReadAhead * ra)
+{
+    ReadAheadPool * pool = ra->pool;
+    unsigned int active = 0;
+    off_t pos = ra->next_offset;
+    ReadAheadBlock * block = NULL;
+
+    for (unsigned int i=0; i<ra->max_window; i++) {
+        if (ra->blocks[i].state != RABLOCK_EMPTY) {
+            active++;
+        }
+    }
+
+    // skip the blocks already present
+    while ((block = ReadAhead_find_block(ra, pos)) != NULL) {
+        pos = block->offset + (off_t)block->size;
+    }
+
+    for (unsigned int i=0; (i<ra->max_window) && (active < ra->window); i++) {
+        if ((ra->eof_offset >= 0) && (pos >= ra->eof_offset)) {
+            break;
+        }
+
+        block = &(ra->blocks[i]);
+        if (block->state != RABLOCK_EMPTY) {
+            continue;
+        }
+
+        if (block->capacity < ra->block_size) {
+            uint8_t * data = realloc(block->data, ra->block_size);
+            if (data == NULL) {
+                log_err("Could not allocate readahead buffer");
+                break;
+            }
+            block->data = data;
+            block->capacity = ra->block_size;
+        }
+
+        block->readahead = ra;
+        block->offset = pos;
+        block->size = ra->block_size;
+        block->len = 0;
+        block->discard = false;
+        block->state = RABLOCK_QUEUED;
+        ra->in_flight++;
+        active++;
+        pos += (off_t)ra->block_size;
+
+        pthread_mutex_lock(&(pool->mutex));
+        block->next_job = NULL;
+        if (pool->queue_tail != NULL) {
+            pool->queue_tail->next_job = block;
+        }
+        else {
+            pool->queue_head = block;
+        }
+        pool->queue_tail = block;
+        pthread_cond_signal(&(pool->cond_job));
+        pthread_mutex_unlock(&(pool->mutex));
+    }
+}
+
+
+/**
+ * update the access pattern detection after a read and adjust the
+ * window: it grows while prefetched blocks get used and shrinks
+ * when they get thrown away unread
+ *
+ * has to be called with the mutex of the readahead locked
+ */
+static void
+ReadAhead_update(ReadAhead * ra, size_t size, off_t offset, bool hit)
+{
+    // reads within the window may arrive out of order from
+    // concurrent fuse threads and still count as sequential
+    bool sequential = (offset == ra->next_offset) ||
+            (ReadAhead_find_block(ra, offset) != NULL);
+
+    if (hit) {
+        ra->hits++;
+    }
+    else {
+        ra->misses++;
+    }
+
+    if (sequential) {
+        ra->sequential_count++;
+        if (hit && (ra->window < ra->max_window)) {
+            ra->window = (ra->window * 2) < ra->max_window ? (ra->window * 2) : ra->max_window;
+            debug("readahead window grows to %u blocks", ra->window);
+        }
+        if (offset + (off_t)size > ra->next_offset) {
+            ra->next_offset = offset + (off_t)size;
+        }
+        ReadAhead_drop_blocks(ra, ra->next_offset);
+    }
+    else {
+        // random access. everything prefetched so far is useless
+        unsigned int wasted = 0;
+        for (unsigned int i=0; i<ra->max_window; i++) {
+            if (ra->blocks[i].state != RABLOCK_EMPTY) {
+                wasted++;
+            }
+        }
+        ReadAhead_cancel(ra);
+        if ((wasted > 0) && (ra->window > 1)) {
+            ra->window /= 2;
+            debug("readahead window shrinks to %u blocks", ra->window);
+        }
+        ra->sequential_count = 1;
+        ra->next_offset = offset + (off_t)size;
+    }
+
+    if (ra->sequential_count >= READAHEAD_SEQUENTIAL_THRESHOLD) {
+        if (ra->in_flight == 0 && ReadAhead_find_block(ra, ra->next_offset) == NULL) {
+            // start of a new stream
+            ra->block_size = size > READAHEAD_BLOCK_SIZE ? size : READAHEAD_BLOCK_SIZE;
+        }
+        ReadAhead_schedule(ra);
+    }
+}
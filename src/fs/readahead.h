@@ -0,0 +1,164 @@
+#ifndef __fs_readahead_h__
+#define __fs_readahead_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/* minimum size of a prefetched block */
+#define READAHEAD_BLOCK_SIZE (128 * 1024)
+
+/* number of consecutive sequential reads before prefetching starts */
+#define READAHEAD_SEQUENTIAL_THRESHOLD 2
+
+/* number of blocks prefetched when a sequential read is detected */
+#define READAHEAD_INITIAL_WINDOW 2
+
+
+/**
+ * fetch "size" bytes at "offset" of the file identified by "ctx"
+ * into "buf"
+ *
+ * returns the number of bytes read or a negative errno on failure
+ */
+typedef int (*ReadAhead_fetch_fn)(void * ctx, uint8_t * buf, size_t size, off_t offset);
+
+
+typedef enum ReadAheadBlockState {
+    RABLOCK_EMPTY = 0,
+    RABLOCK_QUEUED,
+    RABLOCK_FETCHING,
+    RABLOCK_READY,
+    RABLOCK_FAILED
+} ReadAheadBlockState;
+
+
+struct ReadAhead;
+
+typedef struct ReadAheadBlock {
+    ReadAheadBlockState state;
+
+    off_t offset;
+
+    // number of bytes requested from the server
+    size_t size;
+
+    // number of bytes received. less than size at the end of the file
+    size_t len;
+
+    uint8_t * data;
+    size_t capacity;
+
+    // the data got invalidated while being fetched
+    bool discard;
+
+    struct ReadAhead * readahead;
+
+    // link in the job queue of the pool
+    struct ReadAheadBlock * next_job;
+} ReadAheadBlock;
+
+
+/**
+ * the threads fetching blocks for all open files
+ */
+typedef struct ReadAheadPool {
+    pthread_t * threads;
+    unsigned int n_threads;
+
+    ReadAhead_fetch_fn fetch;
+
+    ReadAheadBlock * queue_head;
+    ReadAheadBlock * queue_tail;
+
+    bool shutdown;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_job;
+} ReadAheadPool;
+
+
+/**
+ * read-ahead state of an open file
+ */
+typedef struct ReadAhead {
+    ReadAheadPool * pool;
+
+    // passed to the fetch function
+    void * ctx;
+
+    // the prefetch window. max_window slots, of which up
+    // to "window" are used
+    ReadAheadBlock * blocks;
+    unsigned int max_window;
+    unsigned int window;
+
+    size_t block_size;
+
+    // offset the next read is expected at when reading sequentially
+    off_t next_offset;
+    unsigned int sequential_count;
+
+    // end of the file as learned from short reads. -1 if not known
+    off_t eof_offset;
+
+    // number of blocks queued or being fetched
+    unsigned int in_flight;
+
+    // statistics
+    unsigned long hits;
+    unsigned long misses;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_done;
+} ReadAhead;
+
+
+/**
+ * initialize the pool and start "n_threads" threads
+ *
+ * returns false on error
+ */
+bool ReadAheadPool_init(ReadAheadPool * pool, unsigned int n_threads, ReadAhead_fetch_fn fetch);
+
+/**
+ * stop the threads of the pool. all ReadAhead structs using this
+ * pool have to be destroyed before
+ */
+void ReadAheadPool_deinit(ReadAheadPool * pool);
+
+
+/**
+ * create the read-ahead state for an open file
+ *
+ * "max_window" is the maximum number of blocks kept in flight
+ *
+ * returns NULL on error
+ */
+ReadAhead * ReadAhead_create(ReadAheadPool * pool, void * ctx, unsigned int max_window);
+
+/**
+ * free the read-ahead state. waits for blocks still being fetched
+ */
+void ReadAhead_destroy(ReadAhead * ra);
+
+/**
+ * serve a read from the prefetched blocks and schedule the next blocks
+ * if the file is read sequentially.
+ *
+ * waits for blocks which are already being fetched.
+ *
+ * returns the number of bytes copied to buf, or -1 if the
+ * range is not (completely) available. in this case the caller has
+ * to fetch the data itself.
+ */
+int ReadAhead_read(ReadAhead * ra, uint8_t * buf, size_t size, off_t offset);
+
+/**
+ * drop all prefetched data. used when the file gets modified
+ */
+void ReadAhead_invalidate(ReadAhead * ra);
+
+#endif /* __fs_readahead_h__ */
@@ -10,32 +10,99 @@
 #include <pthread.h>
 #include <sys/time.h>
 
+#include "../codec.h"
+#include "../compresspolicy.h"
+#include "../codecpool.h"
 #include "../mapping.h"
 #include "../request.h"
 #include "../response.h"
 #include "../datablock.h"
-#include "socketpool.h"
+#include "transport.h"
 #include "../version.h"
 #include "../dbg.h"
 #include "../path.h"
 #include "../helptext.h"
 #include "attrcache.h"
+#include "inodetable.h"
+#include "readahead.h"
+#include "writeback.h"
+#include "notifylistener.h"
+#include "clientstats.h"
 
-// use the 2.6 fuse api
+// use the 3.4 fuse low-level api
 #ifndef FUSE_USE_VERSION
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 34
 #endif
-#include <fuse.h>
+#include <fuse_lowlevel.h>
 
 #include <zmq.h>
 
+/* inode number reported for directory entries whose inode is not known yet.
+ * the same value the high-level fuse api uses */
+#define RHIZOFS_UNKNOWN_INO 0xffffffff
 
-/** private data to be stored in the fuse context */
+
+/** private data of the mounted filesystem */
 typedef struct RhizoPriv {
     /** the zeromq context */
     void * context;
 } RhizoPriv;
 
+/** state of an open file. stored in fuse_file_info::fh */
+typedef struct RhizoFile {
+    /** the handle of the file on the server. 0 if the server
+     * did not keep the file open */
+    uint64_t handle;
+
+    /** the path the file was opened with. replaced when the file
+     * or a directory above it is renamed */
+    char * path;
+
+    /** paths replaced by renames. other threads may still use them,
+     * so they are kept until the file is closed */
+    char ** old_paths;
+    size_t n_old_paths;
+
+    /** list of all open files */
+    struct RhizoFile * prev;
+    struct RhizoFile * next;
+
+    /** NULL if read-ahead is disabled */
+    ReadAhead * readahead;
+
+    /** NULL if write-back is disabled or the file is read-only */
+    WriteBack * writeback;
+
+    /** the content of a virtual file of the client, taken when the
+     * file was opened. NULL for files on the server */
+    char * content;
+    size_t content_size;
+} RhizoFile;
+
+/** state of an open directory. stored in fuse_file_info::fh */
+typedef struct RhizoDir {
+    /** the path the directory was opened with */
+    char * path;
+
+    /** a complete listing the entries are served from. the offsets
+     * are the indices of the entries. NULL while streaming pages */
+    DirListing * listing;
+
+    /** the page of the listing fetched last while streaming. the
+     * offsets are the cookies of the server */
+    DirListing * page;
+    uint64_t * page_cookies;
+    bool page_is_last;
+
+    /** the pages read from the start of the listing in order. added
+     * to the attrcache once complete. NULL if the listing will not
+     * be cached */
+    DirListing * assembled;
+
+    /** the cookie following the last assembled entry */
+    uint64_t assembled_cookie;
+} RhizoDir;
+
 typedef struct RhizoSettings {
     /** the name of the zmq socket to connect to */
     char *host_socket;
@@ -56,10 +123,46 @@ typedef struct RhizoSettings {
      */
     uint32_t timeout;
 
-    /** check socket connection.
-     * this is set to false if the program is only supposed to
-     * print its help text and exit */
-    bool check_socket_connection;
+    /** maximum number of blocks to prefetch for files read
+     * sequentially. 0 disables read-ahead */
+    unsigned int readahead_window;
+
+    /** maximum number of requests sent to the server without
+     * having received their responses */
+    unsigned int max_in_flight;
+
+    /** maximum amount (in MB) of written data kept in memory before
+     * it is sent to the server. 0 disables write-back buffering */
+    unsigned int writeback_max_dirty_mb;
+
+    /** time (in seconds) for which paths are remembered to not
+     * exist. 0 disables negative caching */
+    unsigned int negative_ttl;
+
+    /** maximum number of paths kept in the attrcache. 0 disables
+     * the attrcache */
+    unsigned int attrcache_size;
+
+    /** time (in seconds) for which attributes and listings are
+     * cached */
+    unsigned int attr_ttl;
+
+    /** the name of the zmq socket the server publishes changes on.
+     * NULL if the client does not subscribe to them */
+    char *notify_socket;
+
+    /** the codec the data of reads and writes gets compressed with
+     * as given on the command line. NULL or "auto" to choose it by
+     * the address of the server */
+    char *compression;
+
+    /** number of threads compressing and decompressing the chunks
+     * of large blocks besides the threads of fuse */
+    unsigned int codec_threads;
+
+    /** 0 to send and receive the data of reads and writes inside the
+     * protobuf messages, like clients before data frames did */
+    unsigned int data_frames;
 
 } RhizoSettings;
 
@@ -82,21 +185,76 @@ static struct fuse_opt rhizo_opts[] = {
     OPTION("-k=%s",           server_public_key),
     OPTION("--pubkey=%s",     server_public_key),
     OPTION("--clientpubkeyfile=%s", client_public_key_file),
+    OPTION("--readahead=%u",  readahead_window),
+    OPTION("--inflight=%u",   max_in_flight),
+    OPTION("--writeback=%u",  writeback_max_dirty_mb),
+    OPTION("--negttl=%u",     negative_ttl),
+    OPTION("--attrcache=%u",  attrcache_size),
+    OPTION("--attrttl=%u",    attr_ttl),
+    OPTION("--notify=%s",     notify_socket),
+    OPTION("--compression=%s", compression),
+    OPTION("--codecthreads=%u", codec_threads),
+    OPTION("--dataframes=%u", data_frames),
     FUSE_OPT_END
 };
 
 // Prototypes
-bool Rhizofs_convert_attrs_stat(Rhizofs__Attrs * attrs, struct stat * stbuf);
-int Rhizofs_getattr_remote(const char *path, struct stat *stbuf);
+bool Rhizofs_convert_attrs_stat(Rhizofs__Attrs * attrs, struct stat * stbuf, fuse_req_t req);
+int Rhizofs_getattr_remote(fuse_req_t req, const char *path, struct stat *stbuf);
 static inline RhizoPriv * RhizoPriv_create();
 static inline void RhizoPriv_destroy(RhizoPriv * priv);
+static RhizoFile * RhizoFile_create(const char * path, uint64_t handle, int flags);
+static void RhizoFile_destroy(RhizoFile * file);
+static void RhizoFile_rename_all(const char * path_from, const char * path_to);
+static RhizoDir * RhizoDir_create(const char * path);
+static void RhizoDir_destroy(RhizoDir * dir);
+static void RhizoDir_reset(RhizoDir * dir);
+static int Rhizofs_read_remote(const char * path, uint64_t handle, uint8_t * buf,
+        size_t size, off_t offset, fuse_req_t req);
+static int Rhizofs_readahead_fetch(void * ctx, uint8_t * buf, size_t size, off_t offset);
+static int Rhizofs_write_remote(const char * path, uint64_t handle, const uint8_t * buf,
+        size_t size, off_t offset, fuse_req_t req);
+static int Rhizofs_writeback_write(void * ctx, const uint8_t * buf, size_t size, off_t offset);
+static int Rhizofs_release_remote(const char * path, uint64_t handle);
+static void Rhizofs_stale_reply(zmq_msg_t * reply, zmq_msg_t * reply_data);
+static void Rhizofs_start_keepalive();
+static void Rhizofs_handle_notification(const Rhizofs__Notification * notification, void * ctx);
 
 
 /** global settings store */
 static RhizoSettings settings;
 
-static SocketPool socketpool;
+/** the fuse session. set while the filesystem is mounted */
+static struct fuse_session * session = NULL;
+
+/** created when the filesystem gets initialized */
+static RhizoPriv * rhizopriv = NULL;
+
+/** the open files, so their paths can be changed when they are renamed */
+static RhizoFile * open_files = NULL;
+static pthread_mutex_t open_files_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static Transport transport;
 static AttrCache attrcache;
+static InodeTable inodetable;
+static ReadAheadPool readaheadpool;
+static WriteBackPool writebackpool;
+static NotifyListener notifylistener;
+static ClientStats clientstats;
+
+/** the codec of the data sent and requested. set from the settings
+ * and the compression types supported by the server */
+static Codec codec = { RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4, 0, 0 };
+
+/** chooses the codec of each block, starting from "codec" */
+static CompressPolicy compresspolicy;
+
+/** set if the server accepts the data of requests as separate frames */
+static bool data_frames = false;
+
+/** interval of the pings keeping the handles of the connection open
+ * on the server. 0 if the server never closes them */
+static unsigned int keepalive_msec = 0;
 
 
 /**
@@ -104,106 +262,141 @@ static AttrCache attrcache;
  *
  * provides:
  * - starting of background threads
+ * - negotiation of the capabilities of the kernel
  */
-static void *
-Rhizofs_init(struct fuse_conn_info * UNUSED_PARAMETER(conn))
+static void
+Rhizofs_init(void * UNUSED_PARAMETER(userdata), struct fuse_conn_info * conn)
 {
-    RhizoPriv * priv = NULL;
+    rhizopriv = RhizoPriv_create();
+    check(rhizopriv, "Could not create RhizoPriv context");
+
+    /* connect to the server */
+    check((Transport_init(&transport, rhizopriv->context, settings.host_socket,
+            settings.max_in_flight, settings.server_public_key,
+            settings.client_public_key, settings.client_secret_key) == true),
+            "Could not initialize the transport");
+    Transport_set_stale_func(&transport, Rhizofs_stale_reply);
+    if (keepalive_msec > 0) {
+        Rhizofs_start_keepalive();
+    }
 
-    priv = RhizoPriv_create();
-    check(priv, "Could not create RhizoPriv context");
+    check((AttrCache_init(&attrcache, settings.attrcache_size, settings.attr_ttl,
+            settings.negative_ttl) == true),
+            "could not initialize the attrcache");
 
-    /* create the socket pool */
-    check((SocketPool_init(&socketpool, priv->context, settings.host_socket, ZMQ_REQ) == true),
-            "Could not initialize the socket pool");
+    check((InodeTable_init(&inodetable) == true),
+            "could not initialize the inodetable");
 
-    if (settings.server_public_key != NULL)
-        SocketPool_set_server_public_key(&socketpool, settings.server_public_key);
-    if (settings.client_public_key != NULL && settings.client_secret_key != NULL)
-        SocketPool_set_client_keypair(&socketpool, settings.client_public_key, settings.client_secret_key);
+    check((CompressPolicy_init(&compresspolicy, true) == true),
+            "could not initialize the compression policy");
 
-    check((AttrCache_init(&attrcache, ATTRCACHE_MAXSIZE, ATTRCACHE_DEFAULT_MAXAGE_SEC) == true),
-            "could not initialize the attrcache");
+    ClientStats_init(&clientstats, &transport, &attrcache, &compresspolicy);
 
-    return priv;
+    check((CodecPool_start(settings.codec_threads) == true),
+            "could not start the codec threads");
+
+    if (settings.readahead_window > 0) {
+        /* every thread waits for one block at a time, so the number of
+         * threads is the number of blocks which can be fetched in parallel */
+        check((ReadAheadPool_init(&readaheadpool, settings.readahead_window,
+                Rhizofs_readahead_fetch) == true),
+                "could not initialize the readahead pool");
+    }
+
+    if (settings.writeback_max_dirty_mb > 0) {
+        check((WriteBackPool_init(&writebackpool, WRITEBACK_DEFAULT_THREADS,
+                (size_t)settings.writeback_max_dirty_mb * 1024 * 1024,
+                Rhizofs_writeback_write) == true),
+                "could not initialize the writeback pool");
+    }
+
+    /* the caches get invalidated when the server reports changes */
+    if (settings.notify_socket != NULL) {
+        check((NotifyListener_init(&notifylistener, rhizopriv->context,
+                settings.notify_socket, Rhizofs_handle_notification, NULL,
+                settings.server_public_key, settings.client_public_key,
+                settings.client_secret_key) == true),
+                "could not subscribe to the notifications of the server");
+    }
+
+    /* larger requests save round trips to the server */
+    conn->max_write = RHIZOFS_MAX_WRITE;
+    if (conn->max_readahead < RHIZOFS_MAX_WRITE) {
+        conn->max_readahead = RHIZOFS_MAX_WRITE;
+    }
+
+    /* readdirplus saves the lookups of the entries of listed directories */
+    if (conn->capable & FUSE_CAP_READDIRPLUS) {
+        conn->want |= FUSE_CAP_READDIRPLUS;
+    }
+
+    return;
 
 error:
 
-    SocketPool_deinit(&socketpool);
+    NotifyListener_deinit(&notifylistener);
+    WriteBackPool_deinit(&writebackpool);
+    ReadAheadPool_deinit(&readaheadpool);
+    Transport_deinit(&transport);
+    InodeTable_deinit(&inodetable);
     AttrCache_deinit(&attrcache);
-    RhizoPriv_destroy(priv);
+    CodecPool_stop();
+    CompressPolicy_deinit(&compresspolicy);
+    RhizoPriv_destroy(rhizopriv);
+    rhizopriv = NULL;
 
     /* exiting here is the last fallback when
        setting up the socket fails. see the NOTES
        file
     */
-    fuse_exit(fuse_get_context()->fuse);
-    return NULL;
+    fuse_session_exit(session);
 }
 
 /**
  * destroy/free the resources allocated by the filesystem
  */
 static void
-Rhizofs_destroy(void * UNUSED_PARAMETER(data))
+Rhizofs_destroy(void * UNUSED_PARAMETER(userdata))
 {
-    SocketPool_deinit(&socketpool);
+    NotifyListener_deinit(&notifylistener);
+    WriteBackPool_deinit(&writebackpool);
+    ReadAheadPool_deinit(&readaheadpool);
+    Transport_deinit(&transport);
+    InodeTable_deinit(&inodetable);
     AttrCache_deinit(&attrcache);
+    CodecPool_stop();
+    CompressPolicy_deinit(&compresspolicy);
 
-    struct fuse_context * fcontext = fuse_get_context();
-    if (fcontext) {
-        RhizoPriv * priv = (RhizoPriv *)fcontext->private_data;
-        RhizoPriv_destroy(priv);
-    }
+    RhizoPriv_destroy(rhizopriv);
+    rhizopriv = NULL;
 }
 
 
 /**
- * send the request and wait for a reponse
- *
- * "socket_to_use" is an optional parameter. if it is not null, the function
- * will use this socket. When it is NULL, a socket from the socketpool will
- * be used.
- *
- * "check_fuse_interrupts" enables checking for any interupts/signals
- * detected by libfuse. set to false to use this function outside
- * of a valid fuse_context
- *
- * returns NULL on error, otherwise a Response the caller
- * is responsible tor free.
+ * send the request over a socket owned by the calling thread and
+ * wait for a reponse. used to check the connection before the
+ * filesystem is started
  */
-Rhizofs__Response *
-Rhizofs_communicate(Rhizofs__Request * req, int * err, void * socket_to_use, bool check_fuse_interrupts)
+static Rhizofs__Response *
+Rhizofs_communicate_socket(Rhizofs__Request * req, int * err, void * sock)
 {
-    void * sock = NULL;
     int rc;
     Rhizofs__Response * response = NULL;
     zmq_msg_t msg_req;
     zmq_msg_t msg_resp;
-    struct fuse_context * fcontext = fuse_get_context();
-    bool renew_socket = false;
 
     (*err) = 0;
 
-    if (socket_to_use) {
-        sock = socket_to_use;
-    }
-    else {
-        /* get a socket from the socketpool, return an errno on failure */
-        sock = SocketPool_get_socket(&socketpool);
+    if (zmq_msg_init(&msg_resp) != 0) {
+        (*err) = ENOMEM;
+        log_and_error("Could not initialize response message");
     }
 
-    if (sock == NULL) {
-        (*err) = ENOTSOCK; /* Socket operation on non-socket */
-        log_and_error("Could not fetch socket from socketpool");
-    };
-
-    if (Request_pack(req, &msg_req) != true) {
+    if (Request_pack(req, &msg_req, NULL) != true) {
         (*err) = errno;
         log_and_error("Could not pack request");
     }
 
-    renew_socket = true;
     uint32_t repetition = 0;
     do {
         rc = zmq_msg_send(&msg_req, sock, 0);
@@ -214,26 +407,14 @@ Rhizofs_communicate(Rhizofs__Request * req, int * err, void * socket_to_use, boo
                  * with the socket not being in the correct state.
                  */
                 usleep(SEND_SLEEP_USEC);
-
-                if (check_fuse_interrupts) {
-                    if ((fuse_interrupted() != 0) || fuse_exited(fcontext->fuse)) {
-                        (*err) = EINTR;
-                        log_info("The request has been interrupted");
-                        goto error;
-                    }
-                }
             }
             else {
                 (*err) = EIO;
-                renew_socket = false;
                 log_and_error("Could not send request [errno: %d]", errno);
             }
-        }
-
-        ++repetition;
 
-        if (rc == -1) {
             // check for a timeout while waiting for being able to send the request
+            ++repetition;
             uint32_t seconds_waited = (repetition * SEND_SLEEP_USEC) / (1000 * 1000);
             if (seconds_waited >= settings.timeout) {
                 log_info("Timeout after trying to send request to server for %d seconds.", seconds_waited);
@@ -247,22 +428,16 @@ Rhizofs_communicate(Rhizofs__Request * req, int * err, void * socket_to_use, boo
         { sock, 0, ZMQ_POLLIN, 0 }
     };
 
-    if (zmq_msg_init(&msg_resp) != 0) {
-        (*err) = ENOMEM;
-        log_and_error("Could not initialize response message");
-    }
-
     rc = zmq_poll(pollset, 1, POLL_TIMEOUT_MSEC);
 
     if (rc > 0 && (pollset[0].revents & ZMQ_POLLIN)) {
         rc = zmq_msg_recv(&msg_resp, sock, 0);
         if (rc != -1) {  /* successfuly received response */
-            response = Response_from_message(&msg_resp);
+            response = Response_from_message(&msg_resp, NULL);
             if (response == NULL) {
                 (*err) = EIO;
                 log_and_error("Could not unpack response");
-            } else
-                *err = errno;
+            }
         } else {
             (*err) = EIO;
             log_and_error("Failed to receive response from server");
@@ -271,41 +446,156 @@ Rhizofs_communicate(Rhizofs__Request * req, int * err, void * socket_to_use, boo
         *err = errno;
         if (*err == 0)
             *err = EIO;
+        goto error;
+    }
+
+    zmq_msg_close(&msg_req);
+    zmq_msg_close(&msg_resp);
+
+    *err = Response_get_errno(response);
+    return response;
+
+error:
+    zmq_msg_close(&msg_req);
+    zmq_msg_close(&msg_resp);
+    return NULL;
+}
+
+
+/**
+ * send the request and wait for a reponse
+ *
+ * "socket_to_use" is an optional parameter. if it is not null, the function
+ * will use this socket. When it is NULL, the request will be sent by
+ * the transport, which allows many requests to be in flight at
+ * the same time.
+ *
+ * "fuse_req" is the fuse request the communication is done for. it
+ * is used to check for interrupts while waiting for the response.
+ * set it to NULL when communicating on behalf of a background thread
+ *
+ * "reply_data" is an initialized message the frame with the data of the
+ * response is moved into. the data block of the response refers to it,
+ * so it has to be closed after the response has been freed. it may be
+ * NULL for responses which do not carry data in a separate frame
+ *
+ * returns NULL on error, otherwise a Response the caller
+ * is responsible tor free.
+ */
+Rhizofs__Response *
+Rhizofs_communicate(Rhizofs__Request * req, int * err, void * socket_to_use, fuse_req_t fuse_req,
+        zmq_msg_t * reply_data)
+{
+    Rhizofs__Response * response = NULL;
+    zmq_msg_t msg_req;
+    zmq_msg_t msg_data;
+    bool send_data_frame = data_frames;
+    TransportCall call;
+    bool call_initialized = false;
+    bool submitted = false;
+    bool answered = false;
+    size_t request_size = 0;
+    size_t reply_size = 0;
+    uint64_t latency_ns = 0;
+
+    if (socket_to_use) {
+        return Rhizofs_communicate_socket(req, err, socket_to_use);
+    }
+
+    (*err) = 0;
+
+    // the data of the request is sent without copying it into the message
+    if (Request_pack(req, &msg_req, send_data_frame ? &msg_data : NULL) != true) {
+        (*err) = errno;
+        log_and_error("Could not pack request");
+    }
+
+    request_size = zmq_msg_size(&msg_req);
+    if (send_data_frame) {
+        request_size += zmq_msg_size(&msg_data);
+    }
+    call_initialized = TransportCall_init(&call, &msg_req, send_data_frame ? &msg_data : NULL);
+    zmq_msg_close(&msg_req);
+    if (send_data_frame) {
+        zmq_msg_close(&msg_data);
+    }
+    if (!call_initialized) {
+        (*err) = ENOMEM;
+        log_and_error("Could not initialize the transport call");
+    }
+
+    if (!Transport_submit(&transport, &call)) {
+        (*err) = EIO;
+        log_and_error("Could not submit request");
+    }
+    submitted = true;
+
+    uint32_t msec_waited = 0;
+    while (!Transport_wait(&transport, &call, POLL_TIMEOUT_MSEC)) {
         /* no response available at this time
          * check if fuse has received an interrupt
          * while waiting for a response
          */
-        if (check_fuse_interrupts) {
-            if ((fuse_interrupted() != 0) || fuse_exited(fcontext->fuse)) {
+        if (fuse_req != NULL) {
+            if ((fuse_req_interrupted(fuse_req) != 0) || fuse_session_exited(session)) {
                 log_info("The request has been interrupted");
-                *err = EINTR;
+                (*err) = EINTR;
+                Transport_cancel(&transport, &call);
+                goto error;
             }
         }
-        goto error;
+
+        msec_waited += POLL_TIMEOUT_MSEC;
+        if (msec_waited >= settings.timeout * 1000) {
+            log_info("Timeout after waiting for a response from the server for %d seconds.",
+                    msec_waited / 1000);
+            (*err) = EAGAIN;
+            Transport_cancel(&transport, &call);
+            goto error;
+        }
     }
 
-    /* close request after receiving reply as it is sure 0mq does not
-     * hold a reference anymore */
-    zmq_msg_close(&msg_req);
-    zmq_msg_close(&msg_resp);
+    if (call.state != TCALL_DONE) {
+        (*err) = call.err;
+        log_and_error("Could not send request [errno: %d]", call.err);
+    }
+    answered = true;
+    latency_ns = Transport_now_ns() - call.submitted_ns - call.queued_ns;
+    reply_size = zmq_msg_size(&(call.reply)) + zmq_msg_size(&(call.reply_data));
+
+    // the data is read from the frame it was received in. it outlives
+    // the call if the caller keeps it
+    if (reply_data != NULL) {
+        zmq_msg_move(reply_data, &(call.reply_data));
+        response = Response_from_message(&(call.reply), reply_data);
+    }
+    else {
+        response = Response_from_message(&(call.reply), NULL);
+    }
+    if (response == NULL) {
+        (*err) = EIO;
+        log_and_error("Could not unpack response");
+    }
 
-    if (response != NULL)
-        *err = Response_get_errno(response);
+    *err = Response_get_errno(response);
+    ClientStats_record(&clientstats, (int)req->requesttype, *err, true, request_size,
+            reply_size, latency_ns, call.queued_ns);
+    if ((req->requesttype == RHIZOFS__REQUEST_TYPE__READ) ||
+            (req->requesttype == RHIZOFS__REQUEST_TYPE__WRITE)) {
+        CompressPolicy_record_transfer(&compresspolicy, request_size + reply_size, latency_ns);
+    }
+    TransportCall_deinit(&call);
 
     return response;
 
 error:
-    if (renew_socket && !socket_to_use) {
-        // renew socket as soon there is any chance of it being in an
-        // inconsistent state
-        //
-        // this basically implements the "The Lazy Pirate Pattern" described
-        // in the ZMQ Guide
-        debug("Renewing socket");
-        SocketPool_renew_socket(&socketpool);
+    if (submitted) {
+        ClientStats_record(&clientstats, (int)req->requesttype, *err, answered, request_size,
+                reply_size, latency_ns, call.queued_ns);
+    }
+    if (call_initialized) {
+        TransportCall_deinit(&call);
     }
-    zmq_msg_close(&msg_req);
-    zmq_msg_close(&msg_resp);
     return NULL;
 }
 
@@ -315,22 +605,28 @@ error:
  * convert a Rhizofs_Attrs struct to a stat
  * the stat has to be allocated
  * by the caller
+ *
+ * "req" is the fuse request whose caller will be set as the owner
+ * of files owned by the server user. may be NULL
  */
 inline bool
-Rhizofs_convert_attrs_stat(Rhizofs__Attrs * attrs, struct stat * stbuf)
+Rhizofs_convert_attrs_stat(Rhizofs__Attrs * attrs, struct stat * stbuf, fuse_req_t req)
 {
-    struct fuse_context * fcontext = fuse_get_context();
-
     check((Attrs_copy_to_stat(attrs, stbuf) == true),
             "could not copy Attrs to stat");
 
     debug("mode: %o",stbuf->st_mode );
 
+    if (req == NULL) {
+        return true;
+    }
+
     /* set the uid ad gid of the calling process
      * do not set anything if the server-user is
      * not the user / in the group. this will cause
      * the FS to return "root"
      */
+    const struct fuse_ctx * fcontext = fuse_req_ctx(req);
     if (attrs->is_owner != 0) {
         stbuf->st_uid = fcontext->uid;
     }
@@ -345,8 +641,173 @@ error:
     return false;
 }
 
+/**
+ * get the RhizoFile of an open file
+ *
+ * returns NULL if there is none
+ */
+static inline RhizoFile *
+RhizoFile_from_fi(const struct fuse_file_info * fi)
+{
+    if (fi == NULL) {
+        return NULL;
+    }
+    return (RhizoFile *)(uintptr_t)fi->fh;
+}
+
+
+/**
+ * the time the kernel may cache attributes and directory entries.
+ * the same as the maximum age of entries of the attrcache
+ */
+static inline double
+Rhizofs_attr_timeout()
+{
+    return (double)attrcache.max_age_sec;
+}
+
+
+/**
+ * drop the attributes and the pages of an inode cached by the kernel
+ */
+static void
+Rhizofs_invalidate_inode(uint64_t ino)
+{
+    if ((session == NULL) || (ino == 0)) {
+        return;
+    }
+
+    int rc = fuse_lowlevel_notify_inval_inode(session, ino, 0, 0);
+    if ((rc != 0) && (rc != -ENOENT)) {
+        debug("Could not invalidate inode %llu: %s", (unsigned long long)ino, strerror(-rc));
+    }
+}
+
+
+/**
+ * drop the directory entry of "path" cached by the kernel. this
+ * includes negative entries of names which did not exist before.
+ * the attributes of the directory are dropped as well, as its
+ * timestamps change with its entries
+ */
+static void
+Rhizofs_invalidate_entry(const char * path)
+{
+    char * parent = path_dirname(path);
+    char * name = path_basename(path);
+
+    if ((parent != NULL) && (name != NULL)) {
+        AttrCache_remove(&attrcache, parent);
+
+        uint64_t parent_ino = InodeTable_peek(&inodetable, parent);
+        if ((session != NULL) && (parent_ino != 0)) {
+            int rc = fuse_lowlevel_notify_inval_entry(session, parent_ino, name, strlen(name));
+            if ((rc != 0) && (rc != -ENOENT)) {
+                debug("Could not invalidate entry %s: %s", path, strerror(-rc));
+            }
+            Rhizofs_invalidate_inode(parent_ino);
+        }
+    }
+
+    free(parent);
+    free(name);
+}
+
+
+/**
+ * drop everything cached about the files of the server
+ */
+static void
+Rhizofs_invalidate_all()
+{
+    size_t n_inodes = 0;
+
+    AttrCache_clear(&attrcache);
+
+    uint64_t * inodes = InodeTable_list(&inodetable, &n_inodes);
+    if (inodes == NULL) {
+        log_err("Could not list the inodes to invalidate");
+        return;
+    }
+
+    for (size_t i=0; i<n_inodes; i++) {
+        char * path = InodeTable_get_path(&inodetable, inodes[i]);
+        if ((path != NULL) && (strcmp(path, "/") != 0)) {
+            Rhizofs_invalidate_entry(path);
+        }
+        free(path);
+        Rhizofs_invalidate_inode(inodes[i]);
+    }
+    free(inodes);
+}
+
+
+/**
+ * update the caches after the server reported a change. called
+ * by the thread of the notifylistener
+ */
+static void
+Rhizofs_handle_notification(const Rhizofs__Notification * notification,
+        void * UNUSED_PARAMETER(ctx))
+{
+    const char * path = notification->path;
+    mode_t type = 0;
+
+    if ((path == NULL) &&
+            (notification->notificationtype != RHIZOFS__NOTIFICATION_TYPE__NT_OVERFLOW)) {
+        return;
+    }
+
+    switch (notification->notificationtype) {
+        case RHIZOFS__NOTIFICATION_TYPE__NT_CHANGED:
+            AttrCache_remove(&attrcache, path);
+            Rhizofs_invalidate_inode(InodeTable_peek(&inodetable, path));
+            break;
+
+        case RHIZOFS__NOTIFICATION_TYPE__NT_CREATED:
+            if (notification->has_filetype) {
+                type = FileType_to_local(notification->filetype) & S_IFMT;
+            }
+            // the name may have replaced another entry
+            AttrCache_remove(&attrcache, path);
+            AttrCache_add_name(&attrcache, path, type);
+            Rhizofs_invalidate_entry(path);
+            Rhizofs_invalidate_inode(InodeTable_peek(&inodetable, path));
+            break;
+
+        case RHIZOFS__NOTIFICATION_TYPE__NT_REMOVED:
+            AttrCache_remove(&attrcache, path);
+            AttrCache_remove_name(&attrcache, path);
+            Rhizofs_invalidate_entry(path);
+            break;
+
+        case RHIZOFS__NOTIFICATION_TYPE__NT_OVERFLOW:
+            log_warn("Notifications of the server got lost - dropping all caches");
+            Rhizofs_invalidate_all();
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * send the buffered writes of all files opened with "path" to the
+ * server. has to be called before operations which would see
+ * or change the size or times of the file on the server
+ */
+static inline void
+Rhizofs_flush_path(const char * path)
+{
+    if (settings.writeback_max_dirty_mb > 0) {
+        WriteBackPool_flush_path(&writebackpool, path);
+    }
+}
+
+
 /*******************************************************************/
-/* filesystem methods                                              */
+/* remote operations                                               */
 /*******************************************************************/
 
 #define OP_STD_RETURNED_ERR EIO
@@ -360,102 +821,387 @@ error:
         log_and_error("Could not initialize Request"); \
     }
 
-#define OP_COMMUNICATE_USING_SOCKET(REQ, RESP, RET_ERR, SOCK, CHECK_FUSE_INTERRUPTS) \
-    RESP = Rhizofs_communicate(&REQ, &RET_ERR, SOCK, CHECK_FUSE_INTERRUPTS); \
+#define OP_COMMUNICATE_USING_SOCKET(REQ, RESP, RET_ERR, SOCK, FUSE_REQ) \
+    RESP = Rhizofs_communicate(&REQ, &RET_ERR, SOCK, FUSE_REQ, NULL); \
+    check_debug((RET_ERR == 0), "Server reported an error: %d", RET_ERR); \
+    check((RESP != NULL), "communicate failed");
+
+/* the frame with the data of the response is kept in DATA, which has
+ * to be closed after OP_DEINIT */
+#define OP_COMMUNICATE_WITH_DATA(REQ, RESP, RET_ERR, FUSE_REQ, DATA) \
+    RESP = Rhizofs_communicate(&REQ, &RET_ERR, NULL, FUSE_REQ, DATA); \
     check_debug((RET_ERR == 0), "Server reported an error: %d", RET_ERR); \
     check((RESP != NULL), "communicate failed");
 
-#define OP_COMMUNICATE(REQ, RESP, RET_ERR) \
-    OP_COMMUNICATE_USING_SOCKET(REQ, RESP, RET_ERR, NULL, true)
+#define OP_COMMUNICATE(REQ, RESP, RET_ERR, FUSE_REQ) \
+    OP_COMMUNICATE_USING_SOCKET(REQ, RESP, RET_ERR, NULL, FUSE_REQ)
 
 #define OP_DEINIT(REQ, RESP) \
     Request_deinit(&REQ); \
     Response_from_message_destroy(RESP);
 
 
-static int
-Rhizofs_readdir(const char * path, void * buf,
-    fuse_fill_dir_t filler, off_t offset, struct fuse_file_info * fi)
+/**
+ * add the entries of a READDIR response to "listing" and their
+ * attributes to the attrcache
+ *
+ * returns false on error
+ */
+static bool
+Rhizofs_add_listing_entries(fuse_req_t req, const char * path,
+        const Rhizofs__Response * response, DirListing * listing)
 {
     unsigned int entry_n = 0;
     char * path_entry = NULL;
     CacheEntry * cache_entry = NULL;
 
-    (void) offset;
-    (void) fi;
-
-    OP_INIT(request, response, returned_err);
-
-    request.path = (char *)path;
-    request.requesttype = RHIZOFS__REQUEST_TYPE__READDIR;
-
-    OP_COMMUNICATE(request, response, returned_err)
-
     time_t current_time = time(NULL);
     check((current_time != -1), "could not fetch current time");
 
     for (entry_n=0; entry_n<response->n_directory_entries; ++entry_n) {
-        check((response->directory_entries[entry_n]->name != NULL),
-            "attrs is missing the name");
+        Rhizofs__Attrs * attrs = response->directory_entries[entry_n];
+        check((attrs->name != NULL), "attrs is missing the name");
 
-        // add to file list
-        if (filler(buf, response->directory_entries[entry_n]->name, NULL, 0)) {
-            break;
+        check(DirListing_append(listing, attrs->name, FileType_to_local(attrs->filetype)),
+                "Could not add %s to listing", attrs->name);
+
+        if ((strcmp(attrs->name, ".") == 0) || (strcmp(attrs->name, "..") == 0)) {
+            continue;
         }
 
         // add to cache
-        check(path_join(path, response->directory_entries[entry_n]->name, &path_entry) == 0,
-                "could not join path for directory entry %s", response->directory_entries[entry_n]->name);
+        check(path_join(path, attrs->name, &path_entry) == 0,
+                "could not join path for directory entry %s", attrs->name);
         check_mem(path_entry);
         cache_entry = CacheEntry_create();
         check_mem(cache_entry);
 
         cache_entry->cache_creation_ts = current_time;
 
-        check(Rhizofs_convert_attrs_stat(response->directory_entries[entry_n], &(cache_entry->stat_result)) == true,
+        check(Rhizofs_convert_attrs_stat(attrs, &(cache_entry->stat_result), req) == true,
                 "could not convert attrs");
 
-        check(AttrCache_set(&attrcache, path_entry, cache_entry),
-                "Could not add stat to AttrCache");
+        // the cache takes ownership even on failure
+        if (!AttrCache_set(&attrcache, path_entry, cache_entry)) {
+            log_warn("Could not add stat of an entry of %s to AttrCache", path);
+        }
+        path_entry = NULL;
+        cache_entry = NULL;
     }
-
-    OP_DEINIT(request, response)
-    return 0;
+    return true;
 
 error:
     free(path_entry);
     CacheEntry_destroy(cache_entry);
-
-    OP_DEINIT(request, response)
-    return -returned_err;
+    return false;
 }
 
 
-static int
-Rhizofs_getattr(const char *path, struct stat *stbuf)
+/**
+ * add a page of the listing of "dir" to the assembled listing. the
+ * listing gets cached once its last page has been added
+ *
+ * "cookie" is the cookie the page was requested with
+ */
+static void
+Rhizofs_assemble_listing(RhizoDir * dir, uint64_t cookie, uint64_t validator)
 {
-    if (AttrCache_copy_stat(&attrcache, path, stbuf) == false) {
-        return Rhizofs_getattr_remote(path, stbuf);
+    if (cookie == 0) {
+        DirListing_destroy(dir->assembled);
+        dir->assembled = DirListing_create();
+        if (dir->assembled == NULL) {
+            return;
+        }
+        dir->assembled->validator = validator;
+        dir->assembled_cookie = 0;
+    }
+    if (dir->assembled == NULL) {
+        return;
     }
-    return 0;
-}
 
+    // pages read out of order, a directory changing between the pages
+    // and listings too large for the cache are not cached
+    if ((cookie != dir->assembled_cookie)
+                || (validator != dir->assembled->validator)
+                || ((cookie != 0) && (validator == 0))
+                || (dir->assembled->n_entries + dir->page->n_entries
+                    > attrcache.max_listing_names_per_shard)) {
+        DirListing_destroy(dir->assembled);
+        dir->assembled = NULL;
+        return;
+    }
 
-inline int
-Rhizofs_getattr_remote(const char *path, struct stat *stbuf)
-{
-    CacheEntry * cache_entry = NULL;
-    char * path_copy = NULL;
+    for (size_t i=0; i<dir->page->n_entries; i++) {
+        DirListingEntry * entry = &(dir->page->entries[i]);
+        if (!DirListing_append(dir->assembled, entry->name, entry->type)) {
+            DirListing_destroy(dir->assembled);
+            dir->assembled = NULL;
+            return;
+        }
+    }
+    if (dir->page->n_entries != 0) {
+        dir->assembled_cookie = dir->page_cookies[dir->page->n_entries - 1];
+    }
 
-    OP_INIT(request, response, returned_err);
+    if (dir->page_is_last) {
+        // the cache takes ownership of the listing it gets
+        if (!AttrCache_set_listing(&attrcache, dir->path, dir->assembled)) {
+            log_warn("Could not add the listing of %s to AttrCache", dir->path);
+        }
+        dir->assembled = NULL;
+    }
+}
 
-    request.path = (char *)path;
-    request.requesttype = RHIZOFS__REQUEST_TYPE__GETATTR;
 
-    OP_COMMUNICATE(request, response, returned_err)
-    check((response->attrs != NULL), "Response did not contain attrs");
+/**
+ * fetch the page of the listing of "dir" following "cookie" and add
+ * the attributes of its entries to the attrcache. cookie 0 fetches
+ * the first page
+ *
+ * "cached" is the listing known to the client or NULL. it is sent
+ * along with the request of the first page and becomes the listing
+ * of "dir" if the server confirms it to be still valid. ownership
+ * of it is taken in any case
+ *
+ * servers without support for pages send the complete listing,
+ * which becomes the listing of "dir" as well
+ *
+ * returns 0 or a negative errno
+ */
+static int
+Rhizofs_readdir_remote(fuse_req_t req, RhizoDir * dir, uint64_t cookie,
+        DirListing * cached)
+{
+    DirListing * fetched = NULL;
+    DirListing * fetched_copy = NULL;
+    uint64_t * cookies = NULL;
+
+    OP_INIT(request, response, returned_err);
+
+    request.path = dir->path;
+    request.requesttype = RHIZOFS__REQUEST_TYPE__READDIR;
+    request.has_cookie = 1;
+    request.cookie = cookie;
+    request.has_max_entries = 1;
+    request.max_entries = READDIR_PAGE_ENTRIES;
+    if ((cookie == 0) && (cached != NULL) && (cached->validator != 0)) {
+        request.has_validator = 1;
+        request.validator = cached->validator;
+    }
+
+    OP_COMMUNICATE(request, response, returned_err, req)
+
+    if ((cookie == 0) && (cached != NULL) && response->has_listing_unchanged
+                && response->listing_unchanged) {
+        debug("listing of %s is unchanged", dir->path);
+        AttrCache_revalidate_listing(&attrcache, dir->path, cached->validator);
+        RhizoDir_reset(dir);
+        dir->listing = cached;
+
+        OP_DEINIT(request, response)
+        return 0;
+    }
+    DirListing_destroy(cached);
+    cached = NULL;
+
+    fetched = DirListing_create();
+    check_mem(fetched);
+    if (response->has_validator) {
+        fetched->validator = response->validator;
+    }
+
+    check(Rhizofs_add_listing_entries(req, dir->path, response, fetched),
+            "could not add the entries of %s", dir->path);
+
+    if (response->n_cookies != response->n_directory_entries) {
+        debug("the server sent the complete listing of %s", dir->path);
+
+        // the cache takes ownership of the listing it gets
+        fetched_copy = DirListing_copy(fetched);
+        check_mem(fetched_copy);
+        if (!AttrCache_set_listing(&attrcache, dir->path, fetched_copy)) {
+            log_warn("Could not add the listing of %s to AttrCache", dir->path);
+        }
+
+        RhizoDir_reset(dir);
+        dir->listing = fetched;
+
+        OP_DEINIT(request, response)
+        return 0;
+    }
+
+    if (response->n_cookies != 0) {
+        cookies = malloc(sizeof(uint64_t) * response->n_cookies);
+        check_mem(cookies);
+        memcpy(cookies, response->cookies, sizeof(uint64_t) * response->n_cookies);
+    }
+
+    DirListing_destroy(dir->listing);
+    dir->listing = NULL;
+    DirListing_destroy(dir->page);
+    dir->page = fetched;
+    free(dir->page_cookies);
+    dir->page_cookies = cookies;
+    dir->page_is_last = response->has_end_of_listing && response->end_of_listing;
+
+    Rhizofs_assemble_listing(dir, cookie, fetched->validator);
+
+    OP_DEINIT(request, response)
+    return 0;
+
+error:
+    DirListing_destroy(cached);
+    DirListing_destroy(fetched);
+
+    OP_DEINIT(request, response)
+    return -returned_err;
+}
+
+
+/**
+ * start reading the listing of "dir" from the beginning. the cached
+ * listing is used as long as it is fresh, and revalidated with the
+ * server after that. otherwise the first page is fetched
+ *
+ * returns 0 or a negative errno
+ */
+static int
+Rhizofs_readdir_start(fuse_req_t req, RhizoDir * dir)
+{
+    bool is_fresh = false;
+
+    RhizoDir_reset(dir);
+
+    if (strcmp(dir->path, RHIZOFS_CONTROL_DIR) == 0) {
+        dir->listing = DirListing_create();
+        if ((dir->listing == NULL) ||
+                !DirListing_append(dir->listing, ".", S_IFDIR) ||
+                !DirListing_append(dir->listing, "..", S_IFDIR) ||
+                !DirListing_append(dir->listing, RHIZOFS_STATS_NAME, S_IFREG)) {
+            return -ENOMEM;
+        }
+        return 0;
+    }
+
+    DirListing * cached = AttrCache_get_listing(&attrcache, dir->path, &is_fresh);
+    if ((cached != NULL) && is_fresh) {
+        debug("using cached listing of %s", dir->path);
+        dir->listing = cached;
+        return 0;
+    }
+
+    return Rhizofs_readdir_remote(req, dir, 0, cached);
+}
+
+
+/**
+ * fill "stbuf" if "path" is one of the virtual files of the client.
+ * they belong to the user who mounted the filesystem
+ *
+ * returns false if it is not
+ */
+static bool
+Rhizofs_control_stat(const char * path, struct stat * stbuf)
+{
+    mode_t mode = 0;
+
+    if (strcmp(path, RHIZOFS_CONTROL_DIR) == 0) {
+        mode = S_IFDIR | 0555;
+    }
+    else if (strcmp(path, RHIZOFS_STATS_FILE) == 0) {
+        mode = S_IFREG | 0444;
+    }
+    else {
+        return false;
+    }
+
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_mode = mode;
+    stbuf->st_nlink = S_ISDIR(mode) ? 2 : 1;
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = time(NULL);
+
+    // the size of the statistics is only known once they are read.
+    // the file is opened with direct_io, so reads ignore the size
+    return true;
+}
+
+
+/**
+ * open a virtual file of the client. its content is taken right
+ * away, so all reads see the same state
+ *
+ * returns 0 or a negative errno
+ */
+static int
+Rhizofs_open_control(const char * path, struct fuse_file_info * fi)
+{
+    RhizoFile * file = NULL;
+
+    if (strcmp(path, RHIZOFS_STATS_FILE) != 0) {
+        return -EISDIR;
+    }
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        return -EACCES;
+    }
+
+    file = calloc(sizeof(RhizoFile), 1);
+    check_mem(file);
+    file->path = strdup(path);
+    check_mem(file->path);
+
+    file->content = ClientStats_format(&clientstats, &(file->content_size));
+    check((file->content != NULL), "Could not format the statistics");
+
+    fi->fh = (uint64_t)(uintptr_t)file;
+    fi->direct_io = 1;
+    return 0;
+
+error:
+    RhizoFile_destroy(file);
+    return -ENOMEM;
+}
+
+
+/**
+ * get the attributes of a path. served from the attrcache if possible
+ */
+static int
+Rhizofs_getattr_path(fuse_req_t req, const char *path, struct stat *stbuf)
+{
+    if (Rhizofs_control_stat(path, stbuf)) {
+        return 0;
+    }
+
+    switch (AttrCache_lookup(&attrcache, path, stbuf)) {
+        case ATTRCACHE_HIT:
+            return 0;
+        case ATTRCACHE_NEGATIVE:
+            return -ENOENT;
+        default:
+            Rhizofs_flush_path(path);
+            return Rhizofs_getattr_remote(req, path, stbuf);
+    }
+}
+
+
+/**
+ * convert the attrs received for "path" to "stbuf" and add them to
+ * the attrcache
+ *
+ * returns false if the attrs could not be converted
+ */
+static bool
+Rhizofs_cache_attrs(fuse_req_t req, const char * path, Rhizofs__Attrs * attrs,
+        struct stat * stbuf)
+{
+    CacheEntry * cache_entry = NULL;
+    char * path_copy = NULL;
+
+    check((attrs != NULL), "Response did not contain attrs");
 
-    check((Rhizofs_convert_attrs_stat(response->attrs, stbuf) == true),
+    check((Rhizofs_convert_attrs_stat(attrs, stbuf, req) == true),
             "could not convert attrs");
 
     // prepare parameters for cache entry
@@ -470,31 +1216,112 @@ Rhizofs_getattr_remote(const char *path, struct stat *stbuf)
 
     memcpy(&(cache_entry->stat_result), stbuf, sizeof(struct stat));
 
-    check(AttrCache_set(&attrcache, path_copy, cache_entry),
-            "Could not add stat to AttrCache");
+    // the cache takes ownership even on failure
+    if (!AttrCache_set(&attrcache, path_copy, cache_entry)) {
+        log_warn("Could not add stat of %s to AttrCache", path);
+    }
+    return true;
+
+error:
+    free(path_copy);
+    CacheEntry_destroy(cache_entry);
+    return false;
+}
+
+
+/**
+ * get the errno of the first failed sub-request of a COMPOUND response
+ *
+ * "n_requests" is the number of sub-requests sent. a response missing
+ * without a failed request before it is reported as EIO
+ */
+static int
+Rhizofs_compound_errno(const Rhizofs__Response * response, size_t n_requests)
+{
+    size_t i;
+
+    for (i=0; i<response->n_responses; i++) {
+        int eno = Response_get_errno(response->responses[i]);
+        if (eno != 0) {
+            return eno;
+        }
+    }
+    if (response->n_responses < n_requests) {
+        log_err("The server answered %d of %d requests",
+                (int)response->n_responses, (int)n_requests);
+        return EIO;
+    }
+    return 0;
+}
+
+
+inline int
+Rhizofs_getattr_remote(fuse_req_t req, const char *path, struct stat *stbuf)
+{
+    OP_INIT(request, response, returned_err);
+
+    request.path = (char *)path;
+    request.requesttype = RHIZOFS__REQUEST_TYPE__GETATTR;
+
+    OP_COMMUNICATE(request, response, returned_err, req)
+    check((Rhizofs_cache_attrs(req, path, response->attrs, stbuf) == true),
+            "could not use the attrs of %s", path);
 
     OP_DEINIT(request, response)
     return 0;
 
 error:
-    free(path_copy);
-    CacheEntry_destroy(cache_entry);
+    if (returned_err == ENOENT) {
+        AttrCache_set_negative(&attrcache, path);
+    }
+
+    OP_DEINIT(request, response)
+    return -returned_err;
+}
+
+
+/**
+ * get the attributes of an open file by its handle on the server. used
+ * after the file has been unlinked, so the attributes are not cached
+ */
+static int
+Rhizofs_getattr_handle(fuse_req_t req, const RhizoFile * file, struct stat * stbuf)
+{
+    Rhizofs_flush_path(file->path);
+
+    OP_INIT(request, response, returned_err);
+
+    request.path = file->path;
+    request.requesttype = RHIZOFS__REQUEST_TYPE__GETATTR;
+    request.has_handle = 1;
+    request.handle = file->handle;
+
+    OP_COMMUNICATE(request, response, returned_err, req)
+    returned_err = EIO;
+    check((response->attrs != NULL), "Response did not contain attrs");
+    check((Rhizofs_convert_attrs_stat(response->attrs, stbuf, req) == true),
+            "could not convert attrs");
 
+    OP_DEINIT(request, response)
+    return 0;
+
+error:
     OP_DEINIT(request, response)
     return -returned_err;
 }
 
 
 static int
-Rhizofs_rmdir(const char * path)
+Rhizofs_rmdir_remote(fuse_req_t req, const char * path)
 {
     OP_INIT(request, response, returned_err);
 
     request.path = (char *)path;
     request.requesttype = RHIZOFS__REQUEST_TYPE__RMDIR;
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
     AttrCache_remove(&attrcache, path);
+    AttrCache_remove_name(&attrcache, path);
 
     OP_DEINIT(request, response)
     return 0;
@@ -506,7 +1333,7 @@ error:
 
 
 static int
-Rhizofs_mkdir(const char * path, mode_t mode)
+Rhizofs_mkdir_remote(fuse_req_t req, const char * path, mode_t mode)
 {
     OP_INIT(request, response, returned_err);
 
@@ -517,7 +1344,8 @@ Rhizofs_mkdir(const char * path, mode_t mode)
     request.permissions = Permissions_create((mode_t)mode);
     check((request.permissions != NULL), "Could not create access permissions struct");
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
+    AttrCache_add_name(&attrcache, path, S_IFDIR);
 
     OP_DEINIT(request, response)
     return 0;
@@ -529,15 +1357,18 @@ error:
 
 
 static int
-Rhizofs_unlink(const char * path)
+Rhizofs_unlink_remote(fuse_req_t req, const char * path)
 {
+    Rhizofs_flush_path(path);
+
     OP_INIT(request, response, returned_err);
 
     request.path = (char *)path;
     request.requesttype = RHIZOFS__REQUEST_TYPE__UNLINK;
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
     AttrCache_remove(&attrcache, path);
+    AttrCache_remove_name(&attrcache, path);
 
     OP_DEINIT(request, response)
     return 0;
@@ -549,7 +1380,7 @@ error:
 
 
 static int
-Rhizofs_access(const char * path, int mask)
+Rhizofs_access_remote(fuse_req_t req, const char * path, int mask)
 {
     OP_INIT(request, response, returned_err);
 
@@ -559,7 +1390,7 @@ Rhizofs_access(const char * path, int mask)
     request.permissions = Permissions_create((mode_t)mask);
     check((request.permissions != NULL), "Could not create access permissions struct");
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
 
     OP_DEINIT(request, response)
     return 0;
@@ -571,7 +1402,7 @@ error:
 
 
 static int
-Rhizofs_open(const char * path, struct fuse_file_info *fi)
+Rhizofs_open_remote(fuse_req_t req, const char * path, struct fuse_file_info *fi)
 {
     OP_INIT(request, response, returned_err);
 
@@ -581,7 +1412,25 @@ Rhizofs_open(const char * path, struct fuse_file_info *fi)
     request.openflags = OpenFlags_from_bitmask(fi->flags);
     check((request.openflags != NULL), "could not create openflags for request");
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
+
+    // servers not supporting handles do not send one. the
+    // following operations will use the path in this case
+    RhizoFile * file = RhizoFile_create(path,
+            response->has_handle ? response->handle : 0, fi->flags);
+    if (file == NULL) {
+        // the server keeps handles open until they are released
+        if (response->has_handle) {
+            Rhizofs_release_remote(path, response->handle);
+        }
+        returned_err = ENOMEM;
+        log_and_error("Could not create RhizoFile");
+    }
+    fi->fh = (uint64_t)(uintptr_t)file;
+
+    // the pages cached by the kernel get invalidated when the
+    // server reports a change of the file
+    fi->keep_cache = (settings.notify_socket != NULL);
 
     OP_DEINIT(request, response)
     return 0;
@@ -592,20 +1441,59 @@ error:
 }
 
 
+/**
+ * create the file and fetch its attributes in one round trip. the
+ * attributes are added to the attrcache for the reply to the kernel
+ */
 static int
-Rhizofs_create(const char * path, mode_t create_mode, struct fuse_file_info *fi)
+Rhizofs_create_remote(fuse_req_t req, const char * path, mode_t create_mode, struct fuse_file_info *fi)
 {
-    (void) fi;
+    struct stat stbuf;
+    Rhizofs__Request * create_request = NULL;
 
     OP_INIT(request, response, returned_err);
 
-    request.requesttype = RHIZOFS__REQUEST_TYPE__CREATE;
-    request.path = (char *)path;
+    request.stop_on_error = 1;
+    request.has_stop_on_error = 1;
+
+    create_request = Request_add_subrequest(&request, RHIZOFS__REQUEST_TYPE__CREATE, path);
+    check_mem(create_request);
+
+    create_request->permissions = Permissions_create(create_mode);
+    check((create_request->permissions != NULL), "Could not create create permissions struct");
+
+    // passing the openflags makes the server keep the file open
+    create_request->openflags = OpenFlags_from_bitmask(fi->flags);
+    check((create_request->openflags != NULL), "could not create openflags for request");
+
+    check_mem(Request_add_subrequest(&request, RHIZOFS__REQUEST_TYPE__GETATTR, path));
 
-    request.permissions = Permissions_create(create_mode);
-    check((request.permissions != NULL), "Could not create create permissions struct");
+    OP_COMMUNICATE(request, response, returned_err, req)
+    returned_err = Rhizofs_compound_errno(response, request.n_requests);
+    if ((returned_err != 0) && (response->n_responses != 0)
+                && (Response_get_errno(response->responses[0]) == 0)) {
+        // only fetching the attributes failed. the kernel will ask again
+        returned_err = 0;
+    }
+    check_debug((returned_err == 0), "Server reported an error: %d", returned_err);
+
+    Rhizofs__Response * create_response = response->responses[0];
+    AttrCache_add_name(&attrcache, path, S_IFREG);
+    AttrCache_remove(&attrcache, path);
+    if (response->n_responses > 1) {
+        Rhizofs_cache_attrs(req, path, response->responses[1]->attrs, &stbuf);
+    }
 
-    OP_COMMUNICATE(request, response, returned_err)
+    RhizoFile * file = RhizoFile_create(path,
+            create_response->has_handle ? create_response->handle : 0, fi->flags);
+    if (file == NULL) {
+        if (create_response->has_handle) {
+            Rhizofs_release_remote(path, create_response->handle);
+        }
+        returned_err = ENOMEM;
+        log_and_error("Could not create RhizoFile");
+    }
+    fi->fh = (uint64_t)(uintptr_t)file;
 
     OP_DEINIT(request, response)
     return 0;
@@ -616,59 +1504,116 @@ error:
 }
 
 
+/**
+ * read a block of a file from the server
+ *
+ * "handle" is the server-side handle of the file or 0
+ *
+ * returns the number of bytes read or a negative errno
+ */
 static int
-Rhizofs_read(const char *path, char *buf, size_t size,
-        off_t offset, struct fuse_file_info *fi)
+Rhizofs_read_remote(const char * path, uint64_t handle, uint8_t * buf,
+        size_t size, off_t offset, fuse_req_t req)
 {
     int size_read = 0;
+    uint64_t file = CompressPolicy_file(path, handle);
+    Codec block_codec = codec;
+    zmq_msg_t data;
 
-    (void) fi;
-
+    zmq_msg_init(&data);
     OP_INIT(request, response, returned_err);
 
     request.path = (char *)path;
+    if (handle != 0) {
+        request.has_handle = 1;
+        request.handle = handle;
+    }
     request.has_size = 1;
     request.size = (int64_t)size;
     request.has_offset = 1;
     request.offset = (int64_t)offset;
     request.requesttype = RHIZOFS__REQUEST_TYPE__READ;
 
-    OP_COMMUNICATE(request, response, returned_err)
+    // the server compresses the data, so there is nothing to sample
+    CompressPolicy_choose(&compresspolicy, file, NULL, size, &block_codec);
+    request.has_compression = 1;
+    request.compression = block_codec.type;
+    request.has_compression_level = 1;
+    request.compression_level = block_codec.level;
+    request.has_chunk_size = 1;
+    request.chunk_size = CODEC_CHUNK_SIZE;
+    request.has_data_frames = 1;
+    request.data_frames = (settings.data_frames != 0);
+
+    OP_COMMUNICATE_WITH_DATA(request, response, returned_err, req, &data)
     check((Response_has_data(response) != -1), "Server did not send data in response");
+    CompressPolicy_record(&compresspolicy, file, &block_codec, response->datablock, 0);
 
-    size_read = DataBlock_get_data_noalloc(response->datablock, (uint8_t *)buf, size);
+    // decompresses or copies straight from the received frame
+    size_read = DataBlock_get_data_noalloc(response->datablock, buf, size);
 
     OP_DEINIT(request, response)
+    zmq_msg_close(&data);
     return size_read;
 
 error:
     OP_DEINIT(request, response)
+    zmq_msg_close(&data);
     return -returned_err;
 
 }
 
 
+/**
+ * fetch function of the read-ahead threads
+ */
 static int
-Rhizofs_write(const char * path, const char * buf, size_t size, off_t offset,
-		      struct fuse_file_info * fi)
+Rhizofs_readahead_fetch(void * ctx, uint8_t * buf, size_t size, off_t offset)
 {
-    int size_write = 0;
+    RhizoFile * file = (RhizoFile *)ctx;
+
+    return Rhizofs_read_remote(file->path, file->handle, buf, size, offset, NULL);
+}
+
 
-    (void) fi;
+/**
+ * write a block of a file to the server
+ *
+ * "handle" is the server-side handle of the file or 0
+ *
+ * returns the number of bytes written or a negative errno
+ */
+static int
+Rhizofs_write_remote(const char * path, uint64_t handle, const uint8_t * buf,
+        size_t size, off_t offset, fuse_req_t req)
+{
+    int size_write = 0;
+    uint64_t file = CompressPolicy_file(path, handle);
+    Codec block_codec = codec;
 
     OP_INIT(request, response, returned_err);
 
     request.path = (char *)path;
+    if (handle != 0) {
+        request.has_handle = 1;
+        request.handle = handle;
+    }
     request.has_size = 1;
     request.size = (int64_t)size;
     request.has_offset = 1;
     request.offset = (int64_t)offset;
     request.requesttype = RHIZOFS__REQUEST_TYPE__WRITE;
-    check((Request_set_data(&request, (const uint8_t *) buf, (size_t)size) == true),
+
+    CompressPolicy_choose(&compresspolicy, file, buf, size, &block_codec);
+    uint64_t start_ns = Transport_now_ns();
+    check((Request_set_data(&request, buf, size, &block_codec) == true),
             "could not set request data");
+    CompressPolicy_record(&compresspolicy, file, &block_codec, request.datablock,
+            Transport_now_ns() - start_ns);
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
     AttrCache_remove(&attrcache, path);
+
     check((response->has_size == 1),
             "response did not contain the number of bytes written");
 
@@ -682,82 +1627,107 @@ error:
     return -returned_err;
 }
 
+
+/**
+ * write function of the write-back threads
+ */
 static int
-Rhizofs_truncate(const char * path, off_t offset)
+Rhizofs_writeback_write(void * ctx, const uint8_t * buf, size_t size, off_t offset)
 {
-    OP_INIT(request, response, returned_err);
+    RhizoFile * file = (RhizoFile *)ctx;
 
-    request.path = (char *)path;
-    request.offset = (int64_t)offset;
-    request.has_offset = 1;
-    request.requesttype = RHIZOFS__REQUEST_TYPE__TRUNCATE;
-
-    OP_COMMUNICATE(request, response, returned_err)
-    AttrCache_remove(&attrcache, path);
-
-    OP_DEINIT(request, response)
-    return 0;
-
-error:
-    OP_DEINIT(request, response)
-    return -returned_err;
+    return Rhizofs_write_remote(file->path, file->handle, buf, size, offset, NULL);
 }
 
 
+/**
+ * change the mode, size and times of "path" as selected by "to_set" and
+ * fetch the resulting attributes in one round trip
+ *
+ * "tv" contains the access and modification times to set. "handle"
+ * is the handle of the open file to change or 0. the attributes of
+ * changes made by handle are not cached, as the file may have been
+ * unlinked
+ *
+ * returns 0 or a negative errno
+ */
 static int
-Rhizofs_chmod(const char * path, mode_t access_mode)
+Rhizofs_setattr_remote(fuse_req_t req, const char * path, uint64_t handle, int to_set,
+        const struct stat * attr, const struct timespec tv[2], struct stat * stbuf)
 {
-    OP_INIT(request, response, returned_err);
+    Rhizofs__Request * subrequest = NULL;
+    bool set_times = (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_ATIME_NOW |
+                FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_MTIME_NOW)) != 0;
+
+    if (set_times || (to_set & FUSE_SET_ATTR_SIZE)) {
+        // buffered writes would change the size and the modification
+        // time afterwards
+        Rhizofs_flush_path(path);
+    }
 
-    request.requesttype = RHIZOFS__REQUEST_TYPE__CHMOD;
-    request.path = (char *)path;
+    OP_INIT(request, response, returned_err);
 
-    request.permissions = Permissions_create(access_mode);
-    check((request.permissions != NULL), "Could not create chmod permissions struct");
+    request.stop_on_error = 1;
+    request.has_stop_on_error = 1;
 
-    OP_COMMUNICATE(request, response, returned_err)
-    AttrCache_remove(&attrcache, path);
+    if (to_set & FUSE_SET_ATTR_MODE) {
+        subrequest = Request_add_subrequest(&request, RHIZOFS__REQUEST_TYPE__CHMOD, path);
+        check_mem(subrequest);
 
-    OP_DEINIT(request, response)
-    return 0;
+        subrequest->permissions = Permissions_create(attr->st_mode);
+        check((subrequest->permissions != NULL), "Could not create chmod permissions struct");
+    }
 
-error:
-    OP_DEINIT(request, response)
-    return -returned_err;
-}
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        subrequest = Request_add_subrequest(&request, RHIZOFS__REQUEST_TYPE__TRUNCATE, path);
+        check_mem(subrequest);
 
+        subrequest->offset = (int64_t)attr->st_size;
+        subrequest->has_offset = 1;
+    }
 
-static int
-Rhizofs_utimens(const char * path, const struct timespec tv[2])
-{
-    OP_INIT(request, response, returned_err);
+    if (set_times) {
+        subrequest = Request_add_subrequest(&request, RHIZOFS__REQUEST_TYPE__UTIMENS, path);
+        check_mem(subrequest);
 
-    request.requesttype = RHIZOFS__REQUEST_TYPE__UTIMENS;
-    request.path = (char *)path;
+        subrequest->timestamps = TimeSet_create();
+        check((subrequest->timestamps != NULL), "Could not create utimens timestamps struct");
 
-    request.timestamps = TimeSet_create();
-    check((request.timestamps != NULL), "Could not create utimens timestamps struct");
+        subrequest->timestamps->access_sec  = tv[0].tv_sec;
+        subrequest->timestamps->access_usec = tv[0].tv_nsec / 1000;
+        subrequest->timestamps->modify_sec  = tv[1].tv_sec;
+        subrequest->timestamps->modify_usec = tv[1].tv_nsec / 1000;
+        subrequest->timestamps->has_access_usec = 1;
+        subrequest->timestamps->has_modify_usec = 1;
+    }
 
-    if (tv != NULL) {
-        request.timestamps->access_sec  = tv[0].tv_sec;
-        request.timestamps->access_usec = tv[0].tv_nsec / 1000;
-        request.timestamps->modify_sec  = tv[1].tv_sec;
-        request.timestamps->modify_usec = tv[1].tv_nsec / 1000;
-    } else {
-        struct timeval now;
-        gettimeofday(&now, NULL);
+    check_mem(Request_add_subrequest(&request, RHIZOFS__REQUEST_TYPE__GETATTR, path));
 
-        request.timestamps->access_sec  = now.tv_sec;
-        request.timestamps->access_usec = now.tv_usec;
-        request.timestamps->modify_sec  = now.tv_sec;
-        request.timestamps->modify_usec = now.tv_usec;
+    if (handle != 0) {
+        for (size_t i=0; i<request.n_requests; i++) {
+            request.requests[i]->has_handle = 1;
+            request.requests[i]->handle = handle;
+        }
     }
-    request.timestamps->has_access_usec = 1;
-    request.timestamps->has_modify_usec = 1;
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
     AttrCache_remove(&attrcache, path);
 
+    returned_err = Rhizofs_compound_errno(response, request.n_requests);
+    check_debug((returned_err == 0), "Server reported an error: %d", returned_err);
+
+    Rhizofs__Response * getattr_response = response->responses[response->n_responses - 1];
+    returned_err = EIO;
+    if (handle != 0) {
+        check((getattr_response->attrs != NULL), "Response did not contain attrs");
+        check((Rhizofs_convert_attrs_stat(getattr_response->attrs, stbuf, req) == true),
+                "could not convert attrs");
+    }
+    else {
+        check((Rhizofs_cache_attrs(req, path, getattr_response->attrs, stbuf) == true),
+                "could not use the attrs of %s", path);
+    }
+
     OP_DEINIT(request, response)
     return 0;
 
@@ -768,15 +1738,24 @@ error:
 
 
 static int
-Rhizofs_link(const char * path_from, const char * path_to)
+Rhizofs_link_remote(fuse_req_t req, const char * path_from, const char * path_to)
 {
+    struct stat stbuf;
+    mode_t type = 0;
+
     OP_INIT(request, response, returned_err);
 
     request.requesttype = RHIZOFS__REQUEST_TYPE__LINK;
     request.path = (char *)path_from;
     request.path_to = (char *)path_to;
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
+    if (AttrCache_copy_stat(&attrcache, path_from, &stbuf)) {
+        type = stbuf.st_mode & S_IFMT;
+    }
+    AttrCache_add_name(&attrcache, path_to, type);
+    // the link count of the file changed
+    AttrCache_remove(&attrcache, path_from);
 
     OP_DEINIT(request, response)
     return 0;
@@ -788,16 +1767,20 @@ error:
 
 
 static int
-Rhizofs_rename(const char * path_from, const char * path_to)
+Rhizofs_rename_remote(fuse_req_t req, const char * path_from, const char * path_to)
 {
+    Rhizofs_flush_path(path_from);
+
     OP_INIT(request, response, returned_err);
 
     request.requesttype = RHIZOFS__REQUEST_TYPE__RENAME;
     request.path = (char *)path_from;
     request.path_to = (char *)path_to;
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
+    AttrCache_rename_name(&attrcache, path_from, path_to);
     AttrCache_remove(&attrcache, path_from);
+    AttrCache_remove(&attrcache, path_to);
 
     OP_DEINIT(request, response)
     return 0;
@@ -809,179 +1792,1182 @@ error:
 
 
 static int
-Rhizofs_readlink(const char * path, char * link_target, size_t len)
+Rhizofs_readlink_remote(fuse_req_t req, const char * path, char * link_target, size_t len)
 {
     OP_INIT(request, response, returned_err);
 
     request.requesttype = RHIZOFS__REQUEST_TYPE__READLINK;
     request.path = (char *)path;
 
-    OP_COMMUNICATE(request, response, returned_err)
+    OP_COMMUNICATE(request, response, returned_err, req)
     check((response->link_target != NULL), "Response did not contain link_target");
     strncpy(link_target, response->link_target, len);
     link_target[len-1] = 0;
 
     debug("symlink points to %s", link_target);
 
-    OP_DEINIT(request, response)
-    return 0;
+    OP_DEINIT(request, response)
+    return 0;
+
+error:
+    OP_DEINIT(request, response)
+    return -returned_err;
+}
+
+
+static int
+Rhizofs_symlink_remote(fuse_req_t req, const char * path_to, const char * path_from)
+{
+    OP_INIT(request, response, returned_err);
+
+    request.requesttype = RHIZOFS__REQUEST_TYPE__SYMLINK;
+    request.path = (char *)path_from;
+    request.path_to = (char *)path_to;
+
+    OP_COMMUNICATE(request, response, returned_err, req)
+    AttrCache_add_name(&attrcache, path_from, S_IFLNK);
+
+    OP_DEINIT(request, response)
+    return 0;
+
+error:
+    OP_DEINIT(request, response)
+    return -returned_err;
+}
+
+
+static int
+Rhizofs_mknod_remote(fuse_req_t req, const char * path, mode_t mode)
+{
+    if (!S_ISREG(mode)) {
+        log_err("Using mknod to create something other than regular files is not supported.");
+        return -EPERM;
+    }
+
+    OP_INIT(request, response, returned_err);
+
+    request.requesttype = RHIZOFS__REQUEST_TYPE__MKNOD;
+    request.path = (char *)path;
+
+    request.filetype = FileType_from_local(mode);
+    request.has_filetype = 1;
+
+    request.permissions = Permissions_create(mode);
+    check((request.permissions != NULL), "Could not create mknod permissions struct");
+
+    OP_COMMUNICATE(request, response, returned_err, req)
+    AttrCache_add_name(&attrcache, path, mode & S_IFMT);
+
+    OP_DEINIT(request, response)
+    return 0;
+
+error:
+    OP_DEINIT(request, response)
+    return -returned_err;
+
+}
+
+
+static int
+Rhizofs_statfs_remote(fuse_req_t req, const char * path, struct statvfs * svfs)
+{
+    OP_INIT(request, response, returned_err);
+
+    request.requesttype = RHIZOFS__REQUEST_TYPE__STATFS;
+    request.path = (char *)path;
+
+    OP_COMMUNICATE(request, response, returned_err, req)
+    check((response->statfs != NULL), "Response did not contain statfs");
+
+    svfs->f_bsize = response->statfs->bsize;
+    svfs->f_frsize = response->statfs->frsize;
+    svfs->f_blocks = response->statfs->blocks;
+    svfs->f_bfree = response->statfs->bfree;
+    svfs->f_bavail = response->statfs->bavail;
+
+    svfs->f_files = response->statfs->files;
+    svfs->f_ffree = response->statfs->ffree;
+    svfs->f_favail = response->statfs->favail;
+
+    svfs->f_fsid = response->statfs->fsid;
+    svfs->f_flag = response->statfs->flag;
+    svfs->f_namemax = response->statfs->namemax;
+
+    OP_DEINIT(request, response)
+    return 0;
+
+error:
+    OP_DEINIT(request, response)
+    return -returned_err;
+}
+
+
+/**
+ * release the handle of a file kept open on the server
+ *
+ * the request is sent without waiting for the response. it is not
+ * given up on when the server is unreachable for a while, and handles
+ * whose release failed get closed once the lease of the connection
+ * expires
+ */
+static int
+Rhizofs_release_remote(const char * path, uint64_t handle)
+{
+    zmq_msg_t msg_req;
+
+    OP_INIT(request, response, returned_err);
+
+    request.requesttype = RHIZOFS__REQUEST_TYPE__RELEASE;
+    request.path = (char *)path;
+    request.has_handle = 1;
+    request.handle = handle;
+
+    if (Request_pack(&request, &msg_req, NULL) != true) {
+        returned_err = errno;
+        log_and_error("Could not pack request");
+    }
+    if (!Transport_send(&transport, &msg_req)) {
+        zmq_msg_close(&msg_req);
+        log_and_error("Could not send the release of handle %llx",
+                (unsigned long long)handle);
+    }
+    zmq_msg_close(&msg_req);
+
+    OP_DEINIT(request, response)
+    return 0;
+
+error:
+    // the handle stays open until the lease expires
+    OP_DEINIT(request, response)
+    return -returned_err;
+}
+
+
+/**
+ * release the handles of the files opened by requests which have been
+ * given up on. the server keeps them open otherwise
+ *
+ * called by the transport with the replies nobody waits for anymore
+ */
+static void
+Rhizofs_stale_reply(zmq_msg_t * reply, zmq_msg_t * reply_data)
+{
+    const Rhizofs__Response * opened = NULL;
+    Rhizofs__Response * response = Response_from_message(reply, reply_data);
+
+    if (response == NULL) {
+        return;
+    }
+
+    if (response->requesttype == RHIZOFS__REQUEST_TYPE__OPEN) {
+        opened = response;
+    }
+    else if ((response->requesttype == RHIZOFS__REQUEST_TYPE__COMPOUND)
+            && (response->n_responses > 0)
+            && (response->responses[0]->requesttype == RHIZOFS__REQUEST_TYPE__CREATE)) {
+        opened = response->responses[0];
+    }
+
+    if ((opened != NULL) && opened->has_handle && (opened->handle != 0)) {
+        debug("releasing handle %llx of a cancelled open", (unsigned long long)opened->handle);
+        Rhizofs_release_remote(NULL, opened->handle);
+    }
+    Response_from_message_destroy(response);
+}
+
+
+/**
+ * ping the server while the connection is idle, so it does not close
+ * the handles of the files kept open
+ */
+static void
+Rhizofs_start_keepalive()
+{
+    zmq_msg_t msg_req;
+
+    OP_INIT(request, response, returned_err);
+    (void)returned_err;
+
+    request.requesttype = RHIZOFS__REQUEST_TYPE__PING;
+    check((Request_pack(&request, &msg_req, NULL) == true), "Could not pack the keepalive");
+    Transport_set_keepalive(&transport, &msg_req, keepalive_msec);
+    zmq_msg_close(&msg_req);
+    log_info("Sending keepalives every %u ms", keepalive_msec);
+
+error:
+    OP_DEINIT(request, response)
+}
+
+
+/*******************************************************************/
+/* filesystem methods                                              */
+/*******************************************************************/
+
+/**
+ * get the path of the entry "name" in the directory "parent"
+ *
+ * returns NULL if the directory is not known. the caller is
+ * responsible for freeing the returned string
+ */
+static char *
+Rhizofs_child_path(fuse_ino_t parent, const char * name)
+{
+    char * path = NULL;
+    char * parent_path = InodeTable_get_path(&inodetable, parent);
+
+    if (parent_path != NULL) {
+        if (path_join(parent_path, name, &path) != 0) {
+            path = NULL;
+        }
+        free(parent_path);
+    }
+    return path;
+}
+
+
+/**
+ * fill the entry for "path" with its attributes and its inode. the
+ * lookup count of the inode is increased
+ *
+ * returns 0 or a negative errno
+ */
+static int
+Rhizofs_fill_entry(fuse_req_t req, const char * path, struct fuse_entry_param * entry)
+{
+    memset(entry, 0, sizeof(struct fuse_entry_param));
+
+    int rc = Rhizofs_getattr_path(req, path, &(entry->attr));
+    if (rc != 0) {
+        return rc;
+    }
+
+    entry->ino = InodeTable_lookup(&inodetable, path);
+    if (entry->ino == 0) {
+        return -ENOMEM;
+    }
+    entry->attr.st_ino = entry->ino;
+    entry->attr_timeout = Rhizofs_attr_timeout();
+    entry->entry_timeout = Rhizofs_attr_timeout();
+
+    return 0;
+}
+
+
+/**
+ * reply to a request for a directory entry with the attributes
+ * of "path"
+ */
+static void
+Rhizofs_reply_entry(fuse_req_t req, const char * path)
+{
+    struct fuse_entry_param entry;
+
+    int rc = Rhizofs_fill_entry(req, path, &entry);
+    if ((rc == -ENOENT) && (settings.negative_ttl > 0)) {
+        // let the kernel cache the missing entry as well
+        memset(&entry, 0, sizeof(struct fuse_entry_param));
+        entry.entry_timeout = (double)settings.negative_ttl;
+        fuse_reply_entry(req, &entry);
+        return;
+    }
+    if (rc != 0) {
+        fuse_reply_err(req, -rc);
+        return;
+    }
+
+    if (fuse_reply_entry(req, &entry) != 0) {
+        // the kernel did not get the reference
+        InodeTable_forget(&inodetable, entry.ino, 1);
+    }
+}
+
+
+static void
+Rhizofs_lookup(fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+    char * path = Rhizofs_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    Rhizofs_reply_entry(req, path);
+    free(path);
+}
+
+
+static void
+Rhizofs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    InodeTable_forget(&inodetable, ino, nlookup);
+    fuse_reply_none(req);
+}
+
+
+static void
+Rhizofs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data * forgets)
+{
+    for (size_t i=0; i<count; i++) {
+        InodeTable_forget(&inodetable, forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+}
+
+
+/**
+ * get the open file of "fi" if it has been unlinked and can still be
+ * reached by its handle on the server
+ *
+ * returns NULL otherwise
+ */
+static RhizoFile *
+Rhizofs_unlinked_file(const struct fuse_file_info * fi)
+{
+    RhizoFile * file = RhizoFile_from_fi(fi);
+
+    if ((file == NULL) || (file->handle == 0)) {
+        return NULL;
+    }
+    return file;
+}
+
+
+static void
+Rhizofs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+    struct stat stbuf;
+    int rc = 0;
+
+    char * path = InodeTable_get_path(&inodetable, ino);
+    if (path == NULL) {
+        // fstat of a file which has been unlinked while open
+        RhizoFile * file = Rhizofs_unlinked_file(fi);
+        if (file == NULL) {
+            fuse_reply_err(req, ENOENT);
+            return;
+        }
+        rc = Rhizofs_getattr_handle(req, file, &stbuf);
+    }
+    else {
+        rc = Rhizofs_getattr_path(req, path, &stbuf);
+    }
+    if (rc == 0) {
+        stbuf.st_ino = ino;
+        fuse_reply_attr(req, &stbuf, Rhizofs_attr_timeout());
+    }
+    else {
+        fuse_reply_err(req, -rc);
+    }
+    free(path);
+}
+
+
+/**
+ * change mode, size and times. changing the owner is not supported
+ */
+static void
+Rhizofs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat * attr,
+        int to_set, struct fuse_file_info * fi)
+{
+    int rc = 0;
+    struct stat stbuf;
+    RhizoFile * unlinked = NULL;
+
+    char * path = InodeTable_get_path(&inodetable, ino);
+    if (path == NULL) {
+        // ftruncate of a file which has been unlinked while open
+        unlinked = Rhizofs_unlinked_file(fi);
+        path = (unlinked != NULL) ? strdup(unlinked->path) : NULL;
+        if (path == NULL) {
+            fuse_reply_err(req, (unlinked != NULL) ? ENOMEM : ENOENT);
+            return;
+        }
+    }
+
+    if (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        log_warn("CHOWN is not (yet) supported");
+        rc = -ENOTSUP;
+        goto reply;
+    }
+
+    int set_atime = to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_ATIME_NOW);
+    int set_mtime = to_set & (FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_MTIME_NOW);
+    struct timespec tv[2];
+    if (set_atime || set_mtime) {
+        struct timespec now;
+
+        // the server always sets both times. keep the one not
+        // being changed
+        if (!set_atime || !set_mtime) {
+            Rhizofs_flush_path(path);
+            rc = (unlinked != NULL) ? Rhizofs_getattr_handle(req, unlinked, &stbuf) :
+                    Rhizofs_getattr_remote(req, path, &stbuf);
+            if (rc != 0) {
+                goto reply;
+            }
+            tv[0] = stbuf.st_atim;
+            tv[1] = stbuf.st_mtim;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+            tv[0] = now;
+        }
+        else if (to_set & FUSE_SET_ATTR_ATIME) {
+            tv[0] = attr->st_atim;
+        }
+        if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+            tv[1] = now;
+        }
+        else if (to_set & FUSE_SET_ATTR_MTIME) {
+            tv[1] = attr->st_mtim;
+        }
+    }
+
+    // all changes and the getattr for the reply in one round trip
+    rc = Rhizofs_setattr_remote(req, path, (unlinked != NULL) ? unlinked->handle : 0,
+            to_set, attr, tv, &stbuf);
+    if ((rc == 0) && (to_set & FUSE_SET_ATTR_SIZE)) {
+        RhizoFile * file = RhizoFile_from_fi(fi);
+        if (file != NULL) {
+            ReadAhead_invalidate(file->readahead);
+        }
+    }
+
+reply:
+    if (rc == 0) {
+        stbuf.st_ino = ino;
+        fuse_reply_attr(req, &stbuf, Rhizofs_attr_timeout());
+    }
+    else {
+        fuse_reply_err(req, -rc);
+    }
+    free(path);
+}
+
+
+static void
+Rhizofs_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    char link_target[PATH_MAX];
+
+    char * path = InodeTable_get_path(&inodetable, ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = Rhizofs_readlink_remote(req, path, link_target, sizeof(link_target));
+    if (rc == 0) {
+        fuse_reply_readlink(req, link_target);
+    }
+    else {
+        fuse_reply_err(req, -rc);
+    }
+    free(path);
+}
+
+
+static void
+Rhizofs_mknod(fuse_req_t req, fuse_ino_t parent, const char * name,
+        mode_t mode, dev_t UNUSED_PARAMETER(rdev))
+{
+    char * path = Rhizofs_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = Rhizofs_mknod_remote(req, path, mode);
+    if (rc == 0) {
+        Rhizofs_reply_entry(req, path);
+    }
+    else {
+        fuse_reply_err(req, -rc);
+    }
+    free(path);
+}
+
+
+static void
+Rhizofs_mkdir(fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode)
+{
+    char * path = Rhizofs_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = Rhizofs_mkdir_remote(req, path, mode);
+    if (rc == 0) {
+        Rhizofs_reply_entry(req, path);
+    }
+    else {
+        fuse_reply_err(req, -rc);
+    }
+    free(path);
+}
+
+
+static void
+Rhizofs_unlink(fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+    char * path = Rhizofs_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = Rhizofs_unlink_remote(req, path);
+    if (rc == 0) {
+        InodeTable_remove(&inodetable, path);
+    }
+    fuse_reply_err(req, -rc);
+    free(path);
+}
+
+
+static void
+Rhizofs_rmdir(fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+    char * path = Rhizofs_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = Rhizofs_rmdir_remote(req, path);
+    if (rc == 0) {
+        InodeTable_remove(&inodetable, path);
+    }
+    fuse_reply_err(req, -rc);
+    free(path);
+}
+
+
+static void
+Rhizofs_symlink(fuse_req_t req, const char * link, fuse_ino_t parent, const char * name)
+{
+    char * path = Rhizofs_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = Rhizofs_symlink_remote(req, link, path);
+    if (rc == 0) {
+        Rhizofs_reply_entry(req, path);
+    }
+    else {
+        fuse_reply_err(req, -rc);
+    }
+    free(path);
+}
+
+
+static void
+Rhizofs_rename(fuse_req_t req, fuse_ino_t parent, const char * name,
+        fuse_ino_t newparent, const char * newname, unsigned int flags)
+{
+    int rc = 0;
+    char * path_from = NULL;
+    char * path_to = NULL;
+
+    // RENAME_EXCHANGE and RENAME_NOREPLACE can not be done atomically
+    if (flags != 0) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    path_from = Rhizofs_child_path(parent, name);
+    path_to = Rhizofs_child_path(newparent, newname);
+    if ((path_from == NULL) || (path_to == NULL)) {
+        rc = -ENOENT;
+    }
+    else {
+        rc = Rhizofs_rename_remote(req, path_from, path_to);
+        if (rc == 0) {
+            InodeTable_rename(&inodetable, path_from, path_to);
+            RhizoFile_rename_all(path_from, path_to);
+        }
+    }
+    fuse_reply_err(req, -rc);
+
+    free(path_from);
+    free(path_to);
+}
+
+
+/**
+ * reply to a link request with the inode linked to, so the kernel
+ * sees both names as the same file. inodes are mapped to a single
+ * path, so the new name gets an inode of its own when it is looked
+ * up again after the kernel dropped its entry
+ *
+ * returns 0 or a negative errno if no reply has been sent
+ */
+static int
+Rhizofs_reply_link(fuse_req_t req, fuse_ino_t ino, const char * path_to)
+{
+    struct fuse_entry_param entry;
+
+    memset(&entry, 0, sizeof(struct fuse_entry_param));
+    int rc = Rhizofs_getattr_path(req, path_to, &(entry.attr));
+    if (rc != 0) {
+        return rc;
+    }
+    if (!InodeTable_hold(&inodetable, ino)) {
+        return -ENOENT;
+    }
+
+    entry.ino = ino;
+    entry.attr.st_ino = ino;
+    entry.attr_timeout = Rhizofs_attr_timeout();
+    entry.entry_timeout = Rhizofs_attr_timeout();
+
+    if (fuse_reply_entry(req, &entry) != 0) {
+        // the kernel did not get the reference
+        InodeTable_forget(&inodetable, ino, 1);
+    }
+    return 0;
+}
+
+
+static void
+Rhizofs_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char * newname)
+{
+    int rc = 0;
+    char * path_from = InodeTable_get_path(&inodetable, ino);
+    char * path_to = Rhizofs_child_path(newparent, newname);
+
+    if ((path_from == NULL) || (path_to == NULL)) {
+        rc = -ENOENT;
+    }
+    else {
+        rc = Rhizofs_link_remote(req, path_from, path_to);
+    }
+
+    if (rc == 0) {
+        rc = Rhizofs_reply_link(req, ino, path_to);
+    }
+    if (rc != 0) {
+        fuse_reply_err(req, -rc);
+    }
+
+    free(path_from);
+    free(path_to);
+}
+
+
+static void
+Rhizofs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+    char * path = InodeTable_get_path(&inodetable, ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stat stbuf;
+    int rc = 0;
+    if (Rhizofs_control_stat(path, &stbuf)) {
+        rc = Rhizofs_open_control(path, fi);
+    }
+    else {
+        rc = Rhizofs_open_remote(req, path, fi);
+    }
+    if (rc == 0) {
+        if (fuse_reply_open(req, fi) != 0) {
+            // the open got interrupted. there will be no release
+            RhizoFile * file = RhizoFile_from_fi(fi);
+            if (file->handle != 0) {
+                Rhizofs_release_remote(file->path, file->handle);
+            }
+            RhizoFile_destroy(file);
+        }
+    }
+    else {
+        fuse_reply_err(req, -rc);
+    }
+    free(path);
+}
+
+
+static void
+Rhizofs_create(fuse_req_t req, fuse_ino_t parent, const char * name,
+        mode_t mode, struct fuse_file_info * fi)
+{
+    struct fuse_entry_param entry;
+
+    char * path = Rhizofs_child_path(parent, name);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int rc = Rhizofs_create_remote(req, path, mode, fi);
+    if (rc != 0) {
+        fuse_reply_err(req, -rc);
+        free(path);
+        return;
+    }
+
+    rc = Rhizofs_fill_entry(req, path, &entry);
+    if ((rc != 0) || (fuse_reply_create(req, &entry, fi) != 0)) {
+        if (rc == 0) {
+            // the kernel did not get the reference
+            InodeTable_forget(&inodetable, entry.ino, 1);
+        }
+        else {
+            fuse_reply_err(req, -rc);
+        }
+
+        // there will be no release for the file
+        RhizoFile * file = RhizoFile_from_fi(fi);
+        if (file->handle != 0) {
+            Rhizofs_release_remote(file->path, file->handle);
+        }
+        RhizoFile_destroy(file);
+    }
+    free(path);
+}
+
+
+static void
+Rhizofs_read(fuse_req_t req, fuse_ino_t UNUSED_PARAMETER(ino), size_t size,
+        off_t offset, struct fuse_file_info * fi)
+{
+    int size_read = -EBADF;
+    RhizoFile * file = RhizoFile_from_fi(fi);
+
+    uint8_t * buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    if (file == NULL) {
+        goto reply;
+    }
+
+    if (file->content != NULL) {
+        size_read = 0;
+        if ((offset >= 0) && ((size_t)offset < file->content_size)) {
+            size_read = (int)(((file->content_size - (size_t)offset) < size) ?
+                    (file->content_size - (size_t)offset) : size);
+            memcpy(buf, file->content + offset, (size_t)size_read);
+        }
+        goto reply;
+    }
+
+    if (file->writeback != NULL) {
+        // the server has to know about the data written before
+        size_read = WriteBack_flush(file->writeback);
+        if (size_read < 0) {
+            goto reply;
+        }
+    }
+
+    size_read = -1;
+    if (file->readahead != NULL) {
+        size_read = ReadAhead_read(file->readahead, buf, size, offset);
+    }
+    if (size_read == -1) {
+        size_read = Rhizofs_read_remote(file->path, file->handle, buf, size, offset, req);
+    }
+
+reply:
+    if (size_read < 0) {
+        fuse_reply_err(req, -size_read);
+    }
+    else {
+        fuse_reply_buf(req, (const char *)buf, (size_t)size_read);
+    }
+    free(buf);
+}
+
+
+static void
+Rhizofs_write(fuse_req_t req, fuse_ino_t UNUSED_PARAMETER(ino), const char * buf,
+        size_t size, off_t offset, struct fuse_file_info * fi)
+{
+    int size_write = 0;
+    RhizoFile * file = RhizoFile_from_fi(fi);
+
+    if (file == NULL) {
+        fuse_reply_err(req, EBADF);
+        return;
+    }
+
+    if (file->writeback != NULL) {
+        size_write = WriteBack_write(file->writeback, (const uint8_t *)buf, size, offset);
+        AttrCache_remove(&attrcache, file->path);
+    }
+    else {
+        size_write = Rhizofs_write_remote(file->path, file->handle,
+                (const uint8_t *)buf, size, offset, req);
+    }
+    ReadAhead_invalidate(file->readahead);
+
+    if (size_write < 0) {
+        fuse_reply_err(req, -size_write);
+    }
+    else {
+        fuse_reply_write(req, (size_t)size_write);
+    }
+}
+
+
+/**
+ * called on each close of a file descriptor. sending the buffered
+ * writes here allows reporting errors to close()
+ */
+static void
+Rhizofs_flush(fuse_req_t req, fuse_ino_t UNUSED_PARAMETER(ino), struct fuse_file_info * fi)
+{
+    int rc = 0;
+    RhizoFile * file = RhizoFile_from_fi(fi);
+
+    if ((file != NULL) && (file->writeback != NULL)) {
+        rc = WriteBack_flush(file->writeback);
+    }
+    fuse_reply_err(req, -rc);
+}
+
+
+/**
+ * sends the buffered writes to the server. the server does not
+ * sync its files to disk, so there is nothing more to do
+ */
+static void
+Rhizofs_fsync(fuse_req_t req, fuse_ino_t UNUSED_PARAMETER(ino),
+        int UNUSED_PARAMETER(datasync), struct fuse_file_info * fi)
+{
+    int rc = 0;
+    RhizoFile * file = RhizoFile_from_fi(fi);
+
+    if ((file != NULL) && (file->writeback != NULL)) {
+        rc = WriteBack_flush(file->writeback);
+    }
+    fuse_reply_err(req, -rc);
+}
+
+
+static void
+Rhizofs_release(fuse_req_t req, fuse_ino_t UNUSED_PARAMETER(ino), struct fuse_file_info * fi)
+{
+    RhizoFile * file = RhizoFile_from_fi(fi);
+
+    if (file != NULL) {
+        // the buffered data has to be written before the
+        // handle gets released
+        if ((file->writeback != NULL) && (WriteBack_flush(file->writeback) < 0)) {
+            log_warn("Could not write back all data of %s", file->path);
+        }
+        if (file->handle != 0) {
+            Rhizofs_release_remote(file->path, file->handle);
+        }
+        RhizoFile_destroy(file);
+        fi->fh = 0;
+    }
+
+    // the return value of release is ignored by fuse
+    fuse_reply_err(req, 0);
+}
+
+
+static void
+Rhizofs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+    char * path = InodeTable_get_path(&inodetable, ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    RhizoDir * dir = RhizoDir_create(path);
+    free(path);
+    if (dir == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
 
-error:
-    OP_DEINIT(request, response)
-    return -returned_err;
+    fi->fh = (uint64_t)(uintptr_t)dir;
+    if (fuse_reply_open(req, fi) != 0) {
+        RhizoDir_destroy(dir);
+    }
 }
 
 
-static int
-Rhizofs_symlink(const char * path_to, const char * path_from)
+/**
+ * add an entry of "dir" to the reply buffer of a readdir
+ *
+ * "plus" adds the attributes of the entry and makes it known to the
+ * kernel as if it had been looked up
+ *
+ * returns the size of the added entry, 0 if it did not fit into
+ * the buffer or -1 on error
+ */
+static ssize_t
+Rhizofs_add_direntry(fuse_req_t req, const RhizoDir * dir, const DirListingEntry * dir_entry,
+        char * buf, size_t size, off_t next_offset, bool plus)
 {
-    OP_INIT(request, response, returned_err);
-
-    request.requesttype = RHIZOFS__REQUEST_TYPE__SYMLINK;
-    request.path = (char *)path_from;
-    request.path_to = (char *)path_to;
+    char * path_entry = NULL;
+    size_t entry_size = 0;
+    bool is_dot = ((strcmp(dir_entry->name, ".") == 0) || (strcmp(dir_entry->name, "..") == 0));
 
-    OP_COMMUNICATE(request, response, returned_err)
+    if (path_join(dir->path, dir_entry->name, &path_entry) != 0) {
+        return -1;
+    }
 
-    OP_DEINIT(request, response)
-    return 0;
+    if (plus) {
+        struct fuse_entry_param entry;
+        memset(&entry, 0, sizeof(entry));
 
-error:
-    OP_DEINIT(request, response)
-    return -returned_err;
-}
+        // the lookup count may only be increased for entries
+        // which fit into the buffer
+        if (fuse_add_direntry_plus(req, NULL, 0, dir_entry->name, NULL, 0) > size) {
+            free(path_entry);
+            return 0;
+        }
 
+        // entries without cached attributes are passed without an
+        // inode, so no lookup is counted. the kernel will look them
+        // up when needed. their d_ino must not be 0 nevertheless, as
+        // readdir skips such entries
+        entry.attr.st_mode = dir_entry->type;
+        if (!is_dot && AttrCache_copy_stat(&attrcache, path_entry, &(entry.attr))) {
+            entry.ino = InodeTable_lookup(&inodetable, path_entry);
+            entry.attr.st_ino = entry.ino;
+            entry.attr_timeout = Rhizofs_attr_timeout();
+            entry.entry_timeout = Rhizofs_attr_timeout();
+        }
+        else {
+            uint64_t ino = InodeTable_peek(&inodetable, path_entry);
+            entry.attr.st_ino = (ino != 0) ? ino : RHIZOFS_UNKNOWN_INO;
+        }
+        entry_size = fuse_add_direntry_plus(req, buf, size, dir_entry->name, &entry, next_offset);
+    }
+    else {
+        struct stat stbuf;
+        memset(&stbuf, 0, sizeof(stbuf));
 
-static int
-Rhizofs_mknod(const char * path, mode_t mode, dev_t dev)
-{
-    (void) dev;
+        uint64_t ino = InodeTable_peek(&inodetable, path_entry);
+        stbuf.st_ino = (ino != 0) ? ino : RHIZOFS_UNKNOWN_INO;
+        stbuf.st_mode = dir_entry->type;
 
-    if (!S_ISREG(mode)) {
-        log_err("Using mknod to create something other than regular files is not supported.");
-        return -EPERM;
+        entry_size = fuse_add_direntry(req, buf, size, dir_entry->name, &stbuf, next_offset);
+        if (entry_size > size) {
+            entry_size = 0;
+        }
     }
 
-    OP_INIT(request, response, returned_err);
+    free(path_entry);
+    return (ssize_t)entry_size;
+}
 
-    request.requesttype = RHIZOFS__REQUEST_TYPE__MKNOD;
-    request.path = (char *)path;
 
-    request.filetype = FileType_from_local(mode);
-    request.has_filetype = 1;
+/**
+ * serve directory entries starting at "offset". reading starts over
+ * at offset 0
+ *
+ * entries of a complete listing use their index as offset. listings
+ * streamed from the server in pages use the cookies of the server, so
+ * only the page holding "offset" needs to be kept
+ *
+ * "plus" adds the attributes of the entries and makes them
+ * known to the kernel as if they had been looked up
+ */
+static void
+Rhizofs_readdir_common(fuse_req_t req, size_t size, off_t offset,
+        struct fuse_file_info * fi, bool plus)
+{
+    int err = 0;
+    char * buf = NULL;
+    size_t buf_used = 0;
+    size_t entry_n = 0;
+    ssize_t entry_size = 0;
+    RhizoDir * dir = (RhizoDir *)(uintptr_t)fi->fh;
+
+    if (offset == 0) {
+        err = Rhizofs_readdir_start(req, dir);
+        if (err != 0) {
+            fuse_reply_err(req, -err);
+            return;
+        }
+    }
 
-    request.permissions = Permissions_create(mode);
-    check((request.permissions != NULL), "Could not create mknod permissions struct");
+    buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
 
-    OP_COMMUNICATE(request, response, returned_err)
+    if ((dir->listing == NULL) && (offset != 0)) {
+        // continue after the entry of the current page the offset
+        // was passed for, or fetch the page following it
+        bool found = false;
+        if (dir->page != NULL) {
+            for (entry_n=0; entry_n<dir->page->n_entries; entry_n++) {
+                if (dir->page_cookies[entry_n] == (uint64_t)offset) {
+                    found = true;
+                    entry_n++;
+                    break;
+                }
+            }
+        }
+        if (!found) {
+            err = Rhizofs_readdir_remote(req, dir, (uint64_t)offset, NULL);
+            entry_n = 0;
+        }
+    }
+    else if (dir->listing != NULL) {
+        entry_n = (size_t)offset;
+    }
 
-    OP_DEINIT(request, response)
-    return 0;
+    while ((err == 0) && (dir->listing != NULL) && (entry_n < dir->listing->n_entries)) {
+        entry_size = Rhizofs_add_direntry(req, dir, &(dir->listing->entries[entry_n]),
+                buf + buf_used, size - buf_used, (off_t)entry_n + 1, plus);
+        if (entry_size <= 0) {
+            err = (entry_size < 0) ? -ENOMEM : 0;
+            break;
+        }
+        buf_used += entry_size;
+        entry_n++;
+    }
 
-error:
-    OP_DEINIT(request, response)
-    return -returned_err;
+    while ((err == 0) && (dir->listing == NULL) && (dir->page != NULL)) {
+        if (entry_n >= dir->page->n_entries) {
+            // reply with what is there instead of waiting for the
+            // next page
+            if (dir->page_is_last || (dir->page->n_entries == 0) || (buf_used != 0)) {
+                break;
+            }
+            err = Rhizofs_readdir_remote(req, dir,
+                    dir->page_cookies[dir->page->n_entries - 1], NULL);
+            entry_n = 0;
+            continue;
+        }
+
+        entry_size = Rhizofs_add_direntry(req, dir, &(dir->page->entries[entry_n]),
+                buf + buf_used, size - buf_used, (off_t)dir->page_cookies[entry_n], plus);
+        if (entry_size <= 0) {
+            err = (entry_size < 0) ? -ENOMEM : 0;
+            break;
+        }
+        buf_used += entry_size;
+        entry_n++;
+    }
 
+    if ((err != 0) && (buf_used == 0)) {
+        fuse_reply_err(req, -err);
+    }
+    else {
+        fuse_reply_buf(req, buf, buf_used);
+    }
+    free(buf);
 }
 
 
-static int
-Rhizofs_chown(const char * path, uid_t user, gid_t group)
+static void
+Rhizofs_readdir(fuse_req_t req, fuse_ino_t UNUSED_PARAMETER(ino), size_t size,
+        off_t offset, struct fuse_file_info * fi)
 {
-    (void) path;
-    (void) user;
-    (void) group;
-
-    log_warn("CHOWN is not (yet) supported");
-    return -ENOTSUP;
+    Rhizofs_readdir_common(req, size, offset, fi, false);
 }
 
 
-static int
-Rhizofs_statfs(const char * path, struct statvfs * svfs)
+static void
+Rhizofs_readdirplus(fuse_req_t req, fuse_ino_t UNUSED_PARAMETER(ino), size_t size,
+        off_t offset, struct fuse_file_info * fi)
 {
-    OP_INIT(request, response, returned_err);
-
-    request.requesttype = RHIZOFS__REQUEST_TYPE__STATFS;
-    request.path = (char *)path;
+    Rhizofs_readdir_common(req, size, offset, fi, true);
+}
 
-    OP_COMMUNICATE(request, response, returned_err)
-    check((response->statfs != NULL), "Response did not contain statfs");
 
-    svfs->f_bsize = response->statfs->bsize;
-    svfs->f_frsize = response->statfs->frsize;
-    svfs->f_blocks = response->statfs->blocks;
-    svfs->f_bfree = response->statfs->bfree;
-    svfs->f_bavail = response->statfs->bavail;
+static void
+Rhizofs_releasedir(fuse_req_t req, fuse_ino_t UNUSED_PARAMETER(ino), struct fuse_file_info * fi)
+{
+    RhizoDir_destroy((RhizoDir *)(uintptr_t)fi->fh);
+    fi->fh = 0;
+    fuse_reply_err(req, 0);
+}
 
-    svfs->f_files = response->statfs->files;
-    svfs->f_ffree = response->statfs->ffree;
-    svfs->f_favail = response->statfs->favail;
 
-    svfs->f_fsid = response->statfs->fsid;
-    svfs->f_flag = response->statfs->flag;
-    svfs->f_namemax = response->statfs->namemax;
+static void
+Rhizofs_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    struct statvfs svfs;
 
-    OP_DEINIT(request, response)
-    return 0;
+    char * path = InodeTable_get_path(&inodetable, ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
 
-error:
-    OP_DEINIT(request, response)
-    return -returned_err;
+    memset(&svfs, 0, sizeof(svfs));
+    int rc = Rhizofs_statfs_remote(req, path, &svfs);
+    if (rc == 0) {
+        fuse_reply_statfs(req, &svfs);
+    }
+    else {
+        fuse_reply_err(req, -rc);
+    }
+    free(path);
 }
 
 
-/*
-static int
-Rhizofs_release(const char *path, struct fuse_file_info *fi)
+static void
+Rhizofs_access(fuse_req_t req, fuse_ino_t ino, int mask)
 {
-    (void) path;
-    (void) fi;
+    char * path = InodeTable_get_path(&inodetable, ino);
+    if (path == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
 
-    log_warn("RELEASE is not (yet) supported");
-    return -ENOTSUP;
+    struct stat stbuf;
+    int rc = 0;
+    if (Rhizofs_control_stat(path, &stbuf)) {
+        rc = (mask & W_OK) ? -EACCES : 0;
+    }
+    else {
+        rc = Rhizofs_access_remote(req, path, mask);
+    }
+    fuse_reply_err(req, -rc);
+    free(path);
 }
 
 
-static int
-Rhizofs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi)
-{
-    (void) path;
-    (void) isdatasync;
-    (void) fi;
-
-    log_warn("FSYNC is not (yet) supported");
-    return -ENOTSUP;
-}
-*/
-
-
-static struct fuse_operations rhizofs_operations = {
-    .readdir    = Rhizofs_readdir,
-    .init       = Rhizofs_init,
-    .destroy    = Rhizofs_destroy,
-    .getattr    = Rhizofs_getattr,
-    .mkdir      = Rhizofs_mkdir,
-    .rmdir      = Rhizofs_rmdir,
-    .unlink     = Rhizofs_unlink,
-    .access     = Rhizofs_access,
-    .open       = Rhizofs_open,
-    .read       = Rhizofs_read,
-    .write      = Rhizofs_write,
-    .create     = Rhizofs_create,
-    .truncate   = Rhizofs_truncate,
-    .chmod      = Rhizofs_chmod,
-    .utimens    = Rhizofs_utimens,
-    .link       = Rhizofs_link,
-    .rename     = Rhizofs_rename,
-    .symlink    = Rhizofs_symlink,
-    .readlink   = Rhizofs_readlink,
-    .mknod      = Rhizofs_mknod,
-//  stubs to implement
-    .chown      = Rhizofs_chown,
-    .statfs     = Rhizofs_statfs
-    //.release    = Rhizofs_release,
-    //.fsync      = Rhizofs_fsync,
+static struct fuse_lowlevel_ops rhizofs_operations = {
+    .init         = Rhizofs_init,
+    .destroy      = Rhizofs_destroy,
+    .lookup       = Rhizofs_lookup,
+    .forget       = Rhizofs_forget,
+    .forget_multi = Rhizofs_forget_multi,
+    .getattr      = Rhizofs_getattr,
+    .setattr      = Rhizofs_setattr,
+    .readlink     = Rhizofs_readlink,
+    .mknod        = Rhizofs_mknod,
+    .mkdir        = Rhizofs_mkdir,
+    .unlink       = Rhizofs_unlink,
+    .rmdir        = Rhizofs_rmdir,
+    .symlink      = Rhizofs_symlink,
+    .rename       = Rhizofs_rename,
+    .link         = Rhizofs_link,
+    .open         = Rhizofs_open,
+    .create       = Rhizofs_create,
+    .read         = Rhizofs_read,
+    .write        = Rhizofs_write,
+    .flush        = Rhizofs_flush,
+    .fsync        = Rhizofs_fsync,
+    .release      = Rhizofs_release,
+    .opendir      = Rhizofs_opendir,
+    .readdir      = Rhizofs_readdir,
+    .readdirplus  = Rhizofs_readdirplus,
+    .releasedir   = Rhizofs_releasedir,
+    .statfs       = Rhizofs_statfs,
+    .access       = Rhizofs_access,
 };
 
 
@@ -995,7 +2981,14 @@ Rhizofs_settings_init()
     // set the default timeout
     settings.timeout = TIMEOUT_DEFAULT;
 
-    settings.check_socket_connection = true;
+    settings.readahead_window = READAHEAD_DEFAULT_WINDOW;
+    settings.max_in_flight = TRANSPORT_DEFAULT_WINDOW;
+    settings.writeback_max_dirty_mb = WRITEBACK_DEFAULT_MAX_DIRTY_MB;
+    settings.negative_ttl = ATTRCACHE_DEFAULT_NEGATIVE_MAXAGE_SEC;
+    settings.attrcache_size = ATTRCACHE_DEFAULT_MAXSIZE;
+    settings.attr_ttl = ATTRCACHE_DEFAULT_MAXAGE_SEC;
+    settings.codec_threads = (unsigned int)CodecPool_default_threads();
+    settings.data_frames = 1;
 }
 
 
@@ -1003,6 +2996,33 @@ static inline void
 Rhizofs_settings_deinit()
 {
     free(settings.host_socket);
+    free(settings.notify_socket);
+    free(settings.compression);
+}
+
+
+/**
+ * check if "host_socket" is an address on the same machine, where
+ * compressing the data costs more time than sending it
+ */
+static bool
+Rhizofs_is_local_socket(const char * host_socket)
+{
+    static const char * const local_prefixes[] = {
+        "ipc://",
+        "inproc://",
+        "tcp://127.",
+        "tcp://localhost:",
+        "tcp://[::1]:",
+        NULL
+    };
+
+    for (int i=0; local_prefixes[i] != NULL; i++) {
+        if (strncmp(host_socket, local_prefixes[i], strlen(local_prefixes[i])) == 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
 
@@ -1017,6 +3037,27 @@ Rhizofs_settings_check()
         fprintf(stderr, "Missing host");
         goto error;
     }
+    if (settings.readahead_window > READAHEAD_MAX_WINDOW) {
+        fprintf(stderr, "readahead may not exceed %d blocks\n", READAHEAD_MAX_WINDOW);
+        goto error;
+    }
+    if ((settings.max_in_flight == 0) || (settings.max_in_flight > TRANSPORT_MAX_WINDOW)) {
+        fprintf(stderr, "inflight has to be between 1 and %d\n", TRANSPORT_MAX_WINDOW);
+        goto error;
+    }
+    if (settings.codec_threads > CODECPOOL_MAX_THREADS) {
+        fprintf(stderr, "codecthreads may not exceed %d\n", CODECPOOL_MAX_THREADS);
+        goto error;
+    }
+    if ((settings.compression == NULL) || (strcmp(settings.compression, "auto") == 0)) {
+        codec.type = Rhizofs_is_local_socket(settings.host_socket) ?
+                RHIZOFS__COMPRESSION_TYPE__COMPR_NONE : RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4;
+        codec.level = 0;
+    }
+    else if (!Codec_parse(settings.compression, &codec)) {
+        fprintf(stderr, "Invalid compression: %s\n", settings.compression);
+        goto error;
+    }
     return 0;
 
 error:
@@ -1060,7 +3101,6 @@ error:
 static inline void
 RhizoPriv_destroy(RhizoPriv * priv)
 {
-    SocketPool_deinit(&socketpool);
     if (priv) {
         if (priv->context != NULL) {
             zmq_ctx_destroy(priv->context);
@@ -1071,6 +3111,184 @@ RhizoPriv_destroy(RhizoPriv * priv)
     }
 }
 
+/** file **********************************************************/
+
+/**
+ * create the state of an opened file
+ *
+ * "handle" is the server-side handle or 0, "flags" the flags
+ * the file was opened with
+ *
+ * returns NULL on error
+ */
+static RhizoFile *
+RhizoFile_create(const char * path, uint64_t handle, int flags)
+{
+    RhizoFile * file = NULL;
+
+    file = calloc(sizeof(RhizoFile), 1);
+    check_mem(file);
+
+    file->handle = handle;
+    file->path = strdup(path);
+    check_mem(file->path);
+
+    if ((settings.readahead_window > 0) && ((flags & O_ACCMODE) != O_WRONLY)) {
+        file->readahead = ReadAhead_create(&readaheadpool, file, settings.readahead_window);
+        check((file->readahead != NULL), "Could not create readahead");
+    }
+
+    if ((settings.writeback_max_dirty_mb > 0) && ((flags & O_ACCMODE) != O_RDONLY)) {
+        file->writeback = WriteBack_create(&writebackpool, file, file->path);
+        check((file->writeback != NULL), "Could not create writeback");
+    }
+
+    pthread_mutex_lock(&open_files_mutex);
+    file->next = open_files;
+    if (open_files != NULL) {
+        open_files->prev = file;
+    }
+    open_files = file;
+    pthread_mutex_unlock(&open_files_mutex);
+
+    return file;
+
+error:
+    RhizoFile_destroy(file);
+    return NULL;
+}
+
+
+/**
+ * destroy the state of an opened file. waits for prefetches
+ * still in progress and sends the buffered writes
+ */
+static void
+RhizoFile_destroy(RhizoFile * file)
+{
+    if (file) {
+        pthread_mutex_lock(&open_files_mutex);
+        if (file->prev != NULL) {
+            file->prev->next = file->next;
+        }
+        else if (open_files == file) {
+            open_files = file->next;
+        }
+        if (file->next != NULL) {
+            file->next->prev = file->prev;
+        }
+        pthread_mutex_unlock(&open_files_mutex);
+
+        if (WriteBack_destroy(file->writeback) < 0) {
+            log_warn("Could not write back all data of %s", file->path);
+        }
+        ReadAhead_destroy(file->readahead);
+        free(file->content);
+        for (size_t i=0; i<file->n_old_paths; i++) {
+            free(file->old_paths[i]);
+        }
+        free(file->old_paths);
+        free(file->path);
+        free(file);
+    }
+}
+
+
+/**
+ * change the paths of the open files after "path_from" has been
+ * renamed to "path_to". this includes the files below a renamed
+ * directory
+ */
+static void
+RhizoFile_rename_all(const char * path_from, const char * path_to)
+{
+    size_t from_len = strlen(path_from);
+
+    pthread_mutex_lock(&open_files_mutex);
+    for (RhizoFile * file = open_files; file != NULL; file = file->next) {
+        if ((strncmp(file->path, path_from, from_len) != 0) ||
+                ((file->path[from_len] != '\0') && (file->path[from_len] != '/'))) {
+            continue;
+        }
+
+        char * new_path = malloc(strlen(path_to) + strlen(file->path + from_len) + 1);
+        char ** old_paths = realloc(file->old_paths, sizeof(char *) * (file->n_old_paths + 1));
+        if ((new_path == NULL) || (old_paths == NULL)) {
+            log_err("Could not allocate the new path of %s", file->path);
+            free(new_path);
+            if (old_paths != NULL) {
+                file->old_paths = old_paths;
+            }
+            continue;
+        }
+        strcpy(new_path, path_to);
+        strcat(new_path, file->path + from_len);
+
+        file->old_paths = old_paths;
+        file->old_paths[file->n_old_paths++] = file->path;
+        __atomic_store_n(&(file->path), new_path, __ATOMIC_RELEASE);
+        if (file->writeback != NULL) {
+            WriteBack_set_path(file->writeback, new_path);
+        }
+    }
+    pthread_mutex_unlock(&open_files_mutex);
+}
+
+/** directory *****************************************************/
+
+/**
+ * create the state of an opened directory
+ *
+ * returns NULL on error
+ */
+static RhizoDir *
+RhizoDir_create(const char * path)
+{
+    RhizoDir * dir = NULL;
+
+    dir = calloc(sizeof(RhizoDir), 1);
+    check_mem(dir);
+
+    dir->path = strdup(path);
+    check_mem(dir->path);
+
+    return dir;
+
+error:
+    RhizoDir_destroy(dir);
+    return NULL;
+}
+
+
+/**
+ * drop the listing and the pages read so far
+ */
+static void
+RhizoDir_reset(RhizoDir * dir)
+{
+    DirListing_destroy(dir->listing);
+    dir->listing = NULL;
+    DirListing_destroy(dir->page);
+    dir->page = NULL;
+    free(dir->page_cookies);
+    dir->page_cookies = NULL;
+    dir->page_is_last = false;
+    DirListing_destroy(dir->assembled);
+    dir->assembled = NULL;
+    dir->assembled_cookie = 0;
+}
+
+
+static void
+RhizoDir_destroy(RhizoDir * dir)
+{
+    if (dir) {
+        RhizoDir_reset(dir);
+        free(dir->path);
+        free(dir);
+    }
+}
+
 /*******************************************************************/
 /* general methods                                                 */
 /*******************************************************************/
@@ -1100,17 +3318,86 @@ Rhizofs_usage(const char * progname)
         "\n"
         "general options\n"
         "---------------\n"
+        "   --attrcache=<paths>       max. number of paths to cache attributes\n"
+        "                             for. 0 disables [default=" STRINGIFY(ATTRCACHE_DEFAULT_MAXSIZE) "]\n"
+        "   --attrttl=<seconds>       time to cache attributes and directory\n"
+        "                             listings [default=" STRINGIFY(ATTRCACHE_DEFAULT_MAXAGE_SEC) "]\n"
         "   --clientpubkeyfile=<file> set client keypair file\n"
+        "   --codecthreads=<threads>  threads compressing and decompressing the\n"
+        "                             chunks of large reads and writes in parallel.\n"
+        "                             0 disables [default=number of CPUs - 1]\n"
+        "   --compression=<codec>     compression of the transferred data: auto,\n"
+        "                             none, lz4[:<acceleration>], lz4hc[:<level>]\n"
+        "                             or zstd[:<level>]. auto uses none for local\n"
+        "                             sockets and lz4 otherwise [default=auto]\n"
+        "   --dataframes=<0|1>        send the data of reads and writes as separate\n"
+        "                             messages if the server supports it [default=1]\n"
         "   -h --help                 print help\n"
+        "   --inflight=<requests>     max. number of requests sent to the server\n"
+        "                             without waiting for responses [default=" STRINGIFY(TRANSPORT_DEFAULT_WINDOW) "]\n"
         "   -k --pubkey=<key>         set the server public key\n"
+        "   --negttl=<seconds>        time to remember paths which do not exist.\n"
+        "                             0 disables [default=" STRINGIFY(ATTRCACHE_DEFAULT_NEGATIVE_MAXAGE_SEC) "]\n"
+        "   --notify=<socket>         subscribe to the changes published by the\n"
+        "                             server on this socket (see rhizosrv --notify)\n"
         "   --pubkeyfile=<file>       set to file that contains the public key\n"
+        "   --readahead=<blocks>      max. number of blocks to prefetch for files\n"
+        "                             read sequentially. 0 disables [default=" STRINGIFY(READAHEAD_DEFAULT_WINDOW) "]\n"
+        "   --writeback=<MB>          max. amount of written data to buffer before\n"
+        "                             sending it to the server. 0 disables [default=" STRINGIFY(WRITEBACK_DEFAULT_MAX_DIRTY_MB) "]\n"
         "   -V --version              print version\n"
         "\n"
         HELPTEXT_LOGGING
-        "\n", progname
+        "\n"
+        "FUSE options:\n", progname
     );
 }
 
+/**
+ * fall back to a codec the server supports if it does not know the
+ * one chosen, and split large writes into chunks and send their data
+ * in separate frames if the server accepts them. keepalives are sent
+ * if the server closes the handles of idle connections
+ *
+ * servers not listing their compression types only know LZ4
+ */
+static void
+Rhizofs_negotiate_codec(const Rhizofs__Response * response)
+{
+    bool supported = (codec.type == RHIZOFS__COMPRESSION_TYPE__COMPR_NONE) ||
+            ((response->n_compressions == 0) && (codec.type == RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4));
+    char name[32];
+
+    for (size_t i=0; i<response->n_compressions; i++) {
+        if (response->compressions[i] == codec.type) {
+            supported = true;
+        }
+    }
+
+    if (!supported) {
+        Codec_format(&codec, name, sizeof(name));
+        log_warn("The server does not support the compression %s. Using lz4", name);
+        fprintf(stderr, "The server does not support the compression %s. Using lz4\n", name);
+        codec.type = RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4;
+        codec.level = 0;
+    }
+
+    // large writes are compressed in parallel if the server is able
+    // to put the chunks together
+    codec.chunk_size = (response->has_chunked_data && response->chunked_data) ?
+            CODEC_CHUNK_SIZE : 0;
+    data_frames = (settings.data_frames != 0) && response->has_data_frames
+        && response->data_frames;
+
+    // idle connections are kept alive well within the lease
+    keepalive_msec = (response->has_lease && (response->lease > 0)) ?
+            response->lease * 1000 / 3 : 0;
+
+    Codec_format(&codec, name, sizeof(name));
+    log_info("Compressing data with %s", name);
+}
+
+
 /**
  * check if a connection to the server is possible by sending a ping
  *
@@ -1120,6 +3407,7 @@ bool
 Rhizofs_check_connection(RhizoPriv * priv)
 {
     void * socket = NULL;
+    Rhizofs__CompressionType client_compressions[CODEC_MAX_TYPES];
 
     OP_INIT(request, response, returned_err);
 
@@ -1138,11 +3426,15 @@ Rhizofs_check_connection(RhizoPriv * priv)
     }
 
     request.requesttype = RHIZOFS__REQUEST_TYPE__PING;
-    OP_COMMUNICATE_USING_SOCKET(request, response, returned_err, socket, false);
+    request.compressions = client_compressions;
+    request.n_compressions = Codec_list(client_compressions, CODEC_MAX_TYPES);
+    OP_COMMUNICATE_USING_SOCKET(request, response, returned_err, socket, NULL);
 
     fprintf(stdout, "Connection successful. (Server version %d.%d.%d)\n", response->version->major,
             response->version->minor,  response->version->patch);
 
+    Rhizofs_negotiate_codec(response);
+
     OP_DEINIT(request, response)
     zmq_close(socket);
 
@@ -1172,6 +3464,17 @@ Rhizofs_fuse_main(struct fuse_args *args)
 {
     RhizoPriv * priv = NULL;
     FILE *fptr = NULL;
+    struct fuse_cmdline_opts opts;
+    bool signal_handlers_set = false;
+    bool mounted = false;
+    int rc = 1;
+
+    memset(&opts, 0, sizeof(opts));
+    check((fuse_parse_cmdline(args, &opts) == 0), "Could not parse the command line");
+    if (opts.mountpoint == NULL) {
+        fprintf(stderr, "Missing mountpoint\n");
+        log_and_error("No mountpoint given");
+    }
 
     priv = RhizoPriv_create();
     check(priv, "Could not create RhizoPriv context");
@@ -1214,21 +3517,55 @@ Rhizofs_fuse_main(struct fuse_args *args)
         }
     }
 
-    if (settings.check_socket_connection) {
-        if (!Rhizofs_check_connection(priv)) {
-            log_and_error("Could not connect to server");
-        }
+    if (!Rhizofs_check_connection(priv)) {
+        log_and_error("Could not connect to server");
     }
 
-    int rc = fuse_main(args->argc, args->argv, &rhizofs_operations, NULL );
+    /* the filesystem creates its own context after
+     * daemonizing */
     RhizoPriv_destroy(priv);
+    priv = NULL;
 
-    return rc;
+    session = fuse_session_new(args, &rhizofs_operations, sizeof(rhizofs_operations), NULL);
+    check((session != NULL), "Could not create the fuse session");
+
+    check((fuse_set_signal_handlers(session) == 0), "Could not set the signal handlers");
+    signal_handlers_set = true;
+
+    check((fuse_session_mount(session, opts.mountpoint) == 0),
+            "Could not mount the filesystem at %s", opts.mountpoint);
+    mounted = true;
+
+    fuse_daemonize(opts.foreground);
+
+    if (opts.singlethread) {
+        rc = fuse_session_loop(session);
+    }
+    else {
+        struct fuse_loop_config config;
+        memset(&config, 0, sizeof(config));
+        config.clone_fd = opts.clone_fd;
+        config.max_idle_threads = opts.max_idle_threads;
+        rc = fuse_session_loop_mt(session, &config);
+    }
+    rc = (rc == 0) ? 0 : 1;
 
 error:
     if (fptr != NULL) fclose(fptr);
     RhizoPriv_destroy(priv);
-    return 1;
+
+    if (session != NULL) {
+        if (mounted) {
+            fuse_session_unmount(session);
+        }
+        if (signal_handlers_set) {
+            fuse_remove_signal_handlers(session);
+        }
+        fuse_session_destroy(session);
+        session = NULL;
+    }
+    free(opts.mountpoint);
+    return rc;
 }
 
 
@@ -1245,17 +3582,14 @@ Rhizofs_opt_proc(void * data, const char *arg, int key, struct fuse_args *outarg
 
     switch (key) {
         case KEY_HELP:
-            settings.check_socket_connection = false;
             Rhizofs_usage(outargs->argv[0]);
-            fuse_opt_add_arg(outargs, "-ho");
-            Rhizofs_fuse_main(outargs);
+            fuse_cmdline_help();
+            fuse_lowlevel_help();
             exit(0);
 
         case KEY_VERSION:
-            settings.check_socket_connection = false;
             fprintf(stderr, "%s version %s\n", RHI_NAME, RHI_VERSION_FULL);
-            fuse_opt_add_arg(outargs, "--version");
-            Rhizofs_fuse_main(outargs);
+            fuse_lowlevel_version();
             exit(0);
 
         case FUSE_OPT_KEY_NONOPT:
@@ -1285,14 +3619,8 @@ Rhizofs_run(int argc, char * argv[])
 
     /* set the host/socket to show in /etc/mtab */
     if (settings.host_socket != NULL) {
-        if (fuse_version() >= 27) {
-            snprintf(tmpbuf, TMPBUF_SIZE, "-osubtype=%.20s,fsname=%.990s", RHI_NAME_LOWER,
-                    settings.host_socket);
-        }
-        else {
-            snprintf(tmpbuf, TMPBUF_SIZE, "-ofsname=%.20s#%.990s",
-                    RHI_NAME_LOWER, settings.host_socket);
-        }
+        snprintf(tmpbuf, TMPBUF_SIZE, "-osubtype=%.20s,fsname=%.990s", RHI_NAME_LOWER,
+                settings.host_socket);
         fuse_opt_insert_arg(&args, 1, tmpbuf);
     }
 #undef TMPBUF_SIZE
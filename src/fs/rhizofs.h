@@ -11,9 +11,36 @@
 
 #define SEND_SLEEP_USEC 1
 
-#define ATTRCACHE_MAXSIZE 1000
+/* default number of paths (and names of listings) in the attrcache */
+#define ATTRCACHE_DEFAULT_MAXSIZE 100000
+
+/* default time (in seconds) attributes are cached */
 #define ATTRCACHE_DEFAULT_MAXAGE_SEC 3
 
+/* default time (in seconds) non-existing paths are remembered */
+#define ATTRCACHE_DEFAULT_NEGATIVE_MAXAGE_SEC 3
+
+/* number of directory entries requested per page of a listing */
+#define READDIR_PAGE_ENTRIES 1024
+
+/* number of blocks prefetched for files read sequentially */
+#define READAHEAD_DEFAULT_WINDOW 8
+#define READAHEAD_MAX_WINDOW 64
+
+/* amount of written data (in MB) buffered for all open files */
+#define WRITEBACK_DEFAULT_MAX_DIRTY_MB 64
+
+/* maximum size of write requests negotiated with the kernel */
+#define RHIZOFS_MAX_WRITE (1024 * 1024)
+
+/* hidden directory holding the virtual files of the client. it is
+ * not listed and hides a directory of the same name on the server */
+#define RHIZOFS_CONTROL_DIR "/.rhizofs"
+
+/* virtual file the statistics of the client are read from */
+#define RHIZOFS_STATS_NAME "stats"
+#define RHIZOFS_STATS_FILE RHIZOFS_CONTROL_DIR "/" RHIZOFS_STATS_NAME
+
 int Rhizofs_run(int argc, char * argv[]);
 
 #endif /* __fs_rhizofs_h__ */
@@ -0,0 +1,767 @@
+#include "transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "../dbg.h"
+
+#define TRANSPORT_SLOT_MASK 0xffffffffULL
+
+#ifndef ZMQ_ROUTING_ID
+/* the name of the option before zmq 4.2 */
+#define ZMQ_ROUTING_ID ZMQ_IDENTITY
+#endif
+
+// prototypes
+static void Transport_set_routing_id(void * socket);
+static void * Transport_io_thread(void * arg);
+static void Transport_enqueue(Transport * t, TransportCall * call);
+static long Transport_keepalive(Transport * t);
+static void Transport_send_pending(Transport * t);
+static void Transport_receive(Transport * t);
+static void Transport_fail_all(Transport * t, int err);
+static void TransportCall_complete(TransportCall * call, TransportCallState state, int err);
+static TransportSlot * Transport_lookup(Transport * t, uint64_t id);
+
+
+void *create_socket(void *ctx, int type,
+                    const char *server_public_key,
+                    const char *client_public_key,
+                    const char *client_secret_key)
+{
+    void * sock = NULL;
+
+    sock = zmq_socket(ctx, type);
+    check((sock != NULL), "Could not create 0mq socket");
+
+    int hwm = 1; /* prevents memory leaks when fuse interrupts while waiting on server */
+    zmq_setsockopt(sock, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(sock, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+
+#ifdef ZMQ_MAKE_VERSION
+#if ZMQ_VERSION >= ZMQ_MAKE_VERSION(2,1,0)
+    int linger = 0;
+    zmq_setsockopt(sock, ZMQ_LINGER, &linger, sizeof(linger));
+#endif
+#endif
+
+    /* if server_public_key is set, encryption is enabled , otherwise it's unencrypted */
+    /* if encryption is enabled: if client_public_key and client_secret_key are set,
+       use them. Otherwise, we generate client keys on the fly. */
+    if (server_public_key != NULL) {
+        check(client_public_key != NULL, "client public key is not set");
+        check(client_secret_key != NULL, "client secret key is not set");
+
+        check(zmq_setsockopt(sock, ZMQ_CURVE_SERVERKEY, server_public_key, 40) == 0,
+            "could not set server public key");
+        check(zmq_setsockopt(sock, ZMQ_CURVE_PUBLICKEY, client_public_key, 40) == 0,
+            "could not set client public key");
+        check(zmq_setsockopt(sock, ZMQ_CURVE_SECRETKEY, client_secret_key, 40) == 0,
+            "could not set client secret key");
+    }
+    return sock;
+error:
+    if (sock)
+        zmq_close(sock);
+    return NULL;
+}
+
+
+// #### TransportCall #########################################
+
+bool
+TransportCall_init(TransportCall * call, zmq_msg_t * request, zmq_msg_t * request_data)
+{
+    check((call != NULL), "passed call is null");
+
+    memset(call, 0, sizeof(TransportCall));
+    call->state = TCALL_PENDING;
+
+    check((zmq_msg_init(&(call->request)) == 0), "Could not initialize request message");
+    check((zmq_msg_init(&(call->reply)) == 0), "Could not initialize reply message");
+    check((zmq_msg_init(&(call->request_data)) == 0), "Could not initialize request data");
+    check((zmq_msg_init(&(call->reply_data)) == 0), "Could not initialize reply data");
+    check((zmq_msg_move(&(call->request), request) == 0), "Could not move request message");
+    if (request_data != NULL) {
+        check((zmq_msg_move(&(call->request_data), request_data) == 0),
+                "Could not move request data");
+    }
+    check((pthread_cond_init(&(call->cond), NULL) == 0),
+            "Could not initialize transport call condition");
+
+    return true;
+
+error:
+    return false;
+}
+
+
+void
+TransportCall_deinit(TransportCall * call)
+{
+    if (call) {
+        zmq_msg_close(&(call->request));
+        zmq_msg_close(&(call->reply));
+        zmq_msg_close(&(call->request_data));
+        zmq_msg_close(&(call->reply_data));
+        pthread_cond_destroy(&(call->cond));
+    }
+}
+
+
+// #### Transport #############################################
+
+/**
+ * give the socket a random routing id of its own. without encryption
+ * the server tells clients apart by it, and the handles of the files
+ * opened on the server are only valid for the id which opened them.
+ * ids assigned by the server would change with every reconnect
+ */
+static void
+Transport_set_routing_id(void * socket)
+{
+    unsigned char id[TRANSPORT_ROUTING_ID_SIZE];
+    int fd = open("/dev/urandom", O_RDONLY);
+    bool have_id = false;
+
+    if (fd != -1) {
+        have_id = (read(fd, id, sizeof(id)) == (ssize_t)sizeof(id));
+        close(fd);
+    }
+    if (!have_id) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        srand((unsigned int)(now.tv_sec ^ now.tv_usec ^ getpid()));
+        for (size_t i=0; i<sizeof(id); i++) {
+            id[i] = (unsigned char)rand();
+        }
+    }
+
+    // ids starting with a zero byte are reserved by zmq
+    id[0] |= 0x80;
+    if (zmq_setsockopt(socket, ZMQ_ROUTING_ID, id, sizeof(id)) != 0) {
+        log_warn("Could not set the routing id of the socket");
+    }
+}
+
+
+bool
+Transport_init(Transport * t, void * context, const char * socket_name,
+        unsigned int window, const char *server_public_key,
+        const char *client_public_key, const char *client_secret_key)
+{
+    check((t != NULL), "passed transport is null");
+    check((window > 0 && window <= TRANSPORT_MAX_WINDOW), "invalid transport window %u", window);
+
+    memset(t, 0, sizeof(Transport));
+    t->wakeup_fds[0] = -1;
+    t->wakeup_fds[1] = -1;
+    t->window = window;
+    zmq_msg_init(&(t->keepalive));
+
+    check((pthread_mutex_init(&(t->mutex), NULL) == 0),
+            "Could not initialize transport mutex");
+
+    t->slots = calloc(sizeof(TransportSlot), window);
+    check_mem(t->slots);
+
+    check((pipe(t->wakeup_fds) == 0), "Could not create transport wakeup pipe");
+    for (int i=0; i<2; i++) {
+        check((fcntl(t->wakeup_fds[i], F_SETFL, O_NONBLOCK) == 0),
+                "Could not set transport wakeup pipe to non-blocking");
+    }
+
+    t->socket = create_socket(context, ZMQ_DEALER, server_public_key,
+            client_public_key, client_secret_key);
+    check((t->socket != NULL), "Could not create transport socket");
+
+    // the window limits the number of messages queued in the socket
+    int hwm = (int)window;
+    zmq_setsockopt(t->socket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(t->socket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+
+    Transport_set_routing_id(t->socket);
+
+    check((zmq_connect(t->socket, socket_name) == 0), "could not connect to socket %s", socket_name);
+
+    // from here on the socket is only used by the I/O thread
+    check((pthread_create(&(t->thread), NULL, Transport_io_thread, t) == 0),
+            "Could not start transport thread");
+    t->thread_started = true;
+
+    return true;
+
+error:
+    Transport_deinit(t);
+    return false;
+}
+
+
+void
+Transport_deinit(Transport * t)
+{
+    if (t && t->slots) {
+        if (t->thread_started) {
+            pthread_mutex_lock(&(t->mutex));
+            t->shutdown = true;
+            pthread_mutex_unlock(&(t->mutex));
+
+            if (write(t->wakeup_fds[1], "", 1) != 1) {
+                debug("could not wake up the transport thread");
+            }
+            pthread_join(t->thread, NULL);
+            t->thread_started = false;
+        }
+
+        if (t->socket != NULL) {
+            zmq_close(t->socket);
+            t->socket = NULL;
+        }
+        for (int i=0; i<2; i++) {
+            if (t->wakeup_fds[i] != -1) {
+                close(t->wakeup_fds[i]);
+                t->wakeup_fds[i] = -1;
+            }
+        }
+
+        free(t->slots);
+        t->slots = NULL;
+        zmq_msg_close(&(t->keepalive));
+        pthread_mutex_destroy(&(t->mutex));
+    }
+}
+
+
+bool
+Transport_submit(Transport * t, TransportCall * call)
+{
+    check((t != NULL), "passed transport is null");
+    check((call != NULL), "passed call is null");
+
+    pthread_mutex_lock(&(t->mutex));
+    if (t->shutdown) {
+        pthread_mutex_unlock(&(t->mutex));
+        log_and_error("the transport has been shut down");
+    }
+    Transport_enqueue(t, call);
+    pthread_mutex_unlock(&(t->mutex));
+
+    // a full pipe already wakes up the I/O thread
+    if ((write(t->wakeup_fds[1], "", 1) != 1) && (errno != EAGAIN)) {
+        log_warn("Could not wake up the transport thread: %s", strerror(errno));
+    }
+    return true;
+
+error:
+    return false;
+}
+
+
+bool
+Transport_send(Transport * t, zmq_msg_t * request)
+{
+    TransportCall * call = NULL;
+
+    call = calloc(sizeof(TransportCall), 1);
+    check_mem(call);
+    check(TransportCall_init(call, request, NULL), "Could not initialize the transport call");
+    call->detached = true;
+
+    check(Transport_submit(t, call), "Could not submit the request");
+    return true;
+
+error:
+    if (call != NULL) {
+        TransportCall_deinit(call);
+        free(call);
+    }
+    return false;
+}
+
+
+void
+Transport_set_keepalive(Transport * t, zmq_msg_t * request, unsigned int interval_msec)
+{
+    pthread_mutex_lock(&(t->mutex));
+    zmq_msg_close(&(t->keepalive));
+    zmq_msg_init(&(t->keepalive));
+    zmq_msg_move(&(t->keepalive), request);
+    t->keepalive_msec = interval_msec;
+    t->sent_ns = Transport_now_ns();
+    pthread_mutex_unlock(&(t->mutex));
+
+    // the I/O thread has to pick up the interval
+    if ((write(t->wakeup_fds[1], "", 1) != 1) && (errno != EAGAIN)) {
+        debug("could not wake up the transport thread");
+    }
+}
+
+
+void
+Transport_set_stale_func(Transport * t, TransportStaleFunc func)
+{
+    pthread_mutex_lock(&(t->mutex));
+    t->stale_func = func;
+    pthread_mutex_unlock(&(t->mutex));
+}
+
+
+bool
+Transport_wait(Transport * t, TransportCall * call, int timeout_msec)
+{
+    struct timeval now;
+    struct timespec deadline;
+
+    gettimeofday(&now, NULL);
+    long nsec = (now.tv_usec * 1000L) + ((timeout_msec % 1000) * 1000000L);
+    deadline.tv_sec = now.tv_sec + (timeout_msec / 1000) + (nsec / 1000000000L);
+    deadline.tv_nsec = nsec % 1000000000L;
+
+    pthread_mutex_lock(&(t->mutex));
+    while ((call->state == TCALL_PENDING) || (call->state == TCALL_SENT)) {
+        if (pthread_cond_timedwait(&(call->cond), &(t->mutex), &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    bool completed = ((call->state == TCALL_DONE) || (call->state == TCALL_FAILED));
+    pthread_mutex_unlock(&(t->mutex));
+
+    return completed;
+}
+
+
+void
+Transport_cancel(Transport * t, TransportCall * call)
+{
+    pthread_mutex_lock(&(t->mutex));
+    if (call->state == TCALL_PENDING) {
+        TransportCall ** link = &(t->pending_head);
+        TransportCall * prev = NULL;
+        while (*link != NULL && *link != call) {
+            prev = *link;
+            link = &((*link)->next);
+        }
+        if (*link == call) {
+            *link = call->next;
+            if (t->pending_tail == call) {
+                t->pending_tail = prev;
+            }
+        }
+        call->state = TCALL_FAILED;
+        call->err = EINTR;
+        t->n_cancelled++;
+    }
+    else if (call->state == TCALL_SENT) {
+        // free the slot right away. the reply will not match the
+        // id of the slot anymore
+        for (unsigned int i=0; i<t->window; i++) {
+            if (t->slots[i].call == call) {
+                t->slots[i].id = 0;
+                t->slots[i].call = NULL;
+                t->in_flight--;
+                break;
+            }
+        }
+        call->state = TCALL_FAILED;
+        call->err = EINTR;
+        t->n_cancelled++;
+    }
+    pthread_mutex_unlock(&(t->mutex));
+
+    // a slot might have become free
+    if ((write(t->wakeup_fds[1], "", 1) != 1) && (errno != EAGAIN)) {
+        debug("could not wake up the transport thread");
+    }
+}
+
+
+void
+Transport_get_stats(Transport * t, TransportStats * stats)
+{
+    memset(stats, 0, sizeof(TransportStats));
+
+    pthread_mutex_lock(&(t->mutex));
+    stats->window = t->window;
+    stats->in_flight = t->in_flight;
+    for (TransportCall * call = t->pending_head; call != NULL; call = call->next) {
+        stats->n_pending++;
+    }
+    stats->n_sent = t->n_sent;
+    stats->n_send_retries = t->n_send_retries;
+    stats->n_send_failures = t->n_send_failures;
+    stats->n_cancelled = t->n_cancelled;
+    stats->n_stale_replies = t->n_stale_replies;
+    stats->n_malformed_replies = t->n_malformed_replies;
+    pthread_mutex_unlock(&(t->mutex));
+}
+
+
+uint64_t
+Transport_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+
+static void *
+Transport_io_thread(void * arg)
+{
+    Transport * t = (Transport *)arg;
+
+    while (true) {
+        pthread_mutex_lock(&(t->mutex));
+        if (t->shutdown) {
+            pthread_mutex_unlock(&(t->mutex));
+            break;
+        }
+        long keepalive_timeout = Transport_keepalive(t);
+        Transport_send_pending(t);
+        // when requests could not be sent, retry after a while
+        long timeout = (t->pending_head != NULL && t->in_flight < t->window) ?
+                TRANSPORT_RETRY_MSEC : keepalive_timeout;
+        pthread_mutex_unlock(&(t->mutex));
+
+        zmq_pollitem_t pollset[] = {
+            { t->socket, 0,               ZMQ_POLLIN, 0 },
+            { NULL,      t->wakeup_fds[0], ZMQ_POLLIN, 0 }
+        };
+        if (zmq_poll(pollset, 2, timeout) == -1) {
+            if (errno == ETERM) {
+                log_err("the 0mq context has been terminated");
+                break;
+            }
+            continue;
+        }
+
+        if (pollset[1].revents & ZMQ_POLLIN) {
+            char buf[64];
+            while (read(t->wakeup_fds[0], buf, sizeof(buf)) > 0) {
+                // drain the pipe
+            }
+        }
+        if (pollset[0].revents & ZMQ_POLLIN) {
+            Transport_receive(t);
+        }
+    }
+
+    pthread_mutex_lock(&(t->mutex));
+    t->shutdown = true;
+    Transport_fail_all(t, ESHUTDOWN);
+    pthread_mutex_unlock(&(t->mutex));
+
+    return NULL;
+}
+
+
+/**
+ * add a call to the end of the pending calls
+ *
+ * has to be called with the mutex locked
+ */
+static void
+Transport_enqueue(Transport * t, TransportCall * call)
+{
+    call->state = TCALL_PENDING;
+    call->next = NULL;
+    call->submitted_ns = Transport_now_ns();
+    if (t->pending_tail != NULL) {
+        t->pending_tail->next = call;
+    }
+    else {
+        t->pending_head = call;
+    }
+    t->pending_tail = call;
+}
+
+
+/**
+ * queue a copy of the keepalive request if nothing has been sent for
+ * its interval. none is queued while other calls are pending
+ *
+ * has to be called with the mutex locked
+ *
+ * returns the time (in milliseconds) until the next keepalive, or -1
+ */
+static long
+Transport_keepalive(Transport * t)
+{
+    TransportCall * call = NULL;
+    zmq_msg_t request;
+    uint64_t interval_ns = (uint64_t)t->keepalive_msec * 1000000ULL;
+    uint64_t now_ns = Transport_now_ns();
+
+    if (t->keepalive_msec == 0) {
+        return -1;
+    }
+    if (now_ns - t->sent_ns < interval_ns) {
+        return (long)((interval_ns - (now_ns - t->sent_ns) + 999999) / 1000000);
+    }
+    t->sent_ns = now_ns;
+
+    if (t->pending_head == NULL) {
+        zmq_msg_init(&request);
+        check((zmq_msg_copy(&request, &(t->keepalive)) == 0), "Could not copy the keepalive");
+
+        call = calloc(sizeof(TransportCall), 1);
+        check_mem(call);
+        check(TransportCall_init(call, &request, NULL), "Could not initialize the keepalive");
+        call->detached = true;
+        Transport_enqueue(t, call);
+        zmq_msg_close(&request);
+    }
+    return (long)t->keepalive_msec;
+
+error:
+    zmq_msg_close(&request);
+    if (call != NULL) {
+        TransportCall_deinit(call);
+        free(call);
+    }
+    return (long)t->keepalive_msec;
+}
+
+
+/**
+ * send pending calls while there are free slots in the window
+ *
+ * has to be called with the mutex locked
+ */
+static void
+Transport_send_pending(Transport * t)
+{
+    while ((t->pending_head != NULL) && (t->in_flight < t->window)) {
+        TransportCall * call = t->pending_head;
+
+        TransportSlot * slot = NULL;
+        for (unsigned int i=0; i<t->window; i++) {
+            if (t->slots[i].id == 0) {
+                slot = &(t->slots[i]);
+                break;
+            }
+        }
+        check((slot != NULL), "no free slot although the window is not full");
+
+        // generation 0 would allow the id of slot 0 to be 0
+        if (++t->generation == 0) {
+            t->generation = 1;
+        }
+        uint64_t id = ((uint64_t)t->generation << 32) | (uint64_t)(slot - t->slots + 1);
+
+        // the envelope: the id, followed by the empty delimiter
+        // expected by the REP sockets of the server
+        if (zmq_send(t->socket, &id, sizeof(id), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1) {
+            if (errno != EAGAIN) {
+                t->pending_head = call->next;
+                if (t->pending_head == NULL) {
+                    t->pending_tail = NULL;
+                }
+                call->next = NULL;
+                TransportCall_complete(call, TCALL_FAILED, EIO);
+                t->n_send_failures++;
+                log_err("Could not send request [errno: %d]", errno);
+                continue;
+            }
+            // not connected. try again later
+            t->n_send_retries++;
+            break;
+        }
+        // once the first part is sent, the others will be queued too
+        bool has_data = (zmq_msg_size(&(call->request_data)) > 0);
+        zmq_send(t->socket, "", 0, ZMQ_SNDMORE);
+        int rc = zmq_msg_send(&(call->request), t->socket, has_data ? ZMQ_SNDMORE : 0);
+        if ((rc != -1) && has_data) {
+            rc = zmq_msg_send(&(call->request_data), t->socket, 0);
+        }
+
+        t->pending_head = call->next;
+        if (t->pending_head == NULL) {
+            t->pending_tail = NULL;
+        }
+        call->next = NULL;
+
+        if (rc == -1) {
+            TransportCall_complete(call, TCALL_FAILED, EIO);
+            t->n_send_failures++;
+            log_err("Could not send request [errno: %d]", errno);
+            continue;
+        }
+
+        slot->id = id;
+        slot->call = call;
+        call->state = TCALL_SENT;
+        t->sent_ns = Transport_now_ns();
+        call->queued_ns = t->sent_ns - call->submitted_ns;
+        t->in_flight++;
+        t->n_sent++;
+    }
+    return;
+
+error:
+    return;
+}
+
+
+/**
+ * receive all replies available on the socket and hand them
+ * to the waiting calls
+ */
+static void
+Transport_receive(Transport * t)
+{
+    while (true) {
+        zmq_msg_t id_msg;
+        zmq_msg_t part;
+        zmq_msg_t body;
+        zmq_msg_t data;
+        size_t n_parts = 0;
+        bool complete = false;
+
+        zmq_msg_init(&id_msg);
+        zmq_msg_init(&body);
+        zmq_msg_init(&data);
+
+        if (zmq_msg_recv(&id_msg, t->socket, ZMQ_DONTWAIT) == -1) {
+            zmq_msg_close(&id_msg);
+            zmq_msg_close(&body);
+            zmq_msg_close(&data);
+            break;
+        }
+
+        // the empty delimiter is followed by the reply and, if the
+        // server sent the data separately, the frame with the data
+        bool more = zmq_msg_more(&id_msg);
+        while (more) {
+            zmq_msg_init(&part);
+            if (zmq_msg_recv(&part, t->socket, 0) == -1) {
+                zmq_msg_close(&part);
+                break;
+            }
+            more = zmq_msg_more(&part);
+            n_parts++;
+            if (n_parts == 2) {
+                zmq_msg_move(&body, &part);
+            }
+            else if (n_parts == 3) {
+                zmq_msg_move(&data, &part);
+            }
+            zmq_msg_close(&part);
+            complete = !more && (n_parts >= 2) && (n_parts <= 3);
+        }
+
+        if (complete && (zmq_msg_size(&id_msg) == sizeof(uint64_t))) {
+            TransportStaleFunc stale_func = NULL;
+            uint64_t id;
+            memcpy(&id, zmq_msg_data(&id_msg), sizeof(id));
+
+            pthread_mutex_lock(&(t->mutex));
+            TransportSlot * slot = Transport_lookup(t, id);
+            if (slot != NULL) {
+                TransportCall * call = slot->call;
+                slot->id = 0;
+                slot->call = NULL;
+                t->in_flight--;
+
+                zmq_msg_move(&(call->reply), &body);
+                zmq_msg_move(&(call->reply_data), &data);
+                TransportCall_complete(call, TCALL_DONE, 0);
+            }
+            else {
+                debug("dropping reply to cancelled request %llx", (unsigned long long)id);
+                t->n_stale_replies++;
+                stale_func = t->stale_func;
+            }
+            Transport_send_pending(t);
+            pthread_mutex_unlock(&(t->mutex));
+
+            // may submit calls itself
+            if (stale_func != NULL) {
+                stale_func(&body, &data);
+            }
+        }
+        else {
+            log_warn("received a malformed reply");
+            pthread_mutex_lock(&(t->mutex));
+            t->n_malformed_replies++;
+            pthread_mutex_unlock(&(t->mutex));
+        }
+
+        zmq_msg_close(&id_msg);
+        zmq_msg_close(&body);
+        zmq_msg_close(&data);
+    }
+}
+
+
+/**
+ * let all pending and sent calls fail
+ *
+ * has to be called with the mutex locked
+ */
+static void
+Transport_fail_all(Transport * t, int err)
+{
+    while (t->pending_head != NULL) {
+        TransportCall * call = t->pending_head;
+        t->pending_head = call->next;
+        TransportCall_complete(call, TCALL_FAILED, err);
+    }
+    t->pending_tail = NULL;
+
+    for (unsigned int i=0; i<t->window; i++) {
+        if (t->slots[i].call != NULL) {
+            TransportCall_complete(t->slots[i].call, TCALL_FAILED, err);
+        }
+        t->slots[i].id = 0;
+        t->slots[i].call = NULL;
+    }
+    t->in_flight = 0;
+}
+
+
+/**
+ * wake up the thread waiting for the call
+ *
+ * has to be called with the mutex of the transport locked
+ */
+static void
+TransportCall_complete(TransportCall * call, TransportCallState state, int err)
+{
+    if (call->detached) {
+        TransportCall_deinit(call);
+        free(call);
+        return;
+    }
+    call->state = state;
+    call->err = err;
+    call->next = NULL;
+    pthread_cond_signal(&(call->cond));
+}
+
+
+/**
+ * find the slot of a sent request
+ *
+ * has to be called with the mutex locked
+ *
+ * returns NULL if the id is unknown
+ */
+static TransportSlot *
+Transport_lookup(Transport * t, uint64_t id)
+{
+    uint64_t slot = id & TRANSPORT_SLOT_MASK;
+
+    if (slot == 0 || slot > t->window) {
+        return NULL;
+    }
+    TransportSlot * entry = &(t->slots[slot - 1]);
+    if (entry->id != id || entry->call == NULL) {
+        return NULL;
+    }
+    return entry;
+}
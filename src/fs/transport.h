@@ -0,0 +1,237 @@
+#ifndef __fs_transport_h__
+#define __fs_transport_h__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <zmq.h>
+
+/* number of requests which may be sent to the server
+ * without having received their responses */
+#define TRANSPORT_DEFAULT_WINDOW 64
+#define TRANSPORT_MAX_WINDOW 4096
+
+/* interval in which the I/O thread retries sending requests
+ * while the server is not reachable */
+#define TRANSPORT_RETRY_MSEC 100
+
+/* length of the routing id the client connects with */
+#define TRANSPORT_ROUTING_ID_SIZE 16
+
+
+void *create_socket(void *ctx, int type,
+                    const char *server_public_key,
+                    const char *client_public_key,
+                    const char *client_secret_key);
+
+
+typedef enum TransportCallState {
+    TCALL_PENDING = 0,  /* waiting for a free slot in the window */
+    TCALL_SENT,         /* sent to the server */
+    TCALL_DONE,         /* the reply has been received */
+    TCALL_FAILED        /* the request could not be sent */
+} TransportCallState;
+
+
+/**
+ * a request submitted to the transport. owned by the calling thread,
+ * usually allocated on its stack
+ */
+typedef struct TransportCall {
+    zmq_msg_t request;
+    zmq_msg_t reply;
+
+    // the frames with the data of the request and the reply, sent
+    // after them. empty if there are none
+    zmq_msg_t request_data;
+    zmq_msg_t reply_data;
+
+    TransportCallState state;
+
+    // errno when the call failed
+    int err;
+
+    // sent by Transport_send. owned by the transport, which frees
+    // it once it has been answered or failed
+    bool detached;
+
+    // when the call was submitted and the time (in nanoseconds) it
+    // waited for a free slot in the window before being sent
+    uint64_t submitted_ns;
+    uint64_t queued_ns;
+
+    pthread_cond_t cond;
+
+    // link in the queue of pending calls
+    struct TransportCall * next;
+} TransportCall;
+
+
+/**
+ * called by the I/O thread with the replies to calls which have been
+ * cancelled. the messages are closed afterwards
+ */
+typedef void (*TransportStaleFunc)(zmq_msg_t * reply, zmq_msg_t * reply_data);
+
+
+typedef struct TransportSlot {
+    // the id sent along with the request. 0 if the slot is unused
+    uint64_t id;
+
+    // NULL if the caller gave up waiting
+    TransportCall * call;
+} TransportSlot;
+
+
+/**
+ * multiplexes the requests of all threads over a single
+ * DEALER socket
+ *
+ * the socket is owned by an I/O thread. every request is sent with
+ * an id in its envelope, which the REP sockets of the server workers
+ * return unchanged with the reply. the number of requests in flight
+ * is limited by the window instead of the number of threads.
+ */
+typedef struct Transport {
+    void * socket;
+
+    pthread_t thread;
+    bool thread_started;
+
+    // written to by submitting threads to wake up the I/O thread
+    int wakeup_fds[2];
+
+    TransportCall * pending_head;
+    TransportCall * pending_tail;
+
+    TransportSlot * slots;
+    unsigned int window;
+    unsigned int in_flight;
+    uint32_t generation;
+
+    bool shutdown;
+
+    // sent after "keepalive_msec" without sending anything else.
+    // not sent if "keepalive_msec" is 0
+    zmq_msg_t keepalive;
+    unsigned int keepalive_msec;
+    uint64_t sent_ns;
+
+    // may be NULL
+    TransportStaleFunc stale_func;
+
+    // counters of the calls
+    uint64_t n_sent;
+    uint64_t n_send_retries;
+    uint64_t n_send_failures;
+    uint64_t n_cancelled;
+    uint64_t n_stale_replies;
+    uint64_t n_malformed_replies;
+
+    pthread_mutex_t mutex;
+} Transport;
+
+
+typedef struct TransportStats {
+    unsigned int window;
+    unsigned int in_flight;
+    size_t n_pending;
+
+    uint64_t n_sent;
+
+    // attempts to send while the server was not reachable
+    uint64_t n_send_retries;
+    uint64_t n_send_failures;
+
+    // calls the callers gave up on, and replies arriving for them later
+    uint64_t n_cancelled;
+    uint64_t n_stale_replies;
+    uint64_t n_malformed_replies;
+} TransportStats;
+
+
+/**
+ * connect to "socket_name" and start the I/O thread
+ *
+ * "window" is the maximum number of requests in flight. the keys
+ * may be NULL when encryption is not used
+ *
+ * returns false on error
+ */
+bool Transport_init(Transport * t, void * context, const char * socket_name,
+        unsigned int window, const char *server_public_key,
+        const char *client_public_key, const char *client_secret_key);
+
+/**
+ * stop the I/O thread and close the socket. calls which are still
+ * waiting fail with ESHUTDOWN
+ */
+void Transport_deinit(Transport * t);
+
+/**
+ * submit a call. the transport takes ownership of the request
+ * message of the call
+ *
+ * returns false on error
+ */
+bool Transport_submit(Transport * t, TransportCall * call);
+
+/**
+ * send a request without waiting for its reply, which is dropped. the
+ * request is sent once the server is reachable. the transport takes
+ * ownership of the message
+ *
+ * returns false on error
+ */
+bool Transport_send(Transport * t, zmq_msg_t * request);
+
+/**
+ * send a copy of "request" whenever nothing has been sent for
+ * "interval_msec", so the server knows the client is still there. the
+ * transport takes ownership of the message
+ */
+void Transport_set_keepalive(Transport * t, zmq_msg_t * request, unsigned int interval_msec);
+
+/**
+ * pass the replies to cancelled calls to "func"
+ */
+void Transport_set_stale_func(Transport * t, TransportStaleFunc func);
+
+/**
+ * wait for the call to complete
+ *
+ * returns true when the call is done or failed and false when
+ * nothing happened within "timeout_msec"
+ */
+bool Transport_wait(Transport * t, TransportCall * call, int timeout_msec);
+
+/**
+ * give up on a call which did not complete. a reply arriving
+ * later will be dropped
+ */
+void Transport_cancel(Transport * t, TransportCall * call);
+
+/**
+ * get the counters and the state of the window
+ */
+void Transport_get_stats(Transport * t, TransportStats * stats);
+
+/**
+ * the monotonic time in nanoseconds
+ */
+uint64_t Transport_now_ns();
+
+
+/**
+ * initialize a call with the request to send and the frame with its
+ * data, which may be NULL. the messages are moved into the call
+ *
+ * returns false on error
+ */
+bool TransportCall_init(TransportCall * call, zmq_msg_t * request, zmq_msg_t * request_data);
+
+void TransportCall_deinit(TransportCall * call);
+
+#endif /* __fs_transport_h__ */
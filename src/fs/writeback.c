@@ -0,0 +1,511 @@
+#include "writeback.h"
+
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "../dbg.h"
+
+// prototypes
+static void * WriteBackPool_worker(void * arg);
+static time_t WriteBackPool_queue_expired(WriteBackPool * pool);
+static WriteBack * WriteBackPool_next_job(WriteBackPool * pool);
+static void WriteBack_queue_current(WriteBack * wb);
+static bool WriteBack_is_dirty(const WriteBack * wb);
+static int WriteBack_wait(WriteBack * wb);
+static WriteBackExtent * WriteBackExtent_create(off_t offset, size_t size);
+static bool WriteBackExtent_reserve(WriteBackExtent * extent, size_t len);
+static void WriteBackExtent_destroy(WriteBackExtent * extent);
+
+
+// #### WriteBackPool #########################################
+
+bool
+WriteBackPool_init(WriteBackPool * pool, unsigned int n_threads,
+        size_t max_dirty_bytes, WriteBack_write_fn write)
+{
+    check((pool != NULL), "passed pool is null");
+    check((write != NULL), "passed write function is null");
+
+    memset(pool, 0, sizeof(WriteBackPool));
+    pool->write = write;
+    pool->max_dirty_bytes = max_dirty_bytes;
+
+    check(pthread_mutex_init(&(pool->mutex), NULL) == 0,
+            "Could not initialize writeback pool mutex");
+    check(pthread_cond_init(&(pool->cond_job), NULL) == 0,
+            "Could not initialize writeback pool condition");
+    check(pthread_cond_init(&(pool->cond_done), NULL) == 0,
+            "Could not initialize writeback pool condition");
+
+    pool->threads = calloc(sizeof(pthread_t), n_threads);
+    check_mem(pool->threads);
+
+    while (pool->n_threads < n_threads) {
+        check((pthread_create(&(pool->threads[pool->n_threads]), NULL,
+                WriteBackPool_worker, pool) == 0),
+                "Could not start writeback thread");
+        pool->n_threads++;
+    }
+
+    return true;
+
+error:
+    WriteBackPool_deinit(pool);
+    return false;
+}
+
+
+void
+WriteBackPool_deinit(WriteBackPool * pool)
+{
+    if (pool && pool->threads) {
+        pthread_mutex_lock(&(pool->mutex));
+        if (pool->files != NULL) {
+            log_warn("writeback pool still has open files");
+        }
+        pool->shutdown = true;
+        pthread_cond_broadcast(&(pool->cond_job));
+        pthread_mutex_unlock(&(pool->mutex));
+
+        for (unsigned int t=0; t<pool->n_threads; t++) {
+            pthread_join(pool->threads[t], NULL);
+        }
+        free(pool->threads);
+        pool->threads = NULL;
+        pool->n_threads = 0;
+
+        pthread_cond_destroy(&(pool->cond_done));
+        pthread_cond_destroy(&(pool->cond_job));
+        pthread_mutex_destroy(&(pool->mutex));
+    }
+}
+
+
+void
+WriteBackPool_flush_path(WriteBackPool * pool, const char * path)
+{
+    if (pool == NULL || pool->threads == NULL || path == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(pool->mutex));
+    bool waiting = true;
+    while (waiting) {
+        waiting = false;
+        for (WriteBack * wb = pool->files; wb != NULL; wb = wb->next) {
+            if (WriteBack_is_dirty(wb) && (strcmp(wb->path, path) == 0)) {
+                WriteBack_queue_current(wb);
+                waiting = true;
+            }
+        }
+        if (waiting) {
+            pthread_cond_wait(&(pool->cond_done), &(pool->mutex));
+        }
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+}
+
+
+static void *
+WriteBackPool_worker(void * arg)
+{
+    WriteBackPool * pool = (WriteBackPool *)arg;
+
+    pthread_mutex_lock(&(pool->mutex));
+    while (!pool->shutdown) {
+        // checked on every wakeup, as steady writes to other files
+        // would otherwise keep the wait from ever timing out
+        time_t wait_sec = WriteBackPool_queue_expired(pool);
+
+        WriteBack * wb = WriteBackPool_next_job(pool);
+        if (wb == NULL) {
+            struct timeval now;
+            struct timespec timeout;
+
+            gettimeofday(&now, NULL);
+            timeout.tv_sec = now.tv_sec + wait_sec;
+            timeout.tv_nsec = now.tv_usec * 1000;
+
+            pthread_cond_timedwait(&(pool->cond_job), &(pool->mutex), &timeout);
+            continue;
+        }
+
+        WriteBackExtent * extent = wb->queue_head;
+        wb->queue_head = extent->next;
+        if (wb->queue_head == NULL) {
+            wb->queue_tail = NULL;
+        }
+        wb->flushing = true;
+        pthread_mutex_unlock(&(pool->mutex));
+
+        // the file is flushing, so the writeback struct will not
+        // be destroyed before the extent is written
+        debug("writing back %d bytes at offset %lld", (int)extent->len,
+                (long long)extent->offset);
+        int rc = pool->write(wb->ctx, extent->data, extent->len, extent->offset);
+
+        pthread_mutex_lock(&(pool->mutex));
+        if (rc < 0 || (size_t)rc < extent->len) {
+            int err = (rc < 0) ? -rc : EIO;
+            log_warn("writing back %d bytes at offset %lld failed: %s",
+                    (int)extent->len, (long long)extent->offset, strerror(err));
+            if (wb->error == 0) {
+                wb->error = err;
+            }
+        }
+        pool->dirty_bytes -= extent->len;
+        wb->flushing = false;
+        pthread_cond_broadcast(&(pool->cond_done));
+
+        WriteBackExtent_destroy(extent);
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return NULL;
+}
+
+
+/**
+ * queue the current extents of all files which have been dirty for
+ * longer than the flush interval
+ *
+ * has to be called with the mutex locked
+ *
+ * returns the seconds until the next of the remaining extents expires
+ */
+static time_t
+WriteBackPool_queue_expired(WriteBackPool * pool)
+{
+    time_t now = time(NULL);
+    time_t wait_sec = WRITEBACK_FLUSH_INTERVAL_SEC;
+
+    for (WriteBack * wb = pool->files; wb != NULL; wb = wb->next) {
+        if (wb->current == NULL) {
+            continue;
+        }
+        time_t age = now - wb->current_ts;
+        if (age >= WRITEBACK_FLUSH_INTERVAL_SEC) {
+            WriteBack_queue_current(wb);
+        }
+        else if ((age >= 0) && (WRITEBACK_FLUSH_INTERVAL_SEC - age < wait_sec)) {
+            wait_sec = WRITEBACK_FLUSH_INTERVAL_SEC - age;
+        }
+    }
+    return wait_sec;
+}
+
+
+/**
+ * find a file with queued extents which is not being
+ * written by another thread
+ *
+ * has to be called with the mutex locked
+ */
+static WriteBack *
+WriteBackPool_next_job(WriteBackPool * pool)
+{
+    for (WriteBack * wb = pool->files; wb != NULL; wb = wb->next) {
+        if ((wb->queue_head != NULL) && !wb->flushing) {
+            return wb;
+        }
+    }
+    return NULL;
+}
+
+
+// #### WriteBack #############################################
+
+WriteBack *
+WriteBack_create(WriteBackPool * pool, void * ctx, const char * path)
+{
+    WriteBack * wb = NULL;
+
+    check((pool != NULL), "passed pool is null");
+    check((path != NULL), "passed path is null");
+
+    wb = calloc(sizeof(WriteBack), 1);
+    check_mem(wb);
+
+    wb->pool = pool;
+    wb->ctx = ctx;
+    wb->path = path;
+
+    pthread_mutex_lock(&(pool->mutex));
+    wb->next = pool->files;
+    if (pool->files != NULL) {
+        pool->files->prev = wb;
+    }
+    pool->files = wb;
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return wb;
+
+error:
+    return NULL;
+}
+
+
+void
+WriteBack_set_path(WriteBack * wb, const char * path)
+{
+    if (wb == NULL || path == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(wb->pool->mutex));
+    wb->path = path;
+    pthread_mutex_unlock(&(wb->pool->mutex));
+}
+
+
+int
+WriteBack_destroy(WriteBack * wb)
+{
+    int rc = 0;
+
+    if (wb == NULL) {
+        return 0;
+    }
+
+    WriteBackPool * pool = wb->pool;
+
+    pthread_mutex_lock(&(pool->mutex));
+    WriteBack_queue_current(wb);
+    rc = WriteBack_wait(wb);
+
+    if (wb->prev != NULL) {
+        wb->prev->next = wb->next;
+    }
+    else {
+        pool->files = wb->next;
+    }
+    if (wb->next != NULL) {
+        wb->next->prev = wb->prev;
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+
+    free(wb);
+    return rc;
+}
+
+
+int
+WriteBack_write(WriteBack * wb, const uint8_t * buf, size_t size, off_t offset)
+{
+    int rc = (int)size;
+
+    check((wb != NULL), "passed writeback is null");
+
+    WriteBackPool * pool = wb->pool;
+
+    pthread_mutex_lock(&(pool->mutex));
+
+    if (wb->error != 0) {
+        rc = -wb->error;
+        wb->error = 0;
+        goto unlock;
+    }
+
+    WriteBackExtent * extent = wb->current;
+
+    // merge writes overlapping or appending to the current extent
+    if ((extent != NULL) &&
+            (offset >= extent->offset) &&
+            (offset <= extent->offset + (off_t)extent->len) &&
+            ((offset - extent->offset) + size <= WRITEBACK_BLOCK_SIZE)) {
+
+        size_t start = (size_t)(offset - extent->offset);
+        if (!WriteBackExtent_reserve(extent, start + size)) {
+            rc = -ENOMEM;
+            goto unlock;
+        }
+        memcpy(extent->data + start, buf, size);
+        if (start + size > extent->len) {
+            pool->dirty_bytes += (start + size) - extent->len;
+            extent->len = start + size;
+        }
+    }
+    else {
+        // extents queued before are written first, so a
+        // write overlapping them will still win
+        WriteBack_queue_current(wb);
+
+        extent = WriteBackExtent_create(offset, size);
+        if (extent == NULL) {
+            rc = -ENOMEM;
+            goto unlock;
+        }
+        memcpy(extent->data, buf, size);
+        extent->len = size;
+        pool->dirty_bytes += size;
+
+        wb->current = extent;
+        wb->current_ts = time(NULL);
+    }
+
+    if (extent->len >= WRITEBACK_BLOCK_SIZE) {
+        WriteBack_queue_current(wb);
+    }
+
+    // throttle the writer while too much data is waiting to be written.
+    // the current extents of other files do not get written any
+    // faster by waiting, so give up when nothing is in flight
+    while (pool->dirty_bytes > pool->max_dirty_bytes) {
+        WriteBack_queue_current(wb);
+
+        bool in_flight = false;
+        for (WriteBack * f = pool->files; f != NULL; f = f->next) {
+            if ((f->queue_head != NULL) || f->flushing) {
+                in_flight = true;
+                break;
+            }
+        }
+        if (!in_flight) {
+            break;
+        }
+        pthread_cond_wait(&(pool->cond_done), &(pool->mutex));
+    }
+
+unlock:
+    pthread_mutex_unlock(&(pool->mutex));
+    return rc;
+
+error:
+    return -EINVAL;
+}
+
+
+int
+WriteBack_flush(WriteBack * wb)
+{
+    int rc = 0;
+
+    check((wb != NULL), "passed writeback is null");
+
+    pthread_mutex_lock(&(wb->pool->mutex));
+    if (WriteBack_is_dirty(wb)) {
+        WriteBack_queue_current(wb);
+    }
+    rc = WriteBack_wait(wb);
+    pthread_mutex_unlock(&(wb->pool->mutex));
+
+    return rc;
+
+error:
+    return -EINVAL;
+}
+
+
+/**
+ * move the current extent to the queue of extents to be written
+ *
+ * has to be called with the mutex of the pool locked
+ */
+static void
+WriteBack_queue_current(WriteBack * wb)
+{
+    if (wb->current == NULL) {
+        return;
+    }
+
+    if (wb->queue_tail != NULL) {
+        wb->queue_tail->next = wb->current;
+    }
+    else {
+        wb->queue_head = wb->current;
+    }
+    wb->queue_tail = wb->current;
+    wb->current = NULL;
+
+    pthread_cond_signal(&(wb->pool->cond_job));
+}
+
+
+/**
+ * has to be called with the mutex of the pool locked
+ */
+static bool
+WriteBack_is_dirty(const WriteBack * wb)
+{
+    return (wb->current != NULL) || (wb->queue_head != NULL) || wb->flushing;
+}
+
+
+/**
+ * wait until all queued extents of the file are written
+ *
+ * has to be called with the mutex of the pool locked
+ *
+ * returns 0 or the negative errno of a failed write
+ */
+static int
+WriteBack_wait(WriteBack * wb)
+{
+    while ((wb->queue_head != NULL) || wb->flushing) {
+        pthread_cond_wait(&(wb->pool->cond_done), &(wb->pool->mutex));
+    }
+
+    int rc = -wb->error;
+    wb->error = 0;
+    return rc;
+}
+
+
+// #### WriteBackExtent #######################################
+
+static WriteBackExtent *
+WriteBackExtent_create(off_t offset, size_t size)
+{
+    WriteBackExtent * extent = calloc(sizeof(WriteBackExtent), 1);
+    check_mem(extent);
+
+    extent->offset = offset;
+    check_mem(WriteBackExtent_reserve(extent, size));
+
+    return extent;
+
+error:
+    WriteBackExtent_destroy(extent);
+    return NULL;
+}
+
+
+/**
+ * make sure the extent can hold "len" bytes. the capacity is
+ * doubled to avoid reallocating for each appended write
+ */
+static bool
+WriteBackExtent_reserve(WriteBackExtent * extent, size_t len)
+{
+    if (len <= extent->capacity) {
+        return true;
+    }
+
+    size_t capacity = (extent->capacity > 0) ? extent->capacity : WRITEBACK_MIN_CAPACITY;
+    while (capacity < len) {
+        capacity *= 2;
+    }
+    if ((capacity > WRITEBACK_BLOCK_SIZE) && (len <= WRITEBACK_BLOCK_SIZE)) {
+        capacity = WRITEBACK_BLOCK_SIZE;
+    }
+
+    uint8_t * data = realloc(extent->data, capacity);
+    if (data == NULL) {
+        log_err("Could not allocate %d bytes for the writeback buffer", (int)capacity);
+        return false;
+    }
+    extent->data = data;
+    extent->capacity = capacity;
+    return true;
+}
+
+
+static void
+WriteBackExtent_destroy(WriteBackExtent * extent)
+{
+    if (extent) {
+        free(extent->data);
+        free(extent);
+    }
+}
@@ -0,0 +1,174 @@
+#ifndef __fs_writeback_h__
+#define __fs_writeback_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/* writes are collected in extents of up to this size before
+ * they are sent to the server */
+#define WRITEBACK_BLOCK_SIZE (4 * 1024 * 1024)
+
+/* initial size of the buffer of an extent. grows up to WRITEBACK_BLOCK_SIZE */
+#define WRITEBACK_MIN_CAPACITY (64 * 1024)
+
+/* dirty data older than this gets written even if the extent is not full */
+#define WRITEBACK_FLUSH_INTERVAL_SEC 1
+
+/* number of threads writing extents to the server */
+#define WRITEBACK_DEFAULT_THREADS 4
+
+
+/**
+ * write "size" bytes of "buf" at "offset" to the file identified by "ctx"
+ *
+ * returns the number of bytes written or a negative errno on failure
+ */
+typedef int (*WriteBack_write_fn)(void * ctx, const uint8_t * buf, size_t size, off_t offset);
+
+
+/**
+ * a contiguous range of dirty data
+ */
+typedef struct WriteBackExtent {
+    off_t offset;
+    size_t len;
+
+    uint8_t * data;
+    size_t capacity;
+
+    // next extent to be written for the same file
+    struct WriteBackExtent * next;
+} WriteBackExtent;
+
+
+struct WriteBackPool;
+
+/**
+ * write-back state of an open file
+ */
+typedef struct WriteBack {
+    struct WriteBackPool * pool;
+
+    // passed to the write function
+    void * ctx;
+
+    // the path of the file - used to flush before path based operations
+    const char * path;
+
+    // the extent collecting writes
+    WriteBackExtent * current;
+    time_t current_ts;
+
+    // extents waiting to be written, oldest first. extents of a file
+    // are written one after the other to keep the order of overlapping
+    // writes
+    WriteBackExtent * queue_head;
+    WriteBackExtent * queue_tail;
+
+    // a thread is writing an extent of this file
+    bool flushing;
+
+    // errno of the first failed asynchronous write. reported
+    // (and reset) by the next write or flush
+    int error;
+
+    // list of all files of the pool
+    struct WriteBack * prev;
+    struct WriteBack * next;
+} WriteBack;
+
+
+/**
+ * the threads writing the extents of all open files
+ *
+ * a single mutex protects the pool and all files using it
+ */
+typedef struct WriteBackPool {
+    pthread_t * threads;
+    unsigned int n_threads;
+
+    WriteBack_write_fn write;
+
+    WriteBack * files;
+
+    // bytes not yet written to the server and their limit
+    size_t dirty_bytes;
+    size_t max_dirty_bytes;
+
+    bool shutdown;
+
+    pthread_mutex_t mutex;
+    // there are extents to write
+    pthread_cond_t cond_job;
+    // an extent has been written
+    pthread_cond_t cond_done;
+} WriteBackPool;
+
+
+/**
+ * initialize the pool and start "n_threads" threads
+ *
+ * "max_dirty_bytes" limits the memory used for data not yet written.
+ * writers are throttled when it is exceeded.
+ *
+ * returns false on error
+ */
+bool WriteBackPool_init(WriteBackPool * pool, unsigned int n_threads,
+        size_t max_dirty_bytes, WriteBack_write_fn write);
+
+/**
+ * stop the threads of the pool. all WriteBack structs using this
+ * pool have to be destroyed before
+ */
+void WriteBackPool_deinit(WriteBackPool * pool);
+
+/**
+ * write all dirty data of the files opened with "path" and wait
+ * until it is on the server. errors are kept for the files.
+ */
+void WriteBackPool_flush_path(WriteBackPool * pool, const char * path);
+
+
+/**
+ * create the write-back state of an open file
+ *
+ * "path" has to stay valid until the WriteBack is destroyed or
+ * the path is replaced
+ *
+ * returns NULL on error
+ */
+WriteBack * WriteBack_create(WriteBackPool * pool, void * ctx, const char * path);
+
+/**
+ * replace the path of the file after it has been renamed. "path"
+ * has to stay valid until the WriteBack is destroyed
+ */
+void WriteBack_set_path(WriteBack * wb, const char * path);
+
+/**
+ * write all dirty data and free the write-back state
+ *
+ * returns 0 or the negative errno of a failed write
+ */
+int WriteBack_destroy(WriteBack * wb);
+
+/**
+ * buffer a write. adjacent and overlapping writes get merged
+ *
+ * returns "size" or the negative errno of an earlier
+ * asynchronous write which failed
+ */
+int WriteBack_write(WriteBack * wb, const uint8_t * buf, size_t size, off_t offset);
+
+/**
+ * write all dirty data of the file and wait until it is on the server
+ *
+ * returns 0 or the negative errno of a failed write
+ */
+int WriteBack_flush(WriteBack * wb);
+
+#endif /* __fs_writeback_h__ */
@@ -35,6 +35,8 @@ static flag_pair errno_map[] = {
     { RHIZOFS__ERRNO__ERRNO_NOSPC,     ENOSPC },
     { RHIZOFS__ERRNO__ERRNO_ROFS,      EROFS },
     { RHIZOFS__ERRNO__ERRNO_SPIPE,     ESPIPE },
+    { RHIZOFS__ERRNO__ERRNO_BADF,      EBADF },
+    { RHIZOFS__ERRNO__ERRNO_AGAIN,     EAGAIN },
 
     /* custom methods are located at the end of this list */
     { RHIZOFS__ERRNO__ERRNO_UNKNOWN,            EIO }, /* everything unknown is an IO error */
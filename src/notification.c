@@ -0,0 +1,53 @@
+#include "notification.h"
+
+#include "dbg.h"
+
+
+void
+Notification_init(Rhizofs__Notification * notification, Rhizofs__Version * version)
+{
+    rhizofs__version__init(version);
+    version->major = RHI_VERSION_MAJOR;
+    version->minor = RHI_VERSION_MINOR;
+    version->patch = RHI_VERSION_PATCH;
+    version->has_patch = 1;
+
+    rhizofs__notification__init(notification);
+    notification->version = version;
+}
+
+
+bool
+Notification_pack(const Rhizofs__Notification * notification, zmq_msg_t * msg)
+{
+    size_t len = (size_t)rhizofs__notification__get_packed_size(notification);
+
+    check((zmq_msg_init_size(msg, len) == 0),
+            "Could not initialize message");
+    check((rhizofs__notification__pack(notification, zmq_msg_data(msg)) == len),
+            "Could not pack message");
+
+    return true;
+
+error:
+    zmq_msg_close(msg);
+    return false;
+}
+
+
+Rhizofs__Notification *
+Notification_from_message(zmq_msg_t * msg)
+{
+    return rhizofs__notification__unpack(NULL,
+        zmq_msg_size(msg),
+        zmq_msg_data(msg));
+}
+
+
+void
+Notification_from_message_destroy(Rhizofs__Notification * notification)
+{
+    if (notification != NULL) {
+        rhizofs__notification__free_unpacked(notification, NULL);
+    }
+}
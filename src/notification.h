@@ -0,0 +1,38 @@
+#ifndef __notification_h__
+#define __notification_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <zmq.h>
+
+#include "version.h"
+#include "proto/rhizofs.pb-c.h"
+
+
+/**
+ * initialize a pre-allocated notification struct. "version" is
+ * filled with the version of this program and referenced by the
+ * notification
+ */
+void Notification_init(Rhizofs__Notification * notification, Rhizofs__Version * version);
+
+/**
+ * pack the notification in a zmq message
+ * the message will be initialized to the correct size
+ * and has to be zmq_msg_closed
+ *
+ * true = success
+ */
+bool Notification_pack(const Rhizofs__Notification * notification, zmq_msg_t * msg);
+
+/**
+ * create an allocated notification struct from a zmq_msg. returns NULL
+ * on failure. the caller is responsible for freeing the struct
+ * with Notification_from_message_destroy
+ */
+Rhizofs__Notification * Notification_from_message(zmq_msg_t * msg);
+
+void Notification_from_message_destroy(Rhizofs__Notification * notification);
+
+#endif /* __notification_h__ */
@@ -1,32 +1,62 @@
 #include "posix.h"
 
+#include <pthread.h>
+
 #include "dbg.h"
 
 
+/* the supplementary groups of the process, sorted. they are fetched
+ * once, as the process does not change its groups while running */
+static pthread_once_t groups_once = PTHREAD_ONCE_INIT;
+static gid_t * groups = NULL;
+static int n_groups = -1;
+static int groups_errno = 0;
+
+
+static int
+posix_compare_gid(const void * a, const void * b)
+{
+    gid_t gid_a = *(const gid_t *)a;
+    gid_t gid_b = *(const gid_t *)b;
+    return (gid_a > gid_b) - (gid_a < gid_b);
+}
+
+
+static void
+posix_load_groups(void)
+{
+    int n = getgroups(0, NULL);
+    check((n != -1), "Could not get group list");
+
+    // calloc may return NULL for 0 elements
+    groups = calloc(sizeof(gid_t), (n > 0) ? n : 1);
+    check_mem(groups);
+
+    n = getgroups(n, groups);
+    check((n != -1), "Could not fetch groups");
+
+    qsort(groups, n, sizeof(gid_t), posix_compare_gid);
+    n_groups = n;
+    return;
+
+error:
+    groups_errno = (errno != 0) ? errno : ENOMEM;
+    free(groups);
+    groups = NULL;
+}
+
+
 int
 posix_current_user_in_group(gid_t gid)
 {
-    int n_groups;
-    gid_t * group_ids = NULL;
-    int is_in_group = 0;
-
-    n_groups = getgroups(0, NULL);
-    check((n_groups != -1), "Could not get group list");
-
-    group_ids = calloc(sizeof(gid_t),n_groups);
-    check_mem(group_ids);
-    check((getgroups(n_groups, group_ids) != -1), "Could not fetch groups");
-
-    for (int i=0; i<n_groups; i++) {
-        if (group_ids[i] == gid) {
-            is_in_group = 1;
-            break;
-        }
+    pthread_once(&groups_once, posix_load_groups);
+    if (n_groups == -1) {
+        errno = groups_errno;
+        return -1;
     }
-    free(group_ids);
-    return is_in_group;
 
-error:
-    free(group_ids);
-    return -1;
+    if (bsearch(&gid, groups, n_groups, sizeof(gid_t), posix_compare_gid) != NULL) {
+        return 1;
+    }
+    return 0;
 }
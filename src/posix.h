@@ -11,6 +11,8 @@
  * check if the user of the program is in group gid
  * "result" will be 1 if the user is a member, otherwise 0
  *
+ * the groups of the process are fetched on the first call only
+ *
  * returns -1 on failure. sets errno
  */
 int posix_current_user_in_group(gid_t gid);
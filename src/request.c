@@ -4,8 +4,17 @@
 #include "dbg.h"
 #include "mapping.h"
 
+/* names of the request types, indexed by their number */
+static const char * request_type_names[] = {
+    "stat", "mkdir", "unknown", "ping", "readdir", "invalid", "rmdir", "unlink",
+    "access", "rename", "getattr", "open", "read", "write", "create", "truncate",
+    "chmod", "utimens", "link", "symlink", "readlink", "mknod", "statfs", "release",
+    "compound"
+};
+
+
 Rhizofs__Request *
-Request_from_message(zmq_msg_t *msg)
+Request_from_message(zmq_msg_t *msg, zmq_msg_t * data)
 {
     Rhizofs__Request *request = NULL;
 
@@ -14,8 +23,48 @@ Request_from_message(zmq_msg_t *msg)
     request = rhizofs__request__unpack(NULL,
         zmq_msg_size(msg),
         zmq_msg_data(msg));
+    check_debug((request != NULL), "Could not unpack request");
+
+    if (request->datablock != NULL) {
+        check(DataBlock_attach_frame(request->datablock, data),
+                "The data frame does not match the request");
+    }
+    else {
+        check(((data == NULL) || (zmq_msg_size(data) == 0)),
+                "Received a data frame for a request without data");
+    }
 
     return request;
+
+error:
+    Request_from_message_destroy(request);
+    return NULL;
+}
+
+
+int
+Request_peek_type(zmq_msg_t * msg)
+{
+    const uint8_t * data = zmq_msg_data(msg);
+    size_t len = zmq_msg_size(msg);
+
+    // key of field 1 with wire type varint, followed by a
+    // single byte value
+    if ((len < 2) || (data[0] != 0x08) || (data[1] & 0x80)) {
+        return -1;
+    }
+    return (int)data[1];
+}
+
+
+const char *
+Request_type_name(int requesttype)
+{
+    if ((requesttype < 0) ||
+            ((size_t)requesttype >= sizeof(request_type_names) / sizeof(request_type_names[0]))) {
+        return "invalid";
+    }
+    return request_type_names[requesttype];
 }
 
 
@@ -23,6 +72,7 @@ void
 Request_from_message_destroy(Rhizofs__Request * request)
 {
     if (request != NULL) {
+        DataBlock_release_frame(request->datablock);
         rhizofs__request__free_unpacked(request, NULL);
     }
 }
@@ -98,13 +148,58 @@ Request_deinit(Rhizofs__Request * request)
         OpenFlags_destroy(request->openflags);
         Permissions_destroy(request->permissions);
         TimeSet_destroy(request->timestamps);
+
+        if (request->n_requests != 0) {
+            size_t i;
+            for (i=0; i<request->n_requests; i++) {
+                Request_destroy(request->requests[i]);
+            }
+            free(request->requests);
+            request->requests = NULL;
+            request->n_requests = 0;
+        }
     }
 }
 
 
+Rhizofs__Request *
+Request_add_subrequest(Rhizofs__Request * request, Rhizofs__RequestType requesttype,
+        const char * path)
+{
+    Rhizofs__Request * subrequest = NULL;
+    Rhizofs__Request ** requests = NULL;
+
+    requests = realloc(request->requests,
+            sizeof(Rhizofs__Request *) * (request->n_requests + 1));
+    check_mem(requests);
+    request->requests = requests;
+
+    subrequest = Request_create();
+    check_mem(subrequest);
+
+    subrequest->requesttype = requesttype;
+    subrequest->path = (char *)path;
+
+    request->requesttype = RHIZOFS__REQUEST_TYPE__COMPOUND;
+    request->requests[request->n_requests] = subrequest;
+    request->n_requests++;
+
+    return subrequest;
+
+error:
+    return NULL;
+}
+
+
 bool
-Request_pack(const Rhizofs__Request * request, zmq_msg_t * msg)
+Request_pack(Rhizofs__Request * request, zmq_msg_t * msg, zmq_msg_t * data)
 {
+    if ((data != NULL) && !DataBlock_move_to_frame(request->datablock, data)) {
+        log_err("Could not move the data into a frame");
+        zmq_msg_close(data);
+        return false;
+    }
+
     /* serialize the reply */
     size_t len = (size_t)rhizofs__request__get_packed_size(request);
     debug("Request will be %d bytes long", (int)len);
@@ -118,12 +213,16 @@ Request_pack(const Rhizofs__Request * request, zmq_msg_t * msg)
 
 error:
     zmq_msg_close(msg);
+    if (data != NULL) {
+        zmq_msg_close(data);
+    }
     return false;
 }
 
 
 bool
-Request_set_data(Rhizofs__Request * request, const uint8_t * data, size_t len)
+Request_set_data(Rhizofs__Request * request, const uint8_t * data, size_t len,
+        const Codec * codec)
 {
     Rhizofs__DataBlock * datablock = NULL;
 
@@ -132,8 +231,7 @@ Request_set_data(Rhizofs__Request * request, const uint8_t * data, size_t len)
     datablock = DataBlock_create();
     check_mem(datablock);
 
-    check(( DataBlock_set_data(datablock, data, len,
-           RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4) == true),
+    check(( DataBlock_set_data(datablock, data, len, codec) == true),
            "could not set datablock data");
 
     request->datablock = datablock;
@@ -11,6 +11,7 @@
 #include "mapping.h"
 #include "version.h"
 #include "proto/rhizofs.pb-c.h"
+#include "codec.h"
 
 
 /**
@@ -39,22 +40,58 @@ bool Request_init(Rhizofs__Request * request);
  */
 void Request_deinit(Rhizofs__Request * request);
 
+/**
+ * append a sub-request to a request and make it a COMPOUND request.
+ * the path is not copied and has to stay valid until the request
+ * is deinitialized
+ *
+ * returns the new sub-request owned by "request" or NULL on error
+ */
+Rhizofs__Request * Request_add_subrequest(Rhizofs__Request * request,
+        Rhizofs__RequestType requesttype, const char * path);
+
 /**
  * pack the request in a zmq message
  * the message will be initialized to the correct size
  * and has to be zmq_msg_closed
  *
+ * if "data" is not NULL, the bytes of the data block are moved into it
+ * to be sent as the frame following the message. it is initialized
+ * empty if there are none and has to be zmq_msg_closed as well
+ *
  * true = success
  */
-bool Request_pack(const Rhizofs__Request * request, zmq_msg_t * msg);
+bool Request_pack(Rhizofs__Request * request, zmq_msg_t * msg, zmq_msg_t * data);
 
 
 /**
  * create an allocated request struct from a zmq_msg. returns NULL on
  * failure. the caller is responsible for freeing the struct
  * with Request_from_message_destroy
+ *
+ * "data" is the frame received after the message or NULL. the data
+ * block of the request refers to it, so it has to stay open until
+ * the request is destroyed
+ */
+Rhizofs__Request * Request_from_message(zmq_msg_t * msg, zmq_msg_t * data);
+
+
+/**
+ * get the type of a packed request without unpacking it. relies on
+ * the type being packed first, as protobuf-c orders the fields by
+ * their number
+ *
+ * returns -1 if the type could not be found
+ */
+int Request_peek_type(zmq_msg_t * msg);
+
+
+/**
+ * get the name of a request type in lower case
+ *
+ * returns "invalid" for unknown types
  */
-Rhizofs__Request * Request_from_message(zmq_msg_t * msg);
+const char * Request_type_name(int requesttype);
 
 
 /**
@@ -63,11 +100,13 @@ Rhizofs__Request * Request_from_message(zmq_msg_t * msg);
 void Request_from_message_destroy(Rhizofs__Request * request);
 
 /**
- * passed data will not be freed
+ * passed data will not be freed. it is compressed with "codec", which
+ * may be NULL to send it uncompressed
  *
  * returns true on success, otherwise false
  */
-bool Request_set_data(Rhizofs__Request * response, const uint8_t * data, size_t len);
+bool Request_set_data(Rhizofs__Request * response, const uint8_t * data, size_t len,
+        const Codec * codec);
 
 /**
  * check if a request has any data associated with it
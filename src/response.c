@@ -51,11 +51,21 @@ Response_destroy(Rhizofs__Response * response)
             }
             free(response->directory_entries);
         }
+        free(response->cookies);
+        free(response->compressions);
 
         if (response->datablock != NULL) {
             DataBlock_destroy(response->datablock);
         }
 
+        if (response->n_responses != 0) {
+            size_t i;
+            for (i=0; i<response->n_responses; i++) {
+                Response_destroy(response->responses[i]);
+            }
+            free(response->responses);
+        }
+
         free(response->version);
         free(response);
     }
@@ -64,8 +74,14 @@ Response_destroy(Rhizofs__Response * response)
 
 
 bool
-Response_pack(const Rhizofs__Response * response, zmq_msg_t * msg)
+Response_pack(Rhizofs__Response * response, zmq_msg_t * msg, zmq_msg_t * data)
 {
+    if ((data != NULL) && !DataBlock_move_to_frame(response->datablock, data)) {
+        log_err("Could not move the data into a frame");
+        zmq_msg_close(data);
+        return false;
+    }
+
     /* serialize the reply */
     size_t len = (size_t)rhizofs__response__get_packed_size(response);
     debug("Response will be %d bytes long", (int)len);
@@ -78,12 +94,16 @@ Response_pack(const Rhizofs__Response * response, zmq_msg_t * msg)
 
 error:
     zmq_msg_close(msg);
+    if (data != NULL) {
+        zmq_msg_close(data);
+    }
     return false;
 }
 
 
 bool
-Response_set_data(Rhizofs__Response * response, const uint8_t * data, size_t len)
+Response_set_data(Rhizofs__Response * response, const uint8_t * data, size_t len,
+        const Codec * codec)
 {
     Rhizofs__DataBlock * datablock = NULL;
 
@@ -92,8 +112,7 @@ Response_set_data(Rhizofs__Response * response, const uint8_t * data, size_t len
     datablock = DataBlock_create();
     check_mem(datablock);
 
-    check(( DataBlock_set_data(datablock, data, len,
-           RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4) == true),
+    check(( DataBlock_set_data(datablock, data, len, codec) == true),
            "could not set datablock data");
 
     response->datablock = datablock;
@@ -106,6 +125,30 @@ error:
 }
 
 
+bool
+Response_set_data_frame(Rhizofs__Response * response, size_t len)
+{
+    Rhizofs__DataBlock * datablock = NULL;
+
+    check((response->datablock == NULL), "Response has aleady a data block");
+
+    datablock = DataBlock_create();
+    check_mem(datablock);
+
+    datablock->size = len;
+    datablock->compression = RHIZOFS__COMPRESSION_TYPE__COMPR_NONE;
+    datablock->has_data_frame = 1;
+    datablock->data_frame = true;
+
+    response->datablock = datablock;
+
+    return true;
+
+error:
+    return false;
+}
+
+
 void
 Response_set_errno(Rhizofs__Response * response, int eno)
 {
@@ -126,7 +169,7 @@ Response_get_errno(const Rhizofs__Response * response)
 
 
 Rhizofs__Response *
-Response_from_message(zmq_msg_t *msg)
+Response_from_message(zmq_msg_t *msg, zmq_msg_t * data)
 {
     Rhizofs__Response *response = NULL;
 
@@ -135,8 +178,22 @@ Response_from_message(zmq_msg_t *msg)
     response = rhizofs__response__unpack(NULL,
         zmq_msg_size(msg),
         zmq_msg_data(msg));
+    check_debug((response != NULL), "Could not unpack response");
+
+    if (response->datablock != NULL) {
+        check(DataBlock_attach_frame(response->datablock, data),
+                "The data frame does not match the response");
+    }
+    else {
+        check(((data == NULL) || (zmq_msg_size(data) == 0)),
+                "Received a data frame for a response without data");
+    }
 
     return response;
+
+error:
+    Response_from_message_destroy(response);
+    return NULL;
 }
 
 
@@ -144,6 +201,7 @@ void
 Response_from_message_destroy(Rhizofs__Response * response)
 {
     if (response != NULL) {
+        DataBlock_release_frame(response->datablock);
         rhizofs__response__free_unpacked(response, NULL);
     }
 }
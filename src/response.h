@@ -10,6 +10,7 @@
 #include "version.h"
 #include "mapping.h"
 #include "proto/rhizofs.pb-c.h"
+#include "codec.h"
 
 
 Rhizofs__Response * Response_create();
@@ -37,18 +38,39 @@ int Response_get_errno(const Rhizofs__Response * response);
  * the message will be initialized to the correct size
  * and has to be zmq_msg_closed
  *
+ * if "data" is not NULL, the bytes of the data block are moved into it
+ * to be sent as the frame following the message. it is initialized
+ * empty if there are none and has to be zmq_msg_closed as well
+ *
  * true = success
  */
-bool Response_pack(const Rhizofs__Response * response, zmq_msg_t * msg);
+bool Response_pack(Rhizofs__Response * response, zmq_msg_t * msg, zmq_msg_t * data);
 
 /**
  * may make a copy of the data. the "data" pointer itself will not be modified or freed.
+ * it is compressed with "codec", which may be NULL to send it uncompressed
  *
  * returns true on success, otherwise false
  */
-bool Response_set_data(Rhizofs__Response * response, const uint8_t * data, size_t len);
+bool Response_set_data(Rhizofs__Response * response, const uint8_t * data, size_t len,
+        const Codec * codec);
 
-Rhizofs__Response * Response_from_message(zmq_msg_t *msg);
+/**
+ * announce "len" bytes of uncompressed data sent in a frame built by
+ * the caller instead of with the response
+ *
+ * returns true on success, otherwise false
+ */
+bool Response_set_data_frame(Rhizofs__Response * response, size_t len);
+
+/**
+ * "data" is the frame received after the message or NULL. the data
+ * block of the response refers to it, so it has to stay open until
+ * the response is destroyed
+ *
+ * returns NULL on failure
+ */
+Rhizofs__Response * Response_from_message(zmq_msg_t *msg, zmq_msg_t * data);
 
 void Response_from_message_destroy(Rhizofs__Response * response);
 
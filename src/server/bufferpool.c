@@ -0,0 +1,246 @@
+#include "bufferpool.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../dbg.h"
+
+
+/**
+ * the size class of buffers of "size" bytes. BUFFERPOOL_N_CLASSES for
+ * buffers which are too large to be kept
+ */
+static size_t
+BufferPool_class(size_t size)
+{
+    size_t c = 0;
+
+    while ((c < BUFFERPOOL_N_CLASSES) && (((size_t)1 << (BUFFERPOOL_MIN_SHIFT + c)) < size)) {
+        c++;
+    }
+    return c;
+}
+
+
+static size_t
+BufferPool_page_size()
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    return (page_size > 0) ? (size_t)page_size : 4096;
+}
+
+
+/**
+ * map anonymous memory for a buffer, using huge pages if possible
+ *
+ * returns false if nothing could be mapped
+ */
+static bool
+BufferPool_map_huge(BufferPoolBuffer * buffer, size_t size)
+{
+    size_t map_size = (size + BUFFERPOOL_HUGE_PAGE_SIZE - 1) & ~((size_t)BUFFERPOOL_HUGE_PAGE_SIZE - 1);
+    void * map = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    // only succeeds if huge pages have been reserved
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (map == MAP_FAILED) {
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        // let the kernel use transparent huge pages
+        madvise(map, map_size, MADV_HUGEPAGE);
+#endif
+    }
+
+    buffer->data = map;
+    buffer->map = map;
+    buffer->map_size = map_size;
+    return true;
+}
+
+
+/**
+ * allocate a buffer of "size" bytes
+ *
+ * returns NULL on error
+ */
+static BufferPoolBuffer *
+BufferPool_alloc(BufferPool * pool, size_t size)
+{
+    BufferPoolBuffer * buffer = NULL;
+    void * data = NULL;
+
+    buffer = calloc(sizeof(BufferPoolBuffer), 1);
+    check_mem(buffer);
+    buffer->pool = pool;
+    buffer->size = size;
+
+    if (pool->huge_pages && (size >= BUFFERPOOL_HUGE_PAGE_SIZE)
+            && BufferPool_map_huge(buffer, size)) {
+        return buffer;
+    }
+
+    check((posix_memalign(&data, BufferPool_page_size(), size) == 0),
+            "Could not allocate a buffer of %lu bytes", (unsigned long)size);
+    buffer->data = data;
+    return buffer;
+
+error:
+    free(buffer);
+    return NULL;
+}
+
+
+static void
+BufferPool_free_buffer(BufferPoolBuffer * buffer)
+{
+    if (buffer->map != NULL) {
+        munmap(buffer->map, buffer->map_size);
+    }
+    else {
+        free(buffer->data);
+    }
+    free(buffer);
+}
+
+
+static void
+BufferPool_free_pool(BufferPool * pool)
+{
+    pthread_mutex_destroy(&(pool->mutex));
+    free(pool);
+}
+
+
+BufferPool *
+BufferPool_create(bool huge_pages)
+{
+    BufferPool * pool = NULL;
+
+    pool = calloc(sizeof(BufferPool), 1);
+    check_mem(pool);
+    pool->huge_pages = huge_pages;
+
+    check((pthread_mutex_init(&(pool->mutex), NULL) == 0),
+            "Could not initialize the mutex of the buffer pool");
+    return pool;
+
+error:
+    free(pool);
+    return NULL;
+}
+
+
+void
+BufferPool_destroy(BufferPool * pool)
+{
+    BufferPoolBuffer * unused[BUFFERPOOL_N_CLASSES];
+    bool last = false;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(pool->mutex));
+    memcpy(unused, pool->unused, sizeof(unused));
+    memset(pool->unused, 0, sizeof(pool->unused));
+    pool->n_cached_bytes = 0;
+    pool->destroyed = true;
+    last = (pool->n_out == 0);
+    pthread_mutex_unlock(&(pool->mutex));
+
+    for (size_t c=0; c<BUFFERPOOL_N_CLASSES; c++) {
+        while (unused[c] != NULL) {
+            BufferPoolBuffer * next = unused[c]->next;
+            BufferPool_free_buffer(unused[c]);
+            unused[c] = next;
+        }
+    }
+
+    // the buffers still out free the pool when they are returned
+    if (last) {
+        BufferPool_free_pool(pool);
+    }
+}
+
+
+BufferPoolBuffer *
+BufferPool_get(BufferPool * pool, size_t size)
+{
+    BufferPoolBuffer * buffer = NULL;
+    size_t c = BufferPool_class(size);
+
+    pthread_mutex_lock(&(pool->mutex));
+    if (c < BUFFERPOOL_N_CLASSES) {
+        buffer = pool->unused[c];
+        if (buffer != NULL) {
+            pool->unused[c] = buffer->next;
+            pool->n_cached_bytes -= buffer->size;
+        }
+    }
+    pool->n_out++;
+    pthread_mutex_unlock(&(pool->mutex));
+
+    if (buffer == NULL) {
+        // buffers which are kept get the size of their class
+        buffer = BufferPool_alloc(pool,
+                (c < BUFFERPOOL_N_CLASSES) ? ((size_t)1 << (BUFFERPOOL_MIN_SHIFT + c)) : size);
+        if (buffer == NULL) {
+            pthread_mutex_lock(&(pool->mutex));
+            pool->n_out--;
+            pthread_mutex_unlock(&(pool->mutex));
+            return NULL;
+        }
+    }
+    buffer->next = NULL;
+    return buffer;
+}
+
+
+void
+BufferPool_put(BufferPoolBuffer * buffer)
+{
+    BufferPool * pool = NULL;
+    bool last = false;
+
+    if (buffer == NULL) {
+        return;
+    }
+    pool = buffer->pool;
+
+    pthread_mutex_lock(&(pool->mutex));
+    pool->n_out--;
+    if (!pool->destroyed
+            && ((pool->n_cached_bytes + buffer->size) <= BUFFERPOOL_MAX_CACHED)) {
+        size_t c = BufferPool_class(buffer->size);
+        if ((c < BUFFERPOOL_N_CLASSES) && (((size_t)1 << (BUFFERPOOL_MIN_SHIFT + c)) == buffer->size)) {
+            buffer->next = pool->unused[c];
+            pool->unused[c] = buffer;
+            pool->n_cached_bytes += buffer->size;
+            buffer = NULL;
+        }
+    }
+    last = pool->destroyed && (pool->n_out == 0);
+    pthread_mutex_unlock(&(pool->mutex));
+
+    if (buffer != NULL) {
+        BufferPool_free_buffer(buffer);
+    }
+    if (last) {
+        BufferPool_free_pool(pool);
+    }
+}
+
+
+void
+BufferPool_free_frame(void * UNUSED_PARAMETER(data), void * hint)
+{
+    BufferPool_put((BufferPoolBuffer *)hint);
+}
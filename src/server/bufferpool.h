@@ -0,0 +1,101 @@
+#ifndef __server_bufferpool_h__
+#define __server_bufferpool_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* sizes of the smallest and the largest buffers kept by a pool, as
+ * powers of two. larger buffers are allocated for each request */
+#define BUFFERPOOL_MIN_SHIFT 16
+#define BUFFERPOOL_MAX_SHIFT 22
+#define BUFFERPOOL_N_CLASSES (BUFFERPOOL_MAX_SHIFT - BUFFERPOOL_MIN_SHIFT + 1)
+
+/* bytes of unused buffers a pool keeps */
+#define BUFFERPOOL_MAX_CACHED (16 * 1024 * 1024)
+
+/* buffers of at least this size are backed by huge pages if the pool
+ * uses them */
+#define BUFFERPOOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+/**
+ * a page aligned buffer of a pool
+ */
+typedef struct BufferPoolBuffer {
+    uint8_t * data;
+
+    // the size of the buffer
+    size_t size;
+
+    // the pool the buffer is returned to
+    struct BufferPool * pool;
+
+    // the memory mapped for the buffer. NULL if it was allocated
+    // on the heap
+    void * map;
+    size_t map_size;
+
+    // link in the list of unused buffers
+    struct BufferPoolBuffer * next;
+} BufferPoolBuffer;
+
+
+/**
+ * buffers the data of reads is placed in, owned by a single worker
+ *
+ * buffers are reused instead of being allocated and cleared for every
+ * request. they are returned from any thread, usually by the zmq free
+ * callback once the reply has been sent. the pool stays alive until
+ * the last of its buffers has been returned, even after its worker
+ * left
+ */
+typedef struct BufferPool {
+    // unused buffers by their size
+    BufferPoolBuffer * unused[BUFFERPOOL_N_CLASSES];
+    size_t n_cached_bytes;
+
+    // buffers handed out and not returned yet
+    size_t n_out;
+
+    bool huge_pages;
+    bool destroyed;
+
+    pthread_mutex_t mutex;
+} BufferPool;
+
+
+/**
+ * "huge_pages" backs large buffers with huge pages if the system
+ * provides them
+ *
+ * returns NULL on error
+ */
+BufferPool * BufferPool_create(bool huge_pages);
+
+/**
+ * free the unused buffers. the pool itself is freed once all buffers
+ * handed out have been returned
+ */
+void BufferPool_destroy(BufferPool * pool);
+
+/**
+ * get a buffer of at least "size" bytes. its contents are undefined
+ *
+ * returns NULL on error
+ */
+BufferPoolBuffer * BufferPool_get(BufferPool * pool, size_t size);
+
+/**
+ * return a buffer to its pool
+ */
+void BufferPool_put(BufferPoolBuffer * buffer);
+
+/**
+ * returns a buffer to its pool. to be passed to zmq_msg_init_data
+ * with the buffer as the hint
+ */
+void BufferPool_free_frame(void * data, void * hint);
+
+#endif /* __server_bufferpool_h__ */
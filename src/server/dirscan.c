@@ -0,0 +1,481 @@
+#include "dirscan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/stat.h>
+
+#ifndef AT_STATX_DONT_SYNC
+#define AT_STATX_DONT_SYNC 0x4000
+#endif
+
+/* the record getdents64 fills the buffer with */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+#include "../dbg.h"
+
+
+/** a page of entries shared with the threads of a StatPool */
+typedef struct StatBatch {
+    int dirfd;
+    DirScanEntry * entries;
+    size_t n_entries;
+
+    // the first entry not claimed by a thread yet
+    size_t next_entry;
+    size_t n_done;
+
+    struct StatBatch * next;
+} StatBatch;
+
+
+// prototypes
+static void * StatPool_routine(void * pool_ptr);
+static void StatPool_unqueue(StatPool * pool, StatBatch * batch);
+static bool StatPool_work(StatPool * pool, StatBatch * batch);
+
+
+bool
+DirScan_open(DirScan * scan, const char * path)
+{
+    memset(scan, 0, sizeof(DirScan));
+    scan->fd = -1;
+
+#ifdef __linux__
+    scan->buf = malloc(DIRSCAN_BUFFER_SIZE);
+    if (scan->buf == NULL) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    scan->fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (scan->fd == -1) {
+        int open_errno = errno;
+        free(scan->buf);
+        scan->buf = NULL;
+        errno = open_errno;
+        return false;
+    }
+#else
+    DIR * dir = opendir(path);
+    if (dir == NULL) {
+        return false;
+    }
+    scan->dir = dir;
+    scan->fd = dirfd(dir);
+#endif
+    return true;
+}
+
+
+void
+DirScan_close(DirScan * scan)
+{
+#ifdef __linux__
+    if (scan->fd != -1) {
+        close(scan->fd);
+    }
+#else
+    if (scan->dir != NULL) {
+        closedir((DIR *)scan->dir);
+        scan->dir = NULL;
+    }
+#endif
+    scan->fd = -1;
+    free(scan->buf);
+    scan->buf = NULL;
+}
+
+
+bool
+DirScan_seek(DirScan * scan, uint64_t cookie)
+{
+#ifdef __linux__
+    if (lseek(scan->fd, (off_t)cookie, SEEK_SET) == (off_t)-1) {
+        return false;
+    }
+    scan->buf_len = 0;
+    scan->buf_pos = 0;
+#else
+    seekdir((DIR *)scan->dir, (long)cookie);
+#endif
+    return true;
+}
+
+
+int
+DirScan_next(DirScan * scan, const char ** name, uint64_t * cookie)
+{
+#ifdef __linux__
+    if (scan->buf_pos >= scan->buf_len) {
+        long nread = syscall(SYS_getdents64, scan->fd, scan->buf, DIRSCAN_BUFFER_SIZE);
+        if (nread == -1) {
+            return -1;
+        }
+        if (nread == 0) {
+            return 0;
+        }
+        scan->buf_len = (size_t)nread;
+        scan->buf_pos = 0;
+    }
+
+    struct linux_dirent64 * de = (struct linux_dirent64 *)(scan->buf + scan->buf_pos);
+    scan->buf_pos += de->d_reclen;
+
+    (*name) = de->d_name;
+    (*cookie) = (uint64_t)de->d_off;
+    return 1;
+#else
+    struct dirent * de = NULL;
+
+    errno = 0;
+    if ((de = readdir((DIR *)scan->dir)) == NULL) {
+        return (errno == 0) ? 0 : -1;
+    }
+    (*name) = de->d_name;
+    (*cookie) = (uint64_t)telldir((DIR *)scan->dir);
+    return 1;
+#endif
+}
+
+
+void
+DirScanPage_init(DirScanPage * page)
+{
+    memset(page, 0, sizeof(DirScanPage));
+}
+
+
+void
+DirScanPage_deinit(DirScanPage * page)
+{
+    if (page) {
+        free(page->entries);
+        free(page->names);
+        DirScanPage_init(page);
+    }
+}
+
+
+bool
+DirScan_read_page(DirScan * scan, DirScanPage * page, size_t max_entries,
+        size_t max_bytes)
+{
+    const char * name = NULL;
+    uint64_t cookie = 0;
+    size_t bytes = 0;
+    int rc;
+
+    page->end_of_directory = false;
+
+    while (true) {
+        if ((page->n_entries >= max_entries) || (bytes >= max_bytes)) {
+            // only known to be the end once the next read returns nothing
+            break;
+        }
+
+        rc = DirScan_next(scan, &name, &cookie);
+        if (rc == -1) {
+            return false;
+        }
+        if (rc == 0) {
+            page->end_of_directory = true;
+            break;
+        }
+
+        size_t name_size = strlen(name) + 1;
+
+        if (page->n_entries == page->capacity) {
+            size_t capacity = (page->capacity == 0) ? 64 : page->capacity * 2;
+            DirScanEntry * entries = realloc(page->entries, sizeof(DirScanEntry) * capacity);
+            if (entries == NULL) {
+                errno = ENOMEM;
+                return false;
+            }
+            page->entries = entries;
+            page->capacity = capacity;
+        }
+        if (page->names_len + name_size > page->names_capacity) {
+            size_t names_capacity = (page->names_capacity == 0) ? 4096 : page->names_capacity * 2;
+            while (page->names_len + name_size > names_capacity) {
+                names_capacity *= 2;
+            }
+            char * names = realloc(page->names, names_capacity);
+            if (names == NULL) {
+                errno = ENOMEM;
+                return false;
+            }
+            page->names = names;
+            page->names_capacity = names_capacity;
+        }
+
+        DirScanEntry * entry = &(page->entries[page->n_entries]);
+        memset(entry, 0, sizeof(DirScanEntry));
+        entry->cookie = cookie;
+
+        // the names buffer may still move. the offset is turned into
+        // a pointer when the page is complete
+        entry->name = (const char *)(uintptr_t)page->names_len;
+        memcpy(page->names + page->names_len, name, name_size);
+        page->names_len += name_size;
+        page->n_entries++;
+
+        bytes += name_size + DIRSCAN_ENTRY_OVERHEAD;
+    }
+
+    for (size_t i=0; i<page->n_entries; i++) {
+        page->entries[i].name = page->names + (uintptr_t)page->entries[i].name;
+    }
+    return true;
+}
+
+
+#ifdef __linux__
+void
+DirScan_statx_to_stat(const struct statx * stx, struct stat * stat_result)
+{
+    memset(stat_result, 0, sizeof(struct stat));
+    stat_result->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    stat_result->st_ino = stx->stx_ino;
+    stat_result->st_mode = stx->stx_mode;
+    stat_result->st_nlink = stx->stx_nlink;
+    stat_result->st_uid = stx->stx_uid;
+    stat_result->st_gid = stx->stx_gid;
+    stat_result->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    stat_result->st_size = stx->stx_size;
+    stat_result->st_blksize = stx->stx_blksize;
+    stat_result->st_blocks = stx->stx_blocks;
+    stat_result->st_atim.tv_sec = stx->stx_atime.tv_sec;
+    stat_result->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    stat_result->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    stat_result->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    stat_result->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    stat_result->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+#endif
+
+
+int
+DirScan_stat(int dirfd, const char * name, struct stat * stat_result)
+{
+#if defined(__linux__) && defined(SYS_statx)
+    static int statx_unsupported = 0;
+
+    if (!statx_unsupported) {
+        struct statx stx;
+
+        if (syscall(SYS_statx, dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                    STATX_BASIC_STATS, &stx) == 0) {
+            DirScan_statx_to_stat(&stx, stat_result);
+            return 0;
+        }
+        if (errno != ENOSYS) {
+            return errno;
+        }
+        statx_unsupported = 1;
+    }
+#endif
+    if (fstatat(dirfd, name, stat_result, AT_SYMLINK_NOFOLLOW) != 0) {
+        return errno;
+    }
+    return 0;
+}
+
+
+bool
+StatPool_init(StatPool * pool, size_t n_threads)
+{
+    bool mutex_initialized = false;
+    bool work_cond_initialized = false;
+    bool done_cond_initialized = false;
+
+    memset(pool, 0, sizeof(StatPool));
+
+    check(pthread_mutex_init(&(pool->mutex), NULL) == 0,
+            "Could not initialize statpool mutex");
+    mutex_initialized = true;
+    check(pthread_cond_init(&(pool->work_cond), NULL) == 0,
+            "Could not initialize statpool condition");
+    work_cond_initialized = true;
+    check(pthread_cond_init(&(pool->done_cond), NULL) == 0,
+            "Could not initialize statpool condition");
+    done_cond_initialized = true;
+
+    pool->threads = calloc(sizeof(pthread_t), n_threads);
+    check_mem(pool->threads);
+
+    for (pool->n_threads=0; pool->n_threads<n_threads; pool->n_threads++) {
+        check((pthread_create(&(pool->threads[pool->n_threads]), NULL,
+                        StatPool_routine, pool) == 0),
+                "Could not start statpool thread");
+    }
+
+    return true;
+
+error:
+    if (pool->threads != NULL) {
+        StatPool_deinit(pool);
+        return false;
+    }
+    if (done_cond_initialized) {
+        pthread_cond_destroy(&(pool->done_cond));
+    }
+    if (work_cond_initialized) {
+        pthread_cond_destroy(&(pool->work_cond));
+    }
+    if (mutex_initialized) {
+        pthread_mutex_destroy(&(pool->mutex));
+    }
+    return false;
+}
+
+
+void
+StatPool_deinit(StatPool * pool)
+{
+    if (pool == NULL || pool->threads == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(pool->mutex));
+    pool->stop = true;
+    pthread_cond_broadcast(&(pool->work_cond));
+    pthread_mutex_unlock(&(pool->mutex));
+
+    for (size_t i=0; i<pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->n_threads = 0;
+
+    pthread_cond_destroy(&(pool->done_cond));
+    pthread_cond_destroy(&(pool->work_cond));
+    pthread_mutex_destroy(&(pool->mutex));
+}
+
+
+void
+StatPool_stat(StatPool * pool, int dirfd, DirScanEntry * entries, size_t n_entries)
+{
+    if ((pool == NULL) || (pool->n_threads == 0)
+                || (n_entries < STATPOOL_PARALLEL_MIN_ENTRIES)) {
+        for (size_t i=0; i<n_entries; i++) {
+            entries[i].stat_errno = DirScan_stat(dirfd, entries[i].name,
+                    &(entries[i].stat_result));
+        }
+        return;
+    }
+
+    StatBatch batch;
+    memset(&batch, 0, sizeof(StatBatch));
+    batch.dirfd = dirfd;
+    batch.entries = entries;
+    batch.n_entries = n_entries;
+
+    pthread_mutex_lock(&(pool->mutex));
+
+    StatBatch ** tail = &(pool->batches);
+    while (*tail != NULL) {
+        tail = &((*tail)->next);
+    }
+    (*tail) = &batch;
+    pthread_cond_broadcast(&(pool->work_cond));
+
+    // help with the own batch until all of it is claimed
+    while (StatPool_work(pool, &batch)) {
+    }
+
+    while (batch.n_done < batch.n_entries) {
+        pthread_cond_wait(&(pool->done_cond), &(pool->mutex));
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+}
+
+
+/**
+ * remove a batch whose entries have all been claimed from the queue.
+ * has to be called with the mutex locked
+ */
+static void
+StatPool_unqueue(StatPool * pool, StatBatch * batch)
+{
+    StatBatch ** link = &(pool->batches);
+    while (*link != NULL) {
+        if (*link == batch) {
+            (*link) = batch->next;
+            return;
+        }
+        link = &((*link)->next);
+    }
+}
+
+
+/**
+ * claim a chunk of the entries of "batch" and stat them. has to be
+ * called with the mutex locked, which is released while stating
+ *
+ * returns false if there was nothing left to claim
+ */
+static bool
+StatPool_work(StatPool * pool, StatBatch * batch)
+{
+    if (batch->next_entry >= batch->n_entries) {
+        return false;
+    }
+
+    size_t start = batch->next_entry;
+    size_t count = batch->n_entries - start;
+    if (count > STATPOOL_CHUNK_SIZE) {
+        count = STATPOOL_CHUNK_SIZE;
+    }
+    batch->next_entry += count;
+    if (batch->next_entry >= batch->n_entries) {
+        StatPool_unqueue(pool, batch);
+    }
+
+    pthread_mutex_unlock(&(pool->mutex));
+    for (size_t i=start; i<start+count; i++) {
+        batch->entries[i].stat_errno = DirScan_stat(batch->dirfd, batch->entries[i].name,
+                &(batch->entries[i].stat_result));
+    }
+    pthread_mutex_lock(&(pool->mutex));
+
+    batch->n_done += count;
+    if (batch->n_done >= batch->n_entries) {
+        pthread_cond_broadcast(&(pool->done_cond));
+    }
+    return true;
+}
+
+
+static void *
+StatPool_routine(void * pool_ptr)
+{
+    StatPool * pool = (StatPool *)pool_ptr;
+
+    pthread_mutex_lock(&(pool->mutex));
+    while (!pool->stop) {
+        if (pool->batches == NULL) {
+            pthread_cond_wait(&(pool->work_cond), &(pool->mutex));
+            continue;
+        }
+        StatPool_work(pool, pool->batches);
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return NULL;
+}
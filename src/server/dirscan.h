@@ -0,0 +1,173 @@
+#ifndef __server_dirscan_h__
+#define __server_dirscan_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <linux/stat.h>
+#endif
+
+/* size of the buffer the entries of a directory are read into */
+#define DIRSCAN_BUFFER_SIZE 32768
+
+/* assumed size of the attributes of an entry besides its name when
+ * limiting the size of a page */
+#define DIRSCAN_ENTRY_OVERHEAD 96
+
+/* number of threads stating the entries of large directories */
+#define STATPOOL_DEFAULT_THREADS 4
+
+/* pages with fewer entries are stated by the calling thread alone */
+#define STATPOOL_PARALLEL_MIN_ENTRIES 256
+
+/* number of entries a thread of the pool claims at once */
+#define STATPOOL_CHUNK_SIZE 32
+
+
+/**
+ * reads the entries of a directory from an open file descriptor.
+ * on linux getdents64 is used directly, so the entries are read in
+ * large blocks and their positions are available as cookies
+ */
+typedef struct DirScan {
+    int fd;
+
+    char * buf;
+    size_t buf_len;
+    size_t buf_pos;
+
+#ifndef __linux__
+    void * dir;
+#endif
+} DirScan;
+
+
+/** an entry of a directory and the result of its stat */
+typedef struct DirScanEntry {
+    const char * name;
+
+    // the position after the entry. see DirScan_seek
+    uint64_t cookie;
+
+    struct stat stat_result;
+
+    // 0 if stat_result is valid
+    int stat_errno;
+} DirScanEntry;
+
+
+/** entries read from a directory at once */
+typedef struct DirScanPage {
+    DirScanEntry * entries;
+    size_t n_entries;
+    size_t capacity;
+
+    // the names of the entries one after the other
+    char * names;
+    size_t names_len;
+    size_t names_capacity;
+
+    // no entries are left in the directory
+    bool end_of_directory;
+} DirScanPage;
+
+
+/**
+ * a small pool of threads sharing the stats of the entries of large
+ * directories with the thread listing them
+ */
+typedef struct StatPool {
+    pthread_t * threads;
+    size_t n_threads;
+
+    // queued batches, oldest first
+    struct StatBatch * batches;
+    bool stop;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+} StatPool;
+
+
+/**
+ * open the directory at "path"
+ *
+ * returns false on error. errno is set
+ */
+bool DirScan_open(DirScan * scan, const char * path);
+
+/**
+ */
+void DirScan_close(DirScan * scan);
+
+/**
+ * continue reading after the entry "cookie" was returned for. cookies
+ * stay valid when the directory is opened again, as the positions of
+ * telldir do on linux
+ *
+ * returns false on error. errno is set
+ */
+bool DirScan_seek(DirScan * scan, uint64_t cookie);
+
+/**
+ * read the next entry. "name" stays valid until the next call
+ *
+ * returns 1 if an entry was read, 0 at the end of the directory and
+ * -1 on error. errno is set
+ */
+int DirScan_next(DirScan * scan, const char ** name, uint64_t * cookie);
+
+/**
+ * read entries until "max_entries" have been read or the names and
+ * DIRSCAN_ENTRY_OVERHEAD per entry add up to "max_bytes". the entries
+ * are not stated
+ *
+ * returns false on error. errno is set
+ */
+bool DirScan_read_page(DirScan * scan, DirScanPage * page, size_t max_entries,
+        size_t max_bytes);
+
+void DirScanPage_init(DirScanPage * page);
+void DirScanPage_deinit(DirScanPage * page);
+
+/**
+ * stat "name" relative to the directory "dirfd" without following
+ * symlinks. statx is told not to synchronize with the server of
+ * network filesystems where available
+ *
+ * returns 0 or an errno
+ */
+int DirScan_stat(int dirfd, const char * name, struct stat * stat_result);
+
+#ifdef __linux__
+/**
+ * fill "stat_result" with the attributes returned by statx
+ */
+void DirScan_statx_to_stat(const struct statx * stx, struct stat * stat_result);
+#endif
+
+/**
+ * start the threads of the pool
+ *
+ * returns false on error
+ */
+bool StatPool_init(StatPool * pool, size_t n_threads);
+
+/**
+ */
+void StatPool_deinit(StatPool * pool);
+
+/**
+ * stat the entries relative to the directory "dirfd". the threads of
+ * the pool help with pages of more than STATPOOL_PARALLEL_MIN_ENTRIES
+ * entries. "pool" may be NULL
+ */
+void StatPool_stat(StatPool * pool, int dirfd, DirScanEntry * entries, size_t n_entries);
+
+#endif /* __server_dirscan_h__ */
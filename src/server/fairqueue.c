@@ -0,0 +1,614 @@
+#include "fairqueue.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../dbg.h"
+#include "../hashfunc.h"
+
+
+bool
+FairQueue_init(FairQueue * fq)
+{
+    memset(fq, 0, sizeof(FairQueue));
+    fq->default_limits.weight = 1;
+    fq->max_client_jobs = FAIRQUEUE_MAX_CLIENT_JOBS;
+
+    fq->clients = hash_create(HASHCOUNT_T_MAX,
+            (hash_comp_t)strcmp,
+            (hash_fun_t)Hashfunc_djb2);
+    check_mem(fq->clients);
+
+    fq->limits = hash_create(HASHCOUNT_T_MAX,
+            (hash_comp_t)strcmp,
+            (hash_fun_t)Hashfunc_djb2);
+    check_mem(fq->limits);
+
+    return true;
+
+error:
+    FairQueue_deinit(fq);
+    return false;
+}
+
+
+static void
+FairQueueClient_destroy(FairQueueClient * client)
+{
+    while (client->connections != NULL) {
+        FairQueueConnection * next = client->connections->next;
+        free(client->connections);
+        client->connections = next;
+    }
+    for (int l=0; l<SCHEDULER_N_LANES; l++) {
+        SchedulerJob * job = client->head[l];
+        while (job != NULL) {
+            SchedulerJob * next = job->next;
+            SchedulerJob_destroy(job);
+            job = next;
+        }
+    }
+    free(client);
+}
+
+
+void
+FairQueue_deinit(FairQueue * fq)
+{
+    hscan_t hash_scan;
+    hnode_t * hash_node = NULL;
+
+    if (fq->clients != NULL) {
+        hash_scan_begin(&hash_scan, fq->clients);
+        while ((hash_node = hash_scan_next(&hash_scan))) {
+            FairQueueClient * client = hnode_get(hash_node);
+            hash_scan_delfree(fq->clients, hash_node);
+            FairQueueClient_destroy(client);
+        }
+        hash_destroy(fq->clients);
+        fq->clients = NULL;
+    }
+
+    if (fq->limits != NULL) {
+        hash_scan_begin(&hash_scan, fq->limits);
+        while ((hash_node = hash_scan_next(&hash_scan))) {
+            char * key = (char *)hnode_getkey(hash_node);
+            free(hnode_get(hash_node));
+            hash_scan_delfree(fq->limits, hash_node);
+            free(key);
+        }
+        hash_destroy(fq->limits);
+        fq->limits = NULL;
+    }
+
+    for (int l=0; l<SCHEDULER_N_LANES; l++) {
+        fq->current[l] = NULL;
+        fq->n_ring[l] = 0;
+    }
+    fq->n_queued = 0;
+    fq->n_held = 0;
+}
+
+
+bool
+FairQueue_set_limits(FairQueue * fq, const char * key, const FairQueueLimits * limits)
+{
+    FairQueueLimits * client_limits = NULL;
+    char * client_key = NULL;
+
+    check((limits->weight > 0), "The weight of a client has to be at least 1");
+
+    if (key == NULL) {
+        fq->default_limits = (*limits);
+        return true;
+    }
+    check((strlen(key) <= FAIRQUEUE_MAX_KEY), "Client key %s is too long", key);
+
+    hnode_t * hash_node = hash_lookup(fq->limits, key);
+    if (hash_node != NULL) {
+        client_limits = hnode_get(hash_node);
+        (*client_limits) = (*limits);
+        return true;
+    }
+
+    client_limits = calloc(sizeof(FairQueueLimits), 1);
+    check_mem(client_limits);
+    (*client_limits) = (*limits);
+
+    client_key = strdup(key);
+    check_mem(client_key);
+
+    check((hash_alloc_insert(fq->limits, client_key, client_limits) == 1),
+            "Could not store the limits of client %s", key);
+    return true;
+
+error:
+    free(client_limits);
+    free(client_key);
+    return false;
+}
+
+
+bool
+FairQueue_read_limits(FairQueue * fq, const char * filename)
+{
+    FILE * file = NULL;
+    char line[256];
+    int line_no = 0;
+
+    file = fopen(filename, "r");
+    check((file != NULL), "Could not open client limits file %s: %s",
+            filename, strerror(errno));
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char key[FAIRQUEUE_MAX_KEY + 1];
+        FairQueueLimits limits;
+        char * pos = line;
+
+        line_no++;
+        while (isspace((unsigned char)*pos)) {
+            pos++;
+        }
+        if ((*pos == '\0') || (*pos == '#')) {
+            continue;
+        }
+
+        memset(&limits, 0, sizeof(limits));
+        check((sscanf(pos, "%64s %u %" SCNu64 " %" SCNu64, key, &(limits.weight),
+                    &(limits.max_requests), &(limits.max_bytes)) == 4),
+                "Invalid client limits in %s line %d", filename, line_no);
+        check(FairQueue_set_limits(fq, (strcmp(key, "*") == 0) ? NULL : key, &limits),
+                "Invalid client limits in %s line %d", filename, line_no);
+    }
+    check((ferror(file) == 0), "Could not read client limits file %s", filename);
+
+    fclose(file);
+    return true;
+
+error:
+    if (file != NULL) {
+        fclose(file);
+    }
+    return false;
+}
+
+
+/**
+ * append the routing id of the connection a job came from as hex
+ * digits to "key", which holds up to "max_len" characters
+ */
+static void
+FairQueue_append_routing_id(SchedulerJob * job, char * key, size_t max_len)
+{
+    if (job->n_envelope > 0) {
+        const unsigned char * id = zmq_msg_data(&(job->envelope[0]));
+        size_t id_len = zmq_msg_size(&(job->envelope[0]));
+        size_t pos = strlen(key);
+
+        for (size_t i=0; (i<id_len) && (pos + 2 <= max_len); i++) {
+            sprintf(key + pos, "%02x", id[i]);
+            pos += 2;
+        }
+    }
+}
+
+
+/**
+ * clients are told apart by the CURVE public key the ZAP handler
+ * accepted, so all mounts of a user share their limits. without
+ * encryption the routing id of the connection is used
+ */
+static void
+FairQueue_client_key(SchedulerJob * job, char key[FAIRQUEUE_MAX_KEY + 1])
+{
+    const char * user_id = zmq_msg_gets(&(job->request), "User-Id");
+
+    if ((user_id != NULL) && (user_id[0] != '\0')) {
+        snprintf(key, FAIRQUEUE_MAX_KEY + 1, "%s", user_id);
+        return;
+    }
+
+    strcpy(key, "id:");
+    FairQueue_append_routing_id(job, key, FAIRQUEUE_MAX_KEY);
+}
+
+
+/**
+ * get the connection of the client a job came from. clients keep
+ * their routing id when they reconnect
+ *
+ * returns NULL on error
+ */
+static FairQueueConnection *
+FairQueue_get_connection(FairQueueClient * client, SchedulerJob * job)
+{
+    char owner[HANDLETABLE_MAX_OWNER + 1];
+    FairQueueConnection * connection = NULL;
+
+    snprintf(owner, sizeof(owner), "%s", client->key);
+    if (strncmp(owner, "id:", 3) != 0) {
+        strcat(owner, "/");
+        FairQueue_append_routing_id(job, owner, HANDLETABLE_MAX_OWNER);
+    }
+
+    for (connection = client->connections; connection != NULL; connection = connection->next) {
+        if (strcmp(connection->owner, owner) == 0) {
+            return connection;
+        }
+    }
+
+    connection = calloc(sizeof(FairQueueConnection), 1);
+    check_mem(connection);
+    strcpy(connection->owner, owner);
+    connection->next = client->connections;
+    client->connections = connection;
+    return connection;
+
+error:
+    return NULL;
+}
+
+
+static FairQueueClient *
+FairQueue_get_client(FairQueue * fq, const char * key, uint64_t now_ns)
+{
+    FairQueueClient * client = NULL;
+
+    hnode_t * hash_node = hash_lookup(fq->clients, key);
+    if (hash_node != NULL) {
+        return hnode_get(hash_node);
+    }
+
+    client = calloc(sizeof(FairQueueClient), 1);
+    check_mem(client);
+    strcpy(client->key, key);
+
+    hash_node = hash_lookup(fq->limits, key);
+    client->limits = (hash_node != NULL) ? *(FairQueueLimits *)hnode_get(hash_node)
+        : fq->default_limits;
+
+    // start with full buckets
+    client->request_tokens = (double)client->limits.max_requests;
+    client->byte_tokens = (double)client->limits.max_bytes;
+    client->refilled_ns = now_ns;
+
+    check((hash_alloc_insert(fq->clients, client->key, client) == 1),
+            "Could not add client %s", key);
+    __atomic_store_n(&(fq->n_clients), hash_count(fq->clients), __ATOMIC_RELAXED);
+    return client;
+
+error:
+    free(client);
+    return NULL;
+}
+
+
+/**
+ * add the client to the ring of a lane, behind the client whose
+ * turn it is
+ */
+static void
+FairQueue_ring_insert(FairQueue * fq, FairQueueClient * client, SchedulerLaneType lane)
+{
+    FairQueueClient * current = fq->current[lane];
+
+    client->deficit[lane] = client->limits.weight;
+    fq->n_ring[lane]++;
+    if (current == NULL) {
+        client->ring_next[lane] = client;
+        client->ring_prev[lane] = client;
+        fq->current[lane] = client;
+        return;
+    }
+
+    client->ring_next[lane] = current;
+    client->ring_prev[lane] = current->ring_prev[lane];
+    current->ring_prev[lane]->ring_next[lane] = client;
+    current->ring_prev[lane] = client;
+}
+
+
+/**
+ * give the turn to the next client of the ring. the deficit of a
+ * client skipped because it is throttled does not grow beyond a
+ * single round
+ */
+static void
+FairQueue_pass_turn(FairQueue * fq, SchedulerLaneType lane)
+{
+    FairQueueClient * client = fq->current[lane]->ring_next[lane];
+
+    fq->current[lane] = client;
+    client->deficit[lane] += client->limits.weight;
+    if (client->deficit[lane] > (int64_t)client->limits.weight) {
+        client->deficit[lane] = client->limits.weight;
+    }
+}
+
+
+static void
+FairQueue_ring_remove(FairQueue * fq, FairQueueClient * client, SchedulerLaneType lane)
+{
+    if (client->ring_next[lane] == client) {
+        fq->current[lane] = NULL;
+    }
+    else {
+        if (fq->current[lane] == client) {
+            FairQueue_pass_turn(fq, lane);
+        }
+        client->ring_prev[lane]->ring_next[lane] = client->ring_next[lane];
+        client->ring_next[lane]->ring_prev[lane] = client->ring_prev[lane];
+    }
+    client->ring_next[lane] = NULL;
+    client->ring_prev[lane] = NULL;
+    client->deficit[lane] = 0;
+    fq->n_ring[lane]--;
+}
+
+
+bool
+FairQueue_add(FairQueue * fq, SchedulerJob * job)
+{
+    char key[FAIRQUEUE_MAX_KEY + 1];
+    SchedulerLaneType lane = job->lane;
+
+    FairQueue_client_key(job, key);
+    FairQueueClient * client = FairQueue_get_client(fq, key, job->queued_ns);
+    check((client != NULL), "Could not queue request of client %s", key);
+
+    if (client->n_queued >= fq->max_client_jobs) {
+        if (client->n_rejected == 0) {
+            log_warn("Client %s has %d requests queued, rejecting further ones",
+                    key, (int)fq->max_client_jobs);
+        }
+        client->n_rejected++;
+        __atomic_add_fetch(&(fq->n_rejected), 1, __ATOMIC_RELAXED);
+        errno = EAGAIN;
+        return false;
+    }
+
+    FairQueueConnection * connection = FairQueue_get_connection(client, job);
+    check((connection != NULL), "Could not queue request of client %s", key);
+    connection->n_jobs++;
+    connection->active_ns = job->queued_ns;
+
+    job->client = client;
+    job->connection = connection;
+    job->next = NULL;
+    if (client->tail[lane] != NULL) {
+        client->tail[lane]->next = job;
+    }
+    else {
+        client->head[lane] = job;
+        FairQueue_ring_insert(fq, client, lane);
+    }
+    client->tail[lane] = job;
+
+    client->n_queued++;
+    client->active_ns = job->queued_ns;
+    fq->n_queued++;
+    if (client->throttled) {
+        fq->n_held++;
+    }
+    return true;
+
+error:
+    errno = ENOMEM;
+    return false;
+}
+
+
+bool
+FairQueue_full(const FairQueue * fq)
+{
+    return (fq->n_queued - fq->n_held) >= FAIRQUEUE_MAX_JOBS;
+}
+
+
+/**
+ * refill the buckets of a client and check whether it may send its
+ * next request
+ *
+ * returns 0 if it may, otherwise the time until it may
+ */
+static uint64_t
+FairQueueClient_throttled(FairQueueClient * client, uint64_t now_ns)
+{
+    double elapsed = (double)(now_ns - client->refilled_ns) / 1e9;
+    uint64_t wait_ns = 0;
+
+    client->refilled_ns = now_ns;
+
+    // a second worth of requests may be sent in a burst
+    if (client->limits.max_requests > 0) {
+        double rate = (double)client->limits.max_requests;
+        client->request_tokens += elapsed * rate;
+        if (client->request_tokens > rate) {
+            client->request_tokens = rate;
+        }
+        if (client->request_tokens < 1.0) {
+            wait_ns = (uint64_t)(((1.0 - client->request_tokens) / rate) * 1e9) + 1;
+        }
+    }
+
+    if (client->limits.max_bytes > 0) {
+        double rate = (double)client->limits.max_bytes;
+        client->byte_tokens += elapsed * rate;
+        if (client->byte_tokens > rate) {
+            client->byte_tokens = rate;
+        }
+        if (client->byte_tokens < 0.0) {
+            uint64_t byte_wait_ns = (uint64_t)((-client->byte_tokens / rate) * 1e9) + 1;
+            if (byte_wait_ns > wait_ns) {
+                wait_ns = byte_wait_ns;
+            }
+        }
+    }
+    return wait_ns;
+}
+
+
+/**
+ * the jobs of throttled clients do not count towards FAIRQUEUE_MAX_JOBS,
+ * so they can not stop the front end from receiving
+ */
+static void
+FairQueue_set_throttled(FairQueue * fq, FairQueueClient * client, bool throttled)
+{
+    if (client->throttled == throttled) {
+        return;
+    }
+
+    client->throttled = throttled;
+    if (throttled) {
+        client->n_throttled++;
+        __atomic_add_fetch(&(fq->n_throttled), 1, __ATOMIC_RELAXED);
+        fq->n_held += client->n_queued;
+    }
+    else {
+        fq->n_held -= client->n_queued;
+    }
+}
+
+
+static SchedulerJob *
+FairQueue_take(FairQueue * fq, FairQueueClient * client, SchedulerLaneType lane)
+{
+    SchedulerJob * job = client->head[lane];
+    size_t size = zmq_msg_size(&(job->request)) + zmq_msg_size(&(job->request_data));
+
+    client->head[lane] = job->next;
+    if (client->head[lane] == NULL) {
+        client->tail[lane] = NULL;
+    }
+    job->next = NULL;
+
+    client->n_queued--;
+    client->n_running++;
+    fq->n_queued--;
+
+    client->request_tokens -= 1.0;
+    client->byte_tokens -= (double)size;
+    client->n_requests++;
+    client->n_bytes += size;
+    client->deficit[lane]--;
+
+    if (client->head[lane] == NULL) {
+        FairQueue_ring_remove(fq, client, lane);
+    }
+    return job;
+}
+
+
+SchedulerJob *
+FairQueue_next(FairQueue * fq, SchedulerLaneType lane, uint64_t now_ns, uint64_t * retry_ns)
+{
+    // a client without deficit gets it back with its next turn, so
+    // every client is visited up to two times
+    size_t n_turns = (fq->n_ring[lane] * 2) + 1;
+
+    for (size_t i=0; (i<n_turns) && (fq->current[lane] != NULL); i++) {
+        FairQueueClient * client = fq->current[lane];
+
+        if (client->deficit[lane] > 0) {
+            uint64_t wait_ns = FairQueueClient_throttled(client, now_ns);
+            if (wait_ns == 0) {
+                FairQueue_set_throttled(fq, client, false);
+                return FairQueue_take(fq, client, lane);
+            }
+
+            FairQueue_set_throttled(fq, client, true);
+            if ((*retry_ns == 0) || (wait_ns < *retry_ns)) {
+                (*retry_ns) = wait_ns;
+            }
+        }
+        FairQueue_pass_turn(fq, lane);
+    }
+    return NULL;
+}
+
+
+void
+FairQueue_done(FairQueue * fq, SchedulerJob * job, size_t reply_size)
+{
+    FairQueueClient * client = job->client;
+    (void)fq;
+
+    if (client != NULL) {
+        client->n_running--;
+        client->byte_tokens -= (double)reply_size;
+        client->n_bytes += reply_size;
+        job->client = NULL;
+    }
+    if (job->connection != NULL) {
+        job->connection->n_jobs--;
+        job->connection = NULL;
+    }
+}
+
+
+/**
+ * forget the idle connections of a client and release the handles
+ * they left open
+ */
+static void
+FairQueue_expire_connections(FairQueue * fq, FairQueueClient * client, uint64_t now_ns)
+{
+    uint64_t lease_ns = (uint64_t)((fq->handles != NULL) ? fq->handles->lease_sec
+            : FAIRQUEUE_EXPIRE_SEC) * 1000000000ULL;
+    FairQueueConnection ** link = &(client->connections);
+
+    while (*link != NULL) {
+        FairQueueConnection * connection = *link;
+
+        if ((connection->n_jobs == 0) && (now_ns - connection->active_ns >= lease_ns)) {
+            HandleTable_release_owner(fq->handles, connection->owner);
+            *link = connection->next;
+            free(connection);
+        }
+        else {
+            link = &(connection->next);
+        }
+    }
+}
+
+
+long
+FairQueue_expire(FairQueue * fq, uint64_t now_ns)
+{
+    hscan_t hash_scan;
+    hnode_t * hash_node = NULL;
+    uint64_t expire_ns = (uint64_t)FAIRQUEUE_EXPIRE_SEC * 1000000000ULL;
+    uint64_t interval_ns = (uint64_t)FAIRQUEUE_EXPIRE_INTERVAL_MSEC * 1000000ULL;
+
+    if (hash_count(fq->clients) == 0) {
+        return -1;
+    }
+    if (now_ns - fq->expired_ns < interval_ns) {
+        return (long)((interval_ns - (now_ns - fq->expired_ns) + 999999) / 1000000);
+    }
+    fq->expired_ns = now_ns;
+
+    hash_scan_begin(&hash_scan, fq->clients);
+    while ((hash_node = hash_scan_next(&hash_scan))) {
+        FairQueueClient * client = hnode_get(hash_node);
+
+        FairQueue_expire_connections(fq, client, now_ns);
+
+        // clients still in debt are kept, so they can not reset
+        // their buckets by pausing
+        if ((client->connections == NULL) && (client->n_queued == 0)
+                && (client->n_running == 0)
+                && (now_ns - client->active_ns >= expire_ns)
+                && (FairQueueClient_throttled(client, now_ns) == 0)) {
+            hash_scan_delfree(fq->clients, hash_node);
+            FairQueueClient_destroy(client);
+        }
+    }
+    __atomic_store_n(&(fq->n_clients), hash_count(fq->clients), __ATOMIC_RELAXED);
+
+    return (hash_count(fq->clients) > 0) ? FAIRQUEUE_EXPIRE_INTERVAL_MSEC : -1;
+}
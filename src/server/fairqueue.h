@@ -0,0 +1,208 @@
+#ifndef __server_fairqueue_h__
+#define __server_fairqueue_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../kazlib/hash.h"
+#include "handletable.h"
+#include "scheduler.h"
+
+/* number of requests held by the front end before it stops receiving.
+ * the socket keeps the requests of every client in a queue of its own
+ * and receives from them in turn. requests of clients held back by
+ * their rate limits are not counted */
+#define FAIRQUEUE_MAX_JOBS 4096
+
+/* default number of requests queued for a single client. further
+ * requests of the client are answered with EAGAIN */
+#define FAIRQUEUE_MAX_CLIENT_JOBS 256
+
+/* maximum length of a client key. keys are the CURVE public key of the
+ * client, or its routing id */
+#define FAIRQUEUE_MAX_KEY 64
+
+/* time (in seconds) after which idle clients are forgotten */
+#define FAIRQUEUE_EXPIRE_SEC 10
+
+/* interval (in milliseconds) in which idle clients and connections
+ * are looked for */
+#define FAIRQUEUE_EXPIRE_INTERVAL_MSEC 1000
+
+
+/**
+ * the share of a client. the rates are per second, 0 is unlimited
+ */
+typedef struct FairQueueLimits {
+    unsigned int weight;
+    uint64_t max_requests;
+    uint64_t max_bytes;
+} FairQueueLimits;
+
+
+/**
+ * a connection of a client. the handles of the files opened through
+ * it belong to the connection, so other mounts using the same key
+ * can neither use them nor keep them open
+ */
+typedef struct FairQueueConnection {
+    // the key of the client followed by the routing id of the
+    // connection
+    char owner[HANDLETABLE_MAX_OWNER + 1];
+
+    // requests queued or running
+    size_t n_jobs;
+    uint64_t active_ns;
+
+    struct FairQueueConnection * next;
+} FairQueueConnection;
+
+
+typedef struct FairQueueClient {
+    char key[FAIRQUEUE_MAX_KEY + 1];
+    FairQueueConnection * connections;
+    FairQueueLimits limits;
+
+    // requests not handed to the workers yet, per lane. linked
+    // through the "next" pointer of the jobs
+    SchedulerJob * head[SCHEDULER_N_LANES];
+    SchedulerJob * tail[SCHEDULER_N_LANES];
+    size_t n_queued;
+
+    // requests handed to the workers and not replied to yet
+    size_t n_running;
+
+    // requests the client may still take in the current round
+    int64_t deficit[SCHEDULER_N_LANES];
+
+    // ring of the clients with requests in a lane
+    struct FairQueueClient * ring_next[SCHEDULER_N_LANES];
+    struct FairQueueClient * ring_prev[SCHEDULER_N_LANES];
+
+    // token buckets of the rate limits. the byte bucket goes negative
+    // when replies are larger than the bucket
+    double request_tokens;
+    double byte_tokens;
+    uint64_t refilled_ns;
+    uint64_t active_ns;
+    bool throttled;
+
+    uint64_t n_requests;
+    uint64_t n_bytes;
+    uint64_t n_throttled;
+    uint64_t n_rejected;
+} FairQueueClient;
+
+
+/**
+ * the requests received by the scheduler, queued per client
+ *
+ * the clients take turns in handing requests to the workers, each
+ * getting "weight" requests per round (deficit round robin). clients
+ * over their rate limits are skipped until their buckets have been
+ * refilled. only used by the thread running the front end of the
+ * scheduler
+ */
+typedef struct FairQueue {
+    // key -> FairQueueClient
+    hash_t * clients;
+
+    // key -> FairQueueLimits configured for single clients
+    hash_t * limits;
+    FairQueueLimits default_limits;
+
+    // the client whose turn it is and the number of clients in the
+    // ring, per lane
+    FairQueueClient * current[SCHEDULER_N_LANES];
+    size_t n_ring[SCHEDULER_N_LANES];
+
+    size_t n_queued;
+    uint64_t expired_ns;
+
+    // requests queued for a single client before further ones
+    // are rejected
+    size_t max_client_jobs;
+
+    // jobs queued for throttled clients
+    size_t n_held;
+
+    // the handles of connections idle for its lease are released.
+    // may be NULL
+    HandleTable * handles;
+
+    // read by other threads
+    size_t n_clients;
+    uint64_t n_throttled;
+    uint64_t n_rejected;
+} FairQueue;
+
+
+/**
+ * returns false on error
+ */
+bool FairQueue_init(FairQueue * fq);
+
+/**
+ * destroy all clients and the requests queued for them
+ */
+void FairQueue_deinit(FairQueue * fq);
+
+/**
+ * set the limits of the client with "key", or the limits of all clients
+ * without limits of their own if "key" is NULL. applies to clients
+ * seen after the call
+ *
+ * returns false on error
+ */
+bool FairQueue_set_limits(FairQueue * fq, const char * key, const FairQueueLimits * limits);
+
+/**
+ * read the limits of clients from a file. each line holds the key of a
+ * client, or "*" for all other clients, followed by the weight, the
+ * requests and the bytes per second. lines starting with "#" are ignored
+ *
+ * returns false on error
+ */
+bool FairQueue_read_limits(FairQueue * fq, const char * filename);
+
+/**
+ * queue a received job for its client. the lane of the job has to be set
+ *
+ * returns false on error. errno is EAGAIN if max_client_jobs requests
+ * are queued for the client already
+ */
+bool FairQueue_add(FairQueue * fq, SchedulerJob * job);
+
+/**
+ * returns true if FAIRQUEUE_MAX_JOBS of clients not throttled are queued
+ */
+bool FairQueue_full(const FairQueue * fq);
+
+/**
+ * take the next job of "lane", honouring the weights and the limits of
+ * the clients. "retry_ns" is lowered to the time until a throttled client
+ * may continue
+ *
+ * returns NULL if there is none or all clients with jobs are throttled
+ */
+SchedulerJob * FairQueue_next(FairQueue * fq, SchedulerLaneType lane, uint64_t now_ns,
+        uint64_t * retry_ns);
+
+/**
+ * account a job taken by FairQueue_next as finished. "reply_size" is
+ * charged to the byte rate of its client
+ */
+void FairQueue_done(FairQueue * fq, SchedulerJob * job, size_t reply_size);
+
+/**
+ * forget the connections idle for the lease of the handletable,
+ * releasing their handles, and the clients without connections idle
+ * for FAIRQUEUE_EXPIRE_SEC
+ *
+ * returns the time (in milliseconds) until it should be called again,
+ * or -1 if there are no clients
+ */
+long FairQueue_expire(FairQueue * fq, uint64_t now_ns);
+
+#endif /* __server_fairqueue_h__ */
@@ -0,0 +1,495 @@
+#include "fdcache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "../dbg.h"
+#include "../hashfunc.h"
+
+#define FDCACHE_WATCH_MASK (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+
+// prototypes
+static void FdCacheEntry_destroy(FdCacheEntry * entry);
+static void FdCache_remove(FdCache * cache, FdCacheEntry * entry);
+static void FdCache_remove_below(FdCache * cache, const char * path);
+static void FdCache_lru_unlink(FdCache * cache, FdCacheEntry * entry);
+static void FdCache_lru_push(FdCache * cache, FdCacheEntry * entry);
+static void FdCache_watch(FdCache * cache, FdCacheEntry * entry);
+static void FdCache_unwatch(FdCache * cache, FdCacheEntry * entry);
+static void FdCache_read_events(FdCache * cache);
+
+
+bool
+FdCache_init(FdCache * cache, size_t max_size)
+{
+    memset(cache, 0, sizeof(FdCache));
+    cache->max_size = max_size;
+    cache->inotify_fd = -1;
+
+    // the entries know their keys and get freed by the cache itself,
+    // so the default allocator of the hash is used
+    cache->entries = hash_create(HASHCOUNT_T_MAX,
+            (hash_comp_t)strcmp,
+            (hash_fun_t)Hashfunc_djb2);
+    check_mem(cache->entries);
+
+#ifdef __linux__
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->inotify_fd == -1) {
+        log_warn("Could not initialize inotify. Cached files will only be revalidated");
+    }
+#endif
+
+    check(pthread_mutex_init(&(cache->mutex), NULL) == 0,
+            "Could not initialize fdcache mutex");
+
+    return true;
+
+error:
+    if (cache->inotify_fd != -1) {
+        close(cache->inotify_fd);
+        cache->inotify_fd = -1;
+    }
+    if (cache->entries != NULL) {
+        hash_destroy(cache->entries);
+        cache->entries = NULL;
+    }
+    return false;
+}
+
+
+void
+FdCache_deinit(FdCache * cache)
+{
+    if (cache == NULL || cache->entries == NULL) {
+        return;
+    }
+
+    while (cache->lru_head != NULL) {
+        FdCache_remove(cache, cache->lru_head);
+    }
+    hash_destroy(cache->entries);
+    cache->entries = NULL;
+
+    for (size_t i=0; i<cache->n_watches; i++) {
+        free(cache->watches[i].dirpath);
+    }
+    free(cache->watches);
+    cache->watches = NULL;
+    cache->n_watches = 0;
+
+    if (cache->inotify_fd != -1) {
+        close(cache->inotify_fd);
+        cache->inotify_fd = -1;
+    }
+
+    if (pthread_mutex_destroy(&(cache->mutex)) != 0) {
+        log_err("Could not destroy fdcache mutex");
+    }
+}
+
+
+FdCacheEntry *
+FdCache_get(FdCache * cache, const char * path, int flags, mode_t mode)
+{
+    FdCacheEntry * entry = NULL;
+    char * key = NULL;
+    struct stat sb;
+    int saved_errno = 0;
+
+    size_t key_len = strlen(path) + 16;
+    key = malloc(key_len);
+    check_mem(key);
+    snprintf(key, key_len, "%x:%s", (unsigned int)flags, path);
+
+    pthread_mutex_lock(&(cache->mutex));
+    FdCache_read_events(cache);
+
+    hnode_t * hash_node = hash_lookup(cache->entries, key);
+    if (hash_node != NULL) {
+        entry = hnode_get(hash_node);
+        entry->refcount++;
+        FdCache_lru_unlink(cache, entry);
+        FdCache_lru_push(cache, entry);
+
+        time_t now = time(NULL);
+        bool revalidate = (now - entry->validated_ts >= FDCACHE_REVALIDATE_SEC);
+        pthread_mutex_unlock(&(cache->mutex));
+
+        if (!revalidate) {
+            free(key);
+            return entry;
+        }
+
+        // the path may lead to a different file by now
+        bool valid = (stat(path, &sb) == 0) && (sb.st_dev == entry->dev)
+                && (sb.st_ino == entry->ino);
+
+        pthread_mutex_lock(&(cache->mutex));
+        if (valid) {
+            entry->validated_ts = now;
+            pthread_mutex_unlock(&(cache->mutex));
+            free(key);
+            return entry;
+        }
+        debug("cached fd of %s is outdated", path);
+        if (!entry->invalidated) {
+            FdCache_remove(cache, entry);
+        }
+        pthread_mutex_unlock(&(cache->mutex));
+        FdCache_put(cache, entry);
+        entry = NULL;
+    }
+    else {
+        pthread_mutex_unlock(&(cache->mutex));
+    }
+
+    entry = calloc(sizeof(FdCacheEntry), 1);
+    check_mem(entry);
+    entry->fd = -1;
+    entry->wd = -1;
+    entry->flags = flags;
+    entry->refcount = 1;
+    entry->key = key;
+    key = NULL;
+
+    entry->fd = open(path, flags, mode);
+    if (entry->fd == -1) {
+        saved_errno = errno;
+        goto error;
+    }
+
+    if ((cache->max_size == 0) || (fstat(entry->fd, &sb) != 0) || !S_ISREG(sb.st_mode)) {
+        // passed to this request only
+        return entry;
+    }
+
+    entry->path = strdup(path);
+    check_mem(entry->path);
+    entry->dev = sb.st_dev;
+    entry->ino = sb.st_ino;
+    entry->validated_ts = time(NULL);
+    entry->cached = true;
+
+    pthread_mutex_lock(&(cache->mutex));
+
+    // another worker may have opened the same file in the meantime
+    hash_node = hash_lookup(cache->entries, entry->key);
+    if (hash_node != NULL) {
+        FdCache_remove(cache, hnode_get(hash_node));
+    }
+
+    if (hash_alloc_insert(cache->entries, entry->key, entry) != 1) {
+        entry->cached = false;
+        pthread_mutex_unlock(&(cache->mutex));
+        log_warn("Could not add the fd of %s to the fdcache", path);
+        return entry;
+    }
+    FdCache_lru_push(cache, entry);
+    FdCache_watch(cache, entry);
+
+    // close the least recently used files which are not in use. files
+    // in use are closed by their last user
+    while (hash_count(cache->entries) > cache->max_size) {
+        FdCache_remove(cache, cache->lru_tail);
+    }
+    pthread_mutex_unlock(&(cache->mutex));
+
+    return entry;
+
+error:
+    free(key);
+    FdCacheEntry_destroy(entry);
+    errno = (saved_errno != 0) ? saved_errno : ENOMEM;
+    return NULL;
+}
+
+
+void
+FdCache_put(FdCache * cache, FdCacheEntry * entry)
+{
+    if (entry == NULL) {
+        return;
+    }
+
+    if (!entry->cached) {
+        FdCacheEntry_destroy(entry);
+        return;
+    }
+
+    pthread_mutex_lock(&(cache->mutex));
+    entry->refcount--;
+    bool destroy = (entry->invalidated && entry->refcount == 0);
+    pthread_mutex_unlock(&(cache->mutex));
+
+    if (destroy) {
+        FdCacheEntry_destroy(entry);
+    }
+}
+
+
+void
+FdCache_invalidate(FdCache * cache, const char * path)
+{
+    pthread_mutex_lock(&(cache->mutex));
+    FdCache_remove_below(cache, path);
+    pthread_mutex_unlock(&(cache->mutex));
+}
+
+
+static void
+FdCacheEntry_destroy(FdCacheEntry * entry)
+{
+    if (entry) {
+        if (entry->fd != -1) {
+            close(entry->fd);
+        }
+        free(entry->key);
+        free(entry->path);
+        free(entry);
+    }
+}
+
+
+/**
+ * remove an entry from the cache. the entry gets destroyed if it is
+ * not in use. has to be called with the mutex locked
+ */
+static void
+FdCache_remove(FdCache * cache, FdCacheEntry * entry)
+{
+    hnode_t * hash_node = hash_lookup(cache->entries, entry->key);
+    if ((hash_node != NULL) && (hnode_get(hash_node) == entry)) {
+        hash_delete_free(cache->entries, hash_node);
+    }
+    FdCache_lru_unlink(cache, entry);
+    FdCache_unwatch(cache, entry);
+
+    if (entry->refcount == 0) {
+        FdCacheEntry_destroy(entry);
+    }
+    else {
+        entry->invalidated = true;
+    }
+}
+
+
+/**
+ * remove the entries of "path" and below. has to be called with the
+ * mutex locked
+ */
+static void
+FdCache_remove_below(FdCache * cache, const char * path)
+{
+    size_t path_len = strlen(path);
+    FdCacheEntry * entry = cache->lru_head;
+
+    while (entry != NULL) {
+        FdCacheEntry * next = entry->lru_next;
+        if ((strncmp(entry->path, path, path_len) == 0)
+                    && ((entry->path[path_len] == '\0') || (entry->path[path_len] == '/'))) {
+            debug("removing the cached fd of %s", entry->path);
+            FdCache_remove(cache, entry);
+        }
+        entry = next;
+    }
+}
+
+
+static void
+FdCache_lru_unlink(FdCache * cache, FdCacheEntry * entry)
+{
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else if (cache->lru_head == entry) {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else if (cache->lru_tail == entry) {
+        cache->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+
+static void
+FdCache_lru_push(FdCache * cache, FdCacheEntry * entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL) {
+        cache->lru_head->lru_prev = entry;
+    }
+    cache->lru_head = entry;
+    if (cache->lru_tail == NULL) {
+        cache->lru_tail = entry;
+    }
+}
+
+
+/**
+ * watch the directory of an entry for its name being removed or
+ * replaced. has to be called with the mutex locked
+ */
+static void
+FdCache_watch(FdCache * cache, FdCacheEntry * entry)
+{
+#ifdef __linux__
+    char * dirpath = NULL;
+
+    if (cache->inotify_fd == -1) {
+        return;
+    }
+
+    const char * slash = strrchr(entry->path, '/');
+    if (slash == NULL) {
+        return;
+    }
+    dirpath = (slash == entry->path) ? strdup("/")
+        : strndup(entry->path, (size_t)(slash - entry->path));
+    check_mem(dirpath);
+
+    // watching a directory twice returns the same watch descriptor
+    int wd = inotify_add_watch(cache->inotify_fd, dirpath, FDCACHE_WATCH_MASK);
+    if (wd == -1) {
+        debug("Could not watch %s", dirpath);
+        free(dirpath);
+        return;
+    }
+
+    for (size_t i=0; i<cache->n_watches; i++) {
+        if (cache->watches[i].wd == wd) {
+            cache->watches[i].n_entries++;
+            entry->wd = wd;
+            free(dirpath);
+            return;
+        }
+    }
+
+    FdCacheWatch * watches = realloc(cache->watches,
+            sizeof(FdCacheWatch) * (cache->n_watches + 1));
+    check_mem(watches);
+    cache->watches = watches;
+    cache->watches[cache->n_watches].wd = wd;
+    cache->watches[cache->n_watches].dirpath = dirpath;
+    cache->watches[cache->n_watches].n_entries = 1;
+    cache->n_watches++;
+    entry->wd = wd;
+    return;
+
+error:
+    free(dirpath);
+#else
+    (void)cache;
+    (void)entry;
+#endif
+}
+
+
+/**
+ * stop watching the directory of an entry once no other entry needs
+ * it. has to be called with the mutex locked
+ */
+static void
+FdCache_unwatch(FdCache * cache, FdCacheEntry * entry)
+{
+    if (entry->wd == -1) {
+        return;
+    }
+
+    for (size_t i=0; i<cache->n_watches; i++) {
+        FdCacheWatch * watch = &(cache->watches[i]);
+        if (watch->wd != entry->wd) {
+            continue;
+        }
+        if (--watch->n_entries == 0) {
+#ifdef __linux__
+            inotify_rm_watch(cache->inotify_fd, watch->wd);
+#endif
+            free(watch->dirpath);
+            cache->watches[i] = cache->watches[cache->n_watches - 1];
+            cache->n_watches--;
+        }
+        break;
+    }
+    entry->wd = -1;
+}
+
+
+/**
+ * remove the entries of names inotify reported to be removed or
+ * replaced. has to be called with the mutex locked
+ */
+static void
+FdCache_read_events(FdCache * cache)
+{
+#ifdef __linux__
+    char buf[FDCACHE_EVENT_BUFFER_SIZE]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    char * path = NULL;
+
+    if ((cache->inotify_fd == -1) || (cache->n_watches == 0)) {
+        return;
+    }
+
+    while (true) {
+        ssize_t len = read(cache->inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            // EAGAIN: no events pending
+            return;
+        }
+
+        for (char * ptr = buf; ptr < buf + len; ) {
+            const struct inotify_event * event = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            FdCacheWatch * watch = NULL;
+            for (size_t i=0; i<cache->n_watches; i++) {
+                if (cache->watches[i].wd == event->wd) {
+                    watch = &(cache->watches[i]);
+                    break;
+                }
+            }
+            if (watch == NULL) {
+                continue;
+            }
+
+            if ((event->len > 0) && (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+                size_t path_len = strlen(watch->dirpath) + event->len + 2;
+                path = malloc(path_len);
+                if (path == NULL) {
+                    continue;
+                }
+                snprintf(path, path_len, "%s/%s", watch->dirpath, event->name);
+                FdCache_remove_below(cache, path);
+                free(path);
+                path = NULL;
+            }
+            else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // the watch may be freed by removing its last entry
+                char * dirpath = strdup(watch->dirpath);
+                if (dirpath != NULL) {
+                    FdCache_remove_below(cache, dirpath);
+                    free(dirpath);
+                }
+            }
+        }
+    }
+#else
+    (void)cache;
+#endif
+}
@@ -0,0 +1,123 @@
+#ifndef __server_fdcache_h__
+#define __server_fdcache_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "../kazlib/hash.h"
+
+/* number of files kept open for requests without a handle */
+#define FDCACHE_DEFAULT_MAXSIZE 256
+
+/* time (in seconds) after which a cached fd is checked to still
+ * belong to its path. catches changes inotify does not report, like
+ * renames of directories further up the tree */
+#define FDCACHE_REVALIDATE_SEC 2
+
+/* size of the buffer for reading inotify events */
+#define FDCACHE_EVENT_BUFFER_SIZE 4096
+
+
+typedef struct FdCacheEntry {
+    // "flags:path" as used in the table
+    char * key;
+    char * path;
+    int flags;
+    int fd;
+
+    // only regular files are cached. other files are passed to a
+    // single user and closed by FdCache_put
+    bool cached;
+
+    // number of requests currently using the fd
+    unsigned int refcount;
+
+    // the entry has been removed from the cache while in use. the
+    // fd will be closed by the last FdCache_put
+    bool invalidated;
+
+    // the file the fd was opened for
+    dev_t dev;
+    ino_t ino;
+    time_t validated_ts;
+
+    // watch descriptor of the parent directory. -1 if not watched
+    int wd;
+
+    struct FdCacheEntry * lru_prev;
+    struct FdCacheEntry * lru_next;
+} FdCacheEntry;
+
+
+/** a directory watched for changes of the names of cached files */
+typedef struct FdCacheWatch {
+    int wd;
+    char * dirpath;
+    unsigned int n_entries;
+} FdCacheWatch;
+
+
+/**
+ * file descriptors kept open for READ and WRITE requests without a
+ * handle, so hot files are not opened and closed for every block
+ *
+ * the cache is shared by all workers. entries are removed when the
+ * served directory is changed through rhizofs and when inotify reports
+ * the name of a cached file to be removed or replaced. the events are
+ * read by the workers using the cache, so no thread of its own is
+ * needed
+ */
+typedef struct FdCache {
+    // key -> FdCacheEntry
+    hash_t * entries;
+    size_t max_size;
+
+    // most recently used entry first
+    FdCacheEntry * lru_head;
+    FdCacheEntry * lru_tail;
+
+    // -1 if inotify is not available. entries are revalidated in
+    // this case only
+    int inotify_fd;
+    FdCacheWatch * watches;
+    size_t n_watches;
+
+    pthread_mutex_t mutex;
+} FdCache;
+
+
+/**
+ * initialize the cache. "max_size" 0 disables caching
+ *
+ * returns false on error
+ */
+bool FdCache_init(FdCache * cache, size_t max_size);
+
+/**
+ * close all cached files
+ */
+void FdCache_deinit(FdCache * cache);
+
+/**
+ * get a fd of the file at "path" opened with "flags". "mode" is used
+ * when the file gets created
+ *
+ * returns NULL on error with errno set. the entry has to be returned
+ * with FdCache_put
+ */
+FdCacheEntry * FdCache_get(FdCache * cache, const char * path, int flags, mode_t mode);
+
+/**
+ * return an entry got by FdCache_get
+ */
+void FdCache_put(FdCache * cache, FdCacheEntry * entry);
+
+/**
+ * remove the entries of "path" and of all paths below it
+ */
+void FdCache_invalidate(FdCache * cache, const char * path);
+
+#endif /* __server_fdcache_h__ */
@@ -0,0 +1,291 @@
+#include "handletable.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "../dbg.h"
+
+#define HANDLE_SLOT_MASK 0xffffffffULL
+
+// prototypes
+static HandleEntry * HandleTable_lookup(HandleTable * ht, uint64_t handle, const char * owner);
+static void HandleTable_close(HandleTable * ht, HandleEntry * entry);
+
+
+size_t
+HandleTable_default_size()
+{
+    struct rlimit rl;
+    size_t size = HANDLETABLE_MAX_SIZE;
+
+    if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY)
+            && (rl.rlim_cur < (rlim_t)(HANDLETABLE_MAX_SIZE + HANDLETABLE_RESERVED_FDS))) {
+        size = (rl.rlim_cur > (rlim_t)HANDLETABLE_RESERVED_FDS) ?
+                (size_t)rl.rlim_cur - HANDLETABLE_RESERVED_FDS : 0;
+    }
+    if (size < HANDLETABLE_MIN_SIZE) {
+        size = HANDLETABLE_MIN_SIZE;
+    }
+    return size;
+}
+
+
+bool
+HandleTable_init(HandleTable * ht, size_t max_size, unsigned int lease_sec)
+{
+    check((ht != NULL), "the handletable parameter is NULL");
+    check((max_size < HANDLE_SLOT_MASK), "handletable size is too big");
+
+    memset(ht, 0, sizeof(HandleTable));
+
+    // a table without slots does not keep any file open
+    ht->entries = calloc(sizeof(HandleEntry), (max_size > 0) ? max_size : 1);
+    check_mem(ht->entries);
+    ht->free_slots = calloc(sizeof(size_t), (max_size > 0) ? max_size : 1);
+    check_mem(ht->free_slots);
+
+    // the lowest slots are used first
+    for (size_t i=0; i<max_size; i++) {
+        ht->entries[i].fd = -1;
+        ht->free_slots[i] = max_size - 1 - i;
+    }
+    ht->n_free = max_size;
+    ht->max_size = max_size;
+    ht->generation = 0;
+    ht->lease_sec = lease_sec;
+
+    check(pthread_mutex_init(&(ht->mutex), NULL) == 0,
+            "Could not initialize handletable mutex");
+
+    return true;
+
+error:
+    if (ht) {
+        free(ht->entries);
+        ht->entries = NULL;
+        free(ht->free_slots);
+        ht->free_slots = NULL;
+    }
+    return false;
+}
+
+
+void
+HandleTable_deinit(HandleTable * ht)
+{
+    if (ht && ht->entries) {
+        for (size_t i=0; i<ht->max_size; i++) {
+            if (ht->entries[i].handle != HANDLE_NONE) {
+                HandleTable_close(ht, &(ht->entries[i]));
+            }
+        }
+        free(ht->entries);
+        ht->entries = NULL;
+        free(ht->free_slots);
+        ht->free_slots = NULL;
+
+        if (pthread_mutex_destroy(&(ht->mutex)) != 0) {
+            log_err("Could not destroy handletable mutex");
+        }
+    }
+}
+
+
+uint64_t
+HandleTable_add(HandleTable * ht, int fd, const char * owner)
+{
+    uint64_t handle = HANDLE_NONE;
+
+    check((ht != NULL), "passed handletable is null");
+    check((fd >= 0), "invalid file descriptor");
+    check(((owner != NULL) && (strlen(owner) <= HANDLETABLE_MAX_OWNER)), "invalid owner");
+
+    pthread_mutex_lock(&(ht->mutex));
+
+    if (ht->n_free > 0) {
+        HandleEntry * entry = &(ht->entries[ht->free_slots[--ht->n_free]]);
+
+        // generation 0 would allow a handle of slot 0 to be HANDLE_NONE
+        if (++ht->generation == 0) {
+            ht->generation = 1;
+        }
+        handle = ((uint64_t)ht->generation << 32) |
+                (uint64_t)(entry - ht->entries + 1);
+
+        entry->handle = handle;
+        entry->fd = fd;
+        entry->refcount = 0;
+        entry->released = false;
+        strcpy(entry->owner, owner);
+        debug("added fd %d as handle %llx", fd, (unsigned long long)handle);
+    }
+    else {
+        log_warn("no free slot in the handletable for fd %d", fd);
+    }
+
+    pthread_mutex_unlock(&(ht->mutex));
+    return handle;
+
+error:
+    return HANDLE_NONE;
+}
+
+
+int
+HandleTable_get(HandleTable * ht, uint64_t handle, const char * owner)
+{
+    int fd = -1;
+
+    if (ht == NULL || handle == HANDLE_NONE || owner == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&(ht->mutex));
+
+    HandleEntry * entry = HandleTable_lookup(ht, handle, owner);
+    if (entry != NULL && !entry->released) {
+        entry->refcount++;
+        fd = entry->fd;
+    }
+
+    pthread_mutex_unlock(&(ht->mutex));
+
+    if (fd == -1) {
+        debug("handle %llx is unknown", (unsigned long long)handle);
+    }
+    return fd;
+}
+
+
+void
+HandleTable_put(HandleTable * ht, uint64_t handle)
+{
+    if (ht == NULL || handle == HANDLE_NONE) {
+        return;
+    }
+
+    pthread_mutex_lock(&(ht->mutex));
+
+    // only called after a successful HandleTable_get, which
+    // checked the owner
+    HandleEntry * entry = HandleTable_lookup(ht, handle, NULL);
+    if (entry != NULL && entry->refcount > 0) {
+        entry->refcount--;
+        if (entry->released && entry->refcount == 0) {
+            HandleTable_close(ht, entry);
+        }
+    }
+
+    pthread_mutex_unlock(&(ht->mutex));
+}
+
+
+bool
+HandleTable_release(HandleTable * ht, uint64_t handle, const char * owner)
+{
+    bool found = false;
+
+    if (ht == NULL || handle == HANDLE_NONE || owner == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&(ht->mutex));
+
+    HandleEntry * entry = HandleTable_lookup(ht, handle, owner);
+    if (entry != NULL && !entry->released) {
+        found = true;
+        entry->released = true;
+        if (entry->refcount == 0) {
+            HandleTable_close(ht, entry);
+        }
+    }
+
+    pthread_mutex_unlock(&(ht->mutex));
+    return found;
+}
+
+
+size_t
+HandleTable_release_owner(HandleTable * ht, const char * owner)
+{
+    size_t n_released = 0;
+
+    if (ht == NULL || owner == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&(ht->mutex));
+
+    for (size_t i=0; i<ht->max_size; i++) {
+        HandleEntry * entry = &(ht->entries[i]);
+
+        if ((entry->handle != HANDLE_NONE) && !entry->released
+                && (strcmp(entry->owner, owner) == 0)) {
+            n_released++;
+            entry->released = true;
+            if (entry->refcount == 0) {
+                HandleTable_close(ht, entry);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&(ht->mutex));
+
+    if (n_released > 0) {
+        log_info("Closed %d files left open by %s", (int)n_released, owner);
+    }
+    return n_released;
+}
+
+
+/**
+ * find the entry of a handle. "owner" may be NULL to find the entry
+ * regardless of its client
+ *
+ * has to be called with the mutex locked
+ *
+ * returns NULL if the handle is unknown or belongs to another client
+ */
+static HandleEntry *
+HandleTable_lookup(HandleTable * ht, uint64_t handle, const char * owner)
+{
+    uint64_t slot = handle & HANDLE_SLOT_MASK;
+
+    if (slot == 0 || slot > ht->max_size) {
+        return NULL;
+    }
+    HandleEntry * entry = &(ht->entries[slot - 1]);
+    if (entry->handle != handle) {
+        return NULL;
+    }
+    if ((owner != NULL) && (strcmp(entry->owner, owner) != 0)) {
+        log_warn("handle %llx of client %s used by client %s",
+                (unsigned long long)handle, entry->owner, owner);
+        return NULL;
+    }
+    return entry;
+}
+
+
+/**
+ * close the fd of the entry and return its slot
+ *
+ * has to be called with the mutex locked
+ */
+static void
+HandleTable_close(HandleTable * ht, HandleEntry * entry)
+{
+    if (entry->fd >= 0) {
+        debug("closing handle %llx (fd %d)", (unsigned long long)entry->handle, entry->fd);
+        if (close(entry->fd) != 0) {
+            log_warn("Could not close fd %d", entry->fd);
+        }
+    }
+    entry->fd = -1;
+    entry->handle = HANDLE_NONE;
+    entry->refcount = 0;
+    entry->released = false;
+    entry->owner[0] = '\0';
+    ht->free_slots[ht->n_free++] = (size_t)(entry - ht->entries);
+}
@@ -0,0 +1,137 @@
+#ifndef __server_handletable_h__
+#define __server_handletable_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+/* bounds of the number of files which may be kept open for clients
+ * at the same time */
+#define HANDLETABLE_MIN_SIZE 64
+#define HANDLETABLE_MAX_SIZE 65536
+
+/* files the process may open which are not used for handles. left for
+ * the fdcache, the sockets and directory listings */
+#define HANDLETABLE_RESERVED_FDS 512
+
+/* maximum length of the key of the connection owning a handle */
+#define HANDLETABLE_MAX_OWNER 128
+
+/* default of the time (in seconds) after which the handles of a
+ * connection which sent no requests are closed */
+#define HANDLETABLE_DEFAULT_LEASE_SEC 300
+
+/* handle value used by the protocol for "no handle" */
+#define HANDLE_NONE 0
+
+
+typedef struct HandleEntry {
+    // the handle as sent to the client. 0 if the slot is unused
+    uint64_t handle;
+
+    int fd;
+
+    // number of workers currently using the fd
+    unsigned int refcount;
+
+    // the client released the handle while it was still in use.
+    // the fd will be closed by the last HandleTable_put
+    bool released;
+
+    // the key of the connection which opened the file. handles are
+    // only valid for this connection
+    char owner[HANDLETABLE_MAX_OWNER + 1];
+} HandleEntry;
+
+
+/**
+ * table of files opened on behalf of the clients
+ *
+ * the table is shared between all worker threads. handles encode the
+ * slot index in their lower 32 bits and a generation counter in
+ * the upper 32 bits, so a handle which has been released and whose
+ * slot got reused will not be found anymore.
+ *
+ * clients which go away without releasing their handles do not
+ * keep them forever. the front end of the scheduler closes the
+ * handles of connections idle for "lease_sec", and clients send
+ * keepalives while they are mounted
+ */
+typedef struct HandleTable {
+    HandleEntry * entries;
+    size_t max_size;
+
+    // indices of the unused slots
+    size_t * free_slots;
+    size_t n_free;
+
+    uint32_t generation;
+
+    unsigned int lease_sec;
+
+    pthread_mutex_t mutex;
+} HandleTable;
+
+
+/**
+ * the number of handles the process may keep open with its limit of
+ * open files, leaving HANDLETABLE_RESERVED_FDS for everything else
+ */
+size_t HandleTable_default_size();
+
+/**
+ * initialize the handletable. with a "max_size" of 0 no handles are
+ * handed out
+ *
+ * returns false on error
+ */
+bool HandleTable_init(HandleTable * ht, size_t max_size, unsigned int lease_sec);
+
+/**
+ * close all remaining files and free the table
+ */
+void HandleTable_deinit(HandleTable * ht);
+
+/**
+ * add an opened file descriptor to the table for the client "owner".
+ * the table takes ownership of the fd.
+ *
+ * handles are only taken away from clients which have gone away, so
+ * the table may be full.
+ *
+ * returns the handle or HANDLE_NONE when the table is full. in that
+ * case the fd is NOT closed.
+ */
+uint64_t HandleTable_add(HandleTable * ht, int fd, const char * owner);
+
+/**
+ * get the fd for a handle of "owner" and mark it as being in use.
+ * every successful call has to be followed by a call to HandleTable_put
+ *
+ * returns -1 if the handle is unknown or belongs to another client
+ */
+int HandleTable_get(HandleTable * ht, uint64_t handle, const char * owner);
+
+/**
+ * return a fd obtained by HandleTable_get
+ */
+void HandleTable_put(HandleTable * ht, uint64_t handle);
+
+/**
+ * release a handle of "owner". the fd will be closed as soon as it
+ * is not used anymore
+ *
+ * returns false if the handle is unknown or belongs to another client
+ */
+bool HandleTable_release(HandleTable * ht, uint64_t handle, const char * owner);
+
+/**
+ * release all handles of "owner", which has gone away
+ *
+ * returns the number of handles released
+ */
+size_t HandleTable_release_owner(HandleTable * ht, const char * owner);
+
+#endif /* __server_handletable_h__ */
@@ -1,11 +1,13 @@
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <getopt.h>
 #include <pthread.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -15,47 +17,105 @@
 #include "../version.h"
 #include "../helptext.h"
 #include "servedir.h"
+#include "notifier.h"
+#include "workerpool.h"
+#include "fairqueue.h"
+#include "metrics.h"
+#include "../codecpool.h"
 
 #define DEFAULT_N_WORKER_THREADS 5
 #define MAX_N_WORKER_THREADS 200
-#define WORKER_SOCKET "inproc://workers"
 
 
 struct option opts_long[] = {
     {"authorized-keys-file", 1, 0, 'a'},
+    {"bytelimit",  1, 0, 'B'},
+    {"clientlimits", 1, 0, 'c'},
+    {"clientqueue", 1, 0, 'q'},
+    {"codecthreads", 1, 0, 'C'},
     {"encrypt",    0, 0, 'e'},
     {"foreground", 0, 0, 'f'},
     {"help",       0, 0, 'h'},
+    {"hugepages",  0, 0, 'H'},
     {"keyfile",    1, 0, 'k'},
+    {"lease",      1, 0, 'L'},
     {"logfile",    1, 0, 'l'},
+    {"maxworkers", 1, 0, 'M'},
+    {"metawait",   1, 0, 'w'},
+    {"metaworkers", 1, 0, 'r'},
+    {"metrics",    1, 0, 's'},
+    {"minworkers", 1, 0, 'm'},
+    {"notify",     1, 0, 'N'},
     {"numworkers", 1, 0, 'n'},
+    {"openfiles",  1, 0, 'o'},
     {"pidfile",    1, 0, 'p'},
     {"pubkeyfile", 1, 0, 'P'},
+    {"ratelimit",  1, 0, 'R'},
+    {"uring",      0, 0, 'u'},
     {"version",    0, 0, 'v'},
     {"verbose",    0, 0, 'V'},
     {0, 0, 0, 0}
 };
 
 
-static const char *opts_short = "a:ehk:vn:Vl:fp:P:";
+static const char *opts_short = "a:B:c:C:ehHk:L:vm:M:n:N:o:Vl:fp:P:q:r:R:s:uw:";
 
 
 static const char *opts_desc =
     "  -a --authorized-keys-file authorized keys file.\n"
+    "  -B --bytelimit=BYTES      Bytes per second each client may send and\n"
+    "                            receive. 0 is unlimited [default=0]\n"
+    "  -c --clientlimits=FILE    File with the weights and limits of single\n"
+    "                            clients. Each line holds the public key of a\n"
+    "                            client or '*', the weight, the requests and the\n"
+    "                            bytes per second.\n"
+    "  -C --codecthreads=NUMBER  Threads compressing and decompressing the chunks\n"
+    "                            of large reads and writes in parallel. 0 uses the\n"
+    "                            workers only [default=number of CPUs - 1]\n"
     "  -e --encrypt\n"
     "  -f --foreground           foreground operation - do not daemonize.\n"
     "  -h --help\n"
+    "  -H --hugepages            Back read buffers of 2 MB and more with huge\n"
+    "                            pages when the system provides them.\n"
     "  -k --keyfile=FILE         File to read for the public key. The secret key\n"
     "                            will be read from the file with the same name but\n"
     "                            with '.secret' appended.\n"
+    "  -L --lease=SECONDS        Close the files left open by clients which sent\n"
+    "                            no requests for this long. Clients send\n"
+    "                            keepalives while they are mounted [default=300]\n"
     "  -l --logfile=FILE         Logfile to use. Additionally it will always\n"
     "                            be logged to the syslog.\n"
+    "  -m --minworkers=NUMBER    The number of workers is reduced down to this\n"
+    "                            number while the server is idle [default=numworkers]\n"
+    "  -M --maxworkers=NUMBER    Workers are added up to this number while requests\n"
+    "                            wait or all workers are blocked [default=numworkers]\n"
+    "  -N --notify=SOCKET        Publish the changes of the directory on this\n"
+    "                            socket, so clients can keep their caches for\n"
+    "                            longer. Clients subscribe with --notify.\n"
     "  -n --numworkers=NUMBER    Number of worker threads to start [default=5]\n"
+    "  -o --openfiles=NUMBER     Files kept open for the clients. 0 lets clients\n"
+    "                            read and write by path [default=limit of open\n"
+    "                            files - 512]\n"
     "  -p --pidfile=FILE         PID-file to write the PID of the daemonized server\n"
     "                            process to.\n"
     "                            Has no effect if the server runs in the foreground.\n"
     "  -P --pubkeyfile           File to store the public key (needs --encrypt).\n"
     "                            If not set, the public key will be written to stdout.\n"
+    "  -q --clientqueue=NUMBER   Requests each client may have queued. Further\n"
+    "                            ones fail with EAGAIN [default=" STRINGIFY(FAIRQUEUE_MAX_CLIENT_JOBS) "]\n"
+    "  -R --ratelimit=NUMBER     Requests per second each client may send.\n"
+    "                            0 is unlimited [default=0]\n"
+    "  -r --metaworkers=NUMBER   Number of workers which only serve metadata\n"
+    "                            requests, so they do not wait behind reads and\n"
+    "                            writes. More are reserved when needed [default=1]\n"
+    "  -s --metrics=ADDRESS      Serve metrics in the prometheus text format over\n"
+    "                            http on ADDRESS. Either HOST:PORT, a PORT on the\n"
+    "                            loopback interface or unix:PATH.\n"
+    "  -u --uring                Submit reads, writes and stats to io_uring, so each\n"
+    "                            worker keeps many requests in flight. Falls back to\n"
+    "                            blocking I/O when io_uring is not available.\n"
+    "  -w --metawait=MSEC        Longest time metadata requests should wait for a\n"
+    "                            worker on average [default=10]\n"
     "  -V --verbose\n"
     "  -v --version\n";
 
@@ -63,10 +123,24 @@ static const char *opts_desc =
 typedef struct ServerSettings {
     char * directory;
     char * socketname;
+    char * notify_socketname; // NULL when changes are not published
     int n_worker_threads;
+    int min_worker_threads; // -1 for n_worker_threads
+    int max_worker_threads; // -1 for n_worker_threads
+    int meta_worker_threads;
+    int max_meta_wait_msec;
+    FairQueueLimits client_limits; // of clients not in client_limits_file
+    char * client_limits_file;
+    size_t max_client_jobs;
+    char * metrics_address; // NULL when the metrics are not served
+    int codec_threads; // -1 for one less than the number of CPUs
+    long open_files; // -1 for the limit of open files
+    unsigned int lease_sec;
     bool encrypt;
     bool foreground; // foreground operation - do not daemonize
     bool verbose;
+    bool use_uring;
+    bool huge_pages; // back large read buffers with huge pages
     char *authorized_keys_file;
 } ServerSettings;
 static ServerSettings settings;
@@ -74,10 +148,26 @@ static ServerSettings settings;
 
 static void * context = NULL; // zmq context
 static void * in_socket = NULL;
-static void * worker_socket = NULL;
 static int exit_code = EXIT_SUCCESS;
-static pthread_t *workers = NULL;
 static pthread_t auth_thread = 0;
+static HandleTable handletable;
+static bool handletable_initialized = false;
+static StatPool statpool;
+static bool statpool_initialized = false;
+static FdCache fdcache;
+static bool fdcache_initialized = false;
+static Scheduler scheduler;
+static bool scheduler_initialized = false;
+static WorkerPool workerpool;
+static bool workerpool_initialized = false;
+static FairQueue fairqueue;
+static bool fairqueue_initialized = false;
+static Metrics metrics;
+static CompressPolicy compresspolicy;
+static bool compresspolicy_initialized = false;
+static bool codecpool_started = false;
+static bool metrics_initialized = false;
+static Notifier notifier;
 static FILE * logfile = NULL;
 static FILE * pidfile = NULL;
 
@@ -198,6 +288,7 @@ void *auth_routine(void* ctx)
     {
         char *status_code = "400";
         char *status_msg = "denied";
+        char *user_id = "";
 
         char *version = receive_string(sock);
         char *request_id = receive_string(sock);
@@ -240,6 +331,8 @@ void *auth_routine(void* ctx)
                     log_info("key from %s accepted", address);
                     status_code = "200";
                     status_msg = "OK";
+                    // the requests of the client are queued by its key
+                    user_id = client_key_text;
                 } else {
                     log_warn("request from %s key '%s' not authorized", address, client_key_text);
                 }
@@ -256,7 +349,7 @@ out:
         send_string(sock, request_id, true);
         send_string(sock, status_code, true);
         send_string(sock, status_msg, true);
-        send_string(sock, "", true);
+        send_string(sock, user_id, true);
         send_string(sock, "", false);
 
         free(version);
@@ -299,6 +392,13 @@ startup(const char *secret_key)
     in_socket = zmq_socket (context, ZMQ_XREP);
     check((in_socket != NULL), "Could not create zmq socket");
 
+#ifdef ZMQ_ROUTER_HANDOVER
+    /* clients keep their routing id, and with it their handles, when
+     * they reconnect before the old connection has been closed */
+    const int router_handover = 1;
+    zmq_setsockopt(in_socket, ZMQ_ROUTER_HANDOVER, &router_handover, sizeof(router_handover));
+#endif
+
     if (secret_key != NULL) {
         const int curve_server_enable = 1;
         zmq_setsockopt(in_socket, ZMQ_CURVE_SERVER, &curve_server_enable, sizeof(curve_server_enable));
@@ -308,24 +408,86 @@ startup(const char *secret_key)
     check((zmq_bind(in_socket, settings.socketname) == 0),
             "could not bind to socket %s", settings.socketname);
 
-    /* Socket to talk to workers */
-    worker_socket = zmq_socket (context, ZMQ_XREQ);
-    check((worker_socket != NULL), "Could not create internal zmq worker socket");
-    check((zmq_bind(worker_socket, WORKER_SOCKET) == 0),
-            "could not bind to socket %s", WORKER_SOCKET);
+    /* files kept open for the clients. the table is sized from the
+     * limit of open files, which is raised as far as allowed */
+    struct rlimit nofile_limit;
+    if ((getrlimit(RLIMIT_NOFILE, &nofile_limit) == 0)
+            && (nofile_limit.rlim_cur < nofile_limit.rlim_max)) {
+        nofile_limit.rlim_cur = nofile_limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &nofile_limit) != 0) {
+            debug("Could not raise the limit of open files: %s", strerror(errno));
+        }
+    }
+    check((HandleTable_init(&handletable, (settings.open_files >= 0) ?
+            (size_t)settings.open_files : HandleTable_default_size(),
+            settings.lease_sec) == true),
+            "Could not initialize the handletable");
+    handletable_initialized = true;
+
+    /* files kept open for requests without a handle */
+    check((FdCache_init(&fdcache, FDCACHE_DEFAULT_MAXSIZE) == true),
+            "Could not initialize the fdcache");
+    fdcache_initialized = true;
+
+    /* threads helping with listing large directories */
+    check((StatPool_init(&statpool, STATPOOL_DEFAULT_THREADS) == true),
+            "Could not start the statpool");
+    statpool_initialized = true;
+
+    /* publish the changes of the directory */
+    if (settings.notify_socketname != NULL) {
+        check((Notifier_init(&notifier, context, settings.notify_socketname,
+                settings.directory, secret_key) == true),
+                "Could not start publishing changes on %s", settings.notify_socketname);
+    }
+
+    /* share the workers between the clients */
+    check((FairQueue_init(&fairqueue) == true), "Could not initialize the fair queue");
+    fairqueue_initialized = true;
+    fairqueue.handles = &handletable;
+    fairqueue.max_client_jobs = settings.max_client_jobs;
+    check((FairQueue_set_limits(&fairqueue, NULL, &(settings.client_limits)) == true),
+            "Could not set the client limits");
+    if (settings.client_limits_file != NULL) {
+        check((FairQueue_read_limits(&fairqueue, settings.client_limits_file) == true),
+                "Could not read the client limits");
+    }
+
+    /* skip compressing replies which will not get smaller. the
+     * clients choose the codecs */
+    check((CompressPolicy_init(&compresspolicy, false) == true),
+            "Could not initialize the compression policy");
+    compresspolicy_initialized = true;
+
+    /* threads compressing the chunks of large replies */
+    check((CodecPool_start((settings.codec_threads >= 0) ? (size_t)settings.codec_threads :
+            CodecPool_default_threads()) == true), "Could not start the codec threads");
+    codecpool_started = true;
+
+    /* counters of the requests served */
+    Metrics_init(&metrics, &scheduler, &workerpool, &fairqueue, &compresspolicy);
+    metrics_initialized = true;
+
+    /* queues of the requests for the workers */
+    check((Scheduler_init(&scheduler, (size_t)settings.max_worker_threads) == true),
+            "Could not initialize the scheduler");
+    scheduler_initialized = true;
 
     /* startup the worker threads */
-    workers = calloc(sizeof(pthread_t), settings.n_worker_threads);
-    check_mem(workers);
-    int t = 0;
-    while (t < settings.n_worker_threads) {
-        pthread_create(&workers[t], NULL, worker_routine, NULL);
-        t++;
+    check((WorkerPool_init(&workerpool, &scheduler, (size_t)settings.n_worker_threads,
+            (size_t)settings.min_worker_threads, (size_t)settings.max_worker_threads,
+            (size_t)settings.meta_worker_threads, (uint64_t)settings.max_meta_wait_msec * 1000,
+            worker_routine) == true), "Could not start the workers");
+    workerpool_initialized = true;
+
+    if (settings.metrics_address != NULL) {
+        check((Metrics_listen(&metrics, settings.metrics_address) == true),
+                "Could not serve the metrics on %s", settings.metrics_address);
     }
 
-    /* connect the worker threads to the incomming socket */
-    check((zmq_device(ZMQ_QUEUE, in_socket, worker_socket) == 0),
-            "Could not set up queue between sockets");
+    /* hand the requests on the incomming socket to the workers */
+    check((Scheduler_run(&scheduler, in_socket, &fairqueue) == true),
+            "Could not schedule the requests");
 
     shutdown(SIGTERM);
     exit(exit_code); /* surpress compiler warnings */
@@ -340,8 +502,6 @@ error:
 void
 shutdown(int sig)
 {
-    int t = 0;
-
     (void) sig;
 
     debug("Shuting down");
@@ -351,11 +511,21 @@ shutdown(int sig)
         in_socket = NULL;
     }
 
-    if (worker_socket != NULL) {
-        zmq_close(worker_socket);
-        worker_socket = NULL;
+    // let the workers leave their loops
+    if (scheduler_initialized) {
+        Scheduler_stop(&scheduler);
+    }
+
+    // the endpoint reads the state of everything below
+    if (metrics_initialized) {
+        Metrics_deinit(&metrics);
+        metrics_initialized = false;
     }
 
+    // terminating the zmq_context waits for the socket
+    // of the notifier to be closed
+    Notifier_deinit(&notifier);
+
     // terminating the zmq_context will make all
     // sockets exit with errno == ETERM
     if (context != NULL) {
@@ -363,12 +533,44 @@ shutdown(int sig)
         context = NULL;
     }
 
-    if (workers != NULL) {
-        while (t<settings.n_worker_threads) {
-            pthread_join(workers[t], NULL);
-            t++;
-        }
-        free(workers);
+    if (workerpool_initialized) {
+        WorkerPool_deinit(&workerpool);
+        workerpool_initialized = false;
+    }
+
+    if (scheduler_initialized) {
+        Scheduler_deinit(&scheduler);
+        scheduler_initialized = false;
+    }
+
+    if (fairqueue_initialized) {
+        FairQueue_deinit(&fairqueue);
+        fairqueue_initialized = false;
+    }
+
+    if (codecpool_started) {
+        CodecPool_stop();
+        codecpool_started = false;
+    }
+
+    if (compresspolicy_initialized) {
+        CompressPolicy_deinit(&compresspolicy);
+        compresspolicy_initialized = false;
+    }
+
+    if (handletable_initialized) {
+        HandleTable_deinit(&handletable);
+        handletable_initialized = false;
+    }
+
+    if (fdcache_initialized) {
+        FdCache_deinit(&fdcache);
+        fdcache_initialized = false;
+    }
+
+    if (statpool_initialized) {
+        StatPool_deinit(&statpool);
+        statpool_initialized = false;
     }
 
     if (auth_thread != 0) {
@@ -396,11 +598,12 @@ void *
 worker_routine(void * wp)
 {
     ServeDir * sd = NULL;
+    size_t worker = (size_t)(uintptr_t)wp;
 
-    (void) wp;
-
-    sd = ServeDir_create(context, WORKER_SOCKET,
-            settings.directory);
+    sd = ServeDir_create(&scheduler, worker,
+            settings.directory, &handletable, &statpool, &fdcache,
+            &metrics, &compresspolicy, settings.use_uring,
+            settings.huge_pages);
     check((sd != NULL), "error serving directory.");
 
     ServeDir_serve(sd);
@@ -472,8 +675,23 @@ main(int argc, char *argv[])
 
     /* defaults */
     settings.n_worker_threads = DEFAULT_N_WORKER_THREADS;
+    settings.min_worker_threads = -1;
+    settings.max_worker_threads = -1;
+    settings.meta_worker_threads = 1;
+    settings.max_meta_wait_msec = WORKERPOOL_DEFAULT_META_WAIT_MSEC;
+    settings.client_limits.weight = 1;
+    settings.client_limits.max_requests = 0;
+    settings.client_limits.max_bytes = 0;
+    settings.client_limits_file = NULL;
+    settings.max_client_jobs = FAIRQUEUE_MAX_CLIENT_JOBS;
+    settings.metrics_address = NULL;
+    settings.codec_threads = -1;
+    settings.open_files = -1;
+    settings.lease_sec = HANDLETABLE_DEFAULT_LEASE_SEC;
     settings.verbose = false;
     settings.foreground = false;
+    settings.use_uring = false;
+    settings.huge_pages = false;
 
     while ((optc = getopt_long(argc, argv, opts_short, opts_long, NULL)) != -1) {
 
@@ -481,6 +699,51 @@ main(int argc, char *argv[])
             case 'a':
                 settings.authorized_keys_file = strdup(optarg);
                 break;
+            case 'B':
+                settings.client_limits.max_bytes = strtoull(optarg, NULL, 10);
+                break;
+            case 'c':
+                settings.client_limits_file = optarg;
+                break;
+            case 'q':
+                settings.max_client_jobs = (size_t)strtoul(optarg, NULL, 10);
+                if ((settings.max_client_jobs < 1)
+                        || (settings.max_client_jobs > FAIRQUEUE_MAX_JOBS))
+                    {
+                    print_wrong_arg("Illegal value for clientqueue");
+                }
+                break;
+            case 'C':
+                settings.codec_threads = atoi(optarg);
+                if ((settings.codec_threads < 0)
+                        || (settings.codec_threads > CODECPOOL_MAX_THREADS))
+                    {
+                    print_wrong_arg("Illegal value for codecthreads");
+                }
+                break;
+            case 's':
+                settings.metrics_address = optarg;
+                break;
+            case 'L':
+                settings.lease_sec = (unsigned int)strtoul(optarg, NULL, 10);
+                if (settings.lease_sec < 1) {
+                    print_wrong_arg("Illegal value for lease");
+                }
+                break;
+            case 'o':
+                settings.open_files = atol(optarg);
+                if ((settings.open_files < 0)
+                        || (settings.open_files > HANDLETABLE_MAX_SIZE))
+                    {
+                    print_wrong_arg("Illegal value for openfiles");
+                }
+                break;
+            case 'R':
+                settings.client_limits.max_requests = strtoull(optarg, NULL, 10);
+                break;
+            case 'N':
+                settings.notify_socketname = optarg;
+                break;
             case 'n':
                 settings.n_worker_threads = atoi(optarg);
                 if ((settings.n_worker_threads < 1)
@@ -489,6 +752,36 @@ main(int argc, char *argv[])
                     print_wrong_arg("Illegal value for numworkers");
                 }
                 break;
+            case 'm':
+                settings.min_worker_threads = atoi(optarg);
+                if ((settings.min_worker_threads < 1)
+                        || (settings.min_worker_threads > MAX_N_WORKER_THREADS))
+                    {
+                    print_wrong_arg("Illegal value for minworkers");
+                }
+                break;
+            case 'M':
+                settings.max_worker_threads = atoi(optarg);
+                if ((settings.max_worker_threads < 1)
+                        || (settings.max_worker_threads > MAX_N_WORKER_THREADS))
+                    {
+                    print_wrong_arg("Illegal value for maxworkers");
+                }
+                break;
+            case 'r':
+                settings.meta_worker_threads = atoi(optarg);
+                if ((settings.meta_worker_threads < 0)
+                        || (settings.meta_worker_threads > MAX_N_WORKER_THREADS))
+                    {
+                    print_wrong_arg("Illegal value for metaworkers");
+                }
+                break;
+            case 'w':
+                settings.max_meta_wait_msec = atoi(optarg);
+                if (settings.max_meta_wait_msec < 1) {
+                    print_wrong_arg("Illegal value for metawait");
+                }
+                break;
             case 'k':
                 key_file = strdup(optarg);
                 break;
@@ -541,6 +834,14 @@ main(int argc, char *argv[])
                 pubkey_file = strdup(optarg);
                 break;
 
+            case 'u':
+                settings.use_uring = true;
+                break;
+
+            case 'H':
+                settings.huge_pages = true;
+                break;
+
             default:
                 print_wrong_arg("Unknown option");
                 break;
@@ -550,6 +851,26 @@ main(int argc, char *argv[])
     if (argc < (optind + 2)) {
         print_wrong_arg("Missing socket and/or directory");
     }
+
+    /* the pool is scaled between the bounds, starting at numworkers.
+     * without bounds the number of workers is fixed */
+    if ((settings.max_worker_threads != -1)
+            && (settings.n_worker_threads > settings.max_worker_threads)) {
+        settings.n_worker_threads = settings.max_worker_threads;
+    }
+    if ((settings.min_worker_threads != -1)
+            && (settings.n_worker_threads < settings.min_worker_threads)) {
+        settings.n_worker_threads = settings.min_worker_threads;
+    }
+    if (settings.min_worker_threads == -1) {
+        settings.min_worker_threads = settings.n_worker_threads;
+    }
+    if (settings.max_worker_threads == -1) {
+        settings.max_worker_threads = settings.n_worker_threads;
+    }
+    if (settings.min_worker_threads > settings.max_worker_threads) {
+        print_wrong_arg("minworkers is larger than maxworkers");
+    }
     settings.socketname = argv[optind];
     settings.directory = argv[optind + 1];
 
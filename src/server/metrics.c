@@ -0,0 +1,561 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../dbg.h"
+
+/* time (in milliseconds) a scraper gets to send its request */
+#define METRICS_REQUEST_TIMEOUT_MSEC 1000
+
+/* time (in milliseconds) a scraper may take to accept more of the response */
+#define METRICS_WRITE_TIMEOUT_MSEC 5000
+
+#define METRICS_UNIX_PREFIX "unix:"
+
+
+/* upper bounds of the buckets in nanoseconds */
+static const uint64_t metrics_bucket_ns[METRICS_N_BUCKETS] = {
+    10000ULL, 25000ULL, 50000ULL, 100000ULL, 250000ULL, 500000ULL,
+    1000000ULL, 2500000ULL, 5000000ULL, 10000000ULL, 25000000ULL, 50000000ULL,
+    100000000ULL, 250000000ULL, 500000000ULL, 1000000000ULL, 2500000000ULL
+};
+
+static const char * metrics_phase_names[METRICS_N_PHASES] = {
+    "wait", "unpack", "exec", "pack"
+};
+
+static const char * metrics_errno_names[METRICS_N_ERRNOS] = {
+    "none", "unknown", "perm", "noent", "nomem", "acces", "busy", "exist",
+    "notdir", "isdir", "inval", "fbig", "nospc", "rofs", "spipe", "invalid_request",
+    "unserializable", "badf"
+};
+
+
+uint64_t
+Metrics_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+
+void
+Metrics_init(Metrics * metrics, Scheduler * scheduler, WorkerPool * workerpool,
+        FairQueue * fairqueue, CompressPolicy * compresspolicy)
+{
+    memset(metrics, 0, sizeof(Metrics));
+    metrics->scheduler = scheduler;
+    metrics->workerpool = workerpool;
+    metrics->fairqueue = fairqueue;
+    metrics->compresspolicy = compresspolicy;
+    metrics->listen_fd = -1;
+    metrics->stop_fds[0] = -1;
+    metrics->stop_fds[1] = -1;
+}
+
+
+static void
+Metrics_close(Metrics * metrics)
+{
+    if (metrics->listen_fd != -1) {
+        close(metrics->listen_fd);
+        metrics->listen_fd = -1;
+    }
+    if (metrics->unix_path != NULL) {
+        unlink(metrics->unix_path);
+        free(metrics->unix_path);
+        metrics->unix_path = NULL;
+    }
+    for (int i=0; i<2; i++) {
+        if (metrics->stop_fds[i] != -1) {
+            close(metrics->stop_fds[i]);
+            metrics->stop_fds[i] = -1;
+        }
+    }
+}
+
+
+void
+Metrics_deinit(Metrics * metrics)
+{
+    if (metrics->thread_started) {
+        if (write(metrics->stop_fds[1], "", 1) == -1) {
+            log_err("Could not stop the metrics endpoint");
+        }
+        pthread_join(metrics->thread, NULL);
+        metrics->thread_started = false;
+    }
+    Metrics_close(metrics);
+}
+
+
+static void
+MetricsHistogram_add(MetricsHistogram * histogram, uint64_t ns)
+{
+    size_t bucket = 0;
+    while ((bucket < METRICS_N_BUCKETS) && (ns > metrics_bucket_ns[bucket])) {
+        bucket++;
+    }
+    __atomic_add_fetch(&(histogram->buckets[bucket]), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(histogram->sum_ns), ns, __ATOMIC_RELAXED);
+}
+
+
+void
+Metrics_record(Metrics * metrics, const Rhizofs__Request * request,
+        const Rhizofs__Response * response, size_t request_size, size_t reply_size,
+        const uint64_t phase_ns[METRICS_N_PHASES])
+{
+    int type = (request != NULL) ? (int)request->requesttype : RHIZOFS__REQUEST_TYPE__UNKNOWN;
+    if ((type < 0) || (type >= METRICS_N_REQUEST_TYPES)) {
+        type = RHIZOFS__REQUEST_TYPE__INVALID;
+    }
+    MetricsRequestType * counters = &(metrics->types[type]);
+
+    __atomic_add_fetch(&(counters->n_requests), 1, __ATOMIC_RELAXED);
+    for (int p=0; p<METRICS_N_PHASES; p++) {
+        MetricsHistogram_add(&(counters->latency[p]), phase_ns[p]);
+    }
+
+    int errnotype = (int)response->errnotype;
+    if (errnotype != RHIZOFS__ERRNO__ERRNO_NONE) {
+        __atomic_add_fetch(&(counters->n_errors), 1, __ATOMIC_RELAXED);
+        if ((errnotype < 0) || (errnotype >= METRICS_N_ERRNOS)) {
+            errnotype = RHIZOFS__ERRNO__ERRNO_UNKNOWN;
+        }
+        __atomic_add_fetch(&(metrics->errors[errnotype]), 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&(metrics->bytes_received), request_size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(metrics->bytes_sent), reply_size, __ATOMIC_RELAXED);
+
+    if ((request != NULL) && (request->datablock != NULL)) {
+        __atomic_add_fetch(&(metrics->write_bytes), (uint64_t)request->datablock->size,
+                __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(metrics->write_bytes_transferred),
+                (uint64_t)request->datablock->data.len, __ATOMIC_RELAXED);
+    }
+    if (response->datablock != NULL) {
+        __atomic_add_fetch(&(metrics->read_bytes), (uint64_t)response->datablock->size,
+                __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(metrics->read_bytes_transferred),
+                (uint64_t)response->datablock->data.len, __ATOMIC_RELAXED);
+    }
+}
+
+
+/**
+ * the text sent to a scraper
+ */
+typedef struct MetricsBuffer {
+    char * data;
+    size_t len;
+    size_t size;
+    bool failed;
+} MetricsBuffer;
+
+
+static void
+MetricsBuffer_printf(MetricsBuffer * buf, const char * format, ...)
+{
+    va_list args;
+
+    if (buf->data == NULL) {
+        buf->size = 16384;
+        buf->data = malloc(buf->size);
+        buf->failed = (buf->data == NULL);
+    }
+
+    while (!buf->failed) {
+        va_start(args, format);
+        int n = vsnprintf(buf->data + buf->len, buf->size - buf->len, format, args);
+        va_end(args);
+
+        if ((n >= 0) && ((size_t)n < buf->size - buf->len)) {
+            buf->len += (size_t)n;
+            return;
+        }
+
+        size_t size = (buf->size * 2) + ((n > 0) ? (size_t)n : 0);
+        char * data = realloc(buf->data, size);
+        if (data == NULL) {
+            buf->failed = true;
+            return;
+        }
+        buf->data = data;
+        buf->size = size;
+    }
+}
+
+
+static uint64_t
+Metrics_get(uint64_t * counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+static void
+Metrics_write_header(MetricsBuffer * buf, const char * name, const char * type,
+        const char * help)
+{
+    MetricsBuffer_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+static void
+Metrics_write_requests(Metrics * metrics, MetricsBuffer * buf)
+{
+    Metrics_write_header(buf, "rhizosrv_requests_total", "counter",
+            "Requests served, by type.");
+    for (int t=0; t<METRICS_N_REQUEST_TYPES; t++) {
+        uint64_t n = Metrics_get(&(metrics->types[t].n_requests));
+        if (n > 0) {
+            MetricsBuffer_printf(buf, "rhizosrv_requests_total{type=\"%s\"} %llu\n",
+                    Request_type_name(t), (unsigned long long)n);
+        }
+    }
+
+    Metrics_write_header(buf, "rhizosrv_request_errors_total", "counter",
+            "Requests answered with an error, by type.");
+    for (int t=0; t<METRICS_N_REQUEST_TYPES; t++) {
+        if (Metrics_get(&(metrics->types[t].n_requests)) > 0) {
+            MetricsBuffer_printf(buf, "rhizosrv_request_errors_total{type=\"%s\"} %llu\n",
+                    Request_type_name(t),
+                    (unsigned long long)Metrics_get(&(metrics->types[t].n_errors)));
+        }
+    }
+
+    Metrics_write_header(buf, "rhizosrv_request_duration_seconds", "histogram",
+            "Time requests spent in each phase, by type.");
+    for (int t=0; t<METRICS_N_REQUEST_TYPES; t++) {
+        if (Metrics_get(&(metrics->types[t].n_requests)) == 0) {
+            continue;
+        }
+        for (int p=0; p<METRICS_N_PHASES; p++) {
+            MetricsHistogram * histogram = &(metrics->types[t].latency[p]);
+            uint64_t count = 0;
+
+            for (int b=0; b<=METRICS_N_BUCKETS; b++) {
+                count += Metrics_get(&(histogram->buckets[b]));
+                if (b < METRICS_N_BUCKETS) {
+                    MetricsBuffer_printf(buf, "rhizosrv_request_duration_seconds_bucket"
+                            "{type=\"%s\",phase=\"%s\",le=\"%g\"} %llu\n",
+                            Request_type_name(t), metrics_phase_names[p],
+                            (double)metrics_bucket_ns[b] / 1e9, (unsigned long long)count);
+                }
+                else {
+                    MetricsBuffer_printf(buf, "rhizosrv_request_duration_seconds_bucket"
+                            "{type=\"%s\",phase=\"%s\",le=\"+Inf\"} %llu\n",
+                            Request_type_name(t), metrics_phase_names[p],
+                            (unsigned long long)count);
+                }
+            }
+            MetricsBuffer_printf(buf, "rhizosrv_request_duration_seconds_sum"
+                    "{type=\"%s\",phase=\"%s\"} %.9f\n",
+                    Request_type_name(t), metrics_phase_names[p],
+                    (double)Metrics_get(&(histogram->sum_ns)) / 1e9);
+            MetricsBuffer_printf(buf, "rhizosrv_request_duration_seconds_count"
+                    "{type=\"%s\",phase=\"%s\"} %llu\n",
+                    Request_type_name(t), metrics_phase_names[p],
+                    (unsigned long long)count);
+        }
+    }
+
+    Metrics_write_header(buf, "rhizosrv_errors_total", "counter",
+            "Errors returned to the clients, by errno.");
+    for (int e=1; e<METRICS_N_ERRNOS; e++) {
+        MetricsBuffer_printf(buf, "rhizosrv_errors_total{errno=\"%s\"} %llu\n",
+                metrics_errno_names[e], (unsigned long long)Metrics_get(&(metrics->errors[e])));
+    }
+}
+
+
+static void
+Metrics_write_bytes(Metrics * metrics, MetricsBuffer * buf)
+{
+    uint64_t read_bytes = Metrics_get(&(metrics->read_bytes));
+    uint64_t read_transferred = Metrics_get(&(metrics->read_bytes_transferred));
+    uint64_t write_bytes = Metrics_get(&(metrics->write_bytes));
+    uint64_t write_transferred = Metrics_get(&(metrics->write_bytes_transferred));
+
+    Metrics_write_header(buf, "rhizosrv_received_bytes_total", "counter",
+            "Size of the requests received.");
+    MetricsBuffer_printf(buf, "rhizosrv_received_bytes_total %llu\n",
+            (unsigned long long)Metrics_get(&(metrics->bytes_received)));
+    Metrics_write_header(buf, "rhizosrv_sent_bytes_total", "counter",
+            "Size of the replies sent.");
+    MetricsBuffer_printf(buf, "rhizosrv_sent_bytes_total %llu\n",
+            (unsigned long long)Metrics_get(&(metrics->bytes_sent)));
+
+    Metrics_write_header(buf, "rhizosrv_data_bytes_total", "counter",
+            "Data of reads and writes before compression.");
+    MetricsBuffer_printf(buf, "rhizosrv_data_bytes_total{direction=\"read\"} %llu\n",
+            (unsigned long long)read_bytes);
+    MetricsBuffer_printf(buf, "rhizosrv_data_bytes_total{direction=\"write\"} %llu\n",
+            (unsigned long long)write_bytes);
+
+    Metrics_write_header(buf, "rhizosrv_data_transferred_bytes_total", "counter",
+            "Data of reads and writes as transferred.");
+    MetricsBuffer_printf(buf, "rhizosrv_data_transferred_bytes_total{direction=\"read\"} %llu\n",
+            (unsigned long long)read_transferred);
+    MetricsBuffer_printf(buf, "rhizosrv_data_transferred_bytes_total{direction=\"write\"} %llu\n",
+            (unsigned long long)write_transferred);
+
+    Metrics_write_header(buf, "rhizosrv_compression_ratio", "gauge",
+            "Data before compression per byte transferred since the start.");
+    MetricsBuffer_printf(buf, "rhizosrv_compression_ratio{direction=\"read\"} %.3f\n",
+            (read_transferred > 0) ? (double)read_bytes / (double)read_transferred : 1.0);
+    MetricsBuffer_printf(buf, "rhizosrv_compression_ratio{direction=\"write\"} %.3f\n",
+            (write_transferred > 0) ? (double)write_bytes / (double)write_transferred : 1.0);
+
+    if (metrics->compresspolicy != NULL) {
+        CompressPolicyStats stats;
+        CompressPolicy_get_stats(metrics->compresspolicy, &stats);
+
+        Metrics_write_header(buf, "rhizosrv_compression_skipped_total", "counter",
+                "Blocks of replies sent uncompressed as they were not expected to get smaller.");
+        MetricsBuffer_printf(buf, "rhizosrv_compression_skipped_total{reason=\"entropy\"} %llu\n",
+                (unsigned long long)stats.n_skipped_entropy);
+        MetricsBuffer_printf(buf, "rhizosrv_compression_skipped_total{reason=\"file\"} %llu\n",
+                (unsigned long long)stats.n_skipped_file);
+        Metrics_write_header(buf, "rhizosrv_compression_incompressible_total", "counter",
+                "Blocks of replies compressed without getting smaller.");
+        MetricsBuffer_printf(buf, "rhizosrv_compression_incompressible_total %llu\n",
+                (unsigned long long)stats.n_incompressible);
+    }
+}
+
+
+static void
+Metrics_write_state(Metrics * metrics, MetricsBuffer * buf)
+{
+    if (metrics->fairqueue != NULL) {
+        Metrics_write_header(buf, "rhizosrv_clients", "gauge",
+                "Clients which sent requests recently.");
+        MetricsBuffer_printf(buf, "rhizosrv_clients %llu\n", (unsigned long long)
+                __atomic_load_n(&(metrics->fairqueue->n_clients), __ATOMIC_RELAXED));
+        Metrics_write_header(buf, "rhizosrv_client_throttled_total", "counter",
+                "Times clients were held back by their rate limits.");
+        MetricsBuffer_printf(buf, "rhizosrv_client_throttled_total %llu\n",
+                (unsigned long long)Metrics_get(&(metrics->fairqueue->n_throttled)));
+        Metrics_write_header(buf, "rhizosrv_client_rejected_total", "counter",
+                "Requests rejected because too many of their client were queued.");
+        MetricsBuffer_printf(buf, "rhizosrv_client_rejected_total %llu\n",
+                (unsigned long long)Metrics_get(&(metrics->fairqueue->n_rejected)));
+    }
+
+    if (metrics->scheduler != NULL) {
+        SchedulerStats stats;
+        Scheduler_get_stats(metrics->scheduler, &stats);
+
+        Metrics_write_header(buf, "rhizosrv_queued_requests", "gauge",
+                "Requests queued for the workers.");
+        MetricsBuffer_printf(buf, "rhizosrv_queued_requests %llu\n",
+                (unsigned long long)stats.n_queued);
+        Metrics_write_header(buf, "rhizosrv_running_requests", "gauge",
+                "Requests executed by the workers.");
+        MetricsBuffer_printf(buf, "rhizosrv_running_requests %llu\n",
+                (unsigned long long)stats.n_running);
+        Metrics_write_header(buf, "rhizosrv_worker_busy_seconds_total", "counter",
+                "Time the workers spent executing requests.");
+        MetricsBuffer_printf(buf, "rhizosrv_worker_busy_seconds_total %.6f\n",
+                (double)stats.busy_ns / 1e9);
+    }
+
+    if (metrics->workerpool != NULL) {
+        WorkerPoolStats stats;
+        WorkerPool_get_stats(metrics->workerpool, &stats);
+
+        Metrics_write_header(buf, "rhizosrv_workers", "gauge", "Active workers.");
+        MetricsBuffer_printf(buf, "rhizosrv_workers %llu\n",
+                (unsigned long long)stats.n_workers);
+        Metrics_write_header(buf, "rhizosrv_workers_reserved", "gauge",
+                "Workers serving metadata requests only.");
+        MetricsBuffer_printf(buf, "rhizosrv_workers_reserved %llu\n",
+                (unsigned long long)stats.n_reserved);
+        Metrics_write_header(buf, "rhizosrv_worker_utilization", "gauge",
+                "Share of the time the workers were busy during the last interval.");
+        MetricsBuffer_printf(buf, "rhizosrv_worker_utilization %.2f\n",
+                (double)stats.busy_percent / 100.0);
+    }
+}
+
+
+/**
+ * answer a scraper. the request itself is ignored, every path gets
+ * the metrics
+ */
+static void
+Metrics_serve_client(Metrics * metrics, int fd)
+{
+    MetricsBuffer buf = { NULL, 0, 0, false };
+    char request[4096];
+    struct pollfd pollset = { fd, POLLIN, 0 };
+
+    if ((poll(&pollset, 1, METRICS_REQUEST_TIMEOUT_MSEC) <= 0)
+            || (read(fd, request, sizeof(request)) <= 0)) {
+        return;
+    }
+
+    Metrics_write_requests(metrics, &buf);
+    Metrics_write_bytes(metrics, &buf);
+    Metrics_write_state(metrics, &buf);
+    if (buf.failed) {
+        log_err("Could not format the metrics");
+        free(buf.data);
+        return;
+    }
+
+    char header[128];
+    int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %llu\r\n\r\n", (unsigned long long)buf.len);
+
+    // a slow scraper only holds up the next scrape, a stalled one is
+    // given up on. scrapers going away must not raise SIGPIPE
+    const char * parts[2] = { header, buf.data };
+    size_t lengths[2] = { (size_t)header_len, buf.len };
+    pollset.events = POLLOUT;
+    for (int i=0; i<2; i++) {
+        size_t written = 0;
+        while (written < lengths[i]) {
+            int ready = poll(&pollset, 1, METRICS_WRITE_TIMEOUT_MSEC);
+            if ((ready == -1) && (errno == EINTR)) {
+                continue;
+            }
+            if (ready <= 0) {
+                debug("Giving up on a stalled metrics scraper");
+                free(buf.data);
+                return;
+            }
+            ssize_t rc = send(fd, parts[i] + written, lengths[i] - written,
+                    MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (rc <= 0) {
+                if ((rc == -1) && ((errno == EINTR) || (errno == EAGAIN))) {
+                    continue;
+                }
+                free(buf.data);
+                return;
+            }
+            written += (size_t)rc;
+        }
+    }
+    free(buf.data);
+}
+
+
+static void *
+Metrics_routine(void * arg)
+{
+    Metrics * metrics = (Metrics *)arg;
+    struct pollfd pollset[2] = {
+        { metrics->listen_fd, POLLIN, 0 },
+        { metrics->stop_fds[0], POLLIN, 0 }
+    };
+
+    while (true) {
+        if (poll(pollset, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_err("Could not wait for metrics requests");
+            break;
+        }
+        if (pollset[1].revents != 0) {
+            break;
+        }
+        if (pollset[0].revents & POLLIN) {
+            int fd = accept(metrics->listen_fd, NULL, NULL);
+            if (fd != -1) {
+                Metrics_serve_client(metrics, fd);
+                close(fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+
+bool
+Metrics_listen(Metrics * metrics, const char * address)
+{
+    struct addrinfo hints;
+    struct addrinfo * addrs = NULL;
+
+    if (strncmp(address, METRICS_UNIX_PREFIX, strlen(METRICS_UNIX_PREFIX)) == 0) {
+        struct sockaddr_un addr;
+        const char * path = address + strlen(METRICS_UNIX_PREFIX);
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        check((strlen(path) > 0) && (strlen(path) < sizeof(addr.sun_path)),
+                "Invalid metrics socket path %s", path);
+        strcpy(addr.sun_path, path);
+
+        metrics->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        check((metrics->listen_fd != -1), "Could not create metrics socket");
+
+        // a socket left behind by an earlier run
+        unlink(path);
+        check((bind(metrics->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0),
+                "Could not bind metrics socket to %s: %s", path, strerror(errno));
+        metrics->unix_path = strdup(path);
+        check_mem(metrics->unix_path);
+    }
+    else {
+        char host[256] = "127.0.0.1";
+        const char * port = address;
+        const char * colon = strrchr(address, ':');
+        const int reuse = 1;
+
+        if (colon != NULL) {
+            size_t host_len = (size_t)(colon - address);
+            check((host_len < sizeof(host)), "Invalid metrics address %s", address);
+            memcpy(host, address, host_len);
+            host[host_len] = '\0';
+            port = colon + 1;
+        }
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        int rc = getaddrinfo(host, port, &hints, &addrs);
+        check((rc == 0), "Invalid metrics address %s: %s", address, gai_strerror(rc));
+
+        metrics->listen_fd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+        check((metrics->listen_fd != -1), "Could not create metrics socket");
+        setsockopt(metrics->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        check((bind(metrics->listen_fd, addrs->ai_addr, addrs->ai_addrlen) == 0),
+                "Could not bind metrics socket to %s: %s", address, strerror(errno));
+        freeaddrinfo(addrs);
+        addrs = NULL;
+    }
+
+    check((listen(metrics->listen_fd, 16) == 0), "Could not listen on %s", address);
+
+    check((pipe(metrics->stop_fds) == 0), "Could not create metrics pipe");
+    check((pthread_create(&(metrics->thread), NULL, Metrics_routine, metrics) == 0),
+            "Could not start the metrics thread");
+    metrics->thread_started = true;
+    return true;
+
+error:
+    if (addrs != NULL) {
+        freeaddrinfo(addrs);
+    }
+    Metrics_close(metrics);
+    return false;
+}
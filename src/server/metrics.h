@@ -0,0 +1,117 @@
+#ifndef __server_metrics_h__
+#define __server_metrics_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "../request.h"
+#include "../response.h"
+#include "../compresspolicy.h"
+#include "scheduler.h"
+#include "workerpool.h"
+#include "fairqueue.h"
+
+/* number of request types and protocol errnos counted */
+#define METRICS_N_REQUEST_TYPES (RHIZOFS__REQUEST_TYPE__COMPOUND + 1)
+#define METRICS_N_ERRNOS (RHIZOFS__ERRNO__ERRNO_BADF + 1)
+
+/* number of buckets of the latency histograms, without +Inf */
+#define METRICS_N_BUCKETS 17
+
+
+/**
+ * the phases the time of a request is split into
+ */
+typedef enum MetricsPhase {
+    METRICS_PHASE_WAIT = 0,     // queued in the scheduler
+    METRICS_PHASE_UNPACK,       // unpacking the request
+    METRICS_PHASE_EXEC,         // executing the operation, mostly syscalls
+    METRICS_PHASE_PACK,         // packing the response
+    METRICS_N_PHASES
+} MetricsPhase;
+
+
+typedef struct MetricsHistogram {
+    uint64_t buckets[METRICS_N_BUCKETS + 1];
+    uint64_t sum_ns;
+} MetricsHistogram;
+
+
+typedef struct MetricsRequestType {
+    uint64_t n_requests;
+    uint64_t n_errors;
+    MetricsHistogram latency[METRICS_N_PHASES];
+} MetricsRequestType;
+
+
+/**
+ * counters of the requests served, updated by all workers without
+ * locking, and an optional endpoint serving them in the text format of
+ * prometheus over http
+ */
+typedef struct Metrics {
+    MetricsRequestType types[METRICS_N_REQUEST_TYPES];
+    uint64_t errors[METRICS_N_ERRNOS];
+
+    // requests and replies as received and sent
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+
+    // the data of writes and reads before compression and as
+    // transferred
+    uint64_t write_bytes;
+    uint64_t write_bytes_transferred;
+    uint64_t read_bytes;
+    uint64_t read_bytes_transferred;
+
+    // the state of the server is read from these. each may be NULL
+    Scheduler * scheduler;
+    WorkerPool * workerpool;
+    FairQueue * fairqueue;
+    CompressPolicy * compresspolicy;
+
+    // the endpoint. -1 if not listening
+    int listen_fd;
+    char * unix_path;
+    int stop_fds[2];
+    pthread_t thread;
+    bool thread_started;
+} Metrics;
+
+
+/**
+ * the monotonic time in nanoseconds
+ */
+uint64_t Metrics_now_ns();
+
+/**
+ * set up the counters. the state of the server is read from the
+ * given objects, which may be NULL
+ */
+void Metrics_init(Metrics * metrics, Scheduler * scheduler, WorkerPool * workerpool,
+        FairQueue * fairqueue, CompressPolicy * compresspolicy);
+
+/**
+ * stop the endpoint
+ */
+void Metrics_deinit(Metrics * metrics);
+
+/**
+ * serve the metrics on "address". either "HOST:PORT", a port on the
+ * loopback interface, or "unix:PATH"
+ *
+ * returns false on error
+ */
+bool Metrics_listen(Metrics * metrics, const char * address);
+
+/**
+ * count a request served. "request" is NULL if it could not be
+ * unpacked. "phase_ns" holds the time spent in every phase
+ */
+void Metrics_record(Metrics * metrics, const Rhizofs__Request * request,
+        const Rhizofs__Response * response, size_t request_size, size_t reply_size,
+        const uint64_t phase_ns[METRICS_N_PHASES]);
+
+#endif /* __server_metrics_h__ */
@@ -0,0 +1,409 @@
+#include "notifier.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <zmq.h>
+
+#include "../dbg.h"
+#include "../path.h"
+#include "../mapping.h"
+#include "../notification.h"
+
+/* events which change what clients may have cached */
+#define NOTIFIER_EVENTS (IN_ATTRIB | IN_MODIFY | IN_CREATE | IN_DELETE | \
+        IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+// prototypes
+static void * Notifier_thread(void * arg);
+static void Notifier_read_events(Notifier * notifier);
+static void Notifier_handle_event(Notifier * notifier, const struct inotify_event * event);
+static void Notifier_watch_tree(Notifier * notifier, const char * path);
+static void Notifier_unwatch_tree(Notifier * notifier, const char * path);
+static bool Notifier_set_watch(Notifier * notifier, int wd, const char * path);
+static void Notifier_publish(Notifier * notifier, Rhizofs__NotificationType type,
+        const char * path, const char * fullpath);
+
+
+bool
+Notifier_init(Notifier * notifier, void * context, const char * socket_name,
+        const char * directory, const char * secret_key)
+{
+    check((notifier != NULL), "passed notifier is null");
+
+    memset(notifier, 0, sizeof(Notifier));
+    notifier->inotify_fd = -1;
+    notifier->wakeup_fds[0] = -1;
+    notifier->wakeup_fds[1] = -1;
+
+    notifier->directory = strdup(directory);
+    check_mem(notifier->directory);
+
+    notifier->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    check((notifier->inotify_fd != -1), "Could not initialize inotify: %s", strerror(errno));
+
+    check((pipe(notifier->wakeup_fds) == 0), "Could not create notifier wakeup pipe");
+
+    notifier->socket = zmq_socket(context, ZMQ_PUB);
+    check((notifier->socket != NULL), "Could not create notification socket");
+
+    int hwm = NOTIFIER_DEFAULT_HWM;
+    zmq_setsockopt(notifier->socket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+
+    if (secret_key != NULL) {
+        const int curve_server_enable = 1;
+        zmq_setsockopt(notifier->socket, ZMQ_CURVE_SERVER, &curve_server_enable,
+                sizeof(curve_server_enable));
+        zmq_setsockopt(notifier->socket, ZMQ_CURVE_SECRETKEY, secret_key, 40);
+    }
+
+    check((zmq_bind(notifier->socket, socket_name) == 0),
+            "could not bind to socket %s", socket_name);
+
+    // from here on the socket is only used by the thread. the tree
+    // gets walked by the thread as well, so large trees do not
+    // delay the startup
+    check((pthread_create(&(notifier->thread), NULL, Notifier_thread, notifier) == 0),
+            "Could not start notifier thread");
+    notifier->thread_started = true;
+
+    return true;
+
+error:
+    Notifier_deinit(notifier);
+    return false;
+}
+
+
+void
+Notifier_deinit(Notifier * notifier)
+{
+    if (notifier == NULL || notifier->directory == NULL) {
+        return;
+    }
+
+    if (notifier->thread_started) {
+        if (write(notifier->wakeup_fds[1], "", 1) != 1) {
+            debug("could not wake up the notifier thread");
+        }
+        pthread_join(notifier->thread, NULL);
+        notifier->thread_started = false;
+    }
+
+    if (notifier->socket != NULL) {
+        zmq_close(notifier->socket);
+        notifier->socket = NULL;
+    }
+    if (notifier->inotify_fd != -1) {
+        close(notifier->inotify_fd);
+        notifier->inotify_fd = -1;
+    }
+    for (int i=0; i<2; i++) {
+        if (notifier->wakeup_fds[i] != -1) {
+            close(notifier->wakeup_fds[i]);
+            notifier->wakeup_fds[i] = -1;
+        }
+    }
+
+    for (size_t i=0; i<notifier->n_watches; i++) {
+        free(notifier->watches[i]);
+    }
+    free(notifier->watches);
+    notifier->watches = NULL;
+    notifier->n_watches = 0;
+
+    free(notifier->directory);
+    notifier->directory = NULL;
+}
+
+
+static void *
+Notifier_thread(void * arg)
+{
+    Notifier * notifier = (Notifier *)arg;
+
+    Notifier_watch_tree(notifier, "/");
+    debug("Watching %d directories for changes", (int)notifier->n_watches);
+
+    while (true) {
+        zmq_pollitem_t pollset[] = {
+            { NULL, notifier->inotify_fd,   ZMQ_POLLIN, 0 },
+            { NULL, notifier->wakeup_fds[0], ZMQ_POLLIN, 0 }
+        };
+        int rc = zmq_poll(pollset, 2, NOTIFIER_HEARTBEAT_MSEC);
+        if (rc == -1) {
+            if (errno == ETERM) {
+                log_err("the 0mq context has been terminated");
+                break;
+            }
+            continue;
+        }
+
+        // lets clients which lost notifications while nothing else
+        // happened find out about it
+        if (rc == 0) {
+            Notifier_publish(notifier, RHIZOFS__NOTIFICATION_TYPE__NT_HEARTBEAT, NULL, NULL);
+            continue;
+        }
+
+        if (pollset[1].revents & ZMQ_POLLIN) {
+            break;
+        }
+        if (pollset[0].revents & ZMQ_POLLIN) {
+            Notifier_read_events(notifier);
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+Notifier_read_events(Notifier * notifier)
+{
+    union {
+        struct inotify_event event;
+        char buf[NOTIFIER_BUFFER_SIZE];
+    } events;
+
+    while (true) {
+        ssize_t len = read(notifier->inotify_fd, events.buf, sizeof(events.buf));
+        if (len <= 0) {
+            if ((len == -1) && (errno != EAGAIN) && (errno != EINTR)) {
+                log_err("Could not read inotify events: %s", strerror(errno));
+            }
+            return;
+        }
+
+        ssize_t pos = 0;
+        while (pos < len) {
+            const struct inotify_event * event = (const struct inotify_event *)(events.buf + pos);
+            Notifier_handle_event(notifier, event);
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+
+static void
+Notifier_handle_event(Notifier * notifier, const struct inotify_event * event)
+{
+    char * path = NULL;
+    char * fullpath = NULL;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+        log_warn("inotify queue overflow - clients will drop their caches");
+        Notifier_publish(notifier, RHIZOFS__NOTIFICATION_TYPE__NT_OVERFLOW, NULL, NULL);
+        return;
+    }
+
+    if ((event->wd < 0) || ((size_t)event->wd >= notifier->n_watches) ||
+            (notifier->watches[event->wd] == NULL)) {
+        return;
+    }
+
+    if (event->mask & IN_IGNORED) {
+        // the directory is gone or its watch has been removed
+        free(notifier->watches[event->wd]);
+        notifier->watches[event->wd] = NULL;
+        return;
+    }
+
+    // events without a name are about the watched directory itself
+    if (event->len > 0) {
+        check((path_join(notifier->watches[event->wd], event->name, &path) == 0),
+                "could not join path for %s", event->name);
+    }
+    else {
+        path = strdup(notifier->watches[event->wd]);
+        check_mem(path);
+    }
+    check((path_join(notifier->directory, path, &fullpath) == 0),
+            "could not join path for %s", path);
+
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        if (event->mask & IN_ISDIR) {
+            Notifier_watch_tree(notifier, path);
+        }
+        Notifier_publish(notifier, RHIZOFS__NOTIFICATION_TYPE__NT_CREATED, path, fullpath);
+    }
+    else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if ((event->mask & (IN_ISDIR | IN_MOVED_FROM)) == (IN_ISDIR | IN_MOVED_FROM)) {
+            // the watches below keep their descriptors but the paths
+            // are wrong now. a directory moved to within the tree gets
+            // watched again
+            Notifier_unwatch_tree(notifier, path);
+        }
+        Notifier_publish(notifier, RHIZOFS__NOTIFICATION_TYPE__NT_REMOVED, path, NULL);
+    }
+    else if (event->mask & (IN_ATTRIB | IN_MODIFY)) {
+        Notifier_publish(notifier, RHIZOFS__NOTIFICATION_TYPE__NT_CHANGED, path, NULL);
+    }
+
+error:
+    free(path);
+    free(fullpath);
+}
+
+
+/**
+ * add watches for a directory and all directories below it
+ */
+static void
+Notifier_watch_tree(Notifier * notifier, const char * path)
+{
+    char * fullpath = NULL;
+    char * child_path = NULL;
+    DIR * dir = NULL;
+    struct dirent * de = NULL;
+
+    check((path_join(notifier->directory, path, &fullpath) == 0),
+            "could not join path for %s", path);
+
+    int wd = inotify_add_watch(notifier->inotify_fd, fullpath, NOTIFIER_EVENTS);
+    if (wd == -1) {
+        if (errno == ENOSPC) {
+            log_err("Could not watch %s: the limit of inotify watches has been "
+                    "reached. see /proc/sys/fs/inotify/max_user_watches", fullpath);
+        }
+        else if (errno != ENOENT && errno != ENOTDIR) {
+            log_warn("Could not watch %s: %s", fullpath, strerror(errno));
+        }
+        goto error;
+    }
+    check(Notifier_set_watch(notifier, wd, path), "Could not store watch for %s", path);
+
+    dir = opendir(fullpath);
+    check_debug((dir != NULL), "Could not open directory %s", fullpath);
+
+    while ((de = readdir(dir)) != NULL) {
+        if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0)) {
+            continue;
+        }
+
+        bool is_dir = (de->d_type == DT_DIR);
+        if (de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = ((fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) &&
+                    S_ISDIR(st.st_mode));
+        }
+        if (!is_dir) {
+            continue;
+        }
+
+        check((path_join(path, de->d_name, &child_path) == 0),
+                "could not join path for %s", de->d_name);
+        Notifier_watch_tree(notifier, child_path);
+        free(child_path);
+        child_path = NULL;
+    }
+
+error:
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    free(child_path);
+    free(fullpath);
+}
+
+
+/**
+ * remove the watches of a directory and all directories below it
+ */
+static void
+Notifier_unwatch_tree(Notifier * notifier, const char * path)
+{
+    size_t path_len = strlen(path);
+
+    for (size_t wd=0; wd<notifier->n_watches; wd++) {
+        const char * watch_path = notifier->watches[wd];
+        if ((watch_path != NULL) && (strncmp(watch_path, path, path_len) == 0) &&
+                ((watch_path[path_len] == '\0') || (watch_path[path_len] == '/'))) {
+            inotify_rm_watch(notifier->inotify_fd, (int)wd);
+            free(notifier->watches[wd]);
+            notifier->watches[wd] = NULL;
+        }
+    }
+}
+
+
+/**
+ * remember the path of a watch descriptor
+ */
+static bool
+Notifier_set_watch(Notifier * notifier, int wd, const char * path)
+{
+    char * path_copy = NULL;
+
+    if ((size_t)wd >= notifier->n_watches) {
+        size_t n_watches = notifier->n_watches ? notifier->n_watches : 64;
+        while (n_watches <= (size_t)wd) {
+            n_watches *= 2;
+        }
+        char ** watches = realloc(notifier->watches, n_watches * sizeof(char *));
+        check_mem(watches);
+        memset(watches + notifier->n_watches, 0,
+                (n_watches - notifier->n_watches) * sizeof(char *));
+        notifier->watches = watches;
+        notifier->n_watches = n_watches;
+    }
+
+    path_copy = strdup(path);
+    check_mem(path_copy);
+
+    // adding a watch for a watched directory returns the same descriptor
+    free(notifier->watches[wd]);
+    notifier->watches[wd] = path_copy;
+
+    return true;
+
+error:
+    return false;
+}
+
+
+/**
+ * publish a notification. "fullpath" is used to find out the type
+ * of created entries and may be NULL
+ */
+static void
+Notifier_publish(Notifier * notifier, Rhizofs__NotificationType type,
+        const char * path, const char * fullpath)
+{
+    Rhizofs__Notification notification;
+    Rhizofs__Version version;
+    zmq_msg_t msg;
+    struct stat st;
+
+    Notification_init(&notification, &version);
+    notification.notificationtype = type;
+    if (type != RHIZOFS__NOTIFICATION_TYPE__NT_HEARTBEAT) {
+        notifier->sequence++;
+    }
+    notification.sequence = notifier->sequence;
+    notification.path = (char *)path;
+
+    if ((fullpath != NULL) && (lstat(fullpath, &st) == 0)) {
+        notification.has_filetype = 1;
+        notification.filetype = FileType_from_local(st.st_mode);
+    }
+
+    if (path != NULL) {
+        debug("Publishing notification %d for %s", (int)type, path);
+    }
+
+    check(Notification_pack(&notification, &msg), "Could not pack notification");
+    if (zmq_msg_send(&msg, notifier->socket, ZMQ_DONTWAIT) == -1) {
+        // subscribers notice the gap in the sequence
+        debug("Could not publish notification: %s", zmq_strerror(errno));
+        zmq_msg_close(&msg);
+    }
+
+error:
+    return;
+}
@@ -0,0 +1,68 @@
+#ifndef __server_notifier_h__
+#define __server_notifier_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* number of notifications queued for a slow subscriber before
+ * further ones get dropped */
+#define NOTIFIER_DEFAULT_HWM 100000
+
+/* interval of the heartbeats sent while nothing changes */
+#define NOTIFIER_HEARTBEAT_MSEC 1000
+
+/* size of the buffer for reading inotify events */
+#define NOTIFIER_BUFFER_SIZE 65536
+
+
+/**
+ * watches the served directory with inotify and publishes the
+ * changes on a PUB socket, so clients can drop what they cached
+ * about the changed paths
+ *
+ * inotify is not recursive, so every directory of the tree gets a
+ * watch of its own. new directories are added when they appear.
+ * the socket and the watches are owned by the thread of the
+ * notifier
+ */
+typedef struct Notifier {
+    char * directory;
+
+    void * socket;
+    int inotify_fd;
+
+    // written to to stop the thread
+    int wakeup_fds[2];
+
+    // paths relative to the directory by watch descriptor. NULL
+    // for unused descriptors
+    char ** watches;
+    size_t n_watches;
+
+    uint64_t sequence;
+
+    pthread_t thread;
+    bool thread_started;
+} Notifier;
+
+
+/**
+ * start watching "directory" and publish the changes on
+ * "socket_name"
+ *
+ * "secret_key" enables CURVE encryption of the socket when not NULL
+ *
+ * returns false on error
+ */
+bool Notifier_init(Notifier * notifier, void * context, const char * socket_name,
+        const char * directory, const char * secret_key);
+
+/**
+ * stop the thread and close the socket. has to be called before
+ * the zmq context gets terminated
+ */
+void Notifier_deinit(Notifier * notifier);
+
+#endif /* __server_notifier_h__ */
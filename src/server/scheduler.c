@@ -0,0 +1,815 @@
+#include "scheduler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../dbg.h"
+#include "../request.h"
+#include "../response.h"
+#include "fairqueue.h"
+
+#define SCHEDULER_QUEUE_MASK (SCHEDULER_QUEUE_SIZE - 1)
+
+
+static uint64_t
+Scheduler_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+
+static bool
+Scheduler_pipe(int fds[2])
+{
+    fds[0] = -1;
+    fds[1] = -1;
+
+    check((pipe(fds) == 0), "Could not create scheduler pipe");
+    for (int i=0; i<2; i++) {
+        int flags = fcntl(fds[i], F_GETFL);
+        check((flags != -1) && (fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) != -1),
+                "Could not make scheduler pipe non-blocking");
+    }
+    return true;
+
+error:
+    for (int i=0; i<2; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+    return false;
+}
+
+
+static void
+Scheduler_pipe_close(int fds[2])
+{
+    for (int i=0; i<2; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+
+/**
+ * a full pipe already wakes the reader, so failed writes are ignored
+ */
+static void
+Scheduler_pipe_notify(int fds[2])
+{
+    if (write(fds[1], "", 1) == -1) {
+        // nothing to do
+    }
+}
+
+
+static void
+Scheduler_pipe_drain(int fds[2])
+{
+    char buf[64];
+    while (read(fds[0], buf, sizeof(buf)) > 0) {
+        // empty the pipe
+    }
+}
+
+
+bool
+Scheduler_init(Scheduler * sched, size_t n_workers)
+{
+    memset(sched, 0, sizeof(Scheduler));
+    sched->reply_fds[0] = -1;
+    sched->reply_fds[1] = -1;
+
+    sched->queues = calloc(sizeof(SchedulerQueue), n_workers);
+    check_mem(sched->queues);
+    for (size_t i=0; i<n_workers; i++) {
+        sched->queues[i].wakeup_fds[0] = -1;
+        sched->queues[i].wakeup_fds[1] = -1;
+    }
+    sched->n_workers = n_workers;
+    sched->n_active = n_workers;
+
+    check(Scheduler_pipe(sched->reply_fds), "Could not create reply pipe");
+    for (size_t i=0; i<n_workers; i++) {
+        check(Scheduler_pipe(sched->queues[i].wakeup_fds), "Could not create wakeup pipe");
+    }
+    return true;
+
+error:
+    Scheduler_deinit(sched);
+    return false;
+}
+
+
+void
+Scheduler_deinit(Scheduler * sched)
+{
+    SchedulerJob * job = NULL;
+
+    if (sched->queues != NULL) {
+        for (size_t i=0; i<sched->n_workers; i++) {
+            SchedulerQueue * queue = &(sched->queues[i]);
+            for (int l=0; l<SCHEDULER_N_LANES; l++) {
+                SchedulerLane * lane = &(queue->lanes[l]);
+                for (size_t pos = lane->head; pos != lane->tail; pos++) {
+                    SchedulerJob_destroy(lane->jobs[pos & SCHEDULER_QUEUE_MASK]);
+                }
+            }
+            Scheduler_pipe_close(queue->wakeup_fds);
+        }
+        free(sched->queues);
+        sched->queues = NULL;
+    }
+
+    for (int l=0; l<SCHEDULER_N_LANES; l++) {
+        SchedulerJob_destroy(sched->held[l]);
+        sched->held[l] = NULL;
+    }
+
+    job = sched->replies;
+    while (job != NULL) {
+        SchedulerJob * next = job->next;
+        SchedulerJob_destroy(job);
+        job = next;
+    }
+    sched->replies = NULL;
+
+    Scheduler_pipe_close(sched->reply_fds);
+    sched->n_workers = 0;
+}
+
+
+void
+SchedulerJob_destroy(SchedulerJob * job)
+{
+    if (job != NULL) {
+        for (size_t i=0; i<job->n_envelope; i++) {
+            zmq_msg_close(&(job->envelope[i]));
+        }
+        zmq_msg_close(&(job->request));
+        zmq_msg_close(&(job->request_data));
+        zmq_msg_close(&(job->reply));
+        zmq_msg_close(&(job->reply_data));
+        free(job);
+    }
+}
+
+
+/**
+ * wake "worker" if it is sleeping
+ *
+ * returns true if it was sleeping
+ */
+static bool
+Scheduler_wake(Scheduler * sched, size_t worker)
+{
+    SchedulerQueue * queue = &(sched->queues[worker]);
+    int sleeping = 1;
+
+    if (__atomic_compare_exchange_n(&(queue->sleeping), &sleeping, 0, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        Scheduler_pipe_notify(queue->wakeup_fds);
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * the lane of a request. only reads and writes are bulk transfers
+ */
+static SchedulerLaneType
+Scheduler_classify(zmq_msg_t * request)
+{
+    switch (Request_peek_type(request)) {
+        case RHIZOFS__REQUEST_TYPE__READ:
+        case RHIZOFS__REQUEST_TYPE__WRITE:
+            return SCHEDULER_LANE_BULK;
+        default:
+            return SCHEDULER_LANE_METADATA;
+    }
+}
+
+
+/**
+ * the index of the first worker taking bulk jobs
+ */
+static size_t
+Scheduler_first_bulk_worker(Scheduler * sched, size_t n_active)
+{
+    size_t n_reserved = __atomic_load_n(&(sched->n_reserved), __ATOMIC_SEQ_CST);
+    return (n_reserved < n_active) ? n_reserved : (n_active - 1);
+}
+
+
+/**
+ * add a job to the queue of a worker taking jobs of its lane. a
+ * sleeping worker is preferred, so it does not have to steal the job
+ *
+ * returns false if all queues of the lane are full
+ */
+static bool
+Scheduler_push(Scheduler * sched, SchedulerJob * job)
+{
+    size_t n_active = __atomic_load_n(&(sched->n_active), __ATOMIC_SEQ_CST);
+    size_t first = 0;
+    size_t n_candidates = 0;
+    size_t target = 0;
+    bool found = false;
+
+    if (n_active == 0) {
+        return false;
+    }
+
+    if (job->lane == SCHEDULER_LANE_BULK) {
+        first = Scheduler_first_bulk_worker(sched, n_active);
+    }
+    n_candidates = n_active - first;
+
+    size_t * next_queue = &(sched->next_queue[job->lane]);
+    for (size_t i=0; i<n_candidates; i++) {
+        size_t worker = first + ((*next_queue + i) % n_candidates);
+        if (__atomic_load_n(&(sched->queues[worker].sleeping), __ATOMIC_RELAXED)) {
+            target = worker - first;
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        target = (*next_queue) % n_candidates;
+    }
+    (*next_queue) = (target + 1) % n_candidates;
+
+    for (size_t i=0; i<n_candidates; i++) {
+        size_t worker = first + ((target + i) % n_candidates);
+        SchedulerLane * lane = &(sched->queues[worker].lanes[job->lane]);
+        size_t tail = lane->tail;
+        size_t head = __atomic_load_n(&(lane->head), __ATOMIC_ACQUIRE);
+
+        if ((tail - head) >= SCHEDULER_QUEUE_SIZE) {
+            continue;
+        }
+
+        __atomic_store_n(&(lane->jobs[tail & SCHEDULER_QUEUE_MASK]), job, __ATOMIC_RELAXED);
+        __atomic_store_n(&(lane->tail), tail + 1, __ATOMIC_RELEASE);
+
+        // pairs with the check of n_queued in Scheduler_wait, so
+        // either the worker sees the job or we see it sleeping
+        __atomic_add_fetch(&(sched->n_queued[job->lane]), 1, __ATOMIC_SEQ_CST);
+
+        // workers which have just become inactive or reserved may
+        // miss the job. it is stolen by another one in that case
+        if (!Scheduler_wake(sched, worker)) {
+            for (size_t j=1; j<n_candidates; j++) {
+                if (Scheduler_wake(sched, first + ((worker - first + j) % n_candidates))) {
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * take the job at the head of a lane of a queue
+ */
+static SchedulerJob *
+Scheduler_pop(Scheduler * sched, SchedulerQueue * queue, SchedulerLaneType lane_type)
+{
+    SchedulerLane * lane = &(queue->lanes[lane_type]);
+    size_t head = __atomic_load_n(&(lane->head), __ATOMIC_ACQUIRE);
+
+    while (true) {
+        size_t tail = __atomic_load_n(&(lane->tail), __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            return NULL;
+        }
+
+        // the slot is not reused before the head has moved past it,
+        // in which case the exchange fails
+        SchedulerJob * job = __atomic_load_n(&(lane->jobs[head & SCHEDULER_QUEUE_MASK]),
+                __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&(lane->head), &head, head + 1, false,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_sub_fetch(&(sched->n_queued[lane_type]), 1, __ATOMIC_SEQ_CST);
+
+            job->started_ns = Scheduler_now_ns();
+            __atomic_add_fetch(&(sched->n_running), 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&(sched->n_jobs[lane_type]), 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&(sched->wait_ns[lane_type]), job->started_ns - job->queued_ns,
+                    __ATOMIC_RELAXED);
+            return job;
+        }
+    }
+}
+
+
+static bool
+Scheduler_is_active(Scheduler * sched, size_t worker)
+{
+    return (worker < __atomic_load_n(&(sched->n_active), __ATOMIC_SEQ_CST));
+}
+
+
+/**
+ * check if "worker" takes bulk jobs
+ */
+static bool
+Scheduler_takes_bulk(Scheduler * sched, size_t worker)
+{
+    size_t n_active = __atomic_load_n(&(sched->n_active), __ATOMIC_SEQ_CST);
+    return (worker >= n_active) || (worker >= Scheduler_first_bulk_worker(sched, n_active));
+}
+
+
+SchedulerJob *
+Scheduler_try_next(Scheduler * sched, size_t worker)
+{
+    SchedulerJob * job = NULL;
+
+    if (!Scheduler_is_active(sched, worker)) {
+        job = Scheduler_pop(sched, &(sched->queues[worker]), SCHEDULER_LANE_METADATA);
+        if (job == NULL) {
+            job = Scheduler_pop(sched, &(sched->queues[worker]), SCHEDULER_LANE_BULK);
+        }
+        return job;
+    }
+
+    for (int l=0; l<SCHEDULER_N_LANES; l++) {
+        if ((l == SCHEDULER_LANE_BULK) && !Scheduler_takes_bulk(sched, worker)) {
+            break;
+        }
+        for (size_t i=0; i<sched->n_workers; i++) {
+            job = Scheduler_pop(sched, &(sched->queues[(worker + i) % sched->n_workers]),
+                    (SchedulerLaneType)l);
+            if (job != NULL) {
+                return job;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+bool
+Scheduler_wait(Scheduler * sched, size_t worker, int fd)
+{
+    SchedulerQueue * queue = &(sched->queues[worker]);
+    struct pollfd pollset[2] = {
+        { queue->wakeup_fds[0], POLLIN, 0 },
+        { fd, POLLIN, 0 }
+    };
+
+    if (!Scheduler_is_active(sched, worker)) {
+        bool queued = false;
+        for (int l=0; l<SCHEDULER_N_LANES; l++) {
+            SchedulerLane * lane = &(queue->lanes[l]);
+            size_t head = __atomic_load_n(&(lane->head), __ATOMIC_ACQUIRE);
+            queued = queued || (head != __atomic_load_n(&(lane->tail), __ATOMIC_ACQUIRE));
+        }
+        return queued && !__atomic_load_n(&(sched->stopping), __ATOMIC_SEQ_CST);
+    }
+
+    __atomic_store_n(&(queue->sleeping), 1, __ATOMIC_SEQ_CST);
+
+    size_t n_queued = __atomic_load_n(&(sched->n_queued[SCHEDULER_LANE_METADATA]),
+            __ATOMIC_SEQ_CST);
+    if (Scheduler_takes_bulk(sched, worker)) {
+        n_queued += __atomic_load_n(&(sched->n_queued[SCHEDULER_LANE_BULK]), __ATOMIC_SEQ_CST);
+    }
+
+    if ((n_queued == 0)
+            && !__atomic_load_n(&(sched->stopping), __ATOMIC_SEQ_CST)) {
+        if ((poll(pollset, (fd == -1) ? 1 : 2, -1) == -1) && (errno != EINTR)) {
+            log_err("Could not wait for jobs");
+        }
+    }
+
+    __atomic_store_n(&(queue->sleeping), 0, __ATOMIC_SEQ_CST);
+    Scheduler_pipe_drain(queue->wakeup_fds);
+
+    return !__atomic_load_n(&(sched->stopping), __ATOMIC_SEQ_CST);
+}
+
+
+SchedulerJob *
+Scheduler_next(Scheduler * sched, size_t worker)
+{
+    while (!__atomic_load_n(&(sched->stopping), __ATOMIC_SEQ_CST)) {
+        SchedulerJob * job = Scheduler_try_next(sched, worker);
+        if (job != NULL) {
+            return job;
+        }
+        if (!Scheduler_wait(sched, worker, -1)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * pass a job back to the front end
+ */
+static void
+Scheduler_return(Scheduler * sched, SchedulerJob * job)
+{
+    SchedulerJob * head = NULL;
+
+    __atomic_sub_fetch(&(sched->n_running), 1, __ATOMIC_RELAXED);
+
+    head = __atomic_load_n(&(sched->replies), __ATOMIC_RELAXED);
+
+    do {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&(sched->replies), &head, job, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // the front end is woken for the first reply only. it takes
+    // all replies at once
+    if (head == NULL) {
+        Scheduler_pipe_notify(sched->reply_fds);
+    }
+}
+
+
+void
+Scheduler_reply(Scheduler * sched, SchedulerJob * job)
+{
+    __atomic_add_fetch(&(sched->busy_ns), Scheduler_now_ns() - job->started_ns,
+            __ATOMIC_RELAXED);
+    Scheduler_return(sched, job);
+}
+
+
+void
+Scheduler_drop(Scheduler * sched, SchedulerJob * job)
+{
+    if (job != NULL) {
+        // the front end still accounts the job to its client
+        job->dropped = true;
+        Scheduler_return(sched, job);
+    }
+}
+
+
+void
+Scheduler_set_active(Scheduler * sched, size_t n_active)
+{
+    size_t previous = 0;
+
+    if (n_active > sched->n_workers) {
+        n_active = sched->n_workers;
+    }
+    previous = __atomic_exchange_n(&(sched->n_active), n_active, __ATOMIC_SEQ_CST);
+
+    // the workers leaving may be waiting for jobs
+    for (size_t i=n_active; i<previous; i++) {
+        Scheduler_pipe_notify(sched->queues[i].wakeup_fds);
+    }
+}
+
+
+void
+Scheduler_set_reserved(Scheduler * sched, size_t n_reserved)
+{
+    __atomic_store_n(&(sched->n_reserved), n_reserved, __ATOMIC_SEQ_CST);
+
+    // bulk jobs may be left in the queues of newly reserved workers,
+    // or wait for the workers released
+    for (size_t i=0; i<sched->n_workers; i++) {
+        Scheduler_pipe_notify(sched->queues[i].wakeup_fds);
+    }
+}
+
+
+void
+Scheduler_get_stats(Scheduler * sched, SchedulerStats * stats)
+{
+    stats->n_queued = 0;
+    for (int l=0; l<SCHEDULER_N_LANES; l++) {
+        stats->n_jobs[l] = __atomic_load_n(&(sched->n_jobs[l]), __ATOMIC_RELAXED);
+        stats->wait_ns[l] = __atomic_load_n(&(sched->wait_ns[l]), __ATOMIC_RELAXED);
+        stats->n_queued += __atomic_load_n(&(sched->n_queued[l]), __ATOMIC_RELAXED);
+    }
+    stats->busy_ns = __atomic_load_n(&(sched->busy_ns), __ATOMIC_RELAXED);
+    stats->n_running = __atomic_load_n(&(sched->n_running), __ATOMIC_RELAXED);
+}
+
+
+void
+Scheduler_stop(Scheduler * sched)
+{
+    __atomic_store_n(&(sched->stopping), 1, __ATOMIC_SEQ_CST);
+
+    if (sched->queues != NULL) {
+        for (size_t i=0; i<sched->n_workers; i++) {
+            Scheduler_pipe_notify(sched->queues[i].wakeup_fds);
+        }
+    }
+    if (sched->reply_fds[1] != -1) {
+        Scheduler_pipe_notify(sched->reply_fds);
+    }
+}
+
+
+/**
+ * receive the next request, its envelope and its data frame without
+ * blocking
+ *
+ * returns 1 if a request was received, 0 if there is none and -1
+ * on error
+ */
+static int
+Scheduler_recv(void * socket, SchedulerJob ** job_out)
+{
+    SchedulerJob * job = NULL;
+    bool overflow = false;
+    bool in_body = false;
+    size_t n_parts = 0;
+    size_t n_body = 0;
+    zmq_msg_t msg;
+
+    job = calloc(sizeof(SchedulerJob), 1);
+    check_mem(job);
+    zmq_msg_init(&(job->request));
+    zmq_msg_init(&(job->request_data));
+    zmq_msg_init(&(job->reply));
+    zmq_msg_init(&(job->reply_data));
+
+    while (true) {
+        zmq_msg_init(&msg);
+        if (zmq_msg_recv(&msg, socket, (n_parts == 0) ? ZMQ_DONTWAIT : 0) == -1) {
+            zmq_msg_close(&msg);
+            if ((errno == EAGAIN) && (n_parts == 0)) {
+                SchedulerJob_destroy(job);
+                return 0;
+            }
+            goto error;
+        }
+        n_parts++;
+        bool more = zmq_msg_more(&msg);
+
+        if (!in_body && more) {
+            // everything up to the empty delimiter is routing information
+            in_body = (zmq_msg_size(&msg) == 0);
+            if (job->n_envelope < SCHEDULER_MAX_ENVELOPE) {
+                zmq_msg_init(&(job->envelope[job->n_envelope]));
+                zmq_msg_move(&(job->envelope[job->n_envelope]), &msg);
+                job->n_envelope++;
+            }
+            else {
+                overflow = true;
+            }
+        }
+        else if (n_body == 0) {
+            zmq_msg_move(&(job->request), &msg);
+            n_body++;
+        }
+        else if (n_body == 1) {
+            zmq_msg_move(&(job->request_data), &msg);
+            n_body++;
+        }
+        else {
+            overflow = true;
+        }
+        zmq_msg_close(&msg);
+
+        if (!more) {
+            break;
+        }
+    }
+
+    if (overflow) {
+        log_warn("Dropping a request with more than %d routing frames or more "
+                "than one data frame", SCHEDULER_MAX_ENVELOPE);
+        SchedulerJob_destroy(job);
+        return 0;
+    }
+
+    (*job_out) = job;
+    return 1;
+
+error:
+    {
+        int saved_errno = errno;
+        SchedulerJob_destroy(job);
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+
+/**
+ * send the reply of a job to the client it came from
+ *
+ * returns false if the socket failed
+ */
+static bool
+Scheduler_send(void * socket, SchedulerJob * job)
+{
+    size_t data_size = zmq_msg_size(&(job->reply_data));
+
+    for (size_t i=0; i<job->n_envelope; i++) {
+        if (zmq_msg_send(&(job->envelope[i]), socket, ZMQ_SNDMORE) == -1) {
+            return false;
+        }
+    }
+    if (zmq_msg_send(&(job->reply), socket, (data_size > 0) ? ZMQ_SNDMORE : 0) == -1) {
+        return false;
+    }
+    if ((data_size > 0) && (zmq_msg_send(&(job->reply_data), socket, 0) == -1)) {
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * answer a job the fair queue did not take with EAGAIN, so the client
+ * does not have to wait for its timeout
+ *
+ * returns false if the socket failed
+ */
+static bool
+Scheduler_reject(void * socket, SchedulerJob * job)
+{
+    Rhizofs__Response * response = NULL;
+    bool success = true;
+
+    response = Response_create();
+    check_mem(response);
+    response->requesttype = Request_peek_type(&(job->request));
+    Response_set_errno(response, EAGAIN);
+
+    // the message is closed again on failure
+    zmq_msg_close(&(job->reply));
+    if (!Response_pack(response, &(job->reply), NULL)) {
+        zmq_msg_init(&(job->reply));
+        log_and_error("Could not pack the rejection");
+    }
+
+    success = Scheduler_send(socket, job);
+    if (!success) {
+        log_err("Could not send reply: %s", zmq_strerror(errno));
+    }
+
+error:
+    Response_destroy(response);
+    SchedulerJob_destroy(job);
+    return success;
+}
+
+
+/**
+ * send all replies passed to Scheduler_reply and account the jobs
+ * returned to their clients
+ *
+ * returns false if the socket failed
+ */
+static bool
+Scheduler_send_replies(Scheduler * sched, void * socket, FairQueue * fq)
+{
+    SchedulerJob * job = NULL;
+    SchedulerJob * ordered = NULL;
+    bool success = true;
+
+    Scheduler_pipe_drain(sched->reply_fds);
+
+    // restore the order the replies were added in
+    job = __atomic_exchange_n(&(sched->replies), NULL, __ATOMIC_ACQUIRE);
+    while (job != NULL) {
+        SchedulerJob * next = job->next;
+        job->next = ordered;
+        ordered = job;
+        job = next;
+    }
+
+    while (ordered != NULL) {
+        job = ordered;
+        ordered = job->next;
+
+        if (job->dropped) {
+            FairQueue_done(fq, job, 0);
+            SchedulerJob_destroy(job);
+            continue;
+        }
+        FairQueue_done(fq, job, zmq_msg_size(&(job->reply)) + zmq_msg_size(&(job->reply_data)));
+
+        if (success) {
+            success = Scheduler_send(socket, job);
+            if (!success) {
+                log_err("Could not send reply: %s", zmq_strerror(errno));
+            }
+        }
+        SchedulerJob_destroy(job);
+    }
+    return success;
+}
+
+
+/**
+ * hand jobs from the fair queue to the workers, keeping up to
+ * SCHEDULER_DISPATCH_DEPTH jobs per active worker queued in each lane
+ *
+ * returns the time (in milliseconds) until a throttled client may
+ * continue or idle clients are looked for, or -1
+ */
+static long
+Scheduler_dispatch(Scheduler * sched, FairQueue * fq)
+{
+    size_t n_active = __atomic_load_n(&(sched->n_active), __ATOMIC_SEQ_CST);
+    uint64_t now_ns = Scheduler_now_ns();
+    uint64_t retry_ns = 0;
+
+    for (int l=0; l<SCHEDULER_N_LANES; l++) {
+        while (__atomic_load_n(&(sched->n_queued[l]), __ATOMIC_SEQ_CST)
+                < (n_active * SCHEDULER_DISPATCH_DEPTH)) {
+            if (sched->held[l] == NULL) {
+                sched->held[l] = FairQueue_next(fq, (SchedulerLaneType)l, now_ns, &retry_ns);
+                if (sched->held[l] == NULL) {
+                    break;
+                }
+            }
+            if (!Scheduler_push(sched, sched->held[l])) {
+                break;
+            }
+            sched->held[l] = NULL;
+        }
+    }
+
+    // idle connections are looked for while there are clients, so
+    // their handles are released without further requests
+    long timeout = FairQueue_expire(fq, now_ns);
+
+    if (retry_ns == 0) {
+        return timeout;
+    }
+    long retry_msec = (long)((retry_ns + 999999) / 1000000);
+    return ((timeout == -1) || (retry_msec < timeout)) ? retry_msec : timeout;
+}
+
+
+bool
+Scheduler_run(Scheduler * sched, void * socket, FairQueue * fq)
+{
+    while (!__atomic_load_n(&(sched->stopping), __ATOMIC_SEQ_CST)) {
+        check(Scheduler_send_replies(sched, socket, fq), "Could not send replies");
+
+        // receive until the fair queue is full. the requests left
+        // are received once the workers caught up
+        while (!FairQueue_full(fq)) {
+            SchedulerJob * job = NULL;
+            int rc = Scheduler_recv(socket, &job);
+            if (rc == 0) {
+                break;
+            }
+            if (rc == -1) {
+                if (errno == ETERM) {
+                    debug("the context has been terminated leaving the scheduler loop");
+                    return true;
+                }
+                break;
+            }
+
+            job->lane = Scheduler_classify(&(job->request));
+            job->queued_ns = Scheduler_now_ns();
+            if (!FairQueue_add(fq, job)) {
+                if (errno == EAGAIN) {
+                    check(Scheduler_reject(socket, job), "Could not send replies");
+                }
+                else {
+                    SchedulerJob_destroy(job);
+                }
+            }
+        }
+
+        long timeout = Scheduler_dispatch(sched, fq);
+
+        zmq_pollitem_t pollset[] = {
+            { socket, 0, FairQueue_full(fq) ? 0 : ZMQ_POLLIN, 0 },
+            { NULL, sched->reply_fds[0], ZMQ_POLLIN, 0 }
+        };
+        if ((zmq_poll(pollset, 2, timeout) == -1) && (errno == ETERM)) {
+            debug("the context has been terminated leaving the scheduler loop");
+            break;
+        }
+    }
+    return true;
+
+error:
+    return false;
+}
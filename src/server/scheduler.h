@@ -0,0 +1,253 @@
+#ifndef __server_scheduler_h__
+#define __server_scheduler_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <zmq.h>
+
+/* number of jobs queued per worker. has to be a power of two */
+#define SCHEDULER_QUEUE_SIZE 256
+
+/* maximum number of routing frames in front of a request */
+#define SCHEDULER_MAX_ENVELOPE 8
+
+/* number of jobs per active worker handed out by the front end ahead of
+ * the workers. the others wait in the fair queue, so the requests of a
+ * new client do not queue up behind those of a busy one */
+#define SCHEDULER_DISPATCH_DEPTH 4
+
+
+struct FairQueue;
+struct FairQueueClient;
+struct FairQueueConnection;
+
+
+/**
+ * requests are queued in separate lanes by their type. workers take
+ * metadata requests before bulk data transfers, so listing a directory
+ * does not wait behind a large copy
+ */
+typedef enum SchedulerLaneType {
+    SCHEDULER_LANE_METADATA = 0,
+    SCHEDULER_LANE_BULK,
+    SCHEDULER_N_LANES
+} SchedulerLaneType;
+
+
+/**
+ * a request received by the front end and the reply to it
+ */
+typedef struct SchedulerJob {
+    // the routing frames the reply has to be sent with
+    zmq_msg_t envelope[SCHEDULER_MAX_ENVELOPE];
+    size_t n_envelope;
+
+    zmq_msg_t request;
+    SchedulerLaneType lane;
+
+    // the frame with the data of the request, sent after it. empty
+    // if there is none
+    zmq_msg_t request_data;
+
+    // filled by the worker before the job is passed to Scheduler_reply.
+    // "reply_data" is sent after the reply unless it is empty
+    zmq_msg_t reply;
+    zmq_msg_t reply_data;
+
+    // link in the queue of the client and in the stack of replies
+    struct SchedulerJob * next;
+
+    // the client which sent the request and its connection
+    struct FairQueueClient * client;
+    struct FairQueueConnection * connection;
+
+    // passed to Scheduler_drop. no reply is sent
+    bool dropped;
+
+    // monotonic times (in nanoseconds) the job was queued and taken
+    // by a worker
+    uint64_t queued_ns;
+    uint64_t started_ns;
+} SchedulerJob;
+
+
+/**
+ * the jobs of a lane queued for a worker. the front end adds jobs at
+ * the tail, the worker and the workers stealing from it take them from
+ * the head without locking
+ */
+typedef struct SchedulerLane {
+    size_t head;
+    size_t tail;
+    SchedulerJob * jobs[SCHEDULER_QUEUE_SIZE];
+} SchedulerLane;
+
+
+typedef struct SchedulerQueue {
+    SchedulerLane lanes[SCHEDULER_N_LANES];
+
+    // the worker waits for jobs in Scheduler_wait
+    int sleeping;
+
+    // a byte is written to wake the sleeping worker
+    int wakeup_fds[2];
+} SchedulerQueue;
+
+
+/**
+ * counters of the jobs executed, read by the autoscaling of the
+ * worker pool
+ */
+typedef struct SchedulerStats {
+    // jobs taken by the workers, per lane
+    uint64_t n_jobs[SCHEDULER_N_LANES];
+
+    // time the jobs spent in the queues, per lane
+    uint64_t wait_ns[SCHEDULER_N_LANES];
+
+    // time from taking jobs to replying to them
+    uint64_t busy_ns;
+
+    // jobs currently queued and currently executed
+    size_t n_queued;
+    size_t n_running;
+} SchedulerStats;
+
+
+/**
+ * hands the requests received on the socket of the server to the
+ * workers and sends their replies back
+ *
+ * the socket is only used by the thread running Scheduler_run. idle
+ * workers steal from the queues of the busy ones, so a slow request
+ * only delays the requests of its own worker until another one is free
+ */
+typedef struct Scheduler {
+    SchedulerQueue * queues;
+    size_t n_workers;
+
+    // jobs are only queued for the workers below this index. the
+    // others finish their queued jobs and leave
+    size_t n_active;
+
+    // the workers below this index only take metadata jobs. at least
+    // one active worker takes bulk jobs
+    size_t n_reserved;
+
+    // queue the next job of a lane is added to, if no worker is
+    // sleeping. only used by the front end
+    size_t next_queue[SCHEDULER_N_LANES];
+
+    // number of jobs in the queues, per lane
+    size_t n_queued[SCHEDULER_N_LANES];
+
+    size_t n_running;
+    uint64_t n_jobs[SCHEDULER_N_LANES];
+    uint64_t wait_ns[SCHEDULER_N_LANES];
+    uint64_t busy_ns;
+
+    // replies waiting to be sent, the most recent first
+    SchedulerJob * replies;
+
+    // a byte is written when a reply is added to an empty stack
+    int reply_fds[2];
+
+    // jobs taken from the fair queue which did not fit into the
+    // queues of the workers. only used by the front end
+    SchedulerJob * held[SCHEDULER_N_LANES];
+
+    int stopping;
+} Scheduler;
+
+
+/**
+ * set up the queues of up to "n_workers" workers, all of them active
+ *
+ * returns false on error
+ */
+bool Scheduler_init(Scheduler * sched, size_t n_workers);
+
+/**
+ * destroy all jobs left in the scheduler. the workers have to be
+ * stopped
+ */
+void Scheduler_deinit(Scheduler * sched);
+
+/**
+ * receive requests on "socket", hand them to the workers in the order
+ * given by "fairqueue" and send the replies. returns when the zmq context
+ * is terminated or the scheduler is stopped
+ *
+ * returns false on error
+ */
+bool Scheduler_run(Scheduler * sched, void * socket, struct FairQueue * fairqueue);
+
+/**
+ * wake all workers and let Scheduler_next return NULL
+ *
+ * safe to call from a signal handler
+ */
+void Scheduler_stop(Scheduler * sched);
+
+/**
+ * queue jobs for the workers below "n_active" only. the workers above
+ * finish the jobs already queued for them. Scheduler_next returns NULL
+ * for them afterwards
+ */
+void Scheduler_set_active(Scheduler * sched, size_t n_active);
+
+/**
+ * let the workers below "n_reserved" take metadata jobs only
+ */
+void Scheduler_set_reserved(Scheduler * sched, size_t n_reserved);
+
+/**
+ * get a snapshot of the counters
+ */
+void Scheduler_get_stats(Scheduler * sched, SchedulerStats * stats);
+
+/**
+ * get the next job for "worker", waiting if there is none
+ *
+ * returns NULL when the scheduler has been stopped or the worker
+ * is not active anymore
+ */
+SchedulerJob * Scheduler_next(Scheduler * sched, size_t worker);
+
+/**
+ * get the next job for "worker" without waiting. metadata jobs are
+ * taken before bulk jobs, from the queue of the worker first, then from
+ * the queues of the others. reserved workers take metadata jobs only,
+ * inactive workers only the jobs of their own queue
+ *
+ * returns NULL if no job is queued
+ */
+SchedulerJob * Scheduler_try_next(Scheduler * sched, size_t worker);
+
+/**
+ * wait until jobs are queued or "fd" becomes readable. "fd" may be -1
+ *
+ * returns false when the scheduler has been stopped or the worker is
+ * not active anymore and its queue is empty
+ */
+bool Scheduler_wait(Scheduler * sched, size_t worker, int fd);
+
+/**
+ * pass a job with its reply set back to the front end, which sends
+ * the reply and destroys the job
+ */
+void Scheduler_reply(Scheduler * sched, SchedulerJob * job);
+
+/**
+ * pass a job taken by a worker back to the front end without replying
+ * to it
+ */
+void Scheduler_drop(Scheduler * sched, SchedulerJob * job);
+
+/**
+ */
+void SchedulerJob_destroy(SchedulerJob * job);
+
+#endif /* __server_scheduler_h__ */
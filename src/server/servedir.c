@@ -2,6 +2,7 @@
 
 #include <limits.h> /* for PATH_MAX */
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <stdio.h>
 #include <errno.h>
@@ -14,12 +15,15 @@
 #include <zmq.h>
 
 #include "../dbg.h"
+#include "../codec.h"
+#include "../compresspolicy.h"
 #include "../datablock.h"
 #include "../path.h"
 #include "../helpers.h"
 #include "../response.h"
 #include "../request.h"
 #include "../proto/rhizofs.pb-c.h"
+#include "fairqueue.h"
 
 #if !defined PATH_MAX && defined _PC_PATH_MAX
 #define PATH_MAX (pathconf ("/", _PC_PATH_MAX) < 1 ? 4096 \
@@ -46,17 +50,31 @@ static const int default_file_creation_permissions =
 
 // prototypes
 static int ServeDir_fullpath(const ServeDir * sd, const Rhizofs__Request * request, char ** fullpath);
-static int ServeDir_op_ping(Rhizofs__Response * response);
+static uint64_t ServeDir_listing_validator(const struct stat * sb);
+static bool ServeDir_set_read_data(const ServeDir * sd, const Rhizofs__Request * request,
+        Rhizofs__Response * response, BufferPoolBuffer * buffer, size_t len,
+        zmq_msg_t * reply_data);
+static bool ServeDir_pack(const Rhizofs__Request * request, Rhizofs__Response * response,
+        SchedulerJob * job);
+static zmq_msg_t * ServeDir_reply_frame(const Rhizofs__Request * request, SchedulerJob * job);
+static int ServeDir_op_ping(const ServeDir * sd, Rhizofs__Response * response);
 static int ServeDir_op_invalid(Rhizofs__Response * response);
+static int ServeDir_dispatch(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response * response,
+        zmq_msg_t * reply_data);
+static int ServeDir_op_read(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response * response,
+        zmq_msg_t * reply_data);
+#ifdef RHIZO_HAVE_URING
+static bool ServeDir_serve_uring(ServeDir * sd);
+#endif
 #define SERVEDIR_OP(NAME)   \
     static int ServeDir_op_ ## NAME (const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response * response);
 SERVEDIR_OP(access)
 SERVEDIR_OP(chmod)
+SERVEDIR_OP(compound)
 SERVEDIR_OP(create)
 SERVEDIR_OP(getattr)
 SERVEDIR_OP(mkdir)
 SERVEDIR_OP(open)
-SERVEDIR_OP(read)
 SERVEDIR_OP(readdir)
 SERVEDIR_OP(rename)
 SERVEDIR_OP(rmdir)
@@ -69,19 +87,30 @@ SERVEDIR_OP(symlink)
 SERVEDIR_OP(readlink)
 SERVEDIR_OP(mknod)
 SERVEDIR_OP(statfs)
+SERVEDIR_OP(release)
 #undef SERVEDIR_OP
 
 
 
 ServeDir *
-ServeDir_create(void *context, char *socket_name, char *directory)
+ServeDir_create(Scheduler * scheduler, size_t worker, char *directory,
+        HandleTable * handles, StatPool * statpool, FdCache * fdcache,
+        Metrics * metrics, CompressPolicy * compresspolicy, bool use_uring,
+        bool huge_pages)
 {
     ServeDir * sd = NULL;
     sd = (ServeDir *)calloc(sizeof(ServeDir), 1);
     check_mem(sd);
 
-    sd->socket = NULL;
+    sd->scheduler = scheduler;
+    sd->worker = worker;
     sd->directory = NULL;
+    sd->handles = handles;
+    sd->statpool = statpool;
+    sd->fdcache = fdcache;
+    sd->metrics = metrics;
+    sd->compresspolicy = compresspolicy;
+    sd->uring = NULL;
     struct stat sr;
 
     /* get the absolute path to the directory */
@@ -94,11 +123,18 @@ ServeDir_create(void *context, char *socket_name, char *directory)
     check((stat((const char*)directory, &sr) == 0), "could not stat %s", directory);
     check(S_ISDIR(sr.st_mode), "%s is not a directory.", directory);
 
-    sd->socket = zmq_socket(context, ZMQ_REP);
-    sd->socket_name = socket_name;
-    check((sd->socket != NULL), "Could not create zmq socket");
-    check((zmq_connect(sd->socket, socket_name) == 0),
-            "could not bind to socket %s", socket_name);
+    sd->bufferpool = BufferPool_create(huge_pages);
+    check_mem(sd->bufferpool);
+
+    if (use_uring) {
+        sd->uring = calloc(sizeof(Uring), 1);
+        check_mem(sd->uring);
+        if (!Uring_init(sd->uring, SERVEDIR_URING_DEPTH)) {
+            log_warn("io_uring is not available (%s). Using blocking I/O", strerror(errno));
+            free(sd->uring);
+            sd->uring = NULL;
+        }
+    }
 
     return sd;
 
@@ -108,9 +144,11 @@ error:
         if (sd->directory != NULL) {
             free(sd->directory); // free the memory allocated by realpath
         }
-        if (sd->socket) {
-            zmq_close(sd->socket);
+        if (sd->uring != NULL) {
+            Uring_deinit(sd->uring);
+            free(sd->uring);
         }
+        BufferPool_destroy(sd->bufferpool);
         free(sd);
     }
     return NULL;
@@ -123,122 +161,181 @@ ServeDir_destroy(ServeDir * sd)
     if (sd) {
         // free the memory allocated by realpath
         free(sd->directory);
-        if (sd->socket != NULL) {
-            zmq_close(sd->socket);
-            sd->socket = NULL;
+        if (sd->uring != NULL) {
+            Uring_deinit(sd->uring);
+            free(sd->uring);
+            sd->uring = NULL;
         }
+        // buffers still being sent return to the pool later
+        BufferPool_destroy(sd->bufferpool);
     }
     free(sd);
 }
 
 
-bool
-ServeDir_serve(ServeDir * sd)
+/**
+ * the key of the connection which sent the request of "job". the
+ * connection is not forgotten by the scheduler before the job has been
+ * replied to
+ */
+static const char *
+ServeDir_client(const SchedulerJob * job)
+{
+    return (job->connection != NULL) ? job->connection->owner : "";
+}
+
+
+/**
+ * execute the request of "job" and pack the response in its reply
+ *
+ * returns false if no reply could be packed
+ */
+static bool
+ServeDir_process(ServeDir * sd, SchedulerJob * job)
 {
-    zmq_msg_t msg_req;
-    zmq_msg_t msg_rep;
-    int term_loop = 0;
     Rhizofs__Request *request = NULL;
     Rhizofs__Response *response = NULL;
+    uint64_t phase_ns[METRICS_N_PHASES];
+    uint64_t start_ns = Metrics_now_ns();
+    uint64_t now_ns = 0;
 
-    debug("Serving directory <%s> on <%s>", sd->directory, sd->socket_name);
+    debug("Received a message");
+    phase_ns[METRICS_PHASE_WAIT] = job->started_ns - job->queued_ns;
 
-    while (term_loop == 0) {
-        int zmq_rc = 0;
+    // create the response message
+    response = Response_create();
+    check_mem(response);
 
-        check((zmq_msg_init(&msg_req) == 0), "Could not initialize request message");
+    request = Request_from_message(&(job->request), &(job->request_data));
+    now_ns = Metrics_now_ns();
+    phase_ns[METRICS_PHASE_UNPACK] = now_ns - start_ns;
+    start_ns = now_ns;
 
-        zmq_rc = zmq_msg_recv(&msg_req, sd->socket, 0);
-        if (zmq_rc != -1) {
-            debug("Received a message");
+    if (request == NULL) {
+        log_warn("Could not unpack incoming message. Skipping");
 
-            // create the response message
-            response = Response_create();
-            check_mem(response);
+        // send back an error
+        response->requesttype = RHIZOFS__REQUEST_TYPE__UNKNOWN;
+        response->errnotype = RHIZOFS__ERRNO__ERRNO_UNSERIALIZABLE;
+    }
+    else {
+        // ensure errno is reset to zero
+        errno = 0;
 
-            request = Request_from_message(&msg_req);
-            if (request == NULL) {
-                log_warn("Could not unpack incoming message. Skipping");
+        sd->client = ServeDir_client(job);
+        int op_rc = ServeDir_dispatch(sd, request, response,
+                ServeDir_reply_frame(request, job));
+        sd->client = NULL;
+        if (op_rc != 0) {
+            log_warn("calling action failed");
+        }
+    }
+    now_ns = Metrics_now_ns();
+    phase_ns[METRICS_PHASE_EXEC] = now_ns - start_ns;
+    start_ns = now_ns;
 
-                // send back an error
-                response->requesttype = RHIZOFS__REQUEST_TYPE__UNKNOWN;
-                response->errnotype = RHIZOFS__ERRNO__ERRNO_UNSERIALIZABLE;
-            }
-            else {
-                int op_rc = 0;
+    // serialize the reply
+    if (!ServeDir_pack(request, response, job)) {
+        log_err("Could not pack message");
+        goto error;
+    }
+    phase_ns[METRICS_PHASE_PACK] = Metrics_now_ns() - start_ns;
 
-                // ensure errno is reset to zero
-                errno = 0;
+    Metrics_record(sd->metrics, request, response,
+            zmq_msg_size(&(job->request)) + zmq_msg_size(&(job->request_data)),
+            zmq_msg_size(&(job->reply)) + zmq_msg_size(&(job->reply_data)), phase_ns);
 
-                switch(request->requesttype) {
-                    case RHIZOFS__REQUEST_TYPE__PING:
-                        op_rc = ServeDir_op_ping(response);
-                        break;
+    Request_from_message_destroy(request);
+    Response_destroy(response);
+    return true;
 
-#define CASE_OP(CNAME, FNAME) \
-                    case RHIZOFS__REQUEST_TYPE__ ## CNAME: \
-                        op_rc = ServeDir_op_ ## FNAME (sd, request, response); \
-                        break;
-
-                    CASE_OP(READDIR, readdir)
-                    CASE_OP(RMDIR, rmdir)
-                    CASE_OP(UNLINK, unlink)
-                    CASE_OP(ACCESS, access)
-                    CASE_OP(RENAME, rename)
-                    CASE_OP(MKDIR, mkdir)
-                    CASE_OP(GETATTR, getattr)
-                    CASE_OP(OPEN, open)
-                    CASE_OP(READ, read)
-                    CASE_OP(WRITE, write)
-                    CASE_OP(CREATE, create)
-                    CASE_OP(TRUNCATE, truncate)
-                    CASE_OP(CHMOD, chmod)
-                    CASE_OP(UTIMENS, utimens)
-                    CASE_OP(LINK, link)
-                    CASE_OP(SYMLINK, symlink)
-                    CASE_OP(READLINK, readlink)
-                    CASE_OP(MKNOD, mknod)
-                    CASE_OP(STATFS, statfs)
-#undef CASE_OP
-                    default:
-                        // dont know what to do with that request
-                        op_rc = ServeDir_op_invalid(response);
-                }
+error:
+    Request_from_message_destroy(request);
+    if (response != NULL) Response_destroy(response);
+    return false;
+}
 
-                if (op_rc != 0) {
-                    log_warn("calling action failed");
-                }
-                Request_from_message_destroy(request);
-            }
 
-            zmq_msg_close(&msg_req);
+bool
+ServeDir_serve(ServeDir * sd)
+{
+    SchedulerJob * job = NULL;
 
-            // serialize the reply
-            check((Response_pack(response, &msg_rep) == true), "Could not pack message");
+    debug("Serving directory <%s> as worker %d", sd->directory, (int)sd->worker);
 
-            //  Send reply back to client
-            check((zmq_msg_send(&msg_rep, sd->socket, 0) != -1), "Could not send message");
-            zmq_msg_close(&msg_rep);
+#ifdef RHIZO_HAVE_URING
+    if (sd->uring != NULL) {
+        return ServeDir_serve_uring(sd);
+    }
+#endif
 
-            Response_destroy(response); response = NULL;
+    while ((job = Scheduler_next(sd->scheduler, sd->worker)) != NULL) {
+        if (ServeDir_process(sd, job)) {
+            Scheduler_reply(sd->scheduler, job);
         }
         else {
-            if (errno == ETERM) {
-                debug("the context has been terminated leaving the servedir loop");
-                zmq_msg_close (&msg_req);
-                term_loop = 1;
-            }
+            Scheduler_drop(sd->scheduler, job);
         }
     }
 
-    debug("Exiting ServeDir_Serve");
+    debug("the scheduler has been stopped leaving the servedir loop");
     return true;
+}
 
-error:
-    zmq_msg_close(&msg_req);
-    zmq_msg_close(&msg_rep);
-    if (response != NULL) Response_destroy(response);
-    return false;
+
+/**
+ * execute a request and fill the response. the data of reads may be
+ * placed directly in "reply_data", which may be NULL
+ *
+ * returns the return code of the operation
+ */
+static int
+ServeDir_dispatch(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response * response,
+        zmq_msg_t * reply_data)
+{
+    int op_rc = 0;
+
+    switch(request->requesttype) {
+        case RHIZOFS__REQUEST_TYPE__PING:
+            op_rc = ServeDir_op_ping(sd, response);
+            break;
+
+#define CASE_OP(CNAME, FNAME) \
+        case RHIZOFS__REQUEST_TYPE__ ## CNAME: \
+            op_rc = ServeDir_op_ ## FNAME (sd, request, response); \
+            break;
+
+        CASE_OP(READDIR, readdir)
+        CASE_OP(RMDIR, rmdir)
+        CASE_OP(UNLINK, unlink)
+        CASE_OP(ACCESS, access)
+        CASE_OP(RENAME, rename)
+        CASE_OP(MKDIR, mkdir)
+        CASE_OP(GETATTR, getattr)
+        CASE_OP(OPEN, open)
+        CASE_OP(WRITE, write)
+        CASE_OP(CREATE, create)
+        CASE_OP(TRUNCATE, truncate)
+        CASE_OP(CHMOD, chmod)
+        CASE_OP(UTIMENS, utimens)
+        CASE_OP(LINK, link)
+        CASE_OP(SYMLINK, symlink)
+        CASE_OP(READLINK, readlink)
+        CASE_OP(MKNOD, mknod)
+        CASE_OP(STATFS, statfs)
+        CASE_OP(RELEASE, release)
+        CASE_OP(COMPOUND, compound)
+#undef CASE_OP
+        case RHIZOFS__REQUEST_TYPE__READ:
+            op_rc = ServeDir_op_read(sd, request, response, reply_data);
+            break;
+
+        default:
+            // dont know what to do with that request
+            op_rc = ServeDir_op_invalid(response);
+    }
+
+    return op_rc;
 }
 
 
@@ -254,6 +351,571 @@ error:
     return -1;
 }
 
+
+/**
+ * requests without a handle use the path of the file
+ */
+static inline bool
+ServeDir_has_handle(const Rhizofs__Request * request)
+{
+    return request->has_handle && (request->handle != HANDLE_NONE);
+}
+
+
+/**
+ * get the fd of the handle passed with the request from the handletable
+ *
+ * the fd has to be returned with HandleTable_put(sd->handles, request->handle)
+ *
+ * returns -1 if the handle is unknown or belongs to another client. the
+ * operation fails with EBADF then, as the file at the path of the
+ * request may not be the one the client opened
+ */
+static int
+ServeDir_handle_fd(const ServeDir * sd, const Rhizofs__Request * request)
+{
+    return HandleTable_get(sd->handles, request->handle, sd->client);
+}
+
+
+/**
+ * get the fd of the handle of a request for an operation on an open
+ * file, which may have been unlinked or renamed since it was opened
+ *
+ * the fd has to be returned with HandleTable_put(sd->handles, request->handle)
+ *
+ * returns -1 and sets EBADF in the response if the handle is unknown
+ */
+static int
+ServeDir_handle_fd_or_fail(const ServeDir * sd, const Rhizofs__Request * request,
+        Rhizofs__Response * response)
+{
+    int fd = ServeDir_handle_fd(sd, request);
+    if (fd == -1) {
+        Response_set_errno(response, EBADF);
+        debug("Unknown handle %llx", (unsigned long long)request->handle);
+    }
+    return fd;
+}
+
+
+/**
+ * store a fd opened by open or create in the handletable and
+ * set the handle in the response
+ *
+ * the handletable takes ownership of the fd. if the table is full the
+ * fd gets closed and the operation fails with ENFILE. a table without
+ * slots keeps no files open, the client uses the path of the file then
+ *
+ * returns false if the fd could not be stored
+ */
+static bool
+ServeDir_set_handle(const ServeDir * sd, Rhizofs__Response * response, int fd)
+{
+    if (sd->handles->max_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    uint64_t handle = HandleTable_add(sd->handles, fd, sd->client);
+
+    if (handle == HANDLE_NONE) {
+        close(fd);
+        Response_set_errno(response, ENFILE);
+        return false;
+    }
+    response->has_handle = 1;
+    response->handle = handle;
+    return true;
+}
+
+#ifdef RHIZO_HAVE_URING
+
+typedef enum UringJobType {
+    URING_JOB_READ,
+    URING_JOB_WRITE,
+    URING_JOB_GETATTR
+} UringJobType;
+
+
+/**
+ * a request waiting for the completion of its I/O
+ */
+typedef struct UringJob {
+    // the request as queued by the scheduler
+    SchedulerJob * sched_job;
+
+    Rhizofs__Request * request;
+    Rhizofs__Response * response;
+    UringJobType type;
+
+    // the file read or written. either from the handletable or
+    // from the fdcache
+    int fd;
+    bool handle_held;
+    FdCacheEntry * cached_fd;
+
+    char * path;
+    uint8_t * data;
+    struct statx stx;
+
+    // the buffer of a read. "data" points into it
+    BufferPoolBuffer * buffer;
+
+    // the decompressed data of a write. NULL if "data" points into
+    // the request or its data frame, which outlive the job
+    uint8_t * decompressed;
+
+    // time spent in the phases so far, and the start of the current one
+    uint64_t phase_ns[METRICS_N_PHASES];
+    uint64_t phase_start_ns;
+} UringJob;
+
+
+static void
+UringJob_destroy(const ServeDir * sd, UringJob * job)
+{
+    if (job == NULL) {
+        return;
+    }
+
+    if (job->handle_held) {
+        HandleTable_put(sd->handles, job->request->handle);
+    }
+    else if (job->cached_fd != NULL) {
+        FdCache_put(sd->fdcache, job->cached_fd);
+    }
+
+    Scheduler_drop(sd->scheduler, job->sched_job);
+    Request_from_message_destroy(job->request);
+    if (job->response != NULL) {
+        Response_destroy(job->response);
+    }
+    if (job->buffer != NULL) {
+        BufferPool_put(job->buffer);
+    }
+    free(job->decompressed);
+    free(job->path);
+    free(job);
+}
+
+
+/**
+ * unpack the request of a job taken from the scheduler
+ *
+ * returns NULL on error. the scheduler job is destroyed in this case
+ */
+static UringJob *
+UringJob_create(const ServeDir * sd, SchedulerJob * sched_job)
+{
+    UringJob * job = NULL;
+
+    debug("Received a message");
+
+    job = calloc(sizeof(UringJob), 1);
+    check_mem(job);
+    job->fd = -1;
+    job->sched_job = sched_job;
+    job->phase_start_ns = Metrics_now_ns();
+    job->phase_ns[METRICS_PHASE_WAIT] = sched_job->started_ns - sched_job->queued_ns;
+
+    job->response = Response_create();
+    check_mem(job->response);
+
+    job->request = Request_from_message(&(sched_job->request), &(sched_job->request_data));
+    job->phase_ns[METRICS_PHASE_UNPACK] = Metrics_now_ns() - job->phase_start_ns;
+    job->phase_start_ns += job->phase_ns[METRICS_PHASE_UNPACK];
+    if (job->request == NULL) {
+        log_warn("Could not unpack incoming message. Skipping");
+
+        // send back an error
+        job->response->requesttype = RHIZOFS__REQUEST_TYPE__UNKNOWN;
+        job->response->errnotype = RHIZOFS__ERRNO__ERRNO_UNSERIALIZABLE;
+    }
+    return job;
+
+error:
+    if (job != NULL) {
+        UringJob_destroy(sd, job);
+    }
+    else {
+        Scheduler_drop(sd->scheduler, sched_job);
+    }
+    return NULL;
+}
+
+
+/**
+ * pass the response of a job to the scheduler and destroy the job
+ */
+static void
+ServeDir_uring_reply(ServeDir * sd, UringJob * job)
+{
+    SchedulerJob * sched_job = job->sched_job;
+    uint64_t now_ns = Metrics_now_ns();
+
+    // includes the time the I/O was in flight
+    job->phase_ns[METRICS_PHASE_EXEC] = now_ns - job->phase_start_ns;
+
+    if (ServeDir_pack(job->request, job->response, sched_job)) {
+        job->phase_ns[METRICS_PHASE_PACK] = Metrics_now_ns() - now_ns;
+        Metrics_record(sd->metrics, job->request, job->response,
+                zmq_msg_size(&(sched_job->request)) + zmq_msg_size(&(sched_job->request_data)),
+                zmq_msg_size(&(sched_job->reply)) + zmq_msg_size(&(sched_job->reply_data)),
+                job->phase_ns);
+        Scheduler_reply(sd->scheduler, sched_job);
+        job->sched_job = NULL;
+    }
+    else {
+        log_err("Could not pack message");
+    }
+    UringJob_destroy(sd, job);
+}
+
+
+/**
+ * get the fd for a READ or WRITE request. only handles and files kept
+ * open by the fdcache are used asynchronously. everything else is
+ * left to the blocking operations, which also report the errors
+ *
+ * returns true if a fd was found
+ */
+static bool
+ServeDir_uring_get_fd(ServeDir * sd, UringJob * job, int flags, mode_t mode)
+{
+    if (ServeDir_has_handle(job->request)) {
+        job->fd = ServeDir_handle_fd(sd, job->request);
+        if (job->fd == -1) {
+            // the blocking operation reports the unknown handle
+            return false;
+        }
+        job->handle_held = true;
+        return true;
+    }
+
+    if (ServeDir_fullpath(sd, job->request, &(job->path)) != 0) {
+        return false;
+    }
+    job->cached_fd = FdCache_get(sd->fdcache, job->path, flags, mode);
+    if (job->cached_fd == NULL) {
+        errno = 0;
+        return false;
+    }
+    if (!job->cached_fd->cached) {
+        // non-regular files keep the semantics of the blocking read
+        FdCache_put(sd->fdcache, job->cached_fd);
+        job->cached_fd = NULL;
+        return false;
+    }
+    job->fd = job->cached_fd->fd;
+    return true;
+}
+
+
+/**
+ * release everything ServeDir_uring_submit got before falling back
+ * to the blocking operation
+ */
+static void
+ServeDir_uring_release(ServeDir * sd, UringJob * job)
+{
+    if (job->handle_held) {
+        HandleTable_put(sd->handles, job->request->handle);
+        job->handle_held = false;
+    }
+    else if (job->cached_fd != NULL) {
+        FdCache_put(sd->fdcache, job->cached_fd);
+        job->cached_fd = NULL;
+    }
+    job->fd = -1;
+    if (job->buffer != NULL) {
+        BufferPool_put(job->buffer);
+        job->buffer = NULL;
+    }
+    free(job->decompressed);
+    job->decompressed = NULL;
+    job->data = NULL;
+    free(job->path);
+    job->path = NULL;
+}
+
+
+/**
+ * submit the I/O of a request to the ring
+ *
+ * returns false if the request has to be executed with the blocking
+ * operations
+ */
+static bool
+ServeDir_uring_submit(ServeDir * sd, UringJob * job)
+{
+    Rhizofs__Request * request = job->request;
+    struct io_uring_sqe * sqe = NULL;
+
+    switch (request->requesttype) {
+        case RHIZOFS__REQUEST_TYPE__READ:
+            if (!request->has_size || !request->has_offset
+                    || (request->size < 0) || (request->size > INT32_MAX)) {
+                return false;
+            }
+            if (!ServeDir_uring_get_fd(sd, job, O_RDONLY, 0)) {
+                goto fallback;
+            }
+            job->buffer = BufferPool_get(sd->bufferpool, (size_t)request->size);
+            if (job->buffer == NULL) {
+                goto fallback;
+            }
+            job->data = job->buffer->data;
+            job->type = URING_JOB_READ;
+            break;
+
+        case RHIZOFS__REQUEST_TYPE__WRITE:
+            if (!request->has_size || !request->has_offset
+                    || (request->size < 0) || (request->size > INT32_MAX)
+                    || (Request_has_data(request) == -1)) {
+                return false;
+            }
+            if (!ServeDir_uring_get_fd(sd, job, O_CREAT | O_WRONLY,
+                    default_file_creation_permissions)) {
+                goto fallback;
+            }
+            // uncompressed data is written straight from the request
+            const uint8_t * block = NULL;
+            int bytes_in_block = DataBlock_peek_data(request->datablock, &block);
+            if (bytes_in_block == -1) {
+                bytes_in_block = DataBlock_get_data(request->datablock, &(job->decompressed));
+                block = job->decompressed;
+            }
+            if (bytes_in_block != (int)request->size) {
+                goto fallback;
+            }
+            job->data = (uint8_t *)block;
+            job->type = URING_JOB_WRITE;
+            break;
+
+        case RHIZOFS__REQUEST_TYPE__GETATTR:
+            if (!sd->uring->has_statx
+                    || (ServeDir_fullpath(sd, request, &(job->path)) != 0)) {
+                goto fallback;
+            }
+            job->type = URING_JOB_GETATTR;
+            break;
+
+        default:
+            return false;
+    }
+
+    sqe = Uring_get_sqe(sd->uring);
+    if (sqe == NULL) {
+        // the entries of the queue are only freed by submitting them
+        if (!Uring_submit(sd->uring) || ((sqe = Uring_get_sqe(sd->uring)) == NULL)) {
+            goto fallback;
+        }
+    }
+
+    switch (job->type) {
+        case URING_JOB_READ:
+        case URING_JOB_WRITE:
+            sqe->opcode = (job->type == URING_JOB_READ) ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd = job->fd;
+            sqe->addr = (uint64_t)(uintptr_t)job->data;
+            sqe->len = (uint32_t)request->size;
+            sqe->off = (uint64_t)request->offset;
+            break;
+
+        case URING_JOB_GETATTR:
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)job->path;
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (uint64_t)(uintptr_t)&(job->stx);
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            break;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)job;
+    return true;
+
+fallback:
+    ServeDir_uring_release(sd, job);
+    return false;
+}
+
+
+/**
+ * fill the response of a job with the result of its I/O
+ */
+static void
+ServeDir_uring_complete(ServeDir * sd, UringJob * job, int32_t result)
+{
+    Rhizofs__Response * response = job->response;
+    ssize_t bytes_read;
+    struct stat sb;
+
+    switch (job->type) {
+        case URING_JOB_READ:
+            response->requesttype = RHIZOFS__REQUEST_TYPE__READ;
+            bytes_read = result;
+            if (result == -ESPIPE) {
+                /* a handle of a non-seekable file */
+                bytes_read = read(job->fd, job->data, (size_t)job->request->size);
+                if (bytes_read == -1) {
+                    result = -errno;
+                }
+            }
+            if (bytes_read >= 0) {
+                // the response takes over the buffer
+                bool data_set = ServeDir_set_read_data(sd, job->request, response, job->buffer,
+                        (size_t)bytes_read, ServeDir_reply_frame(job->request, job->sched_job));
+                job->buffer = NULL;
+                job->data = NULL;
+                if (!data_set) {
+                    log_err("could not set response data");
+                    response->errnotype = RHIZOFS__ERRNO__ERRNO_NOMEM;
+                }
+            }
+            else {
+                Response_set_errno(response, -result);
+                debug("Could not read from %s", job->path);
+            }
+            break;
+
+        case URING_JOB_WRITE:
+            response->requesttype = RHIZOFS__REQUEST_TYPE__WRITE;
+            if (result < 0) {
+                Response_set_errno(response, -result);
+                debug("Could not write %ld bytes to %s", (int64_t)job->request->size, job->path);
+            }
+            response->has_size = 1;
+            response->size = (result < 0) ? -1 : (int)result;
+            break;
+
+        case URING_JOB_GETATTR:
+            response->requesttype = RHIZOFS__REQUEST_TYPE__GETATTR;
+            if (result == 0) {
+                DirScan_statx_to_stat(&(job->stx), &sb);
+                response->attrs = Attrs_create(&sb, NULL);
+                if (response->attrs == NULL) {
+                    log_err("could not create attrs from stat");
+                    response->errnotype = RHIZOFS__ERRNO__ERRNO_NOMEM;
+                }
+            }
+            else {
+                Response_set_errno(response, -result);
+                debug("Could not stat %s", job->path);
+            }
+            break;
+    }
+    errno = 0;
+
+    ServeDir_uring_release(sd, job);
+}
+
+
+/**
+ * answer the requests whose I/O completed. with "reply" false the
+ * jobs are only destroyed
+ */
+static void
+ServeDir_uring_reap(ServeDir * sd, size_t * n_in_flight, bool reply)
+{
+    uint64_t user_data;
+    int32_t result;
+
+    while (Uring_next_completion(sd->uring, &user_data, &result)) {
+        UringJob * job = (UringJob *)(uintptr_t)user_data;
+        (*n_in_flight)--;
+
+        ServeDir_uring_complete(sd, job, result);
+        if (reply) {
+            ServeDir_uring_reply(sd, job);
+        }
+        else {
+            UringJob_destroy(sd, job);
+        }
+    }
+}
+
+
+/**
+ * serve requests with the I/O of reads, writes and getattrs running
+ * asynchronously on the ring. while they are in flight further
+ * requests are taken from the scheduler. all other operations are
+ * executed directly
+ */
+static bool
+ServeDir_serve_uring(ServeDir * sd)
+{
+    size_t n_in_flight = 0;
+    bool success = true;
+
+    debug("Serving requests using io_uring");
+
+    while (true) {
+        ServeDir_uring_reap(sd, &n_in_flight, true);
+
+        // take requests while there is room in the ring
+        while (n_in_flight < SERVEDIR_URING_DEPTH) {
+            SchedulerJob * sched_job = Scheduler_try_next(sd->scheduler, sd->worker);
+            if (sched_job == NULL) {
+                break;
+            }
+
+            UringJob * job = UringJob_create(sd, sched_job);
+            if (job == NULL) {
+                continue;
+            }
+
+            if (job->request != NULL) {
+                // ensure errno is reset to zero
+                errno = 0;
+
+                sd->client = ServeDir_client(sched_job);
+                if (ServeDir_uring_submit(sd, job)) {
+                    sd->client = NULL;
+                    n_in_flight++;
+                    continue;
+                }
+                if (ServeDir_dispatch(sd, job->request, job->response,
+                        ServeDir_reply_frame(job->request, job->sched_job)) != 0) {
+                    log_warn("calling action failed");
+                }
+                sd->client = NULL;
+            }
+            ServeDir_uring_reply(sd, job);
+        }
+
+        check(Uring_submit(sd->uring), "Could not submit to io_uring");
+
+        if (n_in_flight >= SERVEDIR_URING_DEPTH) {
+            // no room for further requests
+            check(Uring_wait(sd->uring), "Could not wait for io_uring");
+        }
+        else if (!Scheduler_wait(sd->scheduler, sd->worker, sd->uring->fd)) {
+            debug("the scheduler has been stopped leaving the servedir loop");
+            goto drain;
+        }
+    }
+
+error:
+    success = false;
+
+drain:
+    // the kernel may still write to the buffers of the jobs in flight
+    while (n_in_flight > 0) {
+        if (!Uring_submit(sd->uring) || !Uring_wait(sd->uring)) {
+            log_err("Could not wait for %d requests in flight", (int)n_in_flight);
+            break;
+        }
+        ServeDir_uring_reap(sd, &n_in_flight, false);
+    }
+
+    debug("Exiting ServeDir_serve_uring");
+    return success;
+}
+
+#endif
+
+
 // ########## filesystem operations ############################
 
 /**
@@ -279,12 +941,163 @@ error:
     }
 
 
+/**
+ * choose the codec compressing the data of the reply to "request"
+ *
+ * clients which do not ask for one get LZ4 in one piece, which every
+ * version of the client is able to decompress
+ */
+static void
+ServeDir_reply_codec(const Rhizofs__Request * request, Codec * codec)
+{
+    codec->type = RHIZOFS__COMPRESSION_TYPE__COMPR_LZ4;
+    codec->level = 0;
+    codec->chunk_size = 0;
+
+    if ((request != NULL) && request->has_chunk_size) {
+        codec->chunk_size = (request->chunk_size < CODEC_MIN_CHUNK_SIZE) ?
+                CODEC_MIN_CHUNK_SIZE : request->chunk_size;
+    }
+
+    if ((request != NULL) && request->has_compression) {
+        if (Codec_is_supported(request->compression)) {
+            codec->type = request->compression;
+            codec->level = request->has_compression_level ? request->compression_level : 0;
+        }
+        else {
+            debug("Unsupported compression type %d requested", (int)request->compression);
+        }
+    }
+}
+
+
+/**
+ * serialize the response to the request of "job" into its reply. the
+ * data is sent as a separate frame if the client asked for it
+ *
+ * returns false on error
+ */
+static bool
+ServeDir_pack(const Rhizofs__Request * request, Rhizofs__Response * response,
+        SchedulerJob * job)
+{
+    bool data_frames = (request != NULL) && request->data_frames;
+
+    if (zmq_msg_size(&(job->reply_data)) > 0) {
+        // the data has already been placed in the frame by the read
+        zmq_msg_close(&(job->reply));
+        if (!Response_pack(response, &(job->reply), NULL)) {
+            zmq_msg_init(&(job->reply));
+            return false;
+        }
+        return true;
+    }
+
+    // the messages are closed again on failure
+    zmq_msg_close(&(job->reply));
+    zmq_msg_close(&(job->reply_data));
+    if (!Response_pack(response, &(job->reply), data_frames ? &(job->reply_data) : NULL)) {
+        zmq_msg_init(&(job->reply));
+        zmq_msg_init(&(job->reply_data));
+        return false;
+    }
+    if (!data_frames) {
+        zmq_msg_init(&(job->reply_data));
+    }
+    return true;
+}
+
+
+/**
+ * the frame the data of the reply to "request" may be placed in. NULL
+ * if the client expects the data in the response
+ */
+static zmq_msg_t *
+ServeDir_reply_frame(const Rhizofs__Request * request, SchedulerJob * job)
+{
+    if ((request == NULL) || !request->data_frames) {
+        return NULL;
+    }
+    return &(job->reply_data);
+}
+
+
+/**
+ * set the data of the reply to a read, compressed unless the policy
+ * expects it to not get smaller. takes over "buffer" in any case
+ *
+ * uncompressed data is sent from the buffer without being copied if
+ * "reply_data" is not NULL. the buffer is returned to its pool once
+ * the frame has been sent
+ *
+ * returns false on error
+ */
+static bool
+ServeDir_set_read_data(const ServeDir * sd, const Rhizofs__Request * request,
+        Rhizofs__Response * response, BufferPoolBuffer * buffer, size_t len,
+        zmq_msg_t * reply_data)
+{
+    Codec codec;
+    uint64_t file = CompressPolicy_file(request->path,
+            request->has_handle ? request->handle : 0);
+    bool data_set = false;
+
+    ServeDir_reply_codec(request, &codec);
+    if (sd->compresspolicy != NULL) {
+        CompressPolicy_choose(sd->compresspolicy, file, buffer->data, len, &codec);
+    }
+
+    if ((reply_data != NULL) && (len > 0) &&
+            ((codec.type == RHIZOFS__COMPRESSION_TYPE__COMPR_NONE) || (len <= CODEC_MIN_SIZE))) {
+        check(Response_set_data_frame(response, len), "could not set the data frame");
+
+        zmq_msg_close(reply_data);
+        if (zmq_msg_init_data(reply_data, buffer->data, len, BufferPool_free_frame, buffer) == 0) {
+            return true;
+        }
+        log_err("Could not initialize the data frame");
+        zmq_msg_init(reply_data);
+
+        // send the data in the response instead
+        DataBlock_destroy(response->datablock);
+        response->datablock = NULL;
+    }
+
+    uint64_t start_ns = Metrics_now_ns();
+    check(Response_set_data(response, buffer->data, len, &codec), "could not set the data");
+    if (sd->compresspolicy != NULL) {
+        CompressPolicy_record(sd->compresspolicy, file, &codec, response->datablock,
+                Metrics_now_ns() - start_ns);
+    }
+    data_set = true;
+
+error:
+    BufferPool_put(buffer);
+    return data_set;
+}
+
+
 static int
-ServeDir_op_ping(Rhizofs__Response * response)
+ServeDir_op_ping(const ServeDir * sd, Rhizofs__Response * response)
 {
     debug("PING");
     response->requesttype = RHIZOFS__REQUEST_TYPE__PING;
 
+    // tell the client which compression types it may ask for. clients
+    // not knowing about them just ignore the field
+    response->compressions = calloc(CODEC_MAX_TYPES, sizeof(Rhizofs__CompressionType));
+    if (response->compressions != NULL) {
+        response->n_compressions = Codec_list(response->compressions, CODEC_MAX_TYPES);
+    }
+    response->has_chunked_data = 1;
+    response->chunked_data = true;
+    response->has_data_frames = 1;
+    response->data_frames = true;
+
+    // clients send requests more often than that to keep their handles
+    response->has_lease = 1;
+    response->lease = sd->handles->lease_sec;
+
     return 0; // always successful
 }
 
@@ -302,61 +1115,196 @@ ServeDir_op_invalid(Rhizofs__Response * response)
 }
 
 
+/**
+ * execute the sub-requests of a compound request in order and collect
+ * their responses
+ */
+static int
+ServeDir_op_compound(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response *response)
+{
+    size_t i;
+    uint64_t handle = HANDLE_NONE;
+
+    debug("COMPOUND with %d requests", (int)request->n_requests);
+    response->requesttype = RHIZOFS__REQUEST_TYPE__COMPOUND;
+
+    if (request->n_requests == 0) {
+        return 0;
+    }
+
+    response->responses = calloc(sizeof(Rhizofs__Response *), request->n_requests);
+    check_mem_response(response->responses);
+
+    for (i=0; i<request->n_requests; i++) {
+        Rhizofs__Request * subrequest = request->requests[i];
+        Rhizofs__Response * subresponse = NULL;
+        int op_rc = 0;
+
+        subresponse = Response_create();
+        check_mem_response(subresponse);
+        response->responses[response->n_responses++] = subresponse;
+
+        if (subrequest->requesttype == RHIZOFS__REQUEST_TYPE__COMPOUND) {
+            op_rc = ServeDir_op_invalid(subresponse);
+        }
+        else {
+            // continue working on the file opened by an earlier
+            // sub-request
+            if (!subrequest->has_handle && (handle != HANDLE_NONE)) {
+                subrequest->has_handle = 1;
+                subrequest->handle = handle;
+            }
+
+            errno = 0;
+            op_rc = ServeDir_dispatch(sd, subrequest, subresponse, NULL);
+        }
+
+        if (subresponse->has_handle) {
+            handle = subresponse->handle;
+        }
+
+        if ((op_rc != 0) || (subresponse->errnotype != RHIZOFS__ERRNO__ERRNO_NONE)) {
+            if (subresponse->errnotype == RHIZOFS__ERRNO__ERRNO_NONE) {
+                subresponse->errnotype = RHIZOFS__ERRNO__ERRNO_UNKNOWN;
+            }
+            if (request->stop_on_error) {
+                debug("stopping compound after failed request %d", (int)i);
+                break;
+            }
+        }
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+
+/**
+ * list a directory
+ *
+ * the entries are read with getdents64 and stated relative to the
+ * directory, large pages with the help of the statpool
+ *
+ * requests with a cookie get a page of the listing starting after the
+ * entry the cookie was returned for. the cookies are the positions of
+ * the entries in the directory, which stay valid across opening the
+ * directory again on linux. requests without a cookie get the
+ * complete listing
+ */
 static int
 ServeDir_op_readdir(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response *response)
 {
-    DIR *dir = NULL;
+    DirScan scan;
+    DirScanPage page;
+    bool scan_open = false;
     char * dirpath = NULL;
-    struct dirent *de = NULL;
-    size_t entry_count = 0;
-    char * entry_fullpath = NULL;
+    size_t max_entries = SIZE_MAX;
+    size_t max_bytes = SIZE_MAX;
     struct stat sb;
+    bool paged = (request->has_cookie != 0);
 
     debug("READDIR");
     response->requesttype = RHIZOFS__REQUEST_TYPE__READDIR;
     response->n_directory_entries = 0;
+    DirScanPage_init(&page);
 
     check_debug((ServeDir_fullpath(sd, request, &dirpath) == 0),
             "Could not assemble directory path.");
     debug("requested directory path: %s", dirpath);
-    dir = opendir(dirpath);
-    if (dir == NULL) {
+    if (!DirScan_open(&scan, dirpath)) {
         Response_set_errno(response, errno);
         debug("Could not open directory %s", dirpath);
 
         free(dirpath);
         return 0;
     }
+    scan_open = true;
+
+    // stat the directory before reading it, so changes made while
+    // reading result in a different validator next time
+    if (fstat(scan.fd, &sb) == 0) {
+        uint64_t validator = ServeDir_listing_validator(&sb);
+        if (validator != 0) {
+            if (request->has_validator && (request->validator == validator)
+                        && (!paged || (request->cookie == 0))) {
+                debug("listing of %s is unchanged", dirpath);
+                response->has_listing_unchanged = 1;
+                response->listing_unchanged = 1;
+                DirScan_close(&scan);
+                free(dirpath);
+                return 0;
+            }
+            response->has_validator = 1;
+            response->validator = validator;
+        }
+    }
+
+    if (paged) {
+        max_entries = SERVEDIR_READDIR_MAX_ENTRIES;
+        if (request->has_max_entries && (request->max_entries != 0)
+                    && (request->max_entries < max_entries)) {
+            max_entries = request->max_entries;
+        }
+        max_bytes = SERVEDIR_READDIR_MAX_BYTES;
+
+        if ((request->cookie != 0) && !DirScan_seek(&scan, request->cookie)) {
+            Response_set_errno(response, errno);
+            log_warn("Could not seek in directory %s", dirpath);
+            goto done;
+        }
+    }
 
-    // count the entries in the directory
-    while (readdir(dir) != NULL) {
-        ++entry_count;
+    if (!DirScan_read_page(&scan, &page, max_entries, max_bytes)) {
+        Response_set_errno(response, errno);
+        log_warn("Could not read directory %s", dirpath);
+        goto done;
     }
 
-    response->directory_entries = (Rhizofs__Attrs**)calloc(sizeof(Rhizofs__Attrs *), entry_count);
-    check_mem_response(response->directory_entries);
+    StatPool_stat(sd->statpool, scan.fd, page.entries, page.n_entries);
+
+    if (page.n_entries != 0) {
+        response->directory_entries = (Rhizofs__Attrs**)calloc(sizeof(Rhizofs__Attrs *), page.n_entries);
+        check_mem_response(response->directory_entries);
 
-    rewinddir(dir);
-    while ((de = readdir(dir)) != NULL) {
-        debug("found directory entry %s",  de->d_name);
+        if (paged) {
+            response->cookies = calloc(sizeof(uint64_t), page.n_entries);
+            check_mem_response(response->cookies);
+        }
+    }
 
-        check((path_join(dirpath, de->d_name, &entry_fullpath)==0),
-            "error processing path for directory entry");
+    for (size_t i=0; i<page.n_entries; i++) {
+        DirScanEntry * entry = &(page.entries[i]);
 
-        if (lstat(entry_fullpath, &sb) == 0)  {
-            response->directory_entries[response->n_directory_entries] = Attrs_create(&sb, de->d_name);
-            check((response->directory_entries[response->n_directory_entries] != NULL),
-                        "could not create attrs from stat");
+        if (entry->stat_errno == 0)  {
+            Rhizofs__Attrs * attrs = Attrs_create(&(entry->stat_result), entry->name);
+            check((attrs != NULL), "could not create attrs from stat");
+            response->directory_entries[response->n_directory_entries] = attrs;
             ++response->n_directory_entries;
+
+            if (paged) {
+                response->cookies[response->n_cookies] = entry->cookie;
+                ++response->n_cookies;
+            }
         }
-        else {
-            Response_set_errno(response, errno);
-            log_warn("Could not stat %s", entry_fullpath);
+        else if (entry->stat_errno != ENOENT) {
+            // entries removed since reading the directory are left out
+            Response_set_errno(response, entry->stat_errno);
+            log_warn("Could not stat %s in %s", entry->name, dirpath);
         }
-        free(entry_fullpath); entry_fullpath = NULL;
     }
 
-    closedir(dir);
+    if (paged) {
+        response->has_end_of_listing = 1;
+        response->end_of_listing = page.end_of_directory;
+    }
+
+    debug("listed %d entries of %s", (int)response->n_directory_entries, dirpath);
+
+done:
+    DirScanPage_deinit(&page);
+    DirScan_close(&scan);
     free(dirpath);
     return 0;
 
@@ -368,17 +1316,64 @@ error:
         }
     }
     free(response->directory_entries);
+    response->directory_entries = NULL;
+    response->n_directory_entries = 0;
+    free(response->cookies);
+    response->cookies = NULL;
+    response->n_cookies = 0;
 
-    if (entry_fullpath != NULL) free(entry_fullpath);
-
-    if (dir != NULL) {
-        closedir(dir);
+    DirScanPage_deinit(&page);
+    if (scan_open) {
+        DirScan_close(&scan);
     }
     free(dirpath);
     return -1;
 }
 
 
+/**
+ * compute the validator of a directory listing from the stat of the
+ * directory. entries being added, removed or renamed change the ctime
+ * of the directory.
+ *
+ * returns 0 if the directory changed too recently to be sure the
+ * timestamps will reflect further changes
+ */
+static uint64_t
+ServeDir_listing_validator(const struct stat * sb)
+{
+    time_t now = time(NULL);
+    if ((now == -1) || (sb->st_ctime >= now - 1)) {
+        return 0;
+    }
+
+    // FNV-1a over the fields identifying the state of the directory
+    const uint64_t fields[] = {
+        (uint64_t)sb->st_dev,
+        (uint64_t)sb->st_ino,
+        (uint64_t)sb->st_mtime,
+        (uint64_t)sb->st_ctime,
+#ifndef __USE_XOPEN2K8
+        (uint64_t)sb->st_mtimensec,
+        (uint64_t)sb->st_ctimensec,
+#else
+        (uint64_t)sb->st_mtim.tv_nsec,
+        (uint64_t)sb->st_ctim.tv_nsec,
+#endif
+        (uint64_t)sb->st_size
+    };
+    const unsigned char * bytes = (const unsigned char *)fields;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i=0; i<sizeof(fields); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    // 0 means no validator
+    return (hash == 0) ? 1 : hash;
+}
+
+
 static int
 ServeDir_op_rmdir(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response *response)
 {
@@ -394,6 +1389,7 @@ ServeDir_op_rmdir(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Resp
         Response_set_errno(response, errno);
         debug("Could not remove directory %s", path);
     }
+    FdCache_invalidate(sd->fdcache, path);
 
     free(path);
     return 0;
@@ -419,6 +1415,7 @@ ServeDir_op_unlink(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Res
         Response_set_errno(response, errno);
         debug("Could not unlink %s", path);
     }
+    FdCache_invalidate(sd->fdcache, path);
 
     free(path);
     return 0;
@@ -484,6 +1481,8 @@ ServeDir_op_rename(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Res
         Response_set_errno(response, errno);
         debug("Could not rename %s to %s", path_from, path_to);
     }
+    FdCache_invalidate(sd->fdcache, path_from);
+    FdCache_invalidate(sd->fdcache, path_to);
 
     free(path_to);
     free(path_from);
@@ -637,11 +1636,25 @@ ServeDir_op_getattr(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Re
     debug("GETATTR");
     response->requesttype = RHIZOFS__REQUEST_TYPE__GETATTR;
 
-    check_debug((ServeDir_fullpath(sd, request, &path) == 0),
-            "Could not assemble path.");
-    debug("requested path: %s", path);
+    int rc;
+    if (ServeDir_has_handle(request)) {
+        int fd = ServeDir_handle_fd_or_fail(sd, request, response);
+        if (fd == -1) {
+            return 0;
+        }
+        rc = fstat(fd, &sb);
+        int err = errno;
+        HandleTable_put(sd->handles, request->handle);
+        errno = err;
+    }
+    else {
+        check_debug((ServeDir_fullpath(sd, request, &path) == 0),
+                "Could not assemble path.");
+        debug("requested path: %s", path);
+        rc = lstat(path, &sb);
+    }
 
-    if (lstat(path, &sb) == 0)  {
+    if (rc == 0)  {
         response->attrs = Attrs_create(&sb, NULL);
         check((response->attrs != NULL), "could not create attrs from stat");
     }
@@ -688,7 +1701,9 @@ ServeDir_op_open(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Respo
         goto error;
     }
 
-    close(fd);
+    if (!ServeDir_set_handle(sd, response, fd)) {
+        debug("No handle left to keep %s open", path);
+    }
     free(path);
     return 0;
 
@@ -698,13 +1713,20 @@ error:
 }
 
 
+/**
+ * "reply_data" is the frame the data may be sent in or NULL if it has
+ * to be part of the response
+ */
 static int
-ServeDir_op_read(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response *response)
+ServeDir_op_read(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response *response,
+        zmq_msg_t * reply_data)
 {
     char * path = NULL;
     int fd = -1;
+    int handle_fd = -1;
+    FdCacheEntry * cached_fd = NULL;
     ssize_t bytes_read;
-    uint8_t * databuf = NULL;
+    BufferPoolBuffer * databuf = NULL;
 
     debug("READ");
     response->requesttype = RHIZOFS__REQUEST_TYPE__READ;
@@ -712,21 +1734,45 @@ ServeDir_op_read(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Respo
     REQ_HAS_OPTIONAL(request, response, size);
     REQ_HAS_OPTIONAL(request, response, offset);
 
-    check_debug((ServeDir_fullpath(sd, request, &path) == 0),
-            "Could not assemble path.");
-    debug("requested path: %s", path);
-    fd = open(path, O_RDONLY);
-    if (fd != -1) {
+    if ((request->size < 0) || (request->size > INT32_MAX)) {
+        log_err("invalid size %ld of read", (long)request->size);
+        response->errnotype = RHIZOFS__ERRNO__ERRNO_INVALID_REQUEST;
+        return -1;
+    }
 
-        databuf = calloc(sizeof(uint8_t), (int)request->size);
+    if (ServeDir_has_handle(request)) {
+        handle_fd = ServeDir_handle_fd(sd, request);
+        if (handle_fd == -1) {
+            Response_set_errno(response, EBADF);
+            debug("Unknown handle %llx", (unsigned long long)request->handle);
+            return 0;
+        }
+        fd = handle_fd;
+    }
+    else {
+        check_debug((ServeDir_fullpath(sd, request, &path) == 0),
+                "Could not assemble path.");
+        debug("requested path: %s", path);
+        cached_fd = FdCache_get(sd->fdcache, path, O_RDONLY, 0);
+        if (cached_fd != NULL) {
+            fd = cached_fd->fd;
+        }
+    }
+    if (fd != -1) {
+        databuf = BufferPool_get(sd->bufferpool, (size_t)request->size);
         check_mem(databuf);
 
-        if (request->offset == 0) {
+        if ((request->offset == 0) && (handle_fd == -1) && !cached_fd->cached) {
             /* use read to enable reading from non-seekable files */
-            bytes_read = read(fd, databuf, (size_t)request->size);
+            bytes_read = read(fd, databuf->data, (size_t)request->size);
         }
         else {
-            bytes_read = pread(fd, databuf, (size_t)request->size, (off_t)request->offset);
+            bytes_read = pread(fd, databuf->data, (size_t)request->size,
+                    (off_t)request->offset);
+            if ((bytes_read == -1) && (errno == ESPIPE)) {
+                /* a handle of a non-seekable file */
+                bytes_read = read(fd, databuf->data, (size_t)request->size);
+            }
         }
         /*
         check((request->size == bytes_read),
@@ -735,29 +1781,41 @@ ServeDir_op_read(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Respo
         */
 
         if (bytes_read != -1) {
-            check((Response_set_data(response, databuf, (size_t)bytes_read) == true),
-                    "could not set response data");
+            // the response takes over the buffer
+            bool data_set = ServeDir_set_read_data(sd, request, response, databuf,
+                    (size_t)bytes_read, reply_data);
+            databuf = NULL;
+            check((data_set == true), "could not set response data");
         }
         else {
             Response_set_errno(response, errno);
             debug("Could not read from on %s", path);
-            free(databuf);
+            BufferPool_put(databuf);
             databuf = NULL;
         }
-        close(fd);
+        if (handle_fd != -1) {
+            HandleTable_put(sd->handles, request->handle);
+        }
+        else {
+            FdCache_put(sd->fdcache, cached_fd);
+        }
     }
     else {
         Response_set_errno(response, errno);
         debug("Could not call open on %s", path);
     }
 
-    free(databuf);
     free(path);
     return 0;
 
 error:
-    free(databuf);
-    if (fd >= 0) close(fd);
+    BufferPool_put(databuf);
+    if (handle_fd != -1) {
+        HandleTable_put(sd->handles, request->handle);
+    }
+    else {
+        FdCache_put(sd->fdcache, cached_fd);
+    }
     free(path);
     return -1;
 }
@@ -767,7 +1825,10 @@ ServeDir_op_write(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Resp
 {
     char * path = NULL;
     int fd = -1;
+    int handle_fd = -1;
+    FdCacheEntry * cached_fd = NULL;
     uint8_t * data = NULL;
+    const uint8_t * block = NULL;
 
     debug("WRITE");
     response->requesttype = RHIZOFS__REQUEST_TYPE__WRITE;
@@ -781,18 +1842,39 @@ ServeDir_op_write(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Resp
         return -1;
     }
 
-    check_debug((ServeDir_fullpath(sd, request, &path) == 0),
-            "Could not assemble path.");
-    debug("requested path: %s", path);
-    fd = open(path, O_CREAT | O_WRONLY, default_file_creation_permissions );
+    if (ServeDir_has_handle(request)) {
+        handle_fd = ServeDir_handle_fd(sd, request);
+        if (handle_fd == -1) {
+            Response_set_errno(response, EBADF);
+            debug("Unknown handle %llx", (unsigned long long)request->handle);
+            return 0;
+        }
+        fd = handle_fd;
+    }
+    else {
+        check_debug((ServeDir_fullpath(sd, request, &path) == 0),
+                "Could not assemble path.");
+        debug("requested path: %s", path);
+        cached_fd = FdCache_get(sd->fdcache, path, O_CREAT | O_WRONLY,
+                default_file_creation_permissions);
+        if (cached_fd != NULL) {
+            fd = cached_fd->fd;
+        }
+    }
     if (fd != -1) {
-        int bytes_in_block = DataBlock_get_data(request->datablock, &data);
+        // uncompressed data is written straight from the message or
+        // the frame it was received in
+        int bytes_in_block = DataBlock_peek_data(request->datablock, &block);
+        if (bytes_in_block == -1) {
+            bytes_in_block = DataBlock_get_data(request->datablock, &data);
+            block = data;
+        }
         check((bytes_in_block != -1), "Could not extract data from datablock")
-        check((data != NULL), "Extract data from datablock is NULL")
+        check(((block != NULL) || (bytes_in_block == 0)), "Extract data from datablock is NULL")
         check((bytes_in_block == request->size), "the number of bytes in the datablock "
                     "does not match the write requests size");
 
-        ssize_t bytes_written = pwrite(fd, data, (size_t)request->size, (off_t)request->offset);
+        ssize_t bytes_written = pwrite(fd, block, (size_t)request->size, (off_t)request->offset);
         if (bytes_written == -1) {
             Response_set_errno(response, errno);
             debug("Could not write %ld bytes to %s", (int64_t)request->size, path);
@@ -802,18 +1884,28 @@ ServeDir_op_write(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Resp
         response->has_size = 1;
         response->size = (int)bytes_written;
 
-        check((close(fd) != -1), "Could not close file opened for writing.");
+        if (handle_fd != -1) {
+            /* the write itself updated the modification time of the file */
+            HandleTable_put(sd->handles, request->handle);
+        }
+        else if (cached_fd->cached) {
+            /* the same for files kept open by the fdcache */
+            FdCache_put(sd->fdcache, cached_fd);
+        }
+        else {
+            FdCache_put(sd->fdcache, cached_fd);
 
-        struct timeval now;
-        struct timeval times[2];
+            struct timeval now;
+            struct timeval times[2];
 
-        gettimeofday(&now, NULL);
-        times[0].tv_sec  = now.tv_sec;
-        times[0].tv_usec = now.tv_usec;
-        times[1].tv_sec  = now.tv_sec;
-        times[1].tv_usec = now.tv_usec;
+            gettimeofday(&now, NULL);
+            times[0].tv_sec  = now.tv_sec;
+            times[0].tv_usec = now.tv_usec;
+            times[1].tv_sec  = now.tv_sec;
+            times[1].tv_usec = now.tv_usec;
 
-        utimes(path, times);
+            utimes(path, times);
+        }
     }
     else {
         Response_set_errno(response, errno);
@@ -828,7 +1920,12 @@ ServeDir_op_write(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Resp
 
 error:
 
-    if (fd >= 0) close(fd);
+    if (handle_fd != -1) {
+        HandleTable_put(sd->handles, request->handle);
+    }
+    else {
+        FdCache_put(sd->fdcache, cached_fd);
+    }
     free(data);
     free(path);
     return -1;
@@ -862,8 +1959,19 @@ ServeDir_op_create(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Res
     // So we will simply add write permissions for the owner here.
     create_mode |= S_IWUSR;
 
-    debug("requested path: %s, create_mode: %o", path, create_mode);
-    fd = creat(path, create_mode);
+    if (request->openflags != NULL) {
+        // the client wants to keep the file open
+        int openflags = OpenFlags_to_bitmask(request->openflags, &success);
+        check((success == true), "could not convert openflags to bitmask");
+
+        debug("requested path: %s, create_mode: %o, openflags: %o", path,
+                create_mode, openflags);
+        fd = open(path, openflags | O_CREAT, create_mode);
+    }
+    else {
+        debug("requested path: %s, create_mode: %o", path, create_mode);
+        fd = creat(path, create_mode);
+    }
     if (fd == -1) {
         Response_set_errno(response, errno);
         debug("Could not call creat on %s: %s", path, strerror(errno));
@@ -871,7 +1979,14 @@ ServeDir_op_create(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Res
         goto error;
     }
 
-    close(fd);
+    if (request->openflags != NULL) {
+        if (!ServeDir_set_handle(sd, response, fd)) {
+            debug("No handle left to keep %s open", path);
+        }
+    }
+    else {
+        close(fd);
+    }
 
     free(path);
     return 0;
@@ -892,6 +2007,19 @@ ServeDir_op_truncate(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__R
 
     REQ_HAS_OPTIONAL(request, response, offset);
 
+    if (ServeDir_has_handle(request)) {
+        int fd = ServeDir_handle_fd_or_fail(sd, request, response);
+        if (fd == -1) {
+            return 0;
+        }
+        if (ftruncate(fd, request->offset) != 0) {
+            Response_set_errno(response, errno);
+            debug("Could not call ftruncate on handle %llx", (unsigned long long)request->handle);
+        }
+        HandleTable_put(sd->handles, request->handle);
+        return 0;
+    }
+
     check_debug((ServeDir_fullpath(sd, request, &path) == 0),
             "Could not assemble path.");
     debug("requested path: %s", path);
@@ -899,6 +2027,7 @@ ServeDir_op_truncate(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__R
         Response_set_errno(response, errno);
         debug("Could not call truncate on %s", path);
     }
+    FdCache_invalidate(sd->fdcache, path);
 
     free(path);
     return 0;
@@ -924,6 +2053,19 @@ ServeDir_op_chmod(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Resp
     localmode = (mode_t)Permissions_to_bitmask(request->permissions, &success);
     check(success, "Could not create bitmask from chmod permissions");
 
+    if (ServeDir_has_handle(request)) {
+        int fd = ServeDir_handle_fd_or_fail(sd, request, response);
+        if (fd == -1) {
+            return 0;
+        }
+        if (fchmod(fd, localmode) != 0) {
+            Response_set_errno(response, errno);
+            debug("Could not call fchmod on handle %llx", (unsigned long long)request->handle);
+        }
+        HandleTable_put(sd->handles, request->handle);
+        return 0;
+    }
+
     check_debug((ServeDir_fullpath(sd, request, &path) == 0),
             "Could not assemble path.");
     debug("requested path: %s", path);
@@ -957,6 +2099,19 @@ ServeDir_op_utimens(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Re
     times[1].tv_sec  = request->timestamps->modify_sec;
     times[1].tv_usec  = request->timestamps->modify_usec;
 
+    if (ServeDir_has_handle(request)) {
+        int fd = ServeDir_handle_fd_or_fail(sd, request, response);
+        if (fd == -1) {
+            return 0;
+        }
+        if (futimes(fd, times) != 0) {
+            Response_set_errno(response, errno);
+            debug("Could not call futimes on handle %llx", (unsigned long long)request->handle);
+        }
+        HandleTable_put(sd->handles, request->handle);
+        return 0;
+    }
+
     check_debug((ServeDir_fullpath(sd, request, &path) == 0),
             "Could not assemble path.");
     debug("requested path: %s", path);
@@ -1048,3 +2203,20 @@ error:
     return -1;
 }
 
+
+static int
+ServeDir_op_release(const ServeDir * sd, Rhizofs__Request * request, Rhizofs__Response *response)
+{
+    debug("RELEASE");
+    response->requesttype = RHIZOFS__REQUEST_TYPE__RELEASE;
+
+    REQ_HAS_OPTIONAL(request, response, handle);
+
+    if (!HandleTable_release(sd->handles, request->handle, sd->client)) {
+        Response_set_errno(response, EBADF);
+        debug("Could not release unknown handle %llx",
+                (unsigned long long)request->handle);
+    }
+
+    return 0;
+}
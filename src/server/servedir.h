@@ -7,14 +7,71 @@
 
 #include <stdbool.h>
 
+#include "handletable.h"
+#include "dirscan.h"
+#include "fdcache.h"
+#include "uring.h"
+#include "scheduler.h"
+#include "metrics.h"
+#include "bufferpool.h"
+#include "../compresspolicy.h"
+
+/* upper limits of the size of a page of a directory listing */
+#define SERVEDIR_READDIR_MAX_ENTRIES 4096
+#define SERVEDIR_READDIR_MAX_BYTES (1024 * 1024)
+
+/* number of requests a worker using io_uring keeps in flight */
+#define SERVEDIR_URING_DEPTH 256
+
 typedef struct ServeDir {
     char * directory;
-    char * socket_name;
-    void * socket;
+
+    // the requests are taken from the queue of "worker"
+    Scheduler * scheduler;
+    size_t worker;
+
+    // files opened for clients. shared by all workers
+    HandleTable * handles;
+
+    // the key of the connection whose request is executed. handles
+    // are only accepted from the connection which opened the file
+    const char * client;
+
+    // threads helping with listing large directories. shared by all
+    // workers. may be NULL
+    StatPool * statpool;
+
+    // files kept open for requests without a handle. shared by
+    // all workers
+    FdCache * fdcache;
+
+    // reads, writes and stats are submitted to this ring and the
+    // worker keeps serving requests until they complete. NULL if
+    // requests are served one after another with blocking calls
+    Uring * uring;
+
+    // counters of the requests served. shared by all workers
+    Metrics * metrics;
+
+    // decides which replies are compressed. shared by all workers.
+    // may be NULL
+    CompressPolicy * compresspolicy;
+
+    // the buffers reads are placed in. owned by the worker
+    BufferPool * bufferpool;
 } ServeDir;
 
 
-ServeDir * ServeDir_create(void *context, char * socket_name, char *directory);
+/**
+ * "use_uring" serves requests asynchronously using io_uring. if it is
+ * not available the blocking calls are used
+ *
+ * "huge_pages" backs large read buffers with huge pages
+ */
+ServeDir * ServeDir_create(Scheduler * scheduler, size_t worker, char *directory,
+        HandleTable * handles, StatPool * statpool, FdCache * fdcache,
+        Metrics * metrics, CompressPolicy * compresspolicy, bool use_uring,
+        bool huge_pages);
 bool ServeDir_serve(ServeDir * sd);
 void ServeDir_destroy(ServeDir * sd);
 
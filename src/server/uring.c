@@ -0,0 +1,256 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef RHIZO_HAVE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../dbg.h"
+
+
+#ifdef RHIZO_HAVE_URING
+
+#define URING_PROBE_OPS 256
+
+static int
+Uring_enter(Uring * ring, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+            flags, NULL, 0);
+}
+
+
+/**
+ * check the kernel for the operations needed
+ */
+static bool
+Uring_probe(Uring * ring)
+{
+    struct io_uring_probe * probe = NULL;
+    bool has_rw = false;
+
+    probe = calloc(1, sizeof(struct io_uring_probe)
+            + URING_PROBE_OPS * sizeof(struct io_uring_probe_op));
+    if (probe == NULL) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+                probe, URING_PROBE_OPS) != 0) {
+        // kernels older than 5.6 neither support the probe nor
+        // reads at an offset
+        free(probe);
+        return false;
+    }
+
+#define URING_SUPPORTS(OP) \
+    ((probe->last_op >= (OP)) && (probe->ops[(OP)].flags & IO_URING_OP_SUPPORTED))
+
+    has_rw = URING_SUPPORTS(IORING_OP_READ) && URING_SUPPORTS(IORING_OP_WRITE);
+    ring->has_statx = URING_SUPPORTS(IORING_OP_STATX);
+
+#undef URING_SUPPORTS
+
+    free(probe);
+    if (!has_rw) {
+        errno = ENOTSUP;
+    }
+    return has_rw;
+}
+
+#endif
+
+
+bool
+Uring_init(Uring * ring, unsigned int entries)
+{
+    memset(ring, 0, sizeof(Uring));
+    ring->fd = -1;
+
+#ifdef RHIZO_HAVE_URING
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd == -1) {
+        return false;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto error;
+    }
+
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+        ring->cq_ring = NULL;
+        goto error;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes_map = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes_map == MAP_FAILED) {
+        ring->sqes_map = NULL;
+        goto error;
+    }
+
+    char * sq = (char *)ring->sq_ring;
+    ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sqes = (struct io_uring_sqe *)ring->sqes_map;
+
+    char * cq = (char *)ring->cq_ring;
+    ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    if (!Uring_probe(ring)) {
+        goto error;
+    }
+
+    return true;
+
+error:
+    {
+        int saved_errno = errno;
+        Uring_deinit(ring);
+        errno = saved_errno;
+    }
+    return false;
+#else
+    (void)entries;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+
+void
+Uring_deinit(Uring * ring)
+{
+#ifdef RHIZO_HAVE_URING
+    if (ring->sqes_map != NULL) {
+        munmap(ring->sqes_map, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+#endif
+    if (ring->fd != -1) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(Uring));
+    ring->fd = -1;
+}
+
+
+#ifdef RHIZO_HAVE_URING
+
+struct io_uring_sqe *
+Uring_get_sqe(Uring * ring)
+{
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = *(ring->sq_tail);
+
+    if (tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+
+    unsigned int index = tail & *(ring->sq_mask);
+    struct io_uring_sqe * sqe = &(ring->sqes[index]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+
+    // the kernel sees the entry once the tail is moved
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->n_pending++;
+
+    return sqe;
+}
+
+#endif
+
+
+bool
+Uring_submit(Uring * ring)
+{
+#ifdef RHIZO_HAVE_URING
+    while (ring->n_pending > 0) {
+        int submitted = Uring_enter(ring, ring->n_pending, 0, 0);
+        if (submitted == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ring->n_pending -= (unsigned int)submitted;
+    }
+    return true;
+#else
+    (void)ring;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+
+bool
+Uring_wait(Uring * ring)
+{
+#ifdef RHIZO_HAVE_URING
+    while (Uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS) == -1) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+#else
+    (void)ring;
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+
+bool
+Uring_next_completion(Uring * ring, uint64_t * user_data, int32_t * result)
+{
+#ifdef RHIZO_HAVE_URING
+    unsigned int head = *(ring->cq_head);
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return false;
+    }
+
+    struct io_uring_cqe * cqe = &(ring->cqes[head & *(ring->cq_mask)]);
+    (*user_data) = cqe->user_data;
+    (*result) = cqe->res;
+
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+#else
+    (void)ring;
+    (void)user_data;
+    (void)result;
+    return false;
+#endif
+}
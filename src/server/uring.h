@@ -0,0 +1,103 @@
+#ifndef __server_uring_h__
+#define __server_uring_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define RHIZO_HAVE_URING 1
+#endif
+#endif
+
+#ifdef RHIZO_HAVE_URING
+#include <linux/io_uring.h>
+#endif
+
+
+/**
+ * a minimal io_uring submission and completion queue, set up with the
+ * system calls directly, so no library is needed
+ *
+ * a ring is used by a single thread only
+ */
+typedef struct Uring {
+    int fd;
+
+    unsigned int * sq_head;
+    unsigned int * sq_tail;
+    unsigned int * sq_mask;
+    unsigned int * sq_array;
+    unsigned int sq_entries;
+#ifdef RHIZO_HAVE_URING
+    struct io_uring_sqe * sqes;
+#endif
+
+    unsigned int * cq_head;
+    unsigned int * cq_tail;
+    unsigned int * cq_mask;
+#ifdef RHIZO_HAVE_URING
+    struct io_uring_cqe * cqes;
+#endif
+
+    void * sq_ring;
+    size_t sq_ring_size;
+    void * cq_ring;
+    size_t cq_ring_size;
+    void * sqes_map;
+    size_t sqes_size;
+
+    // entries added since the last Uring_submit
+    unsigned int n_pending;
+
+    // the kernel supports IORING_OP_STATX
+    bool has_statx;
+} Uring;
+
+
+/**
+ * set up a ring with room for "entries" submissions
+ *
+ * returns false with errno set if io_uring is not available or lacks
+ * support for reads and writes at an offset
+ */
+bool Uring_init(Uring * ring, unsigned int entries);
+
+/**
+ */
+void Uring_deinit(Uring * ring);
+
+#ifdef RHIZO_HAVE_URING
+/**
+ * get a cleared submission queue entry to fill. it is passed to the
+ * kernel by the next Uring_submit
+ *
+ * returns NULL if the queue is full
+ */
+struct io_uring_sqe * Uring_get_sqe(Uring * ring);
+#endif
+
+/**
+ * pass the entries added since the last call to the kernel
+ *
+ * returns false on error. errno is set
+ */
+bool Uring_submit(Uring * ring);
+
+/**
+ * wait for at least one completion
+ *
+ * returns false on error. errno is set
+ */
+bool Uring_wait(Uring * ring);
+
+/**
+ * take the next completion from the queue
+ *
+ * returns false if there is none
+ */
+bool Uring_next_completion(Uring * ring, uint64_t * user_data, int32_t * result);
+
+#endif /* __server_uring_h__ */
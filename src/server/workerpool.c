@@ -0,0 +1,334 @@
+#include "workerpool.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../dbg.h"
+
+
+/**
+ * run the routine of a worker and mark its thread as exited
+ */
+static void *
+WorkerPool_run(void * arg)
+{
+    WorkerPoolThread * worker = (WorkerPoolThread *)arg;
+    void * result = worker->pool->routine((void *)(uintptr_t)worker->index);
+
+    __atomic_store_n(&(worker->exited), true, __ATOMIC_SEQ_CST);
+    return result;
+}
+
+
+/**
+ * wait for the thread of a worker which is not active anymore
+ */
+static void
+WorkerPool_join(WorkerPool * pool, size_t worker)
+{
+    WorkerPoolThread * thread = &(pool->threads[worker]);
+
+    if (thread->started) {
+        pthread_join(thread->thread, NULL);
+        thread->started = false;
+    }
+}
+
+
+/**
+ * join the thread of a removed worker if it has left already
+ *
+ * returns false if the thread is still running
+ */
+static bool
+WorkerPool_reap(WorkerPool * pool, size_t worker)
+{
+    WorkerPoolThread * thread = &(pool->threads[worker]);
+
+    if (thread->started && !__atomic_load_n(&(thread->exited), __ATOMIC_SEQ_CST)) {
+        return false;
+    }
+    WorkerPool_join(pool, worker);
+    return true;
+}
+
+
+/**
+ * activate and start the workers up to "n_workers"
+ *
+ * workers removed before may still be finishing their requests.
+ * activating them again would let two threads use a queue, so the pool
+ * only grows up to the first of them which is still running
+ *
+ * returns the number of workers running afterwards
+ */
+static size_t
+WorkerPool_grow(WorkerPool * pool, size_t n_workers)
+{
+    size_t previous = pool->n_workers;
+
+    for (size_t i=previous; i<n_workers; i++) {
+        if (!WorkerPool_reap(pool, i)) {
+            debug("Worker %d is still finishing its requests", (int)i);
+            n_workers = i;
+            break;
+        }
+    }
+    if (n_workers <= previous) {
+        return previous;
+    }
+
+    Scheduler_set_active(pool->scheduler, n_workers);
+    for (size_t i=previous; i<n_workers; i++) {
+        WorkerPoolThread * thread = &(pool->threads[i]);
+
+        thread->exited = false;
+        if (pthread_create(&(thread->thread), NULL, WorkerPool_run, thread) != 0) {
+            log_err("Could not start worker %d", (int)i);
+            Scheduler_set_active(pool->scheduler, i);
+            n_workers = i;
+            break;
+        }
+        thread->started = true;
+    }
+
+    pool->n_workers = n_workers;
+    return n_workers;
+}
+
+
+/**
+ * deactivate the last worker. it leaves once its queue is empty and
+ * is joined later
+ */
+static void
+WorkerPool_shrink(WorkerPool * pool)
+{
+    pool->n_workers--;
+    Scheduler_set_active(pool->scheduler, pool->n_workers);
+}
+
+
+/**
+ * reserve "n_reserved" workers for metadata requests. the last active
+ * worker is never reserved
+ */
+static void
+WorkerPool_reserve(WorkerPool * pool, size_t n_reserved)
+{
+    pool->n_reserved = n_reserved;
+    Scheduler_set_reserved(pool->scheduler, n_reserved);
+}
+
+
+static void *
+WorkerPool_autoscale(void * arg)
+{
+    WorkerPool * pool = (WorkerPool *)arg;
+    SchedulerStats last;
+    SchedulerStats current;
+    unsigned int idle_intervals = 0;
+    unsigned int meta_idle_intervals = 0;
+
+    Scheduler_get_stats(pool->scheduler, &last);
+
+    pthread_mutex_lock(&(pool->mutex));
+    while (!pool->stopping) {
+        struct timeval now;
+        struct timespec timeout;
+
+        gettimeofday(&now, NULL);
+        long nsec = (now.tv_usec * 1000L) + ((WORKERPOOL_INTERVAL_MSEC % 1000) * 1000000L);
+        timeout.tv_sec = now.tv_sec + (WORKERPOOL_INTERVAL_MSEC / 1000) + (nsec / 1000000000L);
+        timeout.tv_nsec = nsec % 1000000000L;
+
+        if (pthread_cond_timedwait(&(pool->cond), &(pool->mutex), &timeout) != ETIMEDOUT) {
+            continue;
+        }
+
+        Scheduler_get_stats(pool->scheduler, &current);
+        uint64_t n_meta_jobs = current.n_jobs[SCHEDULER_LANE_METADATA]
+            - last.n_jobs[SCHEDULER_LANE_METADATA];
+        uint64_t meta_wait_ns = current.wait_ns[SCHEDULER_LANE_METADATA]
+            - last.wait_ns[SCHEDULER_LANE_METADATA];
+        uint64_t n_jobs = n_meta_jobs + current.n_jobs[SCHEDULER_LANE_BULK]
+            - last.n_jobs[SCHEDULER_LANE_BULK];
+        uint64_t wait_ns = meta_wait_ns + current.wait_ns[SCHEDULER_LANE_BULK]
+            - last.wait_ns[SCHEDULER_LANE_BULK];
+        uint64_t busy_ns = current.busy_ns - last.busy_ns;
+        last = current;
+
+        pool->stats.avg_wait_usec = (n_jobs > 0) ? (wait_ns / n_jobs / 1000) : 0;
+        pool->stats.meta_wait_usec = (n_meta_jobs > 0) ? (meta_wait_ns / n_meta_jobs / 1000) : 0;
+        bool meta_slow = (pool->stats.meta_wait_usec > pool->max_meta_wait_usec);
+
+        // prefer moving a worker to the metadata requests over
+        // starting another one
+        if (meta_slow && (pool->n_reserved + 1 < pool->n_workers)) {
+            WorkerPool_reserve(pool, pool->n_reserved + 1);
+            log_info("Reserved %d workers for metadata requests. They waited %d usec on average",
+                    (int)pool->n_reserved, (int)pool->stats.meta_wait_usec);
+            meta_slow = false;
+            meta_idle_intervals = 0;
+        }
+        else if ((pool->n_reserved > pool->min_reserved)
+                && (pool->stats.meta_wait_usec < pool->max_meta_wait_usec / 4)) {
+            meta_idle_intervals++;
+            if (meta_idle_intervals >= WORKERPOOL_SHRINK_INTERVALS) {
+                WorkerPool_reserve(pool, pool->n_reserved - 1);
+                log_info("Reserved %d workers for metadata requests", (int)pool->n_reserved);
+                meta_idle_intervals = 0;
+            }
+        }
+        else {
+            meta_idle_intervals = 0;
+        }
+        pool->stats.busy_percent = (unsigned int)((busy_ns * 100)
+                / ((uint64_t)WORKERPOOL_INTERVAL_MSEC * 1000000ULL * pool->n_workers));
+
+        // nothing completed although requests are waiting. all
+        // workers are blocked
+        bool stalled = (current.n_queued > 0) && (n_jobs == 0);
+
+        if ((pool->n_workers < pool->max_workers)
+                && ((pool->stats.avg_wait_usec > WORKERPOOL_GROW_WAIT_USEC)
+                    || meta_slow || stalled)) {
+            size_t previous = pool->n_workers;
+            size_t n_workers = previous + ((previous / 4 > 0) ? previous / 4 : 1);
+            if (n_workers > pool->max_workers) {
+                n_workers = pool->max_workers;
+            }
+
+            n_workers = WorkerPool_grow(pool, n_workers);
+            if (n_workers > previous) {
+                pool->stats.n_grown += n_workers - previous;
+                log_info("Added %d workers (%d running). Requests waited %d usec on average%s",
+                        (int)(n_workers - previous), (int)n_workers,
+                        (int)pool->stats.avg_wait_usec, stalled ? ", all workers blocked" : "");
+            }
+            idle_intervals = 0;
+        }
+        else if ((pool->n_workers > pool->min_workers)
+                && (pool->stats.busy_percent < WORKERPOOL_SHRINK_BUSY_PERCENT)
+                && (current.n_queued == 0)) {
+            idle_intervals++;
+            if (idle_intervals >= WORKERPOOL_SHRINK_INTERVALS) {
+                WorkerPool_shrink(pool);
+                pool->stats.n_shrunk++;
+                log_info("Removed a worker (%d running). Workers were busy %d%% of the time",
+                        (int)pool->n_workers, (int)pool->stats.busy_percent);
+                idle_intervals = 0;
+            }
+        }
+        else {
+            idle_intervals = 0;
+        }
+        pool->stats.n_workers = pool->n_workers;
+        pool->stats.n_reserved = pool->n_reserved;
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return NULL;
+}
+
+
+bool
+WorkerPool_init(WorkerPool * pool, Scheduler * scheduler, size_t n_workers,
+        size_t min_workers, size_t max_workers, size_t min_reserved,
+        uint64_t max_meta_wait_usec, void * (*routine)(void *))
+{
+    bool mutex_initialized = false;
+    bool cond_initialized = false;
+
+    memset(pool, 0, sizeof(WorkerPool));
+    pool->scheduler = scheduler;
+    pool->routine = routine;
+    pool->min_workers = min_workers;
+    pool->max_workers = max_workers;
+    pool->min_reserved = min_reserved;
+    pool->max_meta_wait_usec = max_meta_wait_usec;
+
+    check((min_workers > 0) && (min_workers <= n_workers) && (n_workers <= max_workers)
+            && (max_workers <= scheduler->n_workers), "Invalid number of workers");
+
+    check(pthread_mutex_init(&(pool->mutex), NULL) == 0,
+            "Could not initialize workerpool mutex");
+    mutex_initialized = true;
+    check(pthread_cond_init(&(pool->cond), NULL) == 0,
+            "Could not initialize workerpool condition");
+    cond_initialized = true;
+
+    pool->threads = calloc(sizeof(WorkerPoolThread), max_workers);
+    check_mem(pool->threads);
+    for (size_t i=0; i<max_workers; i++) {
+        pool->threads[i].pool = pool;
+        pool->threads[i].index = i;
+    }
+
+    WorkerPool_reserve(pool, min_reserved);
+    check((WorkerPool_grow(pool, n_workers) == n_workers), "Could not start the workers");
+    pool->stats.n_workers = n_workers;
+    pool->stats.n_reserved = min_reserved;
+
+    check((pthread_create(&(pool->autoscale_thread), NULL,
+            WorkerPool_autoscale, pool) == 0), "Could not start the autoscaling");
+    pool->autoscale_started = true;
+    return true;
+
+error:
+    if (pool->threads != NULL) {
+        // the workers leave when the scheduler is stopped
+        Scheduler_stop(scheduler);
+        for (size_t i=0; i<max_workers; i++) {
+            WorkerPool_join(pool, i);
+        }
+    }
+    free(pool->threads);
+    pool->threads = NULL;
+    if (cond_initialized) {
+        pthread_cond_destroy(&(pool->cond));
+    }
+    if (mutex_initialized) {
+        pthread_mutex_destroy(&(pool->mutex));
+    }
+    return false;
+}
+
+
+void
+WorkerPool_deinit(WorkerPool * pool)
+{
+    if (pool->threads == NULL) {
+        return;
+    }
+
+    if (pool->autoscale_started) {
+        pthread_mutex_lock(&(pool->mutex));
+        pool->stopping = true;
+        pthread_cond_signal(&(pool->cond));
+        pthread_mutex_unlock(&(pool->mutex));
+
+        pthread_join(pool->autoscale_thread, NULL);
+        pool->autoscale_started = false;
+    }
+
+    for (size_t i=0; i<pool->max_workers; i++) {
+        WorkerPool_join(pool, i);
+    }
+
+    free(pool->threads);
+    pool->threads = NULL;
+
+    pthread_cond_destroy(&(pool->cond));
+    pthread_mutex_destroy(&(pool->mutex));
+}
+
+
+void
+WorkerPool_get_stats(WorkerPool * pool, WorkerPoolStats * stats)
+{
+    pthread_mutex_lock(&(pool->mutex));
+    (*stats) = pool->stats;
+    pthread_mutex_unlock(&(pool->mutex));
+}
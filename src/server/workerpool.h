@@ -0,0 +1,139 @@
+#ifndef __server_workerpool_h__
+#define __server_workerpool_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "scheduler.h"
+
+/* interval (in milliseconds) between two scaling decisions */
+#define WORKERPOOL_INTERVAL_MSEC 1000
+
+/* workers are added when requests waited longer than this (in
+ * microseconds) in the queues on average */
+#define WORKERPOOL_GROW_WAIT_USEC 2000
+
+/* workers are removed when they spent less than this share of their
+ * time executing requests ... */
+#define WORKERPOOL_SHRINK_BUSY_PERCENT 25
+
+/* ... for this number of intervals in a row */
+#define WORKERPOOL_SHRINK_INTERVALS 10
+
+/* default of the longest time (in milliseconds) metadata requests
+ * should wait in the queues on average */
+#define WORKERPOOL_DEFAULT_META_WAIT_MSEC 10
+
+
+/**
+ * the scaling decisions and the load they were based on
+ */
+typedef struct WorkerPoolStats {
+    size_t n_workers;
+
+    // workers started and stopped by the autoscaling
+    uint64_t n_grown;
+    uint64_t n_shrunk;
+
+    // workers taking metadata requests only
+    size_t n_reserved;
+
+    // load during the last interval
+    uint64_t avg_wait_usec;
+    uint64_t meta_wait_usec;
+    unsigned int busy_percent;
+} WorkerPoolStats;
+
+
+typedef struct WorkerPool WorkerPool;
+
+
+/**
+ * the thread of a worker
+ */
+typedef struct WorkerPoolThread {
+    WorkerPool * pool;
+    size_t index;
+    pthread_t thread;
+
+    // started and not joined yet
+    bool started;
+
+    // set by the thread when the routine returned
+    bool exited;
+} WorkerPoolThread;
+
+
+/**
+ * the worker threads of the server
+ *
+ * a thread checks the load of the scheduler periodically. with
+ * "min_workers" below "max_workers" workers are added when requests
+ * wait in the queues, or when none completed while requests were queued
+ * because all workers are blocked. they are removed one by one when they
+ * have been mostly idle for a while
+ *
+ * at least "min_reserved" workers take metadata requests only. running
+ * bulk transfers can not be interrupted, so more workers are reserved,
+ * or added, when metadata requests waited longer than
+ * "max_meta_wait_usec" on average. one worker always takes bulk requests
+ *
+ * removed workers are never waited for while the mutex is held. a
+ * worker is only added again after its thread has left
+ */
+struct WorkerPool {
+    Scheduler * scheduler;
+
+    // the routine of the workers. gets the index of the worker
+    // cast to a pointer
+    void * (*routine)(void *);
+
+    size_t min_workers;
+    size_t max_workers;
+    size_t min_reserved;
+    uint64_t max_meta_wait_usec;
+
+    // index of the workers above the active ones
+    size_t n_workers;
+
+    // index of the workers above the reserved ones
+    size_t n_reserved;
+
+    // the threads of all "max_workers" workers, including workers
+    // which have been removed and are finishing their requests
+    WorkerPoolThread * threads;
+
+    pthread_t autoscale_thread;
+    bool autoscale_started;
+    bool stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    WorkerPoolStats stats;
+};
+
+
+/**
+ * start "n_workers" workers and the thread scaling them. the scheduler
+ * has to be set up for "max_workers"
+ *
+ * returns false on error
+ */
+bool WorkerPool_init(WorkerPool * pool, Scheduler * scheduler, size_t n_workers,
+        size_t min_workers, size_t max_workers, size_t min_reserved,
+        uint64_t max_meta_wait_usec, void * (*routine)(void *));
+
+/**
+ * stop the autoscaling and wait for all workers. the scheduler has to
+ * be stopped before
+ */
+void WorkerPool_deinit(WorkerPool * pool);
+
+/**
+ * get the state of the pool
+ */
+void WorkerPool_get_stats(WorkerPool * pool, WorkerPoolStats * stats);
+
+#endif /* __server_workerpool_h__ */